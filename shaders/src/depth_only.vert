@@ -0,0 +1,41 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "input_structures.glsl"
+
+
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+}; 
+
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
+	Vertex vertices[];
+};
+
+
+layout( push_constant ) uniform constants
+{
+	mat4 render_matrix;
+	VertexBuffer vertexBuffer;
+	uint materialIndex;
+} PushConstants;
+
+
+// must match mesh.vert bit for bit, the shading pass tests depth with EQUAL
+invariant gl_Position;
+
+
+void main() 
+{
+	const vec3 position = PushConstants.vertexBuffer.vertices[gl_VertexIndex].position;
+
+	gl_Position = sceneData.viewproj * PushConstants.render_matrix * vec4(position, 1.0f);
+}
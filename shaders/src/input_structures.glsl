@@ -9,12 +9,21 @@ layout(set = 0, binding = 0) uniform SceneData
 } sceneData;
 
 
-layout(set = 1, binding = 0) uniform GLTFMaterialData
-{   
+struct MaterialConstants
+{
 	vec4 colorFactors;
+	// metallic, roughness, alpha cutoff
 	vec4 metal_rough_factors;
+};
+
+
+// constants of every material in the scene, draws pick theirs with the material index push constant
+layout(set = 1, binding = 0) readonly buffer GLTFMaterialData
+{   
+	MaterialConstants constants[];
 } materialData;
 
 
 layout(set = 1, binding = 1) uniform sampler2D colorTex;
+// not sampled yet, materials bind the white image
 layout(set = 1, binding = 2) uniform sampler2D metalRoughTex;
\ No newline at end of file
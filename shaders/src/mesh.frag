@@ -6,17 +6,30 @@
 
 
 layout (location = 0) in vec3 inNormal;
-layout (location = 1) in vec3 inColor;
+layout (location = 1) in vec4 inColor;
 layout (location = 2) in vec2 inUV;
+layout (location = 3) flat in float inAlphaCutoff;
 
 layout (location = 0) out vec4 outFragColor;
 
 
+// GLTFMetallic_Roughness::MaterialFeature, materials without a texture bind the white image and skip sampling it
+layout (constant_id = 0) const bool HAS_COLOR_TEXTURE = true;
+layout (constant_id = 1) const bool USE_ALPHA_TEST = false;
+
+
 void main() 
 {
+	// sampled before the alpha test, implicit derivatives are undefined once quad neighbours are discarded
+	const vec4 baseColor = HAS_COLOR_TEXTURE ? inColor * texture(colorTex, inUV) : inColor;
+
+	if (USE_ALPHA_TEST && baseColor.a < inAlphaCutoff) {
+		discard;
+	}
+
 	const float lightValue = max(dot(inNormal, sceneData.sunlightDirectionPower.xyz), 0.1f);
 
-	const vec3 color = inColor * texture(colorTex,inUV).xyz;
+	const vec3 color = baseColor.rgb;
 	const vec3 ambient = color * sceneData.ambientColor.xyz;
 
 	outFragColor = vec4(color * lightValue * sceneData.sunlightColor.w + ambient, 1.f);
@@ -7,8 +7,9 @@
 
 
 layout (location = 0) out vec3 outNormal;
-layout (location = 1) out vec3 outColor;
+layout (location = 1) out vec4 outColor;
 layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out float outAlphaCutoff;
 
 
 struct Vertex {
@@ -30,9 +31,14 @@ layout( push_constant ) uniform constants
 {
 	mat4 render_matrix;
 	VertexBuffer vertexBuffer;
+	uint materialIndex;
 } PushConstants;
 
 
+// depth_only.vert computes the same position for the depth pre-pass
+invariant gl_Position;
+
+
 void main() 
 {
 	const Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
@@ -41,8 +47,11 @@ void main()
 
 	gl_Position = sceneData.viewproj * PushConstants.render_matrix *position;
 
+	const MaterialConstants material = materialData.constants[PushConstants.materialIndex];
+
 	outNormal = normalize((PushConstants.render_matrix * vec4(v.normal, 0.f)).xyz);
-	outColor = v.color.xyz * materialData.colorFactors.xyz;	
+	outColor = v.color * material.colorFactors;
+	outAlphaCutoff = material.metal_rough_factors.z;
 	outUV.x = v.uv_x;
 	outUV.y = v.uv_y;
 }
\ No newline at end of file
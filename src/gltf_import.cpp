@@ -0,0 +1,359 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "gltf_import.h"
+#include "job_system.h"
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <stb_image.h>
+
+
+VkFilter ExtractFilter(fastgltf::Filter filter)
+{
+    switch (filter) {
+        case fastgltf::Filter::Nearest:
+        case fastgltf::Filter::NearestMipMapNearest:
+        case fastgltf::Filter::NearestMipMapLinear:
+            return VK_FILTER_NEAREST;
+        case fastgltf::Filter::Linear:
+        case fastgltf::Filter::LinearMipMapNearest:
+        case fastgltf::Filter::LinearMipMapLinear:
+        default:
+            return VK_FILTER_LINEAR;
+    }
+}
+
+VkSamplerMipmapMode ExtractMipmapMode(fastgltf::Filter filter)
+{
+    switch (filter) {
+        case fastgltf::Filter::NearestMipMapNearest:
+        case fastgltf::Filter::LinearMipMapNearest:
+            return VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        case fastgltf::Filter::NearestMipMapLinear:
+        case fastgltf::Filter::LinearMipMapLinear:
+        default:
+            return VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    }
+}
+
+
+DecodedImage DecodeImage(const fastgltf::Asset& asset, const fastgltf::Image& image)
+{
+    DecodedImage decoded = {};
+
+    int width = 0, height = 0, nrChannels = 0;
+
+    auto DecodeFromMemory = [&](std::span<const uint8_t> bytes) {
+        if (IsKtx2Data(bytes)) {
+            ParseKtx2(bytes, decoded.ktx2);
+        } else {
+            decoded.pPixels = stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()), &width, &height, &nrChannels, 4);
+        }
+    };
+
+    std::visit(
+        fastgltf::visitor {
+            [](const auto& arg) {},
+            [&](const fastgltf::sources::URI& filePath) {
+                ENG_ASSERT(filePath.fileByteOffset == 0); // We don't support offsets with stbi.
+                ENG_ASSERT(filePath.uri.isLocalPath()); // We're only capable of loading local files.
+
+                const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
+
+                if (std::filesystem::path(path).extension() == ".ktx2") {
+                    std::ifstream file(path, std::ios::binary);
+                    const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+                    DecodeFromMemory(bytes);
+                } else {
+                    decoded.pPixels = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
+                }
+            },
+            [&](const fastgltf::sources::Vector& vector) {
+                DecodeFromMemory(std::span((const uint8_t*)vector.bytes.data(), vector.bytes.size()));
+            },
+            [&](const fastgltf::sources::BufferView& view) {
+                const fastgltf::BufferView& bufferView = asset.bufferViews[view.bufferViewIndex];
+                const fastgltf::Buffer& buffer = asset.buffers[bufferView.bufferIndex];
+
+                std::visit(fastgltf::visitor {
+                    [](const auto& arg) {},
+                    [&](const fastgltf::sources::Vector& vector) {
+                        DecodeFromMemory(std::span((const uint8_t*)vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength));
+                   } },
+                buffer.data);
+            },
+        },
+        image.data);
+
+    if (decoded.ktx2.IsValid()) {
+        decoded.extent = decoded.ktx2.extent;
+    } else {
+        decoded.extent.width = width;
+        decoded.extent.height = height;
+        decoded.extent.depth = 1;
+    }
+
+    return decoded;
+}
+
+
+std::optional<size_t> GetTextureImageIndex(const ParsedGLTF& parsed, const fastgltf::Texture& texture)
+{
+    if (texture.basisuImageIndex.has_value() && parsed.images[texture.basisuImageIndex.value()].IsValid()) {
+        return texture.basisuImageIndex.value();
+    }
+
+    if (texture.imageIndex.has_value()) {
+        return texture.imageIndex.value();
+    }
+
+    return std::nullopt;
+}
+
+
+std::vector<uint8_t> GetImageUsages(const ParsedGLTF& parsed)
+{
+    const fastgltf::Asset& gltf = parsed.asset;
+
+    std::vector<uint8_t> usages(parsed.images.size(), (uint8_t)ImageUsage::NONE);
+
+    auto AddUsage = [&](const fastgltf::Optional<fastgltf::TextureInfo>& textureInfo, ImageUsage usage) {
+        if (!textureInfo.has_value()) {
+            return;
+        }
+
+        const std::optional<size_t> imageIndex = GetTextureImageIndex(parsed, gltf.textures[textureInfo.value().textureIndex]);
+
+        if (imageIndex.has_value()) {
+            usages[imageIndex.value()] |= (uint8_t)usage;
+        }
+    };
+
+    for (const fastgltf::Material& material : gltf.materials) {
+        AddUsage(material.pbrData.baseColorTexture, ImageUsage::COLOR);
+        AddUsage(material.pbrData.metallicRoughnessTexture, ImageUsage::METAL_ROUGH);
+    }
+
+    return usages;
+}
+
+
+glm::mat4 GetNodeLocalTransform(const fastgltf::Node& node)
+{
+    glm::mat4 localTrs;
+
+    std::visit(fastgltf::visitor { 
+        [&](const fastgltf::math::fmat4x4& matrix) {
+            memcpy(&localTrs, matrix.data(), sizeof(matrix));
+        },
+        [&](const fastgltf::TRS& transform) {
+            const glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
+            const glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
+            const glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+            
+            const glm::mat4 tm = glm::translate(glm::identity<glm::mat4>(), tl);
+            const glm::mat4 rm = glm::toMat4(rot);
+            const glm::mat4 sm = glm::scale(glm::identity<glm::mat4>(), sc);
+            
+            localTrs = tm * rm * sm;
+        }
+    }, node.transform);
+
+    return localTrs;
+}
+
+
+void FreeDecodedImage(DecodedImage& image)
+{
+    if (image.pPixels != nullptr) {
+        stbi_image_free(image.pPixels);
+        image.pPixels = nullptr;
+    }
+
+    image.ktx2 = {};
+}
+
+
+ParsedGLTF::~ParsedGLTF()
+{
+    // images the GPU load never got to
+    for (DecodedImage& image : images) {
+        FreeDecodedImage(image);
+    }
+}
+
+
+static void ParseMesh(const fastgltf::Asset& gltf, const fastgltf::Mesh& mesh, ParsedMesh& outMesh)
+{
+    outMesh.name = mesh.name.c_str();
+
+    std::vector<uint32_t>& indices = outMesh.indices;
+    std::vector<Vertex>& vertices = outMesh.vertices;
+
+    for (const fastgltf::Primitive& p : mesh.primitives) {
+        ParsedSurface newSurface;
+        newSurface.startIndex = (uint32_t)indices.size();
+        newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+
+        if (p.materialIndex.has_value()) {
+            newSurface.materialIndex = p.materialIndex.value();
+        }
+
+        size_t initialVtx = vertices.size();
+
+        {
+            const fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
+            indices.reserve(indices.size() + indexaccessor.count);
+
+            fastgltf::iterateAccessor<std::uint32_t>(gltf, indexaccessor,
+                [&](std::uint32_t idx) {
+                    indices.push_back(idx + initialVtx);
+                });
+        }
+
+        {
+            const fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
+            vertices.resize(vertices.size() + posAccessor.count);
+
+            fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor,
+                [&](glm::vec3 v, size_t index) {
+                    Vertex newvtx;
+                    newvtx.position = v;
+                    newvtx.normal = glm::vec3(1, 0, 0);
+                    newvtx.color = glm::vec4(1.f);
+                    newvtx.uvX = 0;
+                    newvtx.uvY = 0;
+                    vertices[initialVtx + index] = newvtx;
+                });
+        }
+
+        auto normals = p.findAttribute("NORMAL");
+        if (normals != p.attributes.end()) {
+            fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[normals->accessorIndex],
+                [&](glm::vec3 v, size_t index) {
+                    vertices[initialVtx + index].normal = v;
+                });
+        }
+
+        auto uv = p.findAttribute("TEXCOORD_0");
+        if (uv != p.attributes.end()) {
+            fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[uv->accessorIndex],
+                [&](glm::vec2 v, size_t index) {
+                    vertices[initialVtx + index].uvX = v.x;
+                    vertices[initialVtx + index].uvY = v.y;
+                });
+        }
+
+        auto colors = p.findAttribute("COLOR_0");
+        if (colors != p.attributes.end()) {
+            fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[colors->accessorIndex],
+                [&](glm::vec4 v, size_t index) {
+                    vertices[initialVtx + index].color = v;
+                });
+        }
+
+        glm::vec3 minpos = vertices[initialVtx].position;
+        glm::vec3 maxpos = vertices[initialVtx].position;
+        for (size_t i = initialVtx; i < vertices.size(); ++i) {
+            minpos = glm::min(minpos, vertices[i].position);
+            maxpos = glm::max(maxpos, vertices[i].position);
+        }
+        
+        newSurface.bounds.origin = (maxpos + minpos) / 2.f;
+        newSurface.bounds.extents = (maxpos - minpos) / 2.f;
+        newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
+
+        outMesh.surfaces.push_back(newSurface);
+    }
+}
+
+
+std::shared_ptr<ParsedGLTF> ParseGLTF(const std::filesystem::path& filepath, ParseProgress* pProgress)
+{
+    fmt::print("Parsing GLTF: {}\n", filepath.string().c_str());
+
+    // KTX2 sources of KHR_texture_basisu are used when they hold GPU formats, see GetTextureImageIndex
+    fastgltf::Parser parser(fastgltf::Extensions::KHR_texture_basisu);
+
+    constexpr fastgltf::Options gltfOptions = fastgltf::Options::DontRequireValidAssetMember 
+        | fastgltf::Options::AllowDouble
+        | fastgltf::Options::LoadExternalBuffers;
+
+    auto dataExp = fastgltf::GltfDataBuffer::FromPath(filepath);
+    if (!dataExp) {
+        fmt::println(stderr, "GLTF {} error: {}", filepath.string().c_str(), fastgltf::getErrorMessage(dataExp.error()));
+        return nullptr;
+    }
+
+    fastgltf::GltfDataBuffer& data = dataExp.get();
+
+    std::shared_ptr<ParsedGLTF> pParsed = std::make_shared<ParsedGLTF>();
+    pParsed->filepath = filepath;
+
+    fastgltf::Asset& gltf = pParsed->asset;
+
+    auto type = fastgltf::determineGltfFileType(data);
+    if (type == fastgltf::GltfType::glTF) {
+        auto load = parser.loadGltf(data, filepath.parent_path(), gltfOptions);
+        if (load) {
+            gltf = std::move(load.get());
+        } else {
+            fmt::println(stderr, "Failed to load glTF: {}", fastgltf::getErrorMessage(load.error()).data());
+            return nullptr;
+        }
+    } else if (type == fastgltf::GltfType::GLB) {
+        auto load = parser.loadGltfBinary(data, filepath.parent_path(), gltfOptions);
+        if (load) {
+            gltf = std::move(load.get());
+        } else {
+            fmt::println(stderr, "Failed to load glTF: {}", fastgltf::getErrorMessage(load.error()).data());
+            return nullptr;
+        }
+    } else {
+        fmt::println(stderr, "Failed to determine GLTF container");
+        return nullptr;
+    }
+
+    auto IsCancelled = [pProgress]() {
+        return pProgress != nullptr && pProgress->isCancelled.load(std::memory_order_relaxed);
+    };
+
+    auto CompleteItem = [pProgress]() {
+        if (pProgress != nullptr) {
+            pProgress->doneItemCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    if (pProgress != nullptr) {
+        pProgress->itemCount.store(static_cast<uint32_t>(gltf.images.size() + gltf.meshes.size()), std::memory_order_relaxed);
+    }
+
+    pParsed->images.resize(gltf.images.size());
+
+    JobSystem::GetInstance().ParallelFor(gltf.images.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end && !IsCancelled(); ++i) {
+            pParsed->images[i] = DecodeImage(gltf, gltf.images[i]);
+            CompleteItem();
+        }
+    });
+
+    // every mesh converts into its own slot, the result doesn't depend on the thread count
+    pParsed->meshes.resize(gltf.meshes.size());
+
+    JobSystem::GetInstance().ParallelFor(gltf.meshes.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end && !IsCancelled(); ++i) {
+            ParseMesh(gltf, gltf.meshes[i], pParsed->meshes[i]);
+            CompleteItem();
+        }
+    });
+
+    if (IsCancelled()) {
+        fmt::print("Parsing GLTF cancelled: {}\n", filepath.string().c_str());
+        return nullptr;
+    }
+
+    return pParsed;
+}
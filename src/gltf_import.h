@@ -0,0 +1,99 @@
+#pragma once
+
+#include "vk_types.h"
+#include "ktx2.h"
+
+#include <atomic>
+#include <filesystem>
+
+#include <fastgltf/glm_element_traits.hpp>
+#include <fastgltf/tools.hpp>
+#include <fastgltf/core.hpp>
+
+
+// CPU side of glTF import, shared by the engine and tools/scene_cooker. Nothing here touches the device.
+
+struct DecodedImage
+{
+    bool IsValid() const noexcept { return pPixels != nullptr || ktx2.IsValid(); }
+
+    // RGBA8 stbi allocation, released with FreeDecodedImage once the image is uploaded
+    uint8_t* pPixels;
+    VkExtent3D extent;
+
+    // KTX2 images keep their stored format and levels, pPixels stays nullptr for them
+    Ktx2Image ktx2;
+};
+
+
+struct ParsedSurface
+{
+    uint32_t startIndex;
+    uint32_t count;
+    std::optional<size_t> materialIndex;
+    Bounds bounds;
+};
+
+
+struct ParsedMesh
+{
+    std::string name;
+
+    std::vector<uint32_t> indices;
+    std::vector<Vertex> vertices;
+    std::vector<ParsedSurface> surfaces;
+};
+
+
+// The parsed document, decoded images and meshes converted to the engine vertex format.
+// Can be produced on any thread while the device is still being set up.
+struct ParsedGLTF
+{
+    ~ParsedGLTF();
+
+    std::filesystem::path filepath;
+    fastgltf::Asset asset;
+
+    std::vector<DecodedImage> images;
+    std::vector<ParsedMesh> meshes;
+};
+
+
+// Written by ParseGLTF while it runs, readable from any thread
+struct ParseProgress
+{
+    // images plus meshes, known once the document itself is parsed
+    std::atomic<uint32_t> itemCount = 0;
+    std::atomic<uint32_t> doneItemCount = 0;
+
+    // set by the caller, ParseGLTF stops between items and returns nullptr
+    std::atomic<bool> isCancelled = false;
+};
+
+
+std::shared_ptr<ParsedGLTF> ParseGLTF(const std::filesystem::path& filepath, ParseProgress* pProgress = nullptr);
+
+// RGBA8 through stb_image or KTX2 as stored, IsValid() is false if the image couldn't be decoded
+DecodedImage DecodeImage(const fastgltf::Asset& asset, const fastgltf::Image& image);
+void FreeDecodedImage(DecodedImage& image);
+
+// Image a texture samples. The KHR_texture_basisu source is used when it decoded, that is when it's a KTX2 file
+// the GPU can take as is, the regular source otherwise.
+std::optional<size_t> GetTextureImageIndex(const ParsedGLTF& parsed, const fastgltf::Texture& texture);
+
+enum class ImageUsage : uint8_t
+{
+    NONE = 0,
+    // sRGB encoded base color
+    COLOR = 1 << 0,
+    // linear, roughness in G and metallic in B
+    METAL_ROUGH = 1 << 1,
+};
+
+// How the materials sample every image of parsed, ImageUsage bits
+std::vector<uint8_t> GetImageUsages(const ParsedGLTF& parsed);
+
+glm::mat4 GetNodeLocalTransform(const fastgltf::Node& node);
+
+VkFilter ExtractFilter(fastgltf::Filter filter);
+VkSamplerMipmapMode ExtractMipmapMode(fastgltf::Filter filter);
@@ -0,0 +1,354 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "job_system.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+
+static thread_local uint32_t s_threadIndex = JobSystem::INVALID_THREAD_INDEX;
+
+
+static void PinCurrentThreadToCore(uint32_t coreIdx) noexcept
+{
+#if defined(_WIN32)
+    const DWORD_PTR mask = DWORD_PTR(1) << (coreIdx % (sizeof(DWORD_PTR) * 8));
+
+    if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+        fmt::print("Failed to pin thread to core {}\n", coreIdx);
+    }
+#else
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(coreIdx % CPU_SETSIZE, &cpuSet);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0) {
+        fmt::print("Failed to pin thread to core {}\n", coreIdx);
+    }
+#endif
+}
+
+
+JobSystem& JobSystem::GetInstance() noexcept
+{
+    static JobSystem jobSystem;
+    return jobSystem;
+}
+
+
+JobSystem::~JobSystem()
+{
+    Terminate();
+}
+
+
+void JobSystem::Init(uint32_t workerCount, bool pinThreads) noexcept
+{
+    if (m_isInitialized) {
+        return;
+    }
+
+    const uint32_t hwThreadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (workerCount == 0) {
+        workerCount = hwThreadCount - 1;
+    }
+
+    const uint32_t threadCount = workerCount + 1;
+
+    m_queues.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+
+    s_threadIndex = 0;
+
+    if (pinThreads) {
+        PinCurrentThreadToCore(0);
+    }
+
+    m_activeThreadCount.store(threadCount);
+    m_isRunning.store(true);
+
+    m_workers.reserve(workerCount);
+    for (uint32_t i = 1; i < threadCount; ++i) {
+        m_workers.emplace_back([this, i, pinThreads]() { WorkerLoop(i, pinThreads); });
+    }
+
+    m_isInitialized = true;
+
+    fmt::print("Job system: {} threads{}\n", threadCount, pinThreads ? " (pinned)" : "");
+}
+
+
+void JobSystem::Terminate() noexcept
+{
+    if (!m_isInitialized) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(m_wakeMutex);
+        m_isRunning.store(false);
+    }
+    m_wakeCondVar.notify_all();
+
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+
+    m_workers.clear();
+    m_queues.clear();
+    m_backgroundQueue.jobs.clear();
+
+    m_pendingJobCount.store(0);
+    m_backgroundJobCount.store(0);
+    s_threadIndex = INVALID_THREAD_INDEX;
+
+    m_isInitialized = false;
+}
+
+
+void JobSystem::Schedule(JobFunc&& job, Counter* pCounter, const Counter* pDependency) noexcept
+{
+    if (!m_isInitialized) {
+        ENG_ASSERT_MSG(pDependency == nullptr || pDependency->IsDone(), "Job dependency can't be resolved without worker threads");
+        job();
+        return;
+    }
+
+    if (pCounter != nullptr) {
+        pCounter->value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t queueIdx = s_threadIndex;
+    if (queueIdx == INVALID_THREAD_INDEX) {
+        queueIdx = m_nextForeignQueue.fetch_add(1, std::memory_order_relaxed) % GetThreadCount();
+    }
+
+    PushJob(queueIdx, Job { std::move(job), pCounter, pDependency });
+}
+
+
+void JobSystem::ScheduleBackground(JobFunc&& job) noexcept
+{
+    if (!m_isInitialized || m_workers.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard lock(m_backgroundQueue.mutex);
+        m_backgroundQueue.jobs.emplace_back(Job { std::move(job), nullptr, nullptr });
+        m_backgroundJobCount.fetch_add(1, std::memory_order_release);
+    }
+
+    {
+        std::lock_guard lock(m_wakeMutex);
+        m_pendingJobCount.fetch_add(1, std::memory_order_release);
+    }
+    m_wakeCondVar.notify_one();
+}
+
+
+void JobSystem::Wait(const Counter& counter) noexcept
+{
+    while (!counter.IsDone()) {
+        // a background job would hold up whoever waits here until it is done
+        if (!TryExecuteJob(s_threadIndex, false)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+void JobSystem::SetActiveThreadCount(uint32_t count) noexcept
+{
+    count = std::clamp(count, 1u, std::max(GetThreadCount(), 1u));
+
+    {
+        std::lock_guard lock(m_wakeMutex);
+        m_activeThreadCount.store(count);
+    }
+    m_wakeCondVar.notify_all();
+}
+
+
+uint32_t JobSystem::GetThreadIndex() const noexcept
+{
+    return s_threadIndex;
+}
+
+
+void JobSystem::PushJob(uint32_t queueIdx, Job&& job) noexcept
+{
+    WorkQueue& queue = *m_queues[queueIdx];
+
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.jobs.emplace_back(std::move(job));
+    }
+
+    {
+        std::lock_guard lock(m_wakeMutex);
+        m_pendingJobCount.fetch_add(1, std::memory_order_release);
+    }
+    m_wakeCondVar.notify_one();
+}
+
+
+bool JobSystem::PopJob(uint32_t queueIdx, Job& outJob) noexcept
+{
+    if (queueIdx == INVALID_THREAD_INDEX) {
+        return false;
+    }
+
+    WorkQueue& queue = *m_queues[queueIdx];
+    std::lock_guard lock(queue.mutex);
+
+    if (queue.jobs.empty()) {
+        return false;
+    }
+
+    outJob = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+
+    m_pendingJobCount.fetch_sub(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+
+bool JobSystem::StealJob(uint32_t thiefIdx, Job& outJob) noexcept
+{
+    const uint32_t queueCount = GetThreadCount();
+    const uint32_t startIdx = thiefIdx == INVALID_THREAD_INDEX ? 0 : thiefIdx + 1;
+
+    for (uint32_t i = 0; i < queueCount; ++i) {
+        const uint32_t victimIdx = (startIdx + i) % queueCount;
+        if (victimIdx == thiefIdx) {
+            continue;
+        }
+
+        WorkQueue& queue = *m_queues[victimIdx];
+        std::unique_lock lock(queue.mutex, std::try_to_lock);
+
+        if (!lock.owns_lock() || queue.jobs.empty()) {
+            continue;
+        }
+
+        outJob = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+
+        m_pendingJobCount.fetch_sub(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    return false;
+}
+
+
+bool JobSystem::PopBackgroundJob(uint32_t threadIdx, Job& outJob) noexcept
+{
+    if (threadIdx == 0 || threadIdx == INVALID_THREAD_INDEX) {
+        return false;
+    }
+
+    std::lock_guard lock(m_backgroundQueue.mutex);
+
+    if (m_backgroundQueue.jobs.empty()) {
+        return false;
+    }
+
+    outJob = std::move(m_backgroundQueue.jobs.front());
+    m_backgroundQueue.jobs.pop_front();
+
+    m_backgroundJobCount.fetch_sub(1, std::memory_order_relaxed);
+    m_pendingJobCount.fetch_sub(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+
+bool JobSystem::TryExecuteJob(uint32_t threadIdx, bool canRunBackground) noexcept
+{
+    Job job;
+    // frame work first, background jobs only when there is nothing else
+    if (!PopJob(threadIdx, job) && !StealJob(threadIdx, job) && !(canRunBackground && PopBackgroundJob(threadIdx, job))) {
+        return false;
+    }
+
+    if (job.pDependency != nullptr && !job.pDependency->IsDone()) {
+        // put it back at the steal end so the owner doesn't pop the same job again right away
+        WorkQueue& queue = *m_queues[threadIdx == INVALID_THREAD_INDEX ? 0 : threadIdx];
+
+        {
+            std::lock_guard lock(queue.mutex);
+            queue.jobs.emplace_front(std::move(job));
+        }
+
+        m_pendingJobCount.fetch_add(1, std::memory_order_release);
+
+        return false;
+    }
+
+    job.func();
+
+    if (job.pCounter != nullptr) {
+        job.pCounter->value.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    return true;
+}
+
+
+void JobSystem::WorkerLoop(uint32_t threadIdx, bool pinThread) noexcept
+{
+    s_threadIndex = threadIdx;
+
+    if (pinThread) {
+        PinCurrentThreadToCore(threadIdx);
+    }
+
+    while (m_isRunning.load(std::memory_order_acquire)) {
+        const bool isActive = threadIdx < m_activeThreadCount.load(std::memory_order_relaxed);
+        const bool servesBackground = threadIdx == BACKGROUND_THREAD_INDEX;
+
+        if (isActive && TryExecuteJob(threadIdx, true)) {
+            continue;
+        }
+
+        // left out of frame work, but a load in flight would never finish without it
+        if (!isActive && servesBackground) {
+            Job job;
+
+            if (PopBackgroundJob(threadIdx, job)) {
+                job.func();
+                continue;
+            }
+        }
+
+        if (isActive && m_pendingJobCount.load(std::memory_order_acquire) > 0) {
+            // only jobs with unresolved dependencies or contended queues are left
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock lock(m_wakeMutex);
+        m_wakeCondVar.wait_for(lock, std::chrono::milliseconds(2), [this, threadIdx, servesBackground]() {
+            return !m_isRunning.load() || (threadIdx < m_activeThreadCount.load() && m_pendingJobCount.load() > 0) ||
+                (servesBackground && m_backgroundJobCount.load() > 0);
+        });
+    }
+
+    s_threadIndex = INVALID_THREAD_INDEX;
+}
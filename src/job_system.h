@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Work-stealing job scheduler. Every thread (the main thread included) owns a deque, the owner pops
+// from the back and idle threads steal from the front of other deques. The main thread takes part
+// in the work while it waits on a counter.
+class JobSystem final
+{
+public:
+    // Number of jobs still in flight. A job can depend on a counter and won't start until it reaches zero.
+    struct Counter
+    {
+        bool IsDone() const noexcept { return value.load(std::memory_order_acquire) == 0; }
+
+        std::atomic<uint32_t> value = 0;
+    };
+
+    using JobFunc = std::function<void()>;
+
+    static constexpr uint32_t INVALID_THREAD_INDEX = UINT32_MAX;
+    // worker that runs background jobs whatever the active thread count
+    static constexpr uint32_t BACKGROUND_THREAD_INDEX = 1;
+
+public:
+    static JobSystem& GetInstance() noexcept;
+
+public:
+    JobSystem() = default;
+    ~JobSystem();
+
+    JobSystem(const JobSystem& other) = delete;
+    JobSystem(JobSystem&& other) = delete;
+    JobSystem& operator=(const JobSystem& other) = delete;
+    JobSystem& operator=(JobSystem&& other) = delete;
+
+    // workerCount == 0 spawns one worker per hardware thread except the calling one
+    void Init(uint32_t workerCount = 0, bool pinThreads = false) noexcept;
+    void Terminate() noexcept;
+
+    void Schedule(JobFunc&& job, Counter* pCounter = nullptr, const Counter* pDependency = nullptr) noexcept;
+
+    // For long jobs that must not hold up a frame, e.g. asset loading or pipeline compilation. Only idle worker
+    // threads pick them up, Wait never runs one. The first worker serves them even when SetActiveThreadCount
+    // leaves it out of frame work.
+    void ScheduleBackground(JobFunc&& job) noexcept;
+
+    // Blocks until counter reaches zero, the calling thread executes jobs in the meantime
+    void Wait(const Counter& counter) noexcept;
+
+    // Splits [0, count) into batches and calls func(begin, end) for each of them, returns when all batches are done.
+    // batchSize == 0 picks a batch size from the number of active threads.
+    template <typename Func>
+    void ParallelFor(size_t count, size_t batchSize, Func&& func) noexcept;
+
+    // Limits the number of threads that execute jobs, used for scaling measurements
+    void SetActiveThreadCount(uint32_t count) noexcept;
+    uint32_t GetActiveThreadCount() const noexcept { return m_activeThreadCount.load(std::memory_order_relaxed); }
+
+    // Worker threads plus the main thread
+    uint32_t GetThreadCount() const noexcept { return static_cast<uint32_t>(m_queues.size()); }
+
+    // 0 is the thread that called Init, INVALID_THREAD_INDEX for threads not owned by the job system
+    uint32_t GetThreadIndex() const noexcept;
+
+    bool IsInitialized() const noexcept { return m_isInitialized; }
+
+private:
+    struct Job
+    {
+        JobFunc func;
+        Counter* pCounter;
+        const Counter* pDependency;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+private:
+    void PushJob(uint32_t queueIdx, Job&& job) noexcept;
+
+    bool PopJob(uint32_t queueIdx, Job& outJob) noexcept;
+    bool StealJob(uint32_t thiefIdx, Job& outJob) noexcept;
+    bool PopBackgroundJob(uint32_t threadIdx, Job& outJob) noexcept;
+
+    bool TryExecuteJob(uint32_t threadIdx, bool canRunBackground) noexcept;
+
+    void WorkerLoop(uint32_t threadIdx, bool pinThread) noexcept;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    WorkQueue m_backgroundQueue;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCondVar;
+
+    std::atomic<uint32_t> m_pendingJobCount = 0;
+    // part of m_pendingJobCount
+    std::atomic<uint32_t> m_backgroundJobCount = 0;
+    std::atomic<uint32_t> m_activeThreadCount = 1;
+    std::atomic<uint32_t> m_nextForeignQueue = 0;
+    std::atomic<bool> m_isRunning = false;
+
+    bool m_isInitialized = false;
+};
+
+
+template <typename Func>
+void JobSystem::ParallelFor(size_t count, size_t batchSize, Func&& func) noexcept
+{
+    if (count == 0) {
+        return;
+    }
+
+    const size_t threadCount = GetActiveThreadCount();
+
+    if (batchSize == 0) {
+        batchSize = std::max<size_t>((count + threadCount * 4 - 1) / (threadCount * 4), 1);
+    }
+
+    if (!m_isInitialized || threadCount == 1 || count <= batchSize) {
+        func(size_t(0), count);
+        return;
+    }
+
+    Counter counter;
+
+    for (size_t begin = batchSize; begin < count; begin += batchSize) {
+        const size_t end = std::min(begin + batchSize, count);
+        Schedule([&func, begin, end]() { func(begin, end); }, &counter);
+    }
+
+    // the calling thread takes the first batch itself
+    func(size_t(0), batchSize);
+
+    Wait(counter);
+}
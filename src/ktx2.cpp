@@ -0,0 +1,132 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "ktx2.h"
+#include "texture_format.h"
+
+
+static constexpr uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+
+struct Ktx2Header
+{
+    uint8_t identifier[12];
+
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header layout mismatch");
+
+
+struct Ktx2LevelIndex
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+
+bool IsKtx2Data(std::span<const uint8_t> bytes) noexcept
+{
+    return bytes.size() >= sizeof(KTX2_IDENTIFIER) && memcmp(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
+
+
+bool ParseKtx2(std::span<const uint8_t> bytes, Ktx2Image& outImage) noexcept
+{
+    outImage = {};
+
+    if (!IsKtx2Data(bytes) || bytes.size() < sizeof(Ktx2Header)) {
+        fmt::println(stderr, "KTX2: not a KTX2 file");
+        return false;
+    }
+
+    Ktx2Header header;
+    memcpy(&header, bytes.data(), sizeof(header));
+
+    const VkFormat format = (VkFormat)header.vkFormat;
+
+    TextureFormatInfo formatInfo;
+    if (!GetTextureFormatInfo(format, formatInfo)) {
+        fmt::println(stderr, "KTX2: unsupported format {}, Basis Universal textures need transcoding", header.vkFormat);
+        return false;
+    }
+
+    if (header.supercompressionScheme != 0) {
+        fmt::println(stderr, "KTX2: supercompression scheme {} is not supported", header.supercompressionScheme);
+        return false;
+    }
+
+    const bool is2D = header.pixelWidth > 0 && header.pixelHeight > 0 && header.pixelDepth == 0;
+    if (!is2D || header.layerCount > 1 || header.faceCount != 1) {
+        fmt::println(stderr, "KTX2: only plain 2D textures are supported");
+        return false;
+    }
+
+    const uint32_t fullMipCount = GetTextureMipCount(header.pixelWidth, header.pixelHeight);
+    const uint32_t levelCount = std::max(header.levelCount, 1u);
+
+    if (levelCount > fullMipCount) {
+        fmt::println(stderr, "KTX2: {} levels for a {}x{} texture", levelCount, header.pixelWidth, header.pixelHeight);
+        return false;
+    }
+
+    if (bytes.size() < sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex)) {
+        fmt::println(stderr, "KTX2: truncated level index");
+        return false;
+    }
+
+    std::vector<Ktx2LevelIndex> levelIndices(levelCount);
+    memcpy(levelIndices.data(), bytes.data() + sizeof(Ktx2Header), levelCount * sizeof(Ktx2LevelIndex));
+
+    uint64_t dataSize = 0;
+
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        const Ktx2LevelIndex& index = levelIndices[level];
+        const uint64_t expectedSize = GetTextureMipSize(format, header.pixelWidth, header.pixelHeight, level);
+
+        const bool isLevelValid = index.byteLength == expectedSize
+            && index.byteOffset <= bytes.size() && index.byteLength <= bytes.size() - index.byteOffset;
+
+        if (!isLevelValid) {
+            fmt::println(stderr, "KTX2: invalid level {}", level);
+            return false;
+        }
+
+        dataSize += expectedSize;
+    }
+
+    outImage.format = format;
+    outImage.extent = { header.pixelWidth, header.pixelHeight, 1 };
+    outImage.needsMipGeneration = header.levelCount == 0 && !formatInfo.isCompressed;
+
+    outImage.data.resize(dataSize);
+    outImage.levels.reserve(levelCount);
+
+    uint64_t offset = 0;
+
+    for (const Ktx2LevelIndex& index : levelIndices) {
+        memcpy(outImage.data.data() + offset, bytes.data() + index.byteOffset, index.byteLength);
+        outImage.levels.emplace_back(Ktx2Level { offset, index.byteLength });
+
+        offset += index.byteLength;
+    }
+
+    return true;
+}
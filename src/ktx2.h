@@ -0,0 +1,38 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <span>
+#include <vector>
+
+
+// Reader for KTX2 texture containers (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html).
+// Only what can go to the GPU as is: 2D, one layer and face, no supercompression and a format from texture_format.h.
+// Basis Universal textures need transcoding and are rejected.
+
+struct Ktx2Level
+{
+    // into Ktx2Image::data
+    uint64_t offset;
+    uint64_t size;
+};
+
+
+struct Ktx2Image
+{
+    bool IsValid() const noexcept { return !levels.empty(); }
+
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent3D extent = {};
+
+    // level 0 first, copied out of the container one after another
+    std::vector<uint8_t> data;
+    std::vector<Ktx2Level> levels;
+
+    // the file asks the loader to build the chain, only possible for uncompressed formats
+    bool needsMipGeneration = false;
+};
+
+
+bool IsKtx2Data(std::span<const uint8_t> bytes) noexcept;
+bool ParseKtx2(std::span<const uint8_t> bytes, Ktx2Image& outImage) noexcept;
@@ -1,15 +1,46 @@
 #include "vk_engine.h"
 
+#include <cstring>
+
 
 int main(int argc, char* argv[])
 {
-    (void)argc;
-    (void)argv;
+    bool runBenchmark = false;
+    bool runLoadBenchmark = false;
+    bool runMaterialBenchmark = false;
+    bool usePipelineCache = true;
+    bool useDescriptorBuffer = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            runBenchmark = true;
+        } else if (strcmp(argv[i], "--bench-load") == 0) {
+            runLoadBenchmark = true;
+        } else if (strcmp(argv[i], "--bench-materials") == 0) {
+            runMaterialBenchmark = true;
+        } else if (strcmp(argv[i], "--no-pipeline-cache") == 0) {
+            usePipelineCache = false;
+        } else if (strcmp(argv[i], "--descriptor-buffer") == 0) {
+            useDescriptorBuffer = true;
+        }
+    }
 
     VulkanEngine& engine = VulkanEngine::GetInstance();
+    engine.m_usePipelineCache = usePipelineCache;
+    engine.m_useDescriptorBuffer = useDescriptorBuffer;
     
     engine.Init();
-    engine.Run();
+
+    if (runLoadBenchmark) {
+        engine.RunLoadBenchmark();
+    } else if (runMaterialBenchmark) {
+        engine.RunMaterialBenchmark();
+    } else if (runBenchmark) {
+        engine.RunBenchmark();
+    } else {
+        engine.Run();
+    }
+
     engine.Terminate();
     
     return 0;
@@ -0,0 +1,130 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        Close();
+
+        std::swap(m_pData, other.m_pData);
+        std::swap(m_size, other.m_size);
+    #if defined(_WIN32)
+        std::swap(m_pFileHandle, other.m_pFileHandle);
+        std::swap(m_pMappingHandle, other.m_pMappingHandle);
+    #endif
+    }
+
+    return *this;
+}
+
+
+bool MappedFile::Open(const std::filesystem::path& filepath) noexcept
+{
+    Close();
+
+#if defined(_WIN32)
+    HANDLE hFile = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (hMapping == nullptr) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    const void* pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (pView == nullptr) {
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return false;
+    }
+
+    m_pFileHandle = hFile;
+    m_pMappingHandle = hMapping;
+    m_pData = static_cast<const uint8_t*>(pView);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat = {};
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* pView = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    
+    // the mapping keeps its own reference to the file
+    close(fd);
+
+    if (pView == MAP_FAILED) {
+        return false;
+    }
+
+    m_pData = static_cast<const uint8_t*>(pView);
+    m_size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+    return true;
+}
+
+
+void MappedFile::Close() noexcept
+{
+    if (m_pData == nullptr) {
+        return;
+    }
+
+#if defined(_WIN32)
+    UnmapViewOfFile(m_pData);
+    CloseHandle(static_cast<HANDLE>(m_pMappingHandle));
+    CloseHandle(static_cast<HANDLE>(m_pFileHandle));
+
+    m_pMappingHandle = nullptr;
+    m_pFileHandle = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(m_pData), m_size);
+#endif
+
+    m_pData = nullptr;
+    m_size = 0;
+}
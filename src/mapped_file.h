@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+
+// Read-only memory mapping of a whole file. The OS pages the contents in on access,
+// nothing is copied into process memory up front.
+class MappedFile final
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool Open(const std::filesystem::path& filepath) noexcept;
+    void Close() noexcept;
+
+    std::span<const uint8_t> GetData() const noexcept { return std::span<const uint8_t>(m_pData, m_size); }
+    size_t GetSize() const noexcept { return m_size; }
+
+    bool IsOpen() const noexcept { return m_pData != nullptr; }
+
+private:
+    const uint8_t* m_pData = nullptr;
+    size_t m_size = 0;
+
+#if defined(_WIN32)
+    void* m_pFileHandle = nullptr;
+    void* m_pMappingHandle = nullptr;
+#endif
+};
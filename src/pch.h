@@ -6,6 +6,7 @@
 #include <vector>
 #include <span>
 #include <array>
+#include <bit>
 #include <functional>
 #include <deque>
 #include <fstream>
@@ -0,0 +1,221 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "radix_sort.h"
+#include "job_system.h"
+
+
+static constexpr uint32_t RADIX_BITS = 8;
+static constexpr uint32_t RADIX_SIZE = 1u << RADIX_BITS;
+static constexpr uint32_t RADIX_MASK = RADIX_SIZE - 1;
+static constexpr uint32_t PASS_COUNT = sizeof(uint64_t) * 8 / RADIX_BITS;
+
+static constexpr size_t PARALLEL_SORT_THRESHOLD = 16 * 1024;
+static constexpr size_t MAX_SORT_CHUNK_COUNT = 64;
+
+using Histogram = std::array<uint32_t, RADIX_SIZE>;
+
+
+static uint32_t GetDigit(uint64_t key, uint32_t pass) noexcept
+{
+    return static_cast<uint32_t>(key >> (pass * RADIX_BITS)) & RADIX_MASK;
+}
+
+
+// One read over the keys fills the histograms of all passes, the eight independent counters per key
+// keep the increments from waiting on each other
+static void BuildPassHistograms(std::span<const uint64_t> keys, std::array<Histogram, PASS_COUNT>& histograms) noexcept
+{
+    for (Histogram& histogram : histograms) {
+        histogram.fill(0);
+    }
+
+    for (uint64_t key : keys) {
+        for (uint32_t pass = 0; pass < PASS_COUNT; ++pass) {
+            ++histograms[pass][GetDigit(key, pass)];
+        }
+    }
+}
+
+
+// Single digit histogram. Runs of equal digits are common in draw keys, so counts go to four
+// interleaved banks to break the store-to-load dependency on the same counter.
+static void BuildDigitHistogram(std::span<const uint64_t> keys, uint32_t pass, Histogram& histogram) noexcept
+{
+    std::array<Histogram, 4> banks = {};
+
+    size_t i = 0;
+    for (; i + 4 <= keys.size(); i += 4) {
+        ++banks[0][GetDigit(keys[i + 0], pass)];
+        ++banks[1][GetDigit(keys[i + 1], pass)];
+        ++banks[2][GetDigit(keys[i + 2], pass)];
+        ++banks[3][GetDigit(keys[i + 3], pass)];
+    }
+
+    for (; i < keys.size(); ++i) {
+        ++banks[0][GetDigit(keys[i], pass)];
+    }
+
+    for (uint32_t d = 0; d < RADIX_SIZE; ++d) {
+        histogram[d] = banks[0][d] + banks[1][d] + banks[2][d] + banks[3][d];
+    }
+}
+
+
+static bool IsPassTrivial(const Histogram& histogram, uint64_t firstKey, uint32_t pass, size_t count) noexcept
+{
+    return histogram[GetDigit(firstKey, pass)] == count;
+}
+
+
+static void ScatterPass(std::span<const uint64_t> srcKeys, std::span<const uint32_t> srcValues, std::span<uint64_t> dstKeys, std::span<uint32_t> dstValues,
+    uint32_t pass, Histogram& offsets) noexcept
+{
+    for (size_t i = 0; i < srcKeys.size(); ++i) {
+        const uint32_t dstIdx = offsets[GetDigit(srcKeys[i], pass)]++;
+
+        dstKeys[dstIdx] = srcKeys[i];
+        dstValues[dstIdx] = srcValues[i];
+    }
+}
+
+
+static void RadixSortSerial(std::span<uint64_t> keys, std::span<uint32_t> values, std::span<uint64_t> tmpKeys, std::span<uint32_t> tmpValues) noexcept
+{
+    const size_t count = keys.size();
+
+    std::array<Histogram, PASS_COUNT> histograms;
+    BuildPassHistograms(keys, histograms);
+
+    std::span<uint64_t> srcKeys = keys;
+    std::span<uint32_t> srcValues = values;
+    std::span<uint64_t> dstKeys = tmpKeys.first(count);
+    std::span<uint32_t> dstValues = tmpValues.first(count);
+
+    for (uint32_t pass = 0; pass < PASS_COUNT; ++pass) {
+        if (IsPassTrivial(histograms[pass], srcKeys[0], pass, count)) {
+            continue;
+        }
+
+        Histogram offsets;
+        uint32_t offset = 0;
+
+        for (uint32_t d = 0; d < RADIX_SIZE; ++d) {
+            offsets[d] = offset;
+            offset += histograms[pass][d];
+        }
+
+        ScatterPass(srcKeys, srcValues, dstKeys, dstValues, pass, offsets);
+
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcValues, dstValues);
+    }
+
+    if (srcKeys.data() != keys.data()) {
+        std::copy(srcKeys.begin(), srcKeys.end(), keys.begin());
+        std::copy(srcValues.begin(), srcValues.end(), values.begin());
+    }
+}
+
+
+// Every chunk counts its own digits, the per chunk offsets are laid out bucket by bucket so that
+// chunks scatter independently and the result stays stable
+static void RadixSortParallel(std::span<uint64_t> keys, std::span<uint32_t> values, std::span<uint64_t> tmpKeys, std::span<uint32_t> tmpValues,
+    size_t chunkCount) noexcept
+{
+    JobSystem& jobSystem = JobSystem::GetInstance();
+
+    const size_t count = keys.size();
+    const size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    chunkCount = (count + chunkSize - 1) / chunkSize;
+
+    // too large for the stack, the parallel path only runs for big inputs so the allocation doesn't matter
+    std::vector<std::array<Histogram, PASS_COUNT>> chunkPassHistograms(chunkCount);
+    std::vector<Histogram> chunkOffsets(chunkCount);
+
+    auto GetChunk = [&](auto span, size_t chunkIdx) {
+        const size_t begin = chunkIdx * chunkSize;
+        return span.subspan(begin, std::min(chunkSize, count - begin));
+    };
+
+    jobSystem.ParallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            BuildPassHistograms(GetChunk(keys, c), chunkPassHistograms[c]);
+        }
+    });
+
+    std::array<Histogram, PASS_COUNT> histograms = {};
+    for (size_t c = 0; c < chunkCount; ++c) {
+        for (uint32_t pass = 0; pass < PASS_COUNT; ++pass) {
+            for (uint32_t d = 0; d < RADIX_SIZE; ++d) {
+                histograms[pass][d] += chunkPassHistograms[c][pass][d];
+            }
+        }
+    }
+
+    std::span<uint64_t> srcKeys = keys;
+    std::span<uint32_t> srcValues = values;
+    std::span<uint64_t> dstKeys = tmpKeys.first(count);
+    std::span<uint32_t> dstValues = tmpValues.first(count);
+
+    bool isFirstPass = true;
+
+    for (uint32_t pass = 0; pass < PASS_COUNT; ++pass) {
+        if (IsPassTrivial(histograms[pass], srcKeys[0], pass, count)) {
+            continue;
+        }
+
+        // keys were reordered by the previous pass, so chunk histograms of this digit have to be rebuilt
+        if (!isFirstPass) {
+            jobSystem.ParallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; ++c) {
+                    BuildDigitHistogram(GetChunk(srcKeys, c), pass, chunkPassHistograms[c][pass]);
+                }
+            });
+        }
+
+        isFirstPass = false;
+
+        uint32_t offset = 0;
+        for (uint32_t d = 0; d < RADIX_SIZE; ++d) {
+            for (size_t c = 0; c < chunkCount; ++c) {
+                chunkOffsets[c][d] = offset;
+                offset += chunkPassHistograms[c][pass][d];
+            }
+        }
+
+        jobSystem.ParallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                ScatterPass(GetChunk(srcKeys, c), GetChunk(srcValues, c), dstKeys, dstValues, pass, chunkOffsets[c]);
+            }
+        });
+
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcValues, dstValues);
+    }
+
+    if (srcKeys.data() != keys.data()) {
+        std::copy(srcKeys.begin(), srcKeys.end(), keys.begin());
+        std::copy(srcValues.begin(), srcValues.end(), values.begin());
+    }
+}
+
+
+void RadixSort(std::span<uint64_t> keys, std::span<uint32_t> values, std::span<uint64_t> tmpKeys, std::span<uint32_t> tmpValues) noexcept
+{
+    ENG_ASSERT(keys.size() == values.size());
+    ENG_ASSERT(tmpKeys.size() >= keys.size() && tmpValues.size() >= values.size());
+
+    if (keys.size() <= 1) {
+        return;
+    }
+
+    const size_t chunkCount = std::min<size_t>(JobSystem::GetInstance().GetActiveThreadCount(), MAX_SORT_CHUNK_COUNT);
+
+    if (keys.size() < PARALLEL_SORT_THRESHOLD || chunkCount <= 1) {
+        RadixSortSerial(keys, values, tmpKeys, tmpValues);
+    } else {
+        RadixSortParallel(keys, values, tmpKeys, tmpValues, chunkCount);
+    }
+}
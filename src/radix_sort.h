@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+
+// Stable LSD radix sort of 64-bit keys carrying 32-bit payloads, 8 bits per pass.
+// Passes whose digit is equal for all keys are skipped. Large inputs build histograms and scatter
+// on the job threads. keys/values are sorted in place, tmpKeys/tmpValues must be at least as large.
+void RadixSort(std::span<uint64_t> keys, std::span<uint32_t> values, std::span<uint64_t> tmpKeys, std::span<uint32_t> tmpValues) noexcept;
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+
+
+// On-disk layout of a cooked scene (.vkscene), shared by the engine and tools/scene_cooker.
+//
+//   SceneFileHeader
+//   SceneFileMesh[meshCount]
+//   SceneFileSurface[surfaceCount]
+//   SceneFileMaterial[materialCount]
+//   SceneFileSampler[samplerCount]
+//   SceneFileTexture[textureCount]
+//   SceneFileMip[mipCount]
+//   SceneFileNode[nodeCount]
+//   char strings[stringsSize]          names, not null terminated
+//   data                               vertex, index and texel blobs
+//
+// All offsets are relative to the start of the file. The data section starts at dataOffset and runs to the end
+// of the file, every blob in it is SCENE_FILE_BLOB_ALIGNMENT aligned, so the whole section goes into a staging
+// buffer with a single copy and blob offsets become copy source offsets.
+// Vertices are stored in the engine Vertex layout, indices as uint32, textures as mip chains in any format from
+// texture_format.h, block compressed ones included. Enum fields hold Vulkan values (VkFormat, VkFilter,
+// VkSamplerMipmapMode, VkComponentSwizzle).
+
+inline constexpr uint32_t SCENE_FILE_MAGIC = 0x4E435356; // "VSCN"
+inline constexpr uint32_t SCENE_FILE_VERSION = 2;
+inline constexpr uint64_t SCENE_FILE_BLOB_ALIGNMENT = 16;
+inline constexpr uint32_t SCENE_FILE_VERTEX_STRIDE = 48;
+
+inline constexpr uint32_t SCENE_FILE_INVALID_INDEX = UINT32_MAX;
+
+
+struct SceneFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+
+    uint32_t meshCount;
+    uint32_t surfaceCount;
+    uint32_t materialCount;
+    uint32_t samplerCount;
+    uint32_t textureCount;
+    uint32_t mipCount;
+    uint32_t nodeCount;
+    uint32_t stringsSize;
+
+    uint64_t meshesOffset;
+    uint64_t surfacesOffset;
+    uint64_t materialsOffset;
+    uint64_t samplersOffset;
+    uint64_t texturesOffset;
+    uint64_t mipsOffset;
+    uint64_t nodesOffset;
+    uint64_t stringsOffset;
+
+    uint64_t dataOffset;
+    uint64_t fileSize;
+};
+
+
+struct SceneFileString
+{
+    // into the strings section
+    uint32_t offset;
+    uint32_t length;
+};
+
+
+struct SceneFileMesh
+{
+    SceneFileString name;
+
+    uint32_t firstSurface;
+    uint32_t surfaceCount;
+
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint64_t verticesOffset;
+    uint64_t indicesOffset;
+};
+
+
+struct SceneFileSurface
+{
+    uint32_t startIndex;
+    uint32_t indexCount;
+    uint32_t materialIndex;
+
+    float boundsOrigin[3];
+    float boundsExtents[3];
+    float boundsSphereRadius;
+};
+
+
+struct SceneFileMaterial
+{
+    SceneFileString name;
+
+    float colorFactors[4];
+    // metallic, roughness, alpha cutoff (zero without alpha test)
+    float metallicRoughnessFactors[4];
+
+    // MaterialPass value
+    uint32_t passType;
+
+    uint32_t colorTextureIndex;
+    uint32_t colorSamplerIndex;
+    uint32_t metalRoughTextureIndex;
+    uint32_t metalRoughSamplerIndex;
+    uint32_t reserved;
+};
+
+
+struct SceneFileSampler
+{
+    uint32_t magFilter;
+    uint32_t minFilter;
+    uint32_t mipmapMode;
+    uint32_t reserved;
+};
+
+
+struct SceneFileTexture
+{
+    SceneFileString name;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+
+    // mipCount == 0 marks an image the cooker failed to decode, otherwise any count down to the full chain
+    uint32_t firstMip;
+    uint32_t mipCount;
+
+    // view swizzle per RGBA channel, zero is identity. Two channel data stored as BC5 is moved back to
+    // the channels the shaders read it from.
+    uint8_t swizzle[4];
+};
+
+
+struct SceneFileMip
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+
+struct SceneFileNode
+{
+    SceneFileString name;
+
+    uint32_t meshIndex;
+    uint32_t parentIndex;
+
+    // column major
+    float localTransform[16];
+};
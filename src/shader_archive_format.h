@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+
+// On-disk layout of the packed shader archive, shared by the engine and tools/shader_packer.
+//
+//   ShaderArchiveHeader
+//   ShaderArchiveEntry[entryCount]    sorted by nameHash
+//   SPIR-V blobs, each at a SHADER_ARCHIVE_BLOB_ALIGNMENT aligned offset
+//
+// Entries are keyed by the FNV-1a hash of the shader file name without the .spv extension, e.g. "mesh.vert".
+
+inline constexpr uint32_t SHADER_ARCHIVE_MAGIC = 0x41534556; // "VESA"
+inline constexpr uint32_t SHADER_ARCHIVE_VERSION = 1;
+inline constexpr uint64_t SHADER_ARCHIVE_BLOB_ALIGNMENT = 16;
+
+
+struct ShaderArchiveHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+
+struct ShaderArchiveEntry
+{
+    uint64_t nameHash;
+    uint64_t offset;
+    uint64_t size;
+};
+
+
+constexpr uint64_t HashShaderName(std::string_view name) noexcept
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "core.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+
+// 32-bit generational handle: slot index in the low bits, slot generation in the high ones.
+// Zero is never handed out, zero initialized structs hold null handles.
+template <typename Tag>
+struct SlotHandle
+{
+    static constexpr uint32_t INDEX_BITS = 20;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr uint32_t MAX_GENERATION = (1u << (32 - INDEX_BITS)) - 1;
+
+    uint32_t GetIndex() const noexcept { return value & INDEX_MASK; }
+    uint32_t GetGeneration() const noexcept { return value >> INDEX_BITS; }
+
+    // Only tells null handles apart, SlotMap::Contains detects stale ones
+    bool IsNull() const noexcept { return value == 0; }
+
+    bool operator==(const SlotHandle& other) const noexcept = default;
+
+    uint32_t value = 0;
+};
+
+
+// Values live in a dense array that stays packed on removal, handles reach them through a slot with
+// the generation of its current value. Lookups are O(1), handles of removed values never match again:
+// a slot whose generation runs out is retired instead of reused.
+template <typename T, typename Tag = T>
+class SlotMap
+{
+public:
+    using Handle = SlotHandle<Tag>;
+
+public:
+    Handle Insert(T&& value) noexcept
+    {
+        uint32_t slotIndex;
+
+        if (!m_freeSlots.empty()) {
+            slotIndex = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        } else {
+            ENG_ASSERT(m_slots.size() <= Handle::INDEX_MASK);
+
+            slotIndex = (uint32_t)m_slots.size();
+            m_slots.push_back(Slot { 0, 1 });
+        }
+
+        Slot& slot = m_slots[slotIndex];
+        slot.denseIndex = (uint32_t)m_values.size();
+
+        m_values.push_back(std::move(value));
+        m_denseSlots.push_back(slotIndex);
+
+        return Handle { (slot.generation << Handle::INDEX_BITS) | slotIndex };
+    }
+
+
+    bool Erase(Handle handle) noexcept
+    {
+        if (!Contains(handle)) {
+            return false;
+        }
+
+        const uint32_t slotIndex = handle.GetIndex();
+        Slot& slot = m_slots[slotIndex];
+
+        // the last value fills the hole
+        const uint32_t lastDenseIndex = (uint32_t)m_values.size() - 1;
+
+        if (slot.denseIndex != lastDenseIndex) {
+            m_values[slot.denseIndex] = std::move(m_values[lastDenseIndex]);
+            m_denseSlots[slot.denseIndex] = m_denseSlots[lastDenseIndex];
+            m_slots[m_denseSlots[slot.denseIndex]].denseIndex = slot.denseIndex;
+        }
+
+        m_values.pop_back();
+        m_denseSlots.pop_back();
+
+        if (slot.generation < Handle::MAX_GENERATION) {
+            ++slot.generation;
+            m_freeSlots.push_back(slotIndex);
+        }
+
+        slot.denseIndex = UINT32_MAX;
+
+        return true;
+    }
+
+
+    bool Contains(Handle handle) const noexcept
+    {
+        const uint32_t slotIndex = handle.GetIndex();
+
+        return !handle.IsNull() && slotIndex < m_slots.size() && m_slots[slotIndex].denseIndex != UINT32_MAX &&
+            m_slots[slotIndex].generation == handle.GetGeneration();
+    }
+
+
+    // nullptr for null and stale handles
+    T* Get(Handle handle) noexcept
+    {
+        return Contains(handle) ? &m_values[m_slots[handle.GetIndex()].denseIndex] : nullptr;
+    }
+
+
+    const T* Get(Handle handle) const noexcept
+    {
+        return Contains(handle) ? &m_values[m_slots[handle.GetIndex()].denseIndex] : nullptr;
+    }
+
+
+    // Dense order changes on removal
+    std::span<T> GetValues() noexcept { return m_values; }
+    std::span<const T> GetValues() const noexcept { return m_values; }
+    Handle GetHandle(size_t denseIndex) const noexcept
+    {
+        const uint32_t slotIndex = m_denseSlots[denseIndex];
+        return Handle { (m_slots[slotIndex].generation << Handle::INDEX_BITS) | slotIndex };
+    }
+
+    size_t GetSize() const noexcept { return m_values.size(); }
+    bool IsEmpty() const noexcept { return m_values.empty(); }
+
+private:
+    struct Slot
+    {
+        // UINT32_MAX while the slot is free
+        uint32_t denseIndex;
+        uint32_t generation;
+    };
+
+private:
+    std::vector<T> m_values;
+    std::vector<uint32_t> m_denseSlots;
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "job_system.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+
+// Lazily started coroutine producing a T. It runs when it is co_awaited and resumes the awaiting
+// coroutine on whatever thread it finishes on, the awaitables it uses decide where that is.
+template <typename T>
+class Task final
+{
+public:
+    struct promise_type
+    {
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        Task get_return_object() noexcept { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+
+        void return_value(T value) noexcept { result = std::move(value); }
+        void unhandled_exception() const noexcept { std::terminate(); }
+
+        std::optional<T> result;
+        std::coroutine_handle<> continuation;
+    };
+
+    struct Awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) const noexcept
+        {
+            handle.promise().continuation = continuation;
+            return handle;
+        }
+
+        T await_resume() const noexcept { return std::move(*handle.promise().result); }
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+public:
+    Task() = default;
+    ~Task() { Destroy(); }
+
+    Task(const Task& other) = delete;
+    Task& operator=(const Task& other) = delete;
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other) {
+            Destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    // The task has to stay alive until the awaiting coroutine is resumed
+    Awaiter operator co_await() const& noexcept { return Awaiter { m_handle }; }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle) {}
+
+    void Destroy() noexcept
+    {
+        if (m_handle) {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+
+// Eagerly started coroutine nobody waits on, its frame frees itself when it finishes.
+// The top level of a chain of Tasks.
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() const noexcept { return {}; }
+
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+
+// co_await ResumeOnBackgroundJob{} continues the coroutine as a JobSystem background job
+struct ResumeOnBackgroundJob
+{
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) const noexcept
+    {
+        JobSystem::GetInstance().ScheduleBackground([handle]() { handle.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+};
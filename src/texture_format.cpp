@@ -0,0 +1,63 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "texture_format.h"
+
+
+bool GetTextureFormatInfo(VkFormat format, TextureFormatInfo& outInfo) noexcept
+{
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            outInfo = { 1, 1, 4, false };
+            return true;
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+            outInfo = { 4, 4, 8, true };
+            return true;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            outInfo = { 4, 4, 16, true };
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+bool IsBlockCompressedFormat(VkFormat format) noexcept
+{
+    TextureFormatInfo info;
+    return GetTextureFormatInfo(format, info) && info.isCompressed;
+}
+
+
+uint32_t GetTextureMipCount(uint32_t width, uint32_t height) noexcept
+{
+    return (uint32_t)std::bit_width(std::max(width, height));
+}
+
+
+uint64_t GetTextureMipSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mip) noexcept
+{
+    TextureFormatInfo info;
+    if (!GetTextureFormatInfo(format, info)) {
+        return 0;
+    }
+
+    const uint64_t mipWidth = std::max(width >> mip, 1u);
+    const uint64_t mipHeight = std::max(height >> mip, 1u);
+
+    // partial blocks at the edges still take a whole block
+    const uint64_t blockCountX = (mipWidth + info.blockWidth - 1) / info.blockWidth;
+    const uint64_t blockCountY = (mipHeight + info.blockHeight - 1) / info.blockHeight;
+
+    return blockCountX * blockCountY * info.blockSize;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "vk_types.h"
+
+
+// Size rules of the formats textures are stored in, shared by the engine, the KTX2 reader and tools/scene_cooker.
+// Block compressed formats encode 4x4 texel blocks, uncompressed ones are treated as 1x1 blocks.
+
+struct TextureFormatInfo
+{
+    uint32_t blockWidth;
+    uint32_t blockHeight;
+    // bytes per block
+    uint32_t blockSize;
+    bool isCompressed;
+};
+
+
+// false for formats the engine doesn't sample textures from
+bool GetTextureFormatInfo(VkFormat format, TextureFormatInfo& outInfo) noexcept;
+bool IsBlockCompressedFormat(VkFormat format) noexcept;
+
+// Full chain down to 1x1
+uint32_t GetTextureMipCount(uint32_t width, uint32_t height) noexcept;
+// Tightly packed size of one mip, 0 for unsupported formats
+uint64_t GetTextureMipSize(VkFormat format, uint32_t width, uint32_t height, uint32_t mip) noexcept;
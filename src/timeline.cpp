@@ -0,0 +1,86 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "timeline.h"
+#include "job_system.h"
+
+
+static constexpr size_t TIMELINE_BAR_WIDTH = 48;
+
+
+void Timeline::Reset() noexcept
+{
+    std::lock_guard lock(m_mutex);
+
+    m_events.clear();
+    m_origin = Clock::now();
+}
+
+
+void Timeline::AddEvent(std::string_view name, Clock::time_point start, Clock::time_point end) noexcept
+{
+    ENG_ASSERT(start <= end);
+
+    const uint32_t threadIndex = JobSystem::GetInstance().GetThreadIndex();
+
+    std::lock_guard lock(m_mutex);
+    m_events.emplace_back(Event { std::string(name), start, end, threadIndex });
+}
+
+
+float Timeline::GetEventMs(std::string_view name) const noexcept
+{
+    std::lock_guard lock(m_mutex);
+
+    for (const Event& event : m_events) {
+        if (event.name == name) {
+            return ToMs(event.end - event.start);
+        }
+    }
+
+    return 0.f;
+}
+
+
+void Timeline::Print(std::string_view title) const noexcept
+{
+    std::vector<Event> events;
+
+    {
+        std::lock_guard lock(m_mutex);
+        events = m_events;
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const Event& lhs, const Event& rhs) {
+        return lhs.start < rhs.start;
+    });
+
+    Clock::time_point timelineEnd = m_origin;
+    size_t nameWidth = 4;
+
+    for (const Event& event : events) {
+        timelineEnd = std::max(timelineEnd, event.end);
+        nameWidth = std::max(nameWidth, event.name.size());
+    }
+
+    const float totalMs = std::max(ToMs(timelineEnd - m_origin), 0.001f);
+
+    fmt::print("{} ({:.2f} ms):\n", title, totalMs);
+    fmt::print("  {:<{}} {:>9} {:>9} {:>9} {:>6}\n", "name", nameWidth, "start ms", "end ms", "dur ms", "thread");
+
+    for (const Event& event : events) {
+        const float startMs = ToMs(event.start - m_origin);
+        const float endMs = ToMs(event.end - m_origin);
+
+        const size_t barBegin = std::min<size_t>(startMs / totalMs * TIMELINE_BAR_WIDTH, TIMELINE_BAR_WIDTH - 1);
+        const size_t barEnd = std::clamp<size_t>(endMs / totalMs * TIMELINE_BAR_WIDTH, barBegin + 1, TIMELINE_BAR_WIDTH);
+
+        std::string bar(TIMELINE_BAR_WIDTH, ' ');
+        std::fill(bar.begin() + barBegin, bar.begin() + barEnd, '#');
+
+        const std::string thread = event.threadIndex == JobSystem::INVALID_THREAD_INDEX ? "-" : std::to_string(event.threadIndex);
+
+        fmt::print("  {:<{}} {:>9.2f} {:>9.2f} {:>9.2f} {:>6} |{}|\n", event.name, nameWidth, startMs, endMs, endMs - startMs, thread, bar);
+    }
+}
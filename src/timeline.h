@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Named time spans relative to a common origin, recorded from any thread. Used to see which
+// init phases overlap and where the critical path to the first frame goes.
+class Timeline final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        std::string name;
+        Clock::time_point start;
+        Clock::time_point end;
+        uint32_t threadIndex;
+    };
+
+public:
+    Timeline() = default;
+
+    Timeline(const Timeline& other) = delete;
+    Timeline(Timeline&& other) = delete;
+    Timeline& operator=(const Timeline& other) = delete;
+    Timeline& operator=(Timeline&& other) = delete;
+
+    // Drops recorded events and moves the origin to now
+    void Reset() noexcept;
+
+    void AddEvent(std::string_view name, Clock::time_point start, Clock::time_point end) noexcept;
+
+    float GetElapsedMs() const noexcept { return ToMs(Clock::now() - m_origin); }
+    float GetEventMs(std::string_view name) const noexcept;
+
+    // Prints the events sorted by start time with a bar per event scaled to the whole timeline
+    void Print(std::string_view title) const noexcept;
+
+private:
+    static float ToMs(Clock::duration duration) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / 1000.f;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<Event> m_events;
+
+    Clock::time_point m_origin = Clock::now();
+};
+
+
+class ScopedTimelineEvent final
+{
+public:
+    ScopedTimelineEvent(Timeline& timeline, std::string_view name) noexcept
+        : m_timeline(timeline), m_name(name), m_start(Timeline::Clock::now()) {}
+
+    ~ScopedTimelineEvent() { m_timeline.AddEvent(m_name, m_start, Timeline::Clock::now()); }
+
+    ScopedTimelineEvent(const ScopedTimelineEvent& other) = delete;
+    ScopedTimelineEvent& operator=(const ScopedTimelineEvent& other) = delete;
+
+private:
+    Timeline& m_timeline;
+    std::string_view m_name;
+    Timeline::Clock::time_point m_start;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+// Single producer, single consumer handoff of the latest value. The producer fills the back slot and swaps it
+// with the middle one, the consumer swaps its front slot with the middle one when that holds a newer value.
+// The swaps are one atomic each, neither side ever touches the slot the other one works on.
+template <typename T>
+class TripleBuffer final
+{
+public:
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer& other) = delete;
+    TripleBuffer& operator=(const TripleBuffer& other) = delete;
+
+    // Drops a published value and reopens a closed buffer, neither side may use it meanwhile
+    void Reset() noexcept
+    {
+        m_frontIdx = 0;
+        m_backIdx = 2;
+        m_middle.store(1, std::memory_order_relaxed);
+    }
+
+    // Producer side: the slot to fill, it still holds the value published three times ago
+    T& GetBack() noexcept { return m_slots[m_backIdx]; }
+
+    // Producer side: makes the back slot the latest value, a value the consumer didn't take is dropped
+    void Publish() noexcept
+    {
+        uint32_t middle = m_middle.load(std::memory_order_relaxed);
+        while (!m_middle.compare_exchange_weak(middle, (middle & CLOSED_BIT) | FRESH_BIT | m_backIdx, std::memory_order_acq_rel,
+            std::memory_order_relaxed)) {
+        }
+
+        m_backIdx = middle & INDEX_MASK;
+        m_middle.notify_one();
+    }
+
+    // Consumer side: takes the latest value if one was published since the last call, GetFront returns it then
+    bool Acquire() noexcept
+    {
+        uint32_t middle = m_middle.load(std::memory_order_relaxed);
+
+        do {
+            if ((middle & FRESH_BIT) == 0) {
+                return false;
+            }
+        } while (!m_middle.compare_exchange_weak(middle, (middle & CLOSED_BIT) | m_frontIdx, std::memory_order_acq_rel,
+            std::memory_order_relaxed));
+
+        m_frontIdx = middle & INDEX_MASK;
+        m_middle.notify_one();
+
+        return true;
+    }
+
+    // Consumer side: the last acquired value
+    const T& GetFront() const noexcept { return m_slots[m_frontIdx]; }
+
+    // Producer side: blocks until the consumer took the last published value, false once the buffer is closed
+    bool WaitConsumed() noexcept
+    {
+        uint32_t middle = m_middle.load(std::memory_order_acquire);
+
+        while ((middle & FRESH_BIT) != 0 && (middle & CLOSED_BIT) == 0) {
+            m_middle.wait(middle, std::memory_order_acquire);
+            middle = m_middle.load(std::memory_order_acquire);
+        }
+
+        return (middle & CLOSED_BIT) == 0;
+    }
+
+    // Consumer side: blocks until a value is published, false once the buffer is closed
+    bool WaitPublished() noexcept
+    {
+        uint32_t middle = m_middle.load(std::memory_order_acquire);
+
+        while ((middle & FRESH_BIT) == 0 && (middle & CLOSED_BIT) == 0) {
+            m_middle.wait(middle, std::memory_order_acquire);
+            middle = m_middle.load(std::memory_order_acquire);
+        }
+
+        return (middle & CLOSED_BIT) == 0;
+    }
+
+    // Wakes up both sides, the waits return false from now on
+    void Close() noexcept
+    {
+        m_middle.fetch_or(CLOSED_BIT, std::memory_order_release);
+        m_middle.notify_all();
+    }
+
+private:
+    static constexpr uint32_t INDEX_MASK = 0x3;
+    // the middle slot holds a value the consumer hasn't taken yet
+    static constexpr uint32_t FRESH_BIT = 0x4;
+    static constexpr uint32_t CLOSED_BIT = 0x8;
+
+private:
+    std::array<T, 3> m_slots = {};
+
+    // owned by the producer and the consumer respectively
+    uint32_t m_backIdx = 2;
+    uint32_t m_frontIdx = 0;
+
+    // index of the middle slot and the state bits
+    std::atomic<uint32_t> m_middle = 1;
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free);
+};
@@ -0,0 +1,187 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_deferred_destroy.h"
+#include "vk_engine.h"
+
+#include <algorithm>
+
+
+void DeferredDestroyQueue::PushBuffer(uint64_t retireFrame, const BufferHandle& buffer) noexcept
+{
+    DeferredDestroy record = {};
+    record.retireFrame = retireFrame;
+    record.pBuffer = buffer.pBuffer;
+    record.pAllocation = buffer.pAllocation;
+    record.type = DeferredDestroyType::BUFFER;
+
+    Push(record);
+}
+
+
+void DeferredDestroyQueue::PushImage(uint64_t retireFrame, const ImageHandle& image) noexcept
+{
+    DeferredDestroy record = {};
+    record.retireFrame = retireFrame;
+    record.pImage = image.pImage;
+    record.pImageView = image.pImageView;
+    record.pAllocation = image.pAllocation;
+    record.type = DeferredDestroyType::IMAGE;
+
+    Push(record);
+}
+
+
+void DeferredDestroyQueue::PushPipeline(uint64_t retireFrame, VkPipeline pPipeline) noexcept
+{
+    DeferredDestroy record = {};
+    record.retireFrame = retireFrame;
+    record.pPipeline = pPipeline;
+    record.type = DeferredDestroyType::PIPELINE;
+
+    Push(record);
+}
+
+
+void DeferredDestroyQueue::PushDescriptorRange(uint64_t retireFrame, VmaVirtualAllocation pRange) noexcept
+{
+    DeferredDestroy record = {};
+    record.retireFrame = retireFrame;
+    record.pDescriptorRange = pRange;
+    record.type = DeferredDestroyType::DESCRIPTOR_RANGE;
+
+    Push(record);
+}
+
+
+void DeferredDestroyQueue::Push(const DeferredDestroy& record) noexcept
+{
+    // a retire frame that far ahead would share the slot of one that isn't flushed yet
+    ENG_ASSERT(!IsRetired(record.retireFrame) && (!m_hasFlushed || record.retireFrame - m_flushedFrame < RING_SIZE));
+
+    m_ring[record.retireFrame % RING_SIZE].push_back(record);
+}
+
+
+void DeferredDestroyQueue::Flush(VulkanEngine& engine, uint64_t frame) noexcept
+{
+    ENG_ASSERT(!m_hasFlushed || frame >= m_flushedFrame);
+
+    std::vector<DeferredDestroy>& records = m_ring[frame % RING_SIZE];
+
+    for (const DeferredDestroy& record : records) {
+        ENG_ASSERT(record.retireFrame <= frame);
+    }
+
+    DestroyRecords(engine, records);
+
+    m_flushedFrame = frame;
+    m_hasFlushed = true;
+}
+
+
+void DeferredDestroyQueue::FlushAll(VulkanEngine& engine) noexcept
+{
+    for (std::vector<DeferredDestroy>& records : m_ring) {
+        DestroyRecords(engine, records);
+    }
+}
+
+
+void DeferredDestroyQueue::DestroyRecords(VulkanEngine& engine, std::vector<DeferredDestroy>& records) noexcept
+{
+    std::sort(records.begin(), records.end(), [](const DeferredDestroy& left, const DeferredDestroy& right) {
+        return left.type < right.type;
+    });
+
+    for (size_t begin = 0; begin < records.size();) {
+        const DeferredDestroyType type = records[begin].type;
+
+        size_t end = begin + 1;
+        while (end < records.size() && records[end].type == type) {
+            ++end;
+        }
+
+        const std::span<const DeferredDestroy> batch(records.data() + begin, end - begin);
+
+        switch (type) {
+            case DeferredDestroyType::BUFFER:
+                DestroyBuffers(engine, batch);
+                break;
+            case DeferredDestroyType::IMAGE:
+                DestroyImages(engine, batch);
+                break;
+            case DeferredDestroyType::PIPELINE:
+                DestroyPipelines(engine, batch);
+                break;
+            case DeferredDestroyType::DESCRIPTOR_RANGE:
+                FreeDescriptorRanges(engine, batch);
+                break;
+            default:
+                ENG_ASSERT_FAIL("unknown deferred destroy type {}", (uint32_t)type);
+                break;
+        }
+
+        begin = end;
+    }
+
+    // keeps the capacity, the slot is reused RING_SIZE frames later
+    records.clear();
+}
+
+
+void DeferredDestroyQueue::DestroyBuffers(VulkanEngine& engine, std::span<const DeferredDestroy> records) noexcept
+{
+    m_freedAllocations.clear();
+
+    for (const DeferredDestroy& record : records) {
+        engine.UntrackAllocation(record.pAllocation);
+
+        // a defragmentation pass moving it destroys the handle and frees the memory when it ends
+        if (engine.m_memoryPools.ReleaseMovable(record.pAllocation)) {
+            continue;
+        }
+
+        vkDestroyBuffer(engine.m_pVkDevice, record.pBuffer, nullptr);
+        m_freedAllocations.push_back(record.pAllocation);
+    }
+
+    vmaFreeMemoryPages(engine.m_pVMA, m_freedAllocations.size(), m_freedAllocations.data());
+}
+
+
+void DeferredDestroyQueue::DestroyImages(VulkanEngine& engine, std::span<const DeferredDestroy> records) noexcept
+{
+    m_freedAllocations.clear();
+
+    for (const DeferredDestroy& record : records) {
+        engine.UntrackAllocation(record.pAllocation);
+
+        if (engine.m_memoryPools.ReleaseMovable(record.pAllocation)) {
+            continue;
+        }
+
+        vkDestroyImageView(engine.m_pVkDevice, record.pImageView, nullptr);
+        vkDestroyImage(engine.m_pVkDevice, record.pImage, nullptr);
+        m_freedAllocations.push_back(record.pAllocation);
+    }
+
+    vmaFreeMemoryPages(engine.m_pVMA, m_freedAllocations.size(), m_freedAllocations.data());
+}
+
+
+void DeferredDestroyQueue::DestroyPipelines(VulkanEngine& engine, std::span<const DeferredDestroy> records) const noexcept
+{
+    for (const DeferredDestroy& record : records) {
+        vkDestroyPipeline(engine.m_pVkDevice, record.pPipeline, nullptr);
+    }
+}
+
+
+void DeferredDestroyQueue::FreeDescriptorRanges(VulkanEngine& engine, std::span<const DeferredDestroy> records) const noexcept
+{
+    for (const DeferredDestroy& record : records) {
+        engine.m_descriptorBuffer.Free(record.pDescriptorRange);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <array>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+
+class VulkanEngine;
+
+
+enum class DeferredDestroyType : uint8_t
+{
+    BUFFER,
+    IMAGE,
+    PIPELINE,
+    DESCRIPTOR_RANGE,
+    COUNT
+};
+
+
+// Resources the GPU may still use are freed once the frame given by retireFrame has waited for its fence
+struct DeferredDestroy
+{
+    uint64_t retireFrame;
+
+    union
+    {
+        VkBuffer pBuffer;
+        VkImage pImage;
+        VkPipeline pPipeline;
+        // range of VulkanEngine::m_descriptorBuffer
+        VmaVirtualAllocation pDescriptorRange;
+    };
+
+    VkImageView pImageView;
+    VmaAllocation pAllocation;
+
+    DeferredDestroyType type;
+};
+
+static_assert(std::is_trivially_copyable_v<DeferredDestroy>);
+
+
+// Typed replacement of DeletionQueue for the per-frame path. Records go to the ring slot of their retire frame,
+// the slots keep their capacity so pushing stops allocating once they grew. A flush frees one slot grouped by type.
+// Engine main thread only, which is the render thread while VulkanEngine::Run is in progress.
+class DeferredDestroyQueue final
+{
+public:
+    // retire frames run at most this many frames ahead of the last flushed one
+    static constexpr size_t RING_SIZE = 4;
+
+public:
+    DeferredDestroyQueue() = default;
+
+    DeferredDestroyQueue(const DeferredDestroyQueue& other) = delete;
+    DeferredDestroyQueue& operator=(const DeferredDestroyQueue& other) = delete;
+
+    void PushBuffer(uint64_t retireFrame, const BufferHandle& buffer) noexcept;
+    void PushImage(uint64_t retireFrame, const ImageHandle& image) noexcept;
+    void PushPipeline(uint64_t retireFrame, VkPipeline pPipeline) noexcept;
+    void PushDescriptorRange(uint64_t retireFrame, VmaVirtualAllocation pRange) noexcept;
+
+    // Frees what retires at frame, the GPU has to be done with it
+    void Flush(VulkanEngine& engine, uint64_t frame) noexcept;
+    // Frees everything, the device has to be idle
+    void FlushAll(VulkanEngine& engine) noexcept;
+
+    bool IsRetired(uint64_t retireFrame) const noexcept { return m_hasFlushed && retireFrame <= m_flushedFrame; }
+
+private:
+    void Push(const DeferredDestroy& record) noexcept;
+    void DestroyRecords(VulkanEngine& engine, std::vector<DeferredDestroy>& records) noexcept;
+
+    void DestroyBuffers(VulkanEngine& engine, std::span<const DeferredDestroy> records) noexcept;
+    void DestroyImages(VulkanEngine& engine, std::span<const DeferredDestroy> records) noexcept;
+    void DestroyPipelines(VulkanEngine& engine, std::span<const DeferredDestroy> records) const noexcept;
+    void FreeDescriptorRanges(VulkanEngine& engine, std::span<const DeferredDestroy> records) const noexcept;
+
+private:
+    std::array<std::vector<DeferredDestroy>, RING_SIZE> m_ring;
+    // memory of a batch is given back to VMA in one call
+    std::vector<VmaAllocation> m_freedAllocations;
+
+    uint64_t m_flushedFrame = 0;
+    bool m_hasFlushed = false;
+};
@@ -2,13 +2,31 @@
 
 #include "vk_descriptors.h"
 
+#include "job_system.h"
 
-void DescriptorLayoutBuilder::AddBinding(uint32_t binding, VkDescriptorType type) noexcept
+#include <algorithm>
+
+
+size_t DescriptorKeyHash::operator()(const DescriptorKey& key) const noexcept
+{
+    // FNV-1a over the words
+    uint64_t hash = 14695981039346656037ull;
+
+    for (uint64_t word : key) {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+
+    return (size_t)hash;
+}
+
+
+void DescriptorLayoutBuilder::AddBinding(uint32_t binding, VkDescriptorType type, uint32_t descriptorCount) noexcept
 {
     VkDescriptorSetLayoutBinding bind = {};
     
     bind.binding = binding;
-    bind.descriptorCount = 1;
+    bind.descriptorCount = descriptorCount;
     bind.descriptorType = type;
 
     m_bindings.push_back(bind);
@@ -42,7 +60,80 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::Build(VkDevice pDevice, VkShaderS
 }
 
 
-void DescriptorAllocatorGrowable::Init(VkDevice pDevice, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios) noexcept
+VkDescriptorSetLayout DescriptorLayoutBuilder::Build(VkDevice pDevice, DescriptorLayoutCache& cache, VkShaderStageFlags shaderStages, VkDescriptorSetLayoutCreateFlags flags) noexcept
+{
+    for (VkDescriptorSetLayoutBinding& binding : m_bindings) {
+        binding.stageFlags |= shaderStages;
+    }
+
+    VkDescriptorSetLayoutCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = flags,
+        .bindingCount = static_cast<uint32_t>(m_bindings.size()),
+        .pBindings = m_bindings.data()
+    };
+
+    return cache.GetLayout(pDevice, info);
+}
+
+
+VkDescriptorSetLayout DescriptorLayoutCache::GetLayout(VkDevice pDevice, const VkDescriptorSetLayoutCreateInfo& info) noexcept
+{
+    ENG_ASSERT(info.pNext == nullptr);
+
+    // binding order doesn't change the layout
+    std::vector<VkDescriptorSetLayoutBinding> bindings(info.pBindings, info.pBindings + info.bindingCount);
+    std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& left, const VkDescriptorSetLayoutBinding& right) {
+        return left.binding < right.binding;
+    });
+
+    DescriptorKey key;
+    key.reserve(1 + bindings.size() * 2);
+    key.push_back(info.flags);
+
+    for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+        ENG_ASSERT(binding.pImmutableSamplers == nullptr);
+
+        key.push_back(((uint64_t)binding.binding << 32) | (uint64_t)binding.descriptorType);
+        key.push_back(((uint64_t)binding.descriptorCount << 32) | (uint64_t)binding.stageFlags);
+    }
+
+    std::scoped_lock lock(m_mutex);
+
+    const auto it = m_layouts.find(key);
+    if (it != m_layouts.end()) {
+        return it->second;
+    }
+
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    ENG_VK_CHECK(vkCreateDescriptorSetLayout(pDevice, &info, nullptr, &layout));
+
+    m_layouts.emplace(std::move(key), layout);
+
+    return layout;
+}
+
+
+void DescriptorLayoutCache::Destroy(VkDevice pDevice) noexcept
+{
+    std::scoped_lock lock(m_mutex);
+
+    for (auto& [key, layout] : m_layouts) {
+        vkDestroyDescriptorSetLayout(pDevice, layout, nullptr);
+    }
+
+    m_layouts.clear();
+}
+
+
+size_t DescriptorLayoutCache::GetLayoutCount() const noexcept
+{
+    std::scoped_lock lock(m_mutex);
+    return m_layouts.size();
+}
+
+
+void DescriptorAllocatorGrowable::Init(VkDevice pDevice, uint32_t maxSets, std::span<const PoolSizeRatio> poolRatios) noexcept
 {
     m_ratios.clear();
     
@@ -70,6 +161,7 @@ void DescriptorAllocatorGrowable::ClearPools(VkDevice pDevice) noexcept
     }
 
     m_fullPools.clear();
+    m_setCache.clear();
 }
 
 
@@ -86,6 +178,7 @@ void DescriptorAllocatorGrowable::DestroyPools(VkDevice pDevice) noexcept
     }
 
     m_fullPools.clear();
+    m_setCache.clear();
 }
 
 
@@ -118,6 +211,49 @@ VkDescriptorSet DescriptorAllocatorGrowable::Allocate(VkDevice pDevice, VkDescri
 }
 
 
+template <typename WriteFunc>
+VkDescriptorSet DescriptorAllocatorGrowable::FindOrAllocate(VkDevice pDevice, VkDescriptorSetLayout pLayout, WriteFunc&& write) noexcept
+{
+    const auto it = m_setCache.find(m_lookupKey);
+    if (it != m_setCache.end()) {
+        ++m_cacheHitCount;
+        return it->second;
+    }
+
+    const VkDescriptorSet pSet = Allocate(pDevice, pLayout);
+    write(pSet);
+
+    m_setCache.emplace(m_lookupKey, pSet);
+
+    return pSet;
+}
+
+
+VkDescriptorSet DescriptorAllocatorGrowable::AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, DescriptorWriter& writer) noexcept
+{
+    m_lookupKey.clear();
+    m_lookupKey.push_back((uint64_t)pLayout);
+    writer.AppendKey(m_lookupKey);
+
+    return FindOrAllocate(pDevice, pLayout, [&](VkDescriptorSet pSet) {
+        writer.UpdateSet(pDevice, pSet);
+    });
+}
+
+
+VkDescriptorSet DescriptorAllocatorGrowable::AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, const DescriptorUpdateTemplate& updateTemplate,
+    const void* pData) noexcept
+{
+    m_lookupKey.clear();
+    m_lookupKey.push_back((uint64_t)pLayout);
+    updateTemplate.AppendKey(pData, m_lookupKey);
+
+    return FindOrAllocate(pDevice, pLayout, [&](VkDescriptorSet pSet) {
+        updateTemplate.UpdateSet(pDevice, pSet, pData);
+    });
+}
+
+
 VkDescriptorPool DescriptorAllocatorGrowable::GetPool(VkDevice pDevice) noexcept
 {
     VkDescriptorPool pNewPool;
@@ -134,7 +270,7 @@ VkDescriptorPool DescriptorAllocatorGrowable::GetPool(VkDevice pDevice) noexcept
 }
 
 
-VkDescriptorPool DescriptorAllocatorGrowable::CreatePool(VkDevice pDevice, uint32_t setsCount, std::span<PoolSizeRatio> poolRatios) noexcept
+VkDescriptorPool DescriptorAllocatorGrowable::CreatePool(VkDevice pDevice, uint32_t setsCount, std::span<const PoolSizeRatio> poolRatios) noexcept
 {
     std::vector<VkDescriptorPoolSize> poolSizes;
     poolSizes.reserve(poolRatios.size());
@@ -158,7 +294,89 @@ VkDescriptorPool DescriptorAllocatorGrowable::CreatePool(VkDevice pDevice, uint3
 }
 
 
-void DescriptorWriter::WriteImage(uint32_t binding, VkImageView pImage, VkSampler pSampler, VkImageLayout pLayout, VkDescriptorType type) noexcept
+void DescriptorAllocatorPerThread::Init(uint32_t threadCount, uint32_t maxSetsPerThread, std::span<const DescriptorAllocatorGrowable::PoolSizeRatio> poolRatios) noexcept
+{
+    m_threadAllocators = std::vector<ThreadAllocator>(std::max(threadCount, 1u));
+    m_ratios.assign(poolRatios.begin(), poolRatios.end());
+    m_maxSetsPerThread = maxSetsPerThread;
+}
+
+
+void DescriptorAllocatorPerThread::ClearPools(VkDevice pDevice) noexcept
+{
+    for (ThreadAllocator& threadAllocator : m_threadAllocators) {
+        threadAllocator.allocator.ClearPools(pDevice);
+    }
+
+    std::scoped_lock lock(m_externalMutex);
+    m_externalAllocator.ClearPools(pDevice);
+}
+
+
+void DescriptorAllocatorPerThread::DestroyPools(VkDevice pDevice) noexcept
+{
+    for (ThreadAllocator& threadAllocator : m_threadAllocators) {
+        threadAllocator.allocator.DestroyPools(pDevice);
+    }
+
+    std::scoped_lock lock(m_externalMutex);
+    m_externalAllocator.DestroyPools(pDevice);
+}
+
+
+template <typename Func>
+VkDescriptorSet DescriptorAllocatorPerThread::AllocateOnThread(VkDevice pDevice, Func&& allocate) noexcept
+{
+    ENG_ASSERT(m_maxSetsPerThread != 0);
+
+    const uint32_t threadIndex = JobSystem::GetInstance().GetThreadIndex();
+
+    if (threadIndex < m_threadAllocators.size()) {
+        DescriptorAllocatorGrowable& allocator = m_threadAllocators[threadIndex].allocator;
+
+        if (!allocator.IsInitialized()) {
+            allocator.Init(pDevice, m_maxSetsPerThread, m_ratios);
+        }
+
+        return allocate(allocator);
+    }
+
+    std::scoped_lock lock(m_externalMutex);
+
+    if (!m_externalAllocator.IsInitialized()) {
+        m_externalAllocator.Init(pDevice, m_maxSetsPerThread, m_ratios);
+    }
+
+    return allocate(m_externalAllocator);
+}
+
+
+VkDescriptorSet DescriptorAllocatorPerThread::Allocate(VkDevice pDevice, VkDescriptorSetLayout pLayout, void* pNext) noexcept
+{
+    return AllocateOnThread(pDevice, [&](DescriptorAllocatorGrowable& allocator) {
+        return allocator.Allocate(pDevice, pLayout, pNext);
+    });
+}
+
+
+VkDescriptorSet DescriptorAllocatorPerThread::AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, DescriptorWriter& writer) noexcept
+{
+    return AllocateOnThread(pDevice, [&](DescriptorAllocatorGrowable& allocator) {
+        return allocator.AllocateCached(pDevice, pLayout, writer);
+    });
+}
+
+
+VkDescriptorSet DescriptorAllocatorPerThread::AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, const DescriptorUpdateTemplate& updateTemplate,
+    const void* pData) noexcept
+{
+    return AllocateOnThread(pDevice, [&](DescriptorAllocatorGrowable& allocator) {
+        return allocator.AllocateCached(pDevice, pLayout, updateTemplate, pData);
+    });
+}
+
+
+void DescriptorWriter::WriteImage(uint32_t binding, VkImageView pImage, VkSampler pSampler, VkImageLayout pLayout, VkDescriptorType type, uint32_t arrayElement) noexcept
 {
     VkDescriptorImageInfo& info = m_imageInfos.emplace_back(VkDescriptorImageInfo {
 		.sampler = pSampler,
@@ -170,6 +388,7 @@ void DescriptorWriter::WriteImage(uint32_t binding, VkImageView pImage, VkSample
 
 	writeInfo.dstBinding = binding;
 	writeInfo.dstSet = VK_NULL_HANDLE;
+	writeInfo.dstArrayElement = arrayElement;
 	writeInfo.descriptorCount = 1;
 	writeInfo.descriptorType = type;
 	writeInfo.pImageInfo = &info;
@@ -214,3 +433,344 @@ void DescriptorWriter::UpdateSet(VkDevice device, VkDescriptorSet set) noexcept
 
     vkUpdateDescriptorSets(device, m_writes.size(), m_writes.data(), 0, nullptr);
 }
+
+
+void DescriptorWriter::AppendKey(DescriptorKey& key) const noexcept
+{
+    for (const VkWriteDescriptorSet& write : m_writes) {
+        key.push_back(((uint64_t)write.dstBinding << 32) | (uint64_t)write.dstArrayElement);
+        key.push_back(((uint64_t)write.descriptorType << 32) | (uint64_t)write.descriptorCount);
+
+        if (write.pImageInfo != nullptr) {
+            key.push_back((uint64_t)write.pImageInfo->sampler);
+            key.push_back((uint64_t)write.pImageInfo->imageView);
+            key.push_back((uint64_t)write.pImageInfo->imageLayout);
+        } else {
+            key.push_back((uint64_t)write.pBufferInfo->buffer);
+            key.push_back(write.pBufferInfo->offset);
+            key.push_back(write.pBufferInfo->range);
+        }
+    }
+}
+
+
+static bool IsImageDescriptor(VkDescriptorType type) noexcept
+{
+    return type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+        type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE || type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+}
+
+
+void DescriptorUpdateTemplate::AddImage(uint32_t binding, VkDescriptorType type, size_t offset, uint32_t arrayElement) noexcept
+{
+    ENG_ASSERT(!IsBuilt() && IsImageDescriptor(type));
+
+    m_entries.push_back(VkDescriptorUpdateTemplateEntry {
+        .dstBinding = binding,
+        .dstArrayElement = arrayElement,
+        .descriptorCount = 1,
+        .descriptorType = type,
+        .offset = offset,
+        .stride = sizeof(VkDescriptorImageInfo)
+    });
+}
+
+
+void DescriptorUpdateTemplate::AddBuffer(uint32_t binding, VkDescriptorType type, size_t offset) noexcept
+{
+    ENG_ASSERT(!IsBuilt() && !IsImageDescriptor(type));
+
+    m_entries.push_back(VkDescriptorUpdateTemplateEntry {
+        .dstBinding = binding,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = type,
+        .offset = offset,
+        .stride = sizeof(VkDescriptorBufferInfo)
+    });
+}
+
+
+void DescriptorUpdateTemplate::Build(VkDevice pDevice, VkDescriptorSetLayout pLayout) noexcept
+{
+    ENG_ASSERT(!IsBuilt() && !m_entries.empty());
+
+    VkDescriptorUpdateTemplateCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+        .descriptorUpdateEntryCount = (uint32_t)m_entries.size(),
+        .pDescriptorUpdateEntries = m_entries.data(),
+        .templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+        .descriptorSetLayout = pLayout
+    };
+
+    ENG_VK_CHECK(vkCreateDescriptorUpdateTemplate(pDevice, &info, nullptr, &m_pTemplate));
+}
+
+
+void DescriptorUpdateTemplate::Destroy(VkDevice pDevice) noexcept
+{
+    vkDestroyDescriptorUpdateTemplate(pDevice, m_pTemplate, nullptr);
+
+    m_pTemplate = VK_NULL_HANDLE;
+    m_entries.clear();
+}
+
+
+void DescriptorUpdateTemplate::UpdateSet(VkDevice pDevice, VkDescriptorSet pSet, const void* pData) const noexcept
+{
+    ENG_ASSERT(IsBuilt());
+    vkUpdateDescriptorSetWithTemplate(pDevice, pSet, m_pTemplate, pData);
+}
+
+
+void DescriptorUpdateTemplate::UpdateSets(VkDevice pDevice, std::span<const VkDescriptorSet> sets, const void* pData, size_t stride) const noexcept
+{
+    ENG_ASSERT(IsBuilt());
+
+    const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+
+    for (size_t i = 0; i < sets.size(); ++i) {
+        vkUpdateDescriptorSetWithTemplate(pDevice, sets[i], m_pTemplate, pBytes + i * stride);
+    }
+}
+
+
+void DescriptorUpdateTemplate::AppendKey(const void* pData, DescriptorKey& key) const noexcept
+{
+    const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+
+    // field by field, the padding of the info structs is undefined
+    for (const VkDescriptorUpdateTemplateEntry& entry : m_entries) {
+        key.push_back(((uint64_t)entry.dstBinding << 32) | (uint64_t)entry.dstArrayElement);
+        key.push_back(((uint64_t)entry.descriptorType << 32) | (uint64_t)entry.descriptorCount);
+
+        if (IsImageDescriptor(entry.descriptorType)) {
+            const VkDescriptorImageInfo* pInfo = reinterpret_cast<const VkDescriptorImageInfo*>(pBytes + entry.offset);
+
+            key.push_back((uint64_t)pInfo->sampler);
+            key.push_back((uint64_t)pInfo->imageView);
+            key.push_back((uint64_t)pInfo->imageLayout);
+        } else {
+            const VkDescriptorBufferInfo* pInfo = reinterpret_cast<const VkDescriptorBufferInfo*>(pBytes + entry.offset);
+
+            key.push_back((uint64_t)pInfo->buffer);
+            key.push_back(pInfo->offset);
+            key.push_back(pInfo->range);
+        }
+    }
+}
+
+
+void DescriptorBuffer::Init(VkDevice pDevice, VkPhysicalDevice pPhysDevice, const BufferHandle& buffer, VkBufferUsageFlags usage) noexcept
+{
+    ENG_ASSERT(pDevice != VK_NULL_HANDLE && !IsInitialized());
+    ENG_ASSERT(buffer.allocationInfo.pMappedData != nullptr && buffer.deviceAddress != 0);
+
+    m_pDevice = pDevice;
+
+    m_props = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT };
+
+    VkPhysicalDeviceProperties2 props2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    props2.pNext = &m_props;
+
+    vkGetPhysicalDeviceProperties2(pPhysDevice, &props2);
+
+    ENG_ASSERT(buffer.deviceAddress % m_props.descriptorBufferOffsetAlignment == 0);
+
+    m_pMappedData = static_cast<uint8_t*>(buffer.allocationInfo.pMappedData);
+    m_address = buffer.deviceAddress;
+    m_usage = usage;
+
+    // shaders reach sampler and resource descriptors only that far from the binding address
+    m_size = std::min({ buffer.allocationInfo.size, m_props.maxSamplerDescriptorBufferRange, m_props.maxResourceDescriptorBufferRange });
+    m_usedSize = 0;
+
+    VmaVirtualBlockCreateInfo blockInfo = {};
+    blockInfo.size = m_size;
+
+    ENG_VK_CHECK(vmaCreateVirtualBlock(&blockInfo, &m_pBlock));
+}
+
+
+void DescriptorBuffer::Terminate() noexcept
+{
+    if (!IsInitialized()) {
+        return;
+    }
+
+    vmaClearVirtualBlock(m_pBlock);
+    vmaDestroyVirtualBlock(m_pBlock);
+
+    m_pBlock = VK_NULL_HANDLE;
+    m_pMappedData = nullptr;
+    m_address = 0;
+    m_size = 0;
+    m_usedSize = 0;
+    m_pDevice = VK_NULL_HANDLE;
+}
+
+
+DescriptorBufferLayout DescriptorBuffer::GetLayout(VkDescriptorSetLayout pLayout, uint32_t bindingCount) const noexcept
+{
+    ENG_ASSERT(IsInitialized());
+
+    DescriptorBufferLayout layout = {};
+    layout.pLayout = pLayout;
+
+    vkGetDescriptorSetLayoutSizeEXT(m_pDevice, pLayout, &layout.size);
+
+    const VkDeviceSize alignment = m_props.descriptorBufferOffsetAlignment;
+    layout.size = (layout.size + alignment - 1) / alignment * alignment;
+
+    layout.bindingOffsets.resize(bindingCount);
+
+    for (uint32_t binding = 0; binding < bindingCount; ++binding) {
+        vkGetDescriptorSetLayoutBindingOffsetEXT(m_pDevice, pLayout, binding, &layout.bindingOffsets[binding]);
+    }
+
+    return layout;
+}
+
+
+DescriptorBufferSet DescriptorBuffer::Allocate(const DescriptorBufferLayout& layout) noexcept
+{
+    ENG_ASSERT(IsInitialized() && layout.size > 0);
+
+    VmaVirtualAllocationCreateInfo allocInfo = {};
+    allocInfo.size = layout.size;
+    allocInfo.alignment = m_props.descriptorBufferOffsetAlignment;
+
+    DescriptorBufferSet set = {};
+
+    if (vmaVirtualAllocate(m_pBlock, &allocInfo, &set.pAllocation, &set.offset) != VK_SUCCESS) {
+        ENG_ASSERT_FAIL("descriptor buffer is full, {} of {} bytes used", m_usedSize, m_size);
+        return DescriptorBufferSet {};
+    }
+
+    m_usedSize += layout.size;
+
+    return set;
+}
+
+
+void DescriptorBuffer::Free(VmaVirtualAllocation pAllocation) noexcept
+{
+    if (pAllocation == VK_NULL_HANDLE) {
+        return;
+    }
+
+    VmaVirtualAllocationInfo allocInfo = {};
+    vmaGetVirtualAllocationInfo(m_pBlock, pAllocation, &allocInfo);
+
+    m_usedSize -= allocInfo.size;
+
+    vmaVirtualFree(m_pBlock, pAllocation);
+}
+
+
+void DescriptorBuffer::WriteBuffer(const DescriptorBufferLayout& layout, const DescriptorBufferSet& set, uint32_t binding, VkDescriptorType type, 
+    VkDeviceAddress address, VkDeviceSize range) noexcept
+{
+    ENG_ASSERT(type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+    const VkDescriptorAddressInfoEXT addressInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT,
+        .address = address,
+        .range = range,
+        .format = VK_FORMAT_UNDEFINED,
+    };
+
+    VkDescriptorGetInfoEXT info = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+    info.type = type;
+
+    if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+        info.data.pUniformBuffer = &addressInfo;
+    } else {
+        info.data.pStorageBuffer = &addressInfo;
+    }
+
+    WriteDescriptor(layout, set, binding, info);
+}
+
+
+void DescriptorBuffer::WriteImage(const DescriptorBufferLayout& layout, const DescriptorBufferSet& set, uint32_t binding, VkDescriptorType type, 
+    const VkDescriptorImageInfo& info) noexcept
+{
+    VkDescriptorGetInfoEXT getInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+    getInfo.type = type;
+
+    switch (type) {
+        case VK_DESCRIPTOR_TYPE_SAMPLER:
+            getInfo.data.pSampler = &info.sampler;
+            break;
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+            getInfo.data.pCombinedImageSampler = &info;
+            break;
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+            getInfo.data.pSampledImage = &info;
+            break;
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+            getInfo.data.pStorageImage = &info;
+            break;
+        default:
+            ENG_ASSERT_FAIL("unsupported image descriptor type {}", string_VkDescriptorType(type));
+            return;
+    }
+
+    WriteDescriptor(layout, set, binding, getInfo);
+}
+
+
+void DescriptorBuffer::CopySet(const DescriptorBufferLayout& layout, const DescriptorBufferSet& src, const DescriptorBufferSet& dst) noexcept
+{
+    ENG_ASSERT(src.pAllocation != VK_NULL_HANDLE && dst.pAllocation != VK_NULL_HANDLE);
+    
+    // descriptors are plain bytes, no driver call needed
+    memcpy(m_pMappedData + dst.offset, m_pMappedData + src.offset, layout.size);
+}
+
+
+void DescriptorBuffer::Bind(VkCommandBuffer pCmdBuf) const noexcept
+{
+    const VkDescriptorBufferBindingInfoEXT bindingInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+        .address = m_address,
+        .usage = m_usage,
+    };
+
+    vkCmdBindDescriptorBuffersEXT(pCmdBuf, 1, &bindingInfo);
+}
+
+
+void DescriptorBuffer::BindSet(VkCommandBuffer pCmdBuf, VkPipelineBindPoint bindPoint, VkPipelineLayout pPipelineLayout, uint32_t setIndex, 
+    const DescriptorBufferSet& set) const noexcept
+{
+    const uint32_t bufferIndex = 0;
+    vkCmdSetDescriptorBufferOffsetsEXT(pCmdBuf, bindPoint, pPipelineLayout, setIndex, 1, &bufferIndex, &set.offset);
+}
+
+
+size_t DescriptorBuffer::GetDescriptorSize(VkDescriptorType type) const noexcept
+{
+    switch (type) {
+        case VK_DESCRIPTOR_TYPE_SAMPLER:                return m_props.samplerDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: return m_props.combinedImageSamplerDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:          return m_props.sampledImageDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:          return m_props.storageImageDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:         return m_props.uniformBufferDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:         return m_props.storageBufferDescriptorSize;
+        default:
+            ENG_ASSERT_FAIL("unsupported descriptor type {}", string_VkDescriptorType(type));
+            return 0;
+    }
+}
+
+
+void DescriptorBuffer::WriteDescriptor(const DescriptorBufferLayout& layout, const DescriptorBufferSet& set, uint32_t binding, 
+    const VkDescriptorGetInfoEXT& info) noexcept
+{
+    ENG_ASSERT(set.pAllocation != VK_NULL_HANDLE && binding < layout.bindingOffsets.size());
+
+    uint8_t* pDescriptor = m_pMappedData + set.offset + layout.bindingOffsets[binding];
+    vkGetDescriptorEXT(m_pDevice, &info, GetDescriptorSize(info.type), pDescriptor);
+}
@@ -2,24 +2,63 @@
 
 #include "vk_types.h"
 
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 
+class DescriptorLayoutCache;
+class DescriptorUpdateTemplate;
+class DescriptorWriter;
+
+
+// Content of a layout or of a set's writes flattened to words, handles included by value
+using DescriptorKey = std::vector<uint64_t>;
+
+struct DescriptorKeyHash
+{
+    size_t operator()(const DescriptorKey& key) const noexcept;
+};
+
+
 class DescriptorLayoutBuilder final
 {
 public:
     DescriptorLayoutBuilder() = default;
 
-    void AddBinding(uint32_t binding, VkDescriptorType type) noexcept;
+    void AddBinding(uint32_t binding, VkDescriptorType type, uint32_t descriptorCount = 1) noexcept;
     void Clear() noexcept;
 
     VkDescriptorSetLayout Build(VkDevice pDevice, VkShaderStageFlags shaderStages, void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0) noexcept;
+    // Layout owned by the cache, builds with the same bindings share it. pNext chains can't be compared, those use the other overload.
+    VkDescriptorSetLayout Build(VkDevice pDevice, DescriptorLayoutCache& cache, VkShaderStageFlags shaderStages, VkDescriptorSetLayoutCreateFlags flags = 0) noexcept;
 
 private:
     std::vector<VkDescriptorSetLayoutBinding> m_bindings;
 };
 
 
+// Set layouts by content. Pipelines are built on job threads, lookups lock.
+class DescriptorLayoutCache final
+{
+public:
+    DescriptorLayoutCache() = default;
+
+    DescriptorLayoutCache(const DescriptorLayoutCache& other) = delete;
+    DescriptorLayoutCache& operator=(const DescriptorLayoutCache& other) = delete;
+
+    // info must not have a pNext chain or immutable samplers
+    VkDescriptorSetLayout GetLayout(VkDevice pDevice, const VkDescriptorSetLayoutCreateInfo& info) noexcept;
+    void Destroy(VkDevice pDevice) noexcept;
+
+    size_t GetLayoutCount() const noexcept;
+
+private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<DescriptorKey, VkDescriptorSetLayout, DescriptorKeyHash> m_layouts;
+};
+
+
 class DescriptorAllocatorGrowable final
 {
 public:
@@ -32,15 +71,28 @@ public:
 public:
     DescriptorAllocatorGrowable() = default;
 
-    void Init(VkDevice pDevice, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios) noexcept;
+    void Init(VkDevice pDevice, uint32_t maxSets, std::span<const PoolSizeRatio> poolRatios) noexcept;
+    // Cached sets go with the pools
     void ClearPools(VkDevice pDevice) noexcept;
     void DestroyPools(VkDevice pDevice) noexcept;
 
     VkDescriptorSet Allocate(VkDevice pDevice, VkDescriptorSetLayout pLayout, void* pNext = nullptr) noexcept;
+    // Returns the set an earlier call wrote with the same layout and writes, allocates and writes one otherwise.
+    // Cached sets are shared and must not be written again.
+    VkDescriptorSet AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, DescriptorWriter& writer) noexcept;
+    // Same with the descriptors of pData laid out as the template expects
+    VkDescriptorSet AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, const DescriptorUpdateTemplate& updateTemplate, const void* pData) noexcept;
+
+    bool IsInitialized() const noexcept { return m_setsPerPool != 0; }
+    uint64_t GetCacheHitCount() const noexcept { return m_cacheHitCount; }
 
 private:
     VkDescriptorPool GetPool(VkDevice pDevice) noexcept;
-    VkDescriptorPool CreatePool(VkDevice pDevice, uint32_t setsCount, std::span<PoolSizeRatio> poolRatios) noexcept;
+    VkDescriptorPool CreatePool(VkDevice pDevice, uint32_t setsCount, std::span<const PoolSizeRatio> poolRatios) noexcept;
+
+    // m_lookupKey has to hold the key, write fills a newly allocated set
+    template <typename WriteFunc>
+    VkDescriptorSet FindOrAllocate(VkDevice pDevice, VkDescriptorSetLayout pLayout, WriteFunc&& write) noexcept;
 
 private:
     std::vector<PoolSizeRatio> m_ratios;
@@ -48,21 +100,173 @@ private:
     std::vector<VkDescriptorPool> m_fullPools;
     std::vector<VkDescriptorPool> m_readyPools;
     
-    uint32_t m_setsPerPool;
+    uint32_t m_setsPerPool = 0;
+
+    std::unordered_map<DescriptorKey, VkDescriptorSet, DescriptorKeyHash> m_setCache;
+    // lookups reuse it, only new entries allocate their key
+    DescriptorKey m_lookupKey;
+    uint64_t m_cacheHitCount = 0;
+};
+
+
+// One growable allocator per job system thread, each thread allocates from its own without locking.
+// Threads outside the job system share a locked one. Pools of a thread are created on its first allocation,
+// clearing and destroying must not overlap with allocations.
+class DescriptorAllocatorPerThread final
+{
+public:
+    DescriptorAllocatorPerThread() = default;
+
+    DescriptorAllocatorPerThread(const DescriptorAllocatorPerThread& other) = delete;
+    DescriptorAllocatorPerThread& operator=(const DescriptorAllocatorPerThread& other) = delete;
+
+    void Init(uint32_t threadCount, uint32_t maxSetsPerThread, std::span<const DescriptorAllocatorGrowable::PoolSizeRatio> poolRatios) noexcept;
+    void ClearPools(VkDevice pDevice) noexcept;
+    void DestroyPools(VkDevice pDevice) noexcept;
+
+    VkDescriptorSet Allocate(VkDevice pDevice, VkDescriptorSetLayout pLayout, void* pNext = nullptr) noexcept;
+    VkDescriptorSet AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, DescriptorWriter& writer) noexcept;
+    VkDescriptorSet AllocateCached(VkDevice pDevice, VkDescriptorSetLayout pLayout, const DescriptorUpdateTemplate& updateTemplate, const void* pData) noexcept;
+
+private:
+    struct alignas(64) ThreadAllocator
+    {
+        DescriptorAllocatorGrowable allocator;
+    };
+
+private:
+    template <typename Func>
+    VkDescriptorSet AllocateOnThread(VkDevice pDevice, Func&& allocate) noexcept;
+
+private:
+    std::vector<ThreadAllocator> m_threadAllocators;
+
+    std::mutex m_externalMutex;
+    DescriptorAllocatorGrowable m_externalAllocator;
+
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> m_ratios;
+    uint32_t m_maxSetsPerThread = 0;
 };
 
 
 class DescriptorWriter final
 {
 public:
-    void WriteImage(uint32_t binding, VkImageView pImage, VkSampler pSampler, VkImageLayout pLayout, VkDescriptorType type) noexcept;
+    // arrayElement selects the slot of an array binding
+    void WriteImage(uint32_t binding, VkImageView pImage, VkSampler pSampler, VkImageLayout pLayout, VkDescriptorType type, uint32_t arrayElement = 0) noexcept;
     void WriteBuffer(uint32_t binding, VkBuffer pBuffer, size_t size, size_t offset, VkDescriptorType type) noexcept;
 
     void Clear() noexcept;
     void UpdateSet(VkDevice device, VkDescriptorSet set) noexcept;
 
+    // Appends the pending writes to key, equal keys write equal sets
+    void AppendKey(DescriptorKey& key) const noexcept;
+
 private:
     std::deque<VkDescriptorImageInfo> m_imageInfos;
     std::deque<VkDescriptorBufferInfo> m_bufferInfos;
     std::vector<VkWriteDescriptorSet> m_writes;
-};
\ No newline at end of file
+};
+
+
+// Writes every descriptor of a set from one flat struct in a single call, without building write structs.
+// Entries name the offset of their VkDescriptorImageInfo or VkDescriptorBufferInfo in the struct, which is
+// usually a local of the caller. Built once per layout.
+class DescriptorUpdateTemplate final
+{
+public:
+    DescriptorUpdateTemplate() = default;
+
+    void AddImage(uint32_t binding, VkDescriptorType type, size_t offset, uint32_t arrayElement = 0) noexcept;
+    void AddBuffer(uint32_t binding, VkDescriptorType type, size_t offset) noexcept;
+
+    void Build(VkDevice pDevice, VkDescriptorSetLayout pLayout) noexcept;
+    void Destroy(VkDevice pDevice) noexcept;
+
+    void UpdateSet(VkDevice pDevice, VkDescriptorSet pSet, const void* pData) const noexcept;
+    // pData holds one struct per set, stride bytes apart
+    void UpdateSets(VkDevice pDevice, std::span<const VkDescriptorSet> sets, const void* pData, size_t stride) const noexcept;
+
+    // Appends the descriptors of pData to key, equal keys write equal sets
+    void AppendKey(const void* pData, DescriptorKey& key) const noexcept;
+
+    bool IsBuilt() const noexcept { return m_pTemplate != VK_NULL_HANDLE; }
+
+private:
+    std::vector<VkDescriptorUpdateTemplateEntry> m_entries;
+    VkDescriptorUpdateTemplate m_pTemplate = VK_NULL_HANDLE;
+};
+
+
+// Where the bindings of a set layout land inside a descriptor buffer set, queried once per layout
+struct DescriptorBufferLayout
+{
+    VkDescriptorSetLayout pLayout = VK_NULL_HANDLE;
+    // rounded up to the set offset alignment
+    VkDeviceSize size = 0;
+    // indexed by binding
+    std::vector<VkDeviceSize> bindingOffsets;
+};
+
+
+// VK_EXT_descriptor_buffer backend. Sets are ranges of one mapped buffer and descriptors are written straight
+// into them, there are no pools and no vkUpdateDescriptorSets calls. Ranges come from a VMA virtual block and
+// are freed by the caller once the GPU is done with them. Layouts of the sets need
+// VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT, pipelines using them VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT.
+// Engine main thread only (VulkanEngine::IsMainThread), materials are written and frames recorded there.
+class DescriptorBuffer final
+{
+public:
+    DescriptorBuffer() = default;
+
+    DescriptorBuffer(const DescriptorBuffer& other) = delete;
+    DescriptorBuffer& operator=(const DescriptorBuffer& other) = delete;
+
+    // buffer has to be mapped and created with usage, which holds the descriptor buffer and device address usages.
+    // It stays owned by the caller.
+    void Init(VkDevice pDevice, VkPhysicalDevice pPhysDevice, const BufferHandle& buffer, VkBufferUsageFlags usage) noexcept;
+    // Frees every range
+    void Terminate() noexcept;
+
+    DescriptorBufferLayout GetLayout(VkDescriptorSetLayout pLayout, uint32_t bindingCount) const noexcept;
+
+    // pAllocation is VK_NULL_HANDLE when the buffer is full
+    DescriptorBufferSet Allocate(const DescriptorBufferLayout& layout) noexcept;
+    void Free(VmaVirtualAllocation pAllocation) noexcept;
+
+    void WriteBuffer(const DescriptorBufferLayout& layout, const DescriptorBufferSet& set, uint32_t binding, VkDescriptorType type, 
+        VkDeviceAddress address, VkDeviceSize range) noexcept;
+    void WriteImage(const DescriptorBufferLayout& layout, const DescriptorBufferSet& set, uint32_t binding, VkDescriptorType type, 
+        const VkDescriptorImageInfo& info) noexcept;
+    // Copies the descriptors of src to dst, both sets have layout
+    void CopySet(const DescriptorBufferLayout& layout, const DescriptorBufferSet& src, const DescriptorBufferSet& dst) noexcept;
+
+    // Binds the buffer at index 0 of pCmdBuf, once per command buffer
+    void Bind(VkCommandBuffer pCmdBuf) const noexcept;
+    void BindSet(VkCommandBuffer pCmdBuf, VkPipelineBindPoint bindPoint, VkPipelineLayout pPipelineLayout, uint32_t setIndex, 
+        const DescriptorBufferSet& set) const noexcept;
+
+    size_t GetDescriptorSize(VkDescriptorType type) const noexcept;
+
+    VkDeviceSize GetSize() const noexcept { return m_size; }
+    VkDeviceSize GetUsedSize() const noexcept { return m_usedSize; }
+
+    bool IsInitialized() const noexcept { return m_pBlock != VK_NULL_HANDLE; }
+
+private:
+    void WriteDescriptor(const DescriptorBufferLayout& layout, const DescriptorBufferSet& set, uint32_t binding, 
+        const VkDescriptorGetInfoEXT& info) noexcept;
+
+private:
+    VkDevice m_pDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT m_props = {};
+
+    VmaVirtualBlock m_pBlock = VK_NULL_HANDLE;
+
+    uint8_t* m_pMappedData = nullptr;
+    VkDeviceAddress m_address = 0;
+    VkBufferUsageFlags m_usage = 0;
+
+    VkDeviceSize m_size = 0;
+    VkDeviceSize m_usedSize = 0;
+};
@@ -8,6 +8,12 @@
 #include "vk_pipelines.h"
 #include "vk_images.h"
 #include "vk_loader.h"
+#include "vk_upload_batch.h"
+
+#include "texture_format.h"
+
+#include "job_system.h"
+#include "radix_sort.h"
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
@@ -28,16 +34,24 @@
     constexpr bool cfg_UseValidationLayers = false;
 #endif
 
-static const std::filesystem::path ENG_GRADIENT_CS_PATH = "../shaders/bin/gradient.comp.spv";
-static const std::filesystem::path ENG_SKY_CS_PATH = "../shaders/bin/sky.comp.spv";
-static const std::filesystem::path ENG_COLORED_TRIANGLE_PS_PATH = "../shaders/bin/colored_mesh.frag.spv";
-static const std::filesystem::path ENG_TEX_IMAGE_PS_PATH = "../shaders/bin/tex_image.frag.spv";
-static const std::filesystem::path ENG_COLORED_TRIANGLE_MESH_VS_PATH = "../shaders/bin/colored_mesh.vert.spv";
-static const std::filesystem::path ENG_MESH_VS_PATH = "../shaders/bin/mesh.vert.spv";
-static const std::filesystem::path ENG_MESH_FS_PATH = "../shaders/bin/mesh.frag.spv";
+constexpr bool cfg_PinJobThreads = false;
+
+static const std::filesystem::path ENG_SHADER_ARCHIVE_PATH = "../shaders/bin/shaders.pak";
+
+static constexpr std::string_view ENG_GRADIENT_CS_NAME = "gradient.comp";
+static constexpr std::string_view ENG_SKY_CS_NAME = "sky.comp";
+static constexpr std::string_view ENG_COLORED_TRIANGLE_PS_NAME = "colored_mesh.frag";
+static constexpr std::string_view ENG_TEX_IMAGE_PS_NAME = "tex_image.frag";
+static constexpr std::string_view ENG_COLORED_TRIANGLE_MESH_VS_NAME = "colored_mesh.vert";
+static constexpr std::string_view ENG_MESH_VS_NAME = "mesh.vert";
+static constexpr std::string_view ENG_MESH_FS_NAME = "mesh.frag";
+static constexpr std::string_view ENG_DEPTH_ONLY_VS_NAME = "depth_only.vert";
 
 static const std::filesystem::path ENG_BASIC_GLTF_MESH_PATH = "../assets/basicmesh.glb";
 static const std::filesystem::path ENG_STRUCTURE_GLTF_MESH_PATH = "../assets/structure.glb";
+static const std::filesystem::path ENG_STRUCTURE_SCENE_PATH = "../assets/cooked/structure.vkscene";
+
+static const std::filesystem::path ENG_PIPELINE_CACHE_PATH = "../cache/pipelines.bin";
 
 
 #define ENG_RND_BACKGROUND_VERSION_CLEAR 0
@@ -52,6 +66,59 @@ static const std::filesystem::path ENG_STRUCTURE_GLTF_MESH_PATH = "../assets/str
     }
 
 
+// 64-bit draw sort key, most significant field first:
+//   opaque:      pass:2 | pipeline:8 | material:16 | mesh:14 | depth:24 (front to back)
+//   transparent: pass:2 | depth:24 (back to front) | pipeline:8 | material:16 | mesh:14
+// Opaque draws are grouped by state to minimise binds, transparent ones must blend in depth order.
+// Depth is the distance to the bounds origin, positive floats keep their order when compared as integers.
+static uint64_t BuildDrawSortKey(const RenderObject& obj, const MaterialPipeline* pPipeline, const glm::vec3& cameraPos)
+{
+    const glm::vec3 boundsOrigin = glm::vec3(obj.transform * glm::vec4(obj.bounds.origin, 1.f));
+    const float distance = glm::length(boundsOrigin - cameraPos);
+
+    const uint64_t depth = (std::bit_cast<uint32_t>(distance) >> 7) & 0xFFFFFF;
+
+    const uint64_t pass = static_cast<uint64_t>(obj.pMaterial->passType) & 0x3;
+    const uint64_t pipeline = pPipeline->id & 0xFF;
+    const uint64_t material = obj.pMaterial->id & 0xFFFF;
+    const uint64_t mesh = obj.meshID & 0x3FFF;
+
+    if (obj.pMaterial->passType == MaterialPass::TRANSPARENT) {
+        return (pass << 62) | ((~depth & 0xFFFFFF) << 38) | (pipeline << 30) | (material << 14) | mesh;
+    } else {
+        return (pass << 62) | (pipeline << 54) | (material << 38) | (mesh << 24) | depth;
+    }
+}
+
+
+static const char* GetMemoryCategoryName(MemoryCategory category)
+{
+    switch (category) {
+        case MemoryCategory::MESHES: return "meshes";
+        case MemoryCategory::TEXTURES: return "textures";
+        case MemoryCategory::RENDER_TARGETS: return "render targets";
+        case MemoryCategory::STAGING: return "staging";
+        case MemoryCategory::TRANSIENT: return "transient";
+        case MemoryCategory::UNIFORMS: return "uniforms";
+        default: return "unknown";
+    }
+}
+
+
+// The pre-pass is skipped while its pipeline is still compiling, the packet carries whether it was ready at the cull
+static bool IsDrawnInDepthPrepass(const RenderObject& obj, bool isDepthPrepassReady)
+{
+    return obj.useDepthPrepass && isDepthPrepassReady && obj.pMaterial->pDepthEqualPipeline != nullptr;
+}
+
+
+// Pipeline the object is shaded with in the main geometry pass
+static const MaterialPipeline* GetShadingPipeline(const RenderObject& obj, bool isDepthPrepassReady)
+{
+    return IsDrawnInDepthPrepass(obj, isDepthPrepassReady) ? obj.pMaterial->pDepthEqualPipeline : obj.pMaterial->pPipeline;
+}
+
+
 static bool IsRendObjVisible(const RenderObject& obj, const glm::mat4& viewproj)
 {
     static constexpr std::array corners = {
@@ -88,16 +155,63 @@ static bool IsRendObjVisible(const RenderObject& obj, const glm::mat4& viewproj)
 }
 
 
+// Depth and cull state of the material passes, see MaterialDrawState
+static constexpr std::array MATERIAL_DYNAMIC_STATES = {
+    VK_DYNAMIC_STATE_CULL_MODE,
+    VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+    VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE,
+    VK_DYNAMIC_STATE_DEPTH_COMPARE_OP,
+};
+
+
+// What the material passes set through dynamic state, the geometry pass only records the fields that change.
+// blendEnable is static in the pipelines unless blend dynamic state is supported.
+struct MaterialDrawState
+{
+    VkCullModeFlags cullMode;
+    VkBool32 depthWriteEnable;
+    VkCompareOp depthCompareOp;
+    VkBool32 blendEnable;
+};
+
+
+static constexpr MaterialDrawState DEPTH_PREPASS_DRAW_STATE = { VK_CULL_MODE_NONE, VK_TRUE, VK_COMPARE_OP_GREATER_OR_EQUAL, VK_FALSE };
+static constexpr MaterialDrawState OPAQUE_DRAW_STATE = { VK_CULL_MODE_NONE, VK_TRUE, VK_COMPARE_OP_GREATER_OR_EQUAL, VK_FALSE };
+// depth is already resolved by the pre-pass, only the front-most fragment of every pixel gets shaded
+static constexpr MaterialDrawState DEPTH_EQUAL_DRAW_STATE = { VK_CULL_MODE_NONE, VK_FALSE, VK_COMPARE_OP_EQUAL, VK_FALSE };
+static constexpr MaterialDrawState TRANSPARENT_DRAW_STATE = { VK_CULL_MODE_NONE, VK_FALSE, VK_COMPARE_OP_GREATER_OR_EQUAL, VK_TRUE };
+
+
+// Sets every MaterialFeature constant of mesh.frag, features holds the enabled ones as bits
+static vkutil::PipelineBuilder SpecializeMaterialFeatures(const vkutil::PipelineBuilder& builder, uint32_t features)
+{
+    vkutil::PipelineBuilder specialized = builder;
+
+    for (uint32_t feature = 0; feature < (uint32_t)GLTFMetallic_Roughness::MaterialFeature::COUNT; ++feature) {
+        specialized.SetSpecializationConstant(VK_SHADER_STAGE_FRAGMENT_BIT, feature, (features >> feature) & 1);
+    }
+
+    return specialized;
+}
+
+
 void GLTFMetallic_Roughness::BuildPipelines(VulkanEngine* pEngine)
 {
-    VkShaderModule meshFragShader;
-	if (!vkutil::LoadShaderModule(ENG_MESH_FS_PATH, pEngine->m_pVkDevice, meshFragShader)) {
-		ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_MESH_FS_PATH.string().c_str());
+    ShaderArchive& shaderArchive = pEngine->m_shaderArchive;
+
+    VkShaderModule meshFragShader = shaderArchive.GetModule(pEngine->m_pVkDevice, ENG_MESH_FS_NAME);
+	if (meshFragShader == VK_NULL_HANDLE) {
+		ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_MESH_FS_NAME);
+	}
+
+	VkShaderModule meshVertexShader = shaderArchive.GetModule(pEngine->m_pVkDevice, ENG_MESH_VS_NAME);
+	if (meshVertexShader == VK_NULL_HANDLE) {
+		ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_MESH_VS_NAME);
 	}
 
-	VkShaderModule meshVertexShader;
-	if (!vkutil::LoadShaderModule(ENG_MESH_VS_PATH, pEngine->m_pVkDevice, meshVertexShader)) {
-		ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_MESH_VS_PATH.string().c_str());
+    VkShaderModule depthOnlyVertexShader = shaderArchive.GetModule(pEngine->m_pVkDevice, ENG_DEPTH_ONLY_VS_NAME);
+	if (depthOnlyVertexShader == VK_NULL_HANDLE) {
+		ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_DEPTH_ONLY_VS_NAME);
 	}
 
 	VkPushConstantRange matrixRange = {};
@@ -106,11 +220,26 @@ void GLTFMetallic_Roughness::BuildPipelines(VulkanEngine* pEngine)
 	matrixRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     DescriptorLayoutBuilder layoutBuilder;
-    layoutBuilder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    layoutBuilder.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     layoutBuilder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 	layoutBuilder.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-    descSetLayout = layoutBuilder.Build(pEngine->m_pVkDevice, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    const bool useDescriptorBuffer = pEngine->m_useDescriptorBuffer;
+    const VkDescriptorSetLayoutCreateFlags layoutFlags = useDescriptorBuffer ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+
+    descSetLayout = layoutBuilder.Build(pEngine->m_pVkDevice, pEngine->m_descriptorLayoutCache, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        layoutFlags);
+
+    if (useDescriptorBuffer) {
+        descBufferLayout = pEngine->m_descriptorBuffer.GetLayout(descSetLayout, DESCRIPTOR_BINDING_COUNT);
+    } else {
+        descTemplate.AddBuffer(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(DescriptorData, constants));
+        descTemplate.AddImage(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(DescriptorData, colorImage));
+        descTemplate.AddImage(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(DescriptorData, metalRoughImage));
+        descTemplate.Build(pEngine->m_pVkDevice, descSetLayout);
+    }
+
+    const VkPipelineCreateFlags pipelineFlags = useDescriptorBuffer ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
 
 	VkDescriptorSetLayout layouts[] = { pEngine->m_pSceneDataDescriptorLayout, descSetLayout };
 
@@ -123,84 +252,304 @@ void GLTFMetallic_Roughness::BuildPipelines(VulkanEngine* pEngine)
 	VkPipelineLayout newLayout;
 	ENG_VK_CHECK(vkCreatePipelineLayout(pEngine->m_pVkDevice, &meshLayoutInfo, nullptr, &newLayout));
 
-    opaquePipeline.layout = newLayout;
-    transparentPipeline.layout = newLayout;
-
-	vkutil::PipelineBuilder pipelineBuilder;
-	pipelineBuilder.SetShaders(meshVertexShader, meshFragShader);
-	pipelineBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipelineBuilder.SetPolygonMode(VK_POLYGON_MODE_FILL);
-	pipelineBuilder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-	pipelineBuilder.DisableMultisampling();
-	pipelineBuilder.DisableBlending();
-	pipelineBuilder.SetDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
-	pipelineBuilder.SetColorAttachmentFormat(pEngine->m_rndImage.format);
-	pipelineBuilder.SetDepthAttachmentFormat(pEngine->m_depthImage.format);
-	pipelineBuilder.m_pipelineLayout = newLayout;
-
-    opaquePipeline.pipeline = pipelineBuilder.Build(pEngine->m_pVkDevice);
+	opaqueBuilder.SetShaders(meshVertexShader, meshFragShader);
+	opaqueBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	opaqueBuilder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+	opaqueBuilder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	opaqueBuilder.DisableMultisampling();
+	opaqueBuilder.DisableBlending();
+	opaqueBuilder.SetDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	opaqueBuilder.SetColorAttachmentFormat(pEngine->m_rndImage.format);
+	opaqueBuilder.SetDepthAttachmentFormat(pEngine->m_depthImage.format);
+	opaqueBuilder.m_pipelineLayout = newLayout;
+	opaqueBuilder.SetFlags(pipelineFlags);
+
+    // RenderGeometry sets them per draw, the opaque, depth-equal and transparent permutations collapse into one pipeline
+    for (VkDynamicState state : MATERIAL_DYNAMIC_STATES) {
+        opaqueBuilder.AddDynamicState(state);
+    }
 
-	pipelineBuilder.SetAdditiveBlending();
+    if (pEngine->m_isBlendDynamicStateSupported) {
+        opaqueBuilder.AddDynamicState(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT);
+        opaqueBuilder.AddDynamicState(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT);
+    }
 
-	pipelineBuilder.SetDepthTest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+    // depth is already resolved by the pre-pass, only the front-most fragment of every pixel gets shaded
+    depthEqualBuilder = opaqueBuilder;
+    depthEqualBuilder.SetDepthTest(false, VK_COMPARE_OP_EQUAL);
+
+    transparentBuilder = opaqueBuilder;
+	transparentBuilder.SetAdditiveBlending();
+	transparentBuilder.SetDepthTest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+    PipelinePermutationCache& permutations = pEngine->m_pipelinePermutations;
+
+    // built up front, it is the fallback the permutations draw with until their own pipelines are compiled
+    const vkutil::PipelineBuilder defaultBuilder = SpecializeMaterialFeatures(opaqueBuilder, 0);
+    pDefaultPipeline = permutations.AddPipeline(defaultBuilder, defaultBuilder.Build(pEngine->m_pVkDevice, pEngine->m_pVkPipelineCache));
+
+    vkutil::PipelineBuilder depthPrepassBuilder;
+	depthPrepassBuilder.SetVertexShader(depthOnlyVertexShader);
+	depthPrepassBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	depthPrepassBuilder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+	depthPrepassBuilder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	depthPrepassBuilder.DisableMultisampling();
+	depthPrepassBuilder.DisableBlending();
+	depthPrepassBuilder.SetDepthTest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	depthPrepassBuilder.SetDepthAttachmentFormat(pEngine->m_depthImage.format);
+	depthPrepassBuilder.m_pipelineLayout = newLayout;
+	depthPrepassBuilder.SetFlags(pipelineFlags);
+
+    for (VkDynamicState state : MATERIAL_DYNAMIC_STATES) {
+        depthPrepassBuilder.AddDynamicState(state);
+    }
 
-	transparentPipeline.pipeline = pipelineBuilder.Build(pEngine->m_pVkDevice);
-	
-	vkDestroyShaderModule(pEngine->m_pVkDevice, meshFragShader, nullptr);
-	vkDestroyShaderModule(pEngine->m_pVkDevice, meshVertexShader, nullptr);
+    // no fallback, the pre-pass is off until it is ready
+    pDepthPrepassPipeline = permutations.GetPipeline(depthPrepassBuilder, VK_NULL_HANDLE);
 }
 
 
 void GLTFMetallic_Roughness::ClearResources(VkDevice device)
 {
-    vkDestroyDescriptorSetLayout(device, descSetLayout, nullptr);
-	vkDestroyPipelineLayout(device, transparentPipeline.layout, nullptr);
+    // the pipelines belong to VulkanEngine::m_pipelinePermutations
+    descTemplate.Destroy(device);
+	vkDestroyPipelineLayout(device, opaqueBuilder.m_pipelineLayout, nullptr);
+}
 
-	vkDestroyPipeline(device, transparentPipeline.pipeline, nullptr);
-	vkDestroyPipeline(device, opaquePipeline.pipeline, nullptr);
+
+MaterialPipeline* GLTFMetallic_Roughness::GetPermutation(VulkanEngine& engine, const vkutil::PipelineBuilder& builder, uint32_t features) const noexcept
+{
+    return engine.m_pipelinePermutations.GetPipeline(SpecializeMaterialFeatures(builder, features), pDefaultPipeline->pipeline);
 }
 
 
-MaterialInstance GLTFMetallic_Roughness::WriteMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator)
+std::optional<MaterialInstance> GLTFMetallic_Roughness::WriteMaterial(VulkanEngine& engine, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator)
 {
     MaterialInstance matData = {};
 	matData.passType = pass;
-    matData.pPipeline = pass == MaterialPass::TRANSPARENT ? &transparentPipeline : &opaquePipeline;
-	matData.descriptorSet = descriptorAllocator.Allocate(device, descSetLayout);
+    matData.id = nextMaterialID++;
+    matData.constantsIndex = resources.constantsIndex;
+
+    uint32_t features = 0;
+
+    // the white image stands in for missing textures, sampling it changes nothing
+    if (resources.colorImage != engine.m_whiteImage) {
+        features |= 1u << (uint32_t)MaterialFeature::COLOR_TEXTURE;
+    }
+
+    if (resources.useAlphaTest) {
+        features |= 1u << (uint32_t)MaterialFeature::ALPHA_TEST;
+    }
+
+    if (pass == MaterialPass::TRANSPARENT) {
+        matData.pPipeline = GetPermutation(engine, transparentBuilder, features);
+    } else {
+        matData.pPipeline = GetPermutation(engine, opaqueBuilder, features);
+
+        // the pre-pass writes depth without running the fragment shader, discarded fragments would occlude
+        if (!resources.useAlphaTest) {
+            matData.pDepthEqualPipeline = GetPermutation(engine, depthEqualBuilder, features);
+        }
+    }
+
+    if (engine.m_useDescriptorBuffer) {
+        // every material owns its range, the owner of the material frees it
+        matData.descriptorBufferSet = engine.m_descriptorBuffer.Allocate(descBufferLayout);
+
+        // a full buffer hands out offset 0, writing there would overwrite the descriptors of another material
+        if (matData.descriptorBufferSet.pAllocation == VK_NULL_HANDLE) {
+            return std::nullopt;
+        }
+
+        WriteDescriptorBufferSet(engine, matData.descriptorBufferSet, resources);
 
-	descWriter.Clear();
-	descWriter.WriteBuffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	descWriter.WriteImage(1, resources.colorImage.pImageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	descWriter.WriteImage(2, resources.metalRoughImage.pImageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        return matData;
+    }
+
+    const DescriptorData descriptorData = GetDescriptorData(engine, resources);
 
-	descWriter.UpdateSet(device, matData.descriptorSet);
+	// the set doesn't depend on the constants index, materials of a scene with the same textures share it
+	matData.descriptorSet = descriptorAllocator.AllocateCached(engine.m_pVkDevice, descSetLayout, descTemplate, &descriptorData);
 
 	return matData;
 }
 
 
-void MeshNode::Render(const glm::mat4& topMatrix, RenderContext& ctx)
+void GLTFMetallic_Roughness::WriteDescriptorBufferSet(VulkanEngine& engine, const DescriptorBufferSet& set, const MaterialResources& resources) noexcept
+{
+    DescriptorBuffer& descBuffer = engine.m_descriptorBuffer;
+    const DescriptorData descriptorData = GetDescriptorData(engine, resources);
+
+    const VkDeviceAddress constantsAddress = engine.GetBuffer(resources.dataBuffer).deviceAddress;
+
+    descBuffer.WriteBuffer(descBufferLayout, set, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, constantsAddress, resources.dataBufferSize);
+    descBuffer.WriteImage(descBufferLayout, set, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptorData.colorImage);
+    descBuffer.WriteImage(descBufferLayout, set, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptorData.metalRoughImage);
+}
+
+
+GLTFMetallic_Roughness::DescriptorData GLTFMetallic_Roughness::GetDescriptorData(const VulkanEngine& engine, const MaterialResources& resources) const noexcept
+{
+    DescriptorData data = {};
+    data.constants = { engine.GetBuffer(resources.dataBuffer).pBuffer, 0, resources.dataBufferSize };
+    data.colorImage = { resources.colorSampler, engine.GetImage(resources.colorImage).pImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    data.metalRoughImage = { resources.metalRoughSampler, engine.GetImage(resources.metalRoughImage).pImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+    return data;
+}
+
+
+RenderObjectID RenderContext::AddObject(const RenderObject& obj) noexcept
+{
+    RenderObjectID id = INVALID_RENDER_OBJECT_ID;
+
+    if (!m_freeIDs.empty()) {
+        id = m_freeIDs.back();
+        m_freeIDs.pop_back();
+    } else {
+        id = static_cast<RenderObjectID>(m_objectIndices.size());
+        m_objectIndices.push_back(UINT32_MAX);
+    }
+
+    m_objectIndices[id] = static_cast<uint32_t>(m_objects.size());
+    
+    m_objects.push_back(obj);
+    m_objectIDs.push_back(id);
+
+    return id;
+}
+
+
+void RenderContext::RemoveObject(RenderObjectID id) noexcept
+{
+    ENG_ASSERT(id < m_objectIndices.size() && m_objectIndices[id] != UINT32_MAX);
+
+    const uint32_t index = m_objectIndices[id];
+    const uint32_t lastIndex = static_cast<uint32_t>(m_objects.size() - 1);
+
+    if (index != lastIndex) {
+        m_objects[index] = m_objects[lastIndex];
+        m_objectIDs[index] = m_objectIDs[lastIndex];
+        m_objectIndices[m_objectIDs[index]] = index;
+    }
+
+    m_objects.pop_back();
+    m_objectIDs.pop_back();
+
+    m_objectIndices[id] = UINT32_MAX;
+    m_freeIDs.push_back(id);
+}
+
+
+void RenderContext::SetObjectTransform(RenderObjectID id, const glm::mat4& transform) noexcept
+{
+    GetObject(id).transform = transform;
+}
+
+
+void RenderContext::SetObjectMaterial(RenderObjectID id, MaterialInstance* pMaterial) noexcept
+{
+    GetObject(id).pMaterial = pMaterial;
+}
+
+
+void RenderContext::SetObjectDepthPrepass(RenderObjectID id, bool useDepthPrepass) noexcept
+{
+    GetObject(id).useDepthPrepass = useDepthPrepass;
+}
+
+
+void RenderContext::Clear() noexcept
+{
+    m_objects.clear();
+    m_objectIDs.clear();
+    m_objectIndices.clear();
+    m_freeIDs.clear();
+}
+
+
+RenderObject& RenderContext::GetObject(RenderObjectID id) noexcept
+{
+    ENG_ASSERT(id < m_objectIndices.size() && m_objectIndices[id] != UINT32_MAX);
+    return m_objects[m_objectIndices[id]];
+}
+
+
+void MeshNode::RefreshTransform(const glm::mat4& parentTrs)
+{
+    Node::RefreshTransform(parentTrs);
+
+    if (pDrawCtx == nullptr) {
+        return;
+    }
+
+    for (RenderObjectID id : drawIDs) {
+        pDrawCtx->SetObjectTransform(id, worldTrs);
+    }
+}
+
+
+void MeshNode::RegisterDraws(RenderContext& ctx)
 {
-    glm::mat4 nodeMatrix = topMatrix * worldTrs;
+    ENG_ASSERT(pDrawCtx == nullptr);
+
+    pDrawCtx = &ctx;
+    drawIDs.reserve(pMesh->surfaces.size());
 
 	for (GeoSurface& surface : pMesh->surfaces) {
 		RenderObject def = {};
 		def.indexCount = surface.count;
 		def.firstIndex = surface.startIndex;
-		def.indexBuffer = pMesh->meshBuffers.idxBuff.pBuffer;
+		def.indexBuffer = pMesh->meshBuffers.idxBuff;
+		def.vertexBuffer = pMesh->meshBuffers.vertBuff;
 		def.pMaterial = &surface.material->data;
+        def.meshID = pMesh->id;
         def.bounds = surface.bounds;
-		def.transform = nodeMatrix;
-		def.vertexBufferAddress = pMesh->meshBuffers.vertBufferGpuAddress;
+		def.transform = worldTrs;
         
-        if (def.pMaterial->passType == MaterialPass::OPAQUE) {
-            ctx.opaqueSurfaces.push_back(def);
-        } else {
-            ctx.transparentSurfaces.push_back(def);
-        }
+        drawIDs.push_back(ctx.AddObject(def));
 	}
 
-	Node::Render(topMatrix, ctx);
+	Node::RegisterDraws(ctx);
+}
+
+
+void MeshNode::UnregisterDraws(RenderContext& ctx)
+{
+    ENG_ASSERT(pDrawCtx == &ctx);
+
+    for (RenderObjectID id : drawIDs) {
+        ctx.RemoveObject(id);
+    }
+
+    drawIDs.clear();
+    pDrawCtx = nullptr;
+
+    Node::UnregisterDraws(ctx);
+}
+
+
+void MeshNode::ForEachDraw(const std::function<void(RenderObjectID)>& func)
+{
+    for (RenderObjectID id : drawIDs) {
+        func(id);
+    }
+
+    Node::ForEachDraw(func);
+}
+
+
+void MeshNode::SetSurfaceMaterial(size_t surfaceIdx, std::shared_ptr<GLTFMaterial> pMaterial) noexcept
+{
+    ENG_ASSERT(surfaceIdx < pMesh->surfaces.size() && pMaterial != nullptr);
+
+    // RegisterDraws builds the records from the surface, it has to hold the material as well
+    GeoSurface& surface = pMesh->surfaces[surfaceIdx];
+    surface.material = std::move(pMaterial);
+
+    if (pDrawCtx != nullptr) {
+        pDrawCtx->SetObjectMaterial(drawIDs[surfaceIdx], &surface.material->data);
+    }
 }
 
 
@@ -217,60 +566,149 @@ void VulkanEngine::Init() noexcept
         return;
     }
 
-    ENG_CHECK_SDL_ERROR(SDL_Init(SDL_INIT_VIDEO) == 0);
+    m_startupTimeline.Reset();
+    m_mainThreadID = std::this_thread::get_id();
+
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "job system");
+        JobSystem::GetInstance().Init(0, cfg_PinJobThreads);
+    }
 
-    const SDL_WindowFlags windowFlags = static_cast<SDL_WindowFlags>(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+    JobSystem& jobSystem = JobSystem::GetInstance();
 
-    m_pWindow = SDL_CreateWindow("Vulkan Engine", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 
-        m_windowExtent.width, m_windowExtent.height, windowFlags);
-    ENG_CHECK_SDL_ERROR(m_pWindow);
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "window");
 
-    if (!InitVulkan()) {
-        ENG_ASSERT_FAIL("Failed to init Vulkan");
-        return;
+        ENG_CHECK_SDL_ERROR(SDL_Init(SDL_INIT_VIDEO) == 0);
+
+        const SDL_WindowFlags windowFlags = static_cast<SDL_WindowFlags>(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+
+        m_pWindow = SDL_CreateWindow("Vulkan Engine", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 
+            m_windowExtent.width, m_windowExtent.height, windowFlags);
+        ENG_CHECK_SDL_ERROR(m_pWindow);
     }
 
-    if (!InitSwapChain()) {
-        ENG_ASSERT_FAIL("Failed to init swapchain");
-        return;
+    // The glTF scene loads asynchronously: parsing and image decoding don't need the device, so they overlap
+    // with the whole device setup, and the scene shows up at a frame boundary once its uploads are done.
+    // Pipelines are built on a job thread while ImGui and the default textures are created on this one,
+    // all queue submissions stay on this thread.
+    JobSystem::Counter pipelinesCounter;
+    bool arePipelinesReady = false;
+
+    // the pipelines job writes to the local above and the scene load would upload into a device
+    // that failed to initialize, both have to be stopped on every exit path
+    auto WaitStartupJobs = [&]() {
+        jobSystem.Wait(pipelinesCounter);
+
+        for (std::shared_ptr<SceneLoadState>& pLoad : m_sceneLoads) {
+            pLoad->Cancel();
+        }
+    };
+
+    // both go through the async loader, the cooked one only maps its file in the background instead of parsing
+    const bool useCookedScene = std::filesystem::exists(ENG_STRUCTURE_SCENE_PATH);
+
+    StartSceneLoad("structure", useCookedScene ? ENG_STRUCTURE_SCENE_PATH : ENG_STRUCTURE_GLTF_MESH_PATH);
+
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "vulkan");
+
+        if (!InitVulkan()) {
+            ENG_ASSERT_FAIL("Failed to init Vulkan");
+            WaitStartupJobs();
+            return;
+        }
     }
 
-    if (!InitCommands()) {
-        ENG_ASSERT_FAIL("Failed to init commands");
-        return;
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "swapchain");
+
+        if (!InitSwapChain()) {
+            ENG_ASSERT_FAIL("Failed to init swapchain");
+            WaitStartupJobs();
+            return;
+        }
     }
 
-    if (!InitSyncStructures()) {
-        ENG_ASSERT_FAIL("Failed to init sync structures");
-        return;
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "commands and sync");
+
+        if (!InitCommands()) {
+            ENG_ASSERT_FAIL("Failed to init commands");
+            WaitStartupJobs();
+            return;
+        }
+
+        if (!InitSyncStructures()) {
+            ENG_ASSERT_FAIL("Failed to init sync structures");
+            WaitStartupJobs();
+            return;
+        }
     }
 
-    if (!InitDescriptors()) {
-        ENG_ASSERT_FAIL("Failed to init descriptors");
-        return;
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "descriptors");
+
+        if (!InitDescriptors()) {
+            ENG_ASSERT_FAIL("Failed to init descriptors");
+            WaitStartupJobs();
+            return;
+        }
     }
 
-    if (!InitPipelines()) {
-        ENG_ASSERT_FAIL("Failed to init pipelines");
-        return;
+    {
+        // ImGui and the pipelines both create pipelines through the cache
+        ScopedTimelineEvent event(m_startupTimeline, "pipeline cache");
+        InitPipelineCache();
+    }
+
+    jobSystem.Schedule([this, &arePipelinesReady]() {
+        ScopedTimelineEvent event(m_startupTimeline, "pipelines");
+        arePipelinesReady = InitPipelines();
+    }, &pipelinesCounter);
+
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "imgui");
+
+        if (!InitImGui()) {
+            ENG_ASSERT_FAIL("Failed to init ImGui");
+            WaitStartupJobs();
+            return;
+        }
+    }
+
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "default data");
+        InitDefaultData();
     }
 
-    if (!InitImGui()) {
-        ENG_ASSERT_FAIL("Failed to init ImGui");
+    {
+        ScopedTimelineEvent event(m_startupTimeline, "pipelines wait");
+        jobSystem.Wait(pipelinesCounter);
+    }
+
+    if (!arePipelinesReady) {
+        ENG_ASSERT_FAIL("Failed to init pipelines");
+        WaitStartupJobs();
         return;
     }
 
-    InitDefaultData();
+    {
+        // the material descriptor layout is created with the pipelines
+        ScopedTimelineEvent event(m_startupTimeline, "default material");
+        InitDefaultMaterial();
+    }
 
     m_mainCamera.velocity = glm::vec3(0.f);
 	m_mainCamera.position = glm::vec3(30.f, 0.f, -85.f);
     m_mainCamera.pitch = 0.f;
     m_mainCamera.yaw = 0.f;
+    m_cameraSpeed.store(m_mainCamera.speed, std::memory_order_relaxed);
 
-    auto structureFile = LoadGLTF(this, ENG_STRUCTURE_GLTF_MESH_PATH);
-    ENG_ASSERT(structureFile.has_value());
+    const char* pPipelineCacheState = !m_usePipelineCache ? "disabled" : (m_isPipelineCacheLoaded ? "warm" : "cold");
 
-    m_loadedScenes["structure"] = structureFile.value();
+    fmt::print("Startup: {:.2f} ms, pipelines: {:.2f} ms (pipeline cache {})\n", 
+        m_startupTimeline.GetElapsedMs(), m_startupTimeline.GetEventMs("pipelines"), pPipelineCacheState);
 
     m_isInitialized = true;
 }
@@ -282,13 +720,28 @@ void VulkanEngine::Terminate() noexcept
         return;
     }
 
+    // loads in flight use the device and the job system, cancel them and let them run out.
+    for (std::shared_ptr<SceneLoadState>& pLoad : m_sceneLoads) {
+        pLoad->Cancel();
+    }
+
+    WaitSceneLoads();
+
     vkDeviceWaitIdle(m_pVkDevice);
 
+    // retires submissions nobody waits on
+    PumpAsyncWork();
+
     m_loadedScenes.clear();
+    m_mainDrawContext.Clear();
 
     for (size_t i = 0; i < FRAMES_DATA_INST_COUNT; ++i) {
         vkDestroyCommandPool(m_pVkDevice, m_framesData[i].pVkCmdPool, nullptr);
 
+        if (m_isTimestampSupported) {
+            vkDestroyQueryPool(m_pVkDevice, m_framesData[i].pVkTimestampQueryPool, nullptr);
+        }
+
         vkDestroyFence(m_pVkDevice, m_framesData[i].pVkRenderFence, nullptr);
 		vkDestroySemaphore(m_pVkDevice, m_framesData[i].pVkRenderSemaphore, nullptr);
 		vkDestroySemaphore(m_pVkDevice ,m_framesData[i].pVkSwapChainSemaphore, nullptr);
@@ -296,10 +749,26 @@ void VulkanEngine::Terminate() noexcept
         m_framesData[i].deletionQueue.Flush();
     }
 
+    m_deferredDestroys.FlushAll(*this);
+
+    m_pipelineCompiler.Terminate();
+    m_pipelinePermutations.Terminate();
+    m_textureStreamer.Terminate();
     m_metalRoughMaterial.ClearResources(m_pVkDevice);
 
+    m_shaderArchive.Close(m_pVkDevice);
+
     m_mainDeletionQueue.Flush();
 
+    if (m_pVkPipelineCache != VK_NULL_HANDLE) {
+        if (!vkutil::SavePipelineCache(m_pVkDevice, m_pVkPipelineCache, m_vkPhysDeviceProps, ENG_PIPELINE_CACHE_PATH)) {
+            fmt::print("Failed to save pipeline cache to {}\n", ENG_PIPELINE_CACHE_PATH.string());
+        }
+
+        vkDestroyPipelineCache(m_pVkDevice, m_pVkPipelineCache, nullptr);
+        m_pVkPipelineCache = VK_NULL_HANDLE;
+    }
+
     DestroySwapChain();
 
     vkDestroySurfaceKHR(m_pVkInstance, m_pVkSurface, nullptr);
@@ -310,6 +779,8 @@ void VulkanEngine::Terminate() noexcept
 
     SDL_DestroyWindow(m_pWindow);
 
+    JobSystem::GetInstance().Terminate();
+
     m_isInitialized = false;
 }
 
@@ -318,104 +789,480 @@ void VulkanEngine::Run() noexcept
 {
     ENG_ASSERT(IsInitialized());
 
-    bool isQuit = false;
-    
-    SDL_Event event;
-    while (!isQuit) {
-        auto startTime = std::chrono::system_clock::now();
-
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT:
-                    isQuit = true;
-                    break;
-
-                case SDL_WINDOWEVENT:
-                    if (event.window.event == SDL_WINDOWEVENT_MINIMIZED) {
-                        m_needRender = false;
-                    } else if (event.window.event == SDL_WINDOWEVENT_RESTORED) {
-                        m_needRender = true;
-                    }
-                    break;
-                case SDL_KEYDOWN:
-                    if (event.key.keysym.sym == SDLK_F5) {
-                        m_isFlyCameraMode = !m_isFlyCameraMode;
-                        SDL_SetRelativeMouseMode(m_isFlyCameraMode ? SDL_TRUE : SDL_FALSE);
-                    }
-                    break;
-
-                default:
-                    break;
-            }
+    m_framePackets.Reset();
 
-            if (m_isFlyCameraMode) {
-                m_mainCamera.ProcessSDLEvent(event);
-            }
-            ImGui_ImplSDL2_ProcessEvent(&event);
-        }
+    // SDL wants its events on the thread that created the window, so this one simulates. The render thread
+    // takes over the main thread role of the engine: async work, scene changes and everything else main thread only.
+    std::thread renderThread([this]() { RunRenderThread(); });
 
+    while (PollEvents()) {
         if (!m_needRender) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             continue;
         }
 
-        if (m_needResizeSwapChain) {
-            ResizeSwapChain();
-        }
+        Simulate(m_framePackets.GetBack());
+        m_framePackets.Publish();
 
-        ImGui_ImplVulkan_NewFrame();
-        ImGui_ImplSDL2_NewFrame();
-        
-        ImGui::NewFrame();
-        RenderDbgUI();
-        ImGui::Render();
+        // one packet ahead at most: the next one is simulated while the render thread records this one
+        m_framePackets.WaitConsumed();
+    }
 
-        Render();
+    m_framePackets.Close();
+    renderThread.join();
 
-        auto endTime = std::chrono::system_clock::now();
-        auto elapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
-        m_stats.frameTime = elapsedTime.count() / 1000.f;
-    }
+    m_mainThreadID = std::this_thread::get_id();
 }
 
 
-VulkanEngine::~VulkanEngine()
+void VulkanEngine::RunRenderThread() noexcept
 {
-    Terminate();
+    // set before the first packet, nothing main thread only runs on the simulation thread meanwhile
+    m_mainThreadID = std::this_thread::get_id();
+
+    while (m_framePackets.WaitPublished()) {
+        m_framePackets.Acquire();
+        RenderFrame(m_framePackets.GetFront());
+    }
 }
 
 
-void VulkanEngine::Render() noexcept
+void VulkanEngine::RunBenchmark() noexcept
 {
-    UpdateScene();
+    ENG_ASSERT(IsInitialized());
 
-    FrameData& currFrameData = GetCurrentFrameData();
+    constexpr uint32_t warmupFrameCount = 30;
+    constexpr uint32_t measuredFrameCount = 300;
 
-    constexpr uint64_t waitRenderFenceTimeoutNs = 1'000'000'000;
+    JobSystem& jobSystem = JobSystem::GetInstance();
+    const uint32_t maxThreadCount = jobSystem.GetThreadCount();
 
-    ENG_VK_CHECK(vkWaitForFences(m_pVkDevice, 1, &currFrameData.pVkRenderFence, true, waitRenderFenceTimeoutNs));
-	
-    currFrameData.deletionQueue.Flush();
-    currFrameData.descriptorAllocator.ClearPools(m_pVkDevice);
+    WaitSceneLoads();
 
-    constexpr uint64_t acquireNextSwapChainImageTimeoutNs = 1'000'000'000;
+    fmt::print("Benchmark: {} objects, {} frames per step\n", m_mainDrawContext.GetObjectCount(), measuredFrameCount);
+    fmt::print("{:>8} {:>12} {:>12} {:>12} {:>12} {:>12} {:>12}\n", "threads", "frame ms", "update ms", "cull ms", "sort ms", "draw ms", "gpu geom ms");
 
-    uint32_t swapChainImageIndex;
-    VkResult acquireResult = vkAcquireNextImageKHR(m_pVkDevice, m_pVkSwapChain, acquireNextSwapChainImageTimeoutNs,
-        currFrameData.pVkSwapChainSemaphore, VK_NULL_HANDLE, &swapChainImageIndex);
-        
-    if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
-        m_needResizeSwapChain = true;
-        return;
-    }
+    for (uint32_t threadCount = 1; threadCount <= maxThreadCount; ++threadCount) {
+        jobSystem.SetActiveThreadCount(threadCount);
 
-    VkCommandBuffer pCmdBuf = currFrameData.pVkCmdBuffer;
-        
-    ENG_VK_CHECK(vkResetFences(m_pVkDevice, 1, &currFrameData.pVkRenderFence));
-    ENG_VK_CHECK(vkResetCommandBuffer(pCmdBuf, 0));
+        EngineStats total = {};
 
-    m_rndExtent.width  = std::min(m_swapChainExtent.width, m_rndImage.extent.width) * m_dynResScale;
-    m_rndExtent.height = std::min(m_swapChainExtent.height, m_rndImage.extent.height) * m_dynResScale;
+        for (uint32_t frame = 0; frame < warmupFrameCount + measuredFrameCount; ++frame) {
+            if (!PollEvents()) {
+                jobSystem.SetActiveThreadCount(maxThreadCount);
+                return;
+            }
+
+            RunFrame();
+
+            if (frame >= warmupFrameCount) {
+                // frames run sequentially here, the simulation adds to the render thread's time
+                total.frameTime += m_stats.frameTime + m_stats.simulationTime;
+                total.sceneUpdateTime += m_stats.sceneUpdateTime;
+                total.cullTime += m_stats.cullTime;
+                total.sortTime += m_stats.sortTime;
+                total.meshRenderTime += m_stats.meshRenderTime;
+                total.gpuGeometryTime += m_stats.gpuGeometryTime;
+            }
+        }
+
+        fmt::print("{:>8} {:>12.3f} {:>12.3f} {:>12.3f} {:>12.3f} {:>12.3f} {:>12.3f}\n", threadCount,
+            total.frameTime / measuredFrameCount, total.sceneUpdateTime / measuredFrameCount, total.cullTime / measuredFrameCount,
+            total.sortTime / measuredFrameCount, total.meshRenderTime / measuredFrameCount, total.gpuGeometryTime / measuredFrameCount);
+    }
+
+    jobSystem.SetActiveThreadCount(maxThreadCount);
+
+    PrintMemoryStats();
+}
+
+
+void VulkanEngine::RunLoadBenchmark() noexcept
+{
+    ENG_ASSERT(IsInitialized());
+
+    // the startup load would compete for the job threads
+    WaitSceneLoads();
+
+    constexpr uint32_t loadCount = 10;
+
+    auto MeasureLoad = [](const auto& load) {
+        float totalMs = 0.f;
+
+        for (uint32_t i = 0; i < loadCount; ++i) {
+            auto start = std::chrono::steady_clock::now();
+
+            std::optional<std::shared_ptr<LoadedGLTF>> scene = load();
+
+            auto end = std::chrono::steady_clock::now();
+
+            if (!scene.has_value()) {
+                return -1.f;
+            }
+
+            totalMs += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+        }
+
+        return totalMs / loadCount;
+    };
+
+    JobSystem& jobSystem = JobSystem::GetInstance();
+    const uint32_t activeThreadCount = jobSystem.GetActiveThreadCount();
+
+    fmt::print("Load benchmark: {} loads per format and thread count\n", loadCount);
+    fmt::print("{:>8} {:>12} {:>12}\n", "threads", "gltf ms", "cooked ms");
+
+    // glTF decode and mesh conversion scale with the worker count, the cooked load is mostly a copy
+    for (uint32_t threadCount = 1; threadCount <= jobSystem.GetThreadCount(); ++threadCount) {
+        jobSystem.SetActiveThreadCount(threadCount);
+
+        // the scenes are never registered for drawing, the GPU doesn't use them when they are released
+        const float gltfMs = MeasureLoad([this]() { return LoadGLTF(this, ENG_STRUCTURE_GLTF_MESH_PATH); });
+        const float cookedMs = MeasureLoad([this]() { return LoadCookedScene(this, ENG_STRUCTURE_SCENE_PATH); });
+
+        fmt::print("{:>8} {:>12.3f} {:>12.3f}\n", threadCount, gltfMs, cookedMs);
+    }
+
+    jobSystem.SetActiveThreadCount(activeThreadCount);
+}
+
+
+void VulkanEngine::RunMaterialBenchmark() noexcept
+{
+    ENG_ASSERT(IsInitialized());
+
+    // a large scene worth of materials, every set is written even though they bind the same constants buffer
+    constexpr uint32_t materialCount = 10'000;
+    constexpr uint32_t runCount = 10;
+
+    const uint32_t constantsSize = sizeof(GLTFMetallic_Roughness::MaterialConstants) * materialCount;
+
+    const BufferID constants = RegisterBuffer(CreateBuffer(constantsSize, GetShaderBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT), 
+        MemoryCategory::UNIFORMS));
+
+    const std::array sizes = {
+        DescriptorAllocatorGrowable::PoolSizeRatio { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.f },
+        DescriptorAllocatorGrowable::PoolSizeRatio { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.f },
+    };
+
+    DescriptorAllocatorGrowable allocator;
+    allocator.Init(m_pVkDevice, materialCount, sizes);
+
+    GLTFMetallic_Roughness::MaterialResources resources = {};
+    resources.colorImage = m_whiteImage;
+    resources.colorSampler = m_linearSampler;
+    resources.metalRoughImage = m_whiteImage;
+    resources.metalRoughSampler = m_linearSampler;
+    resources.dataBuffer = constants;
+    resources.dataBufferSize = constantsSize;
+
+    // the material's own layout can't be allocated from pools with the descriptor buffer backend, the pool paths
+    // use their own. The cache hands out the material's one otherwise.
+    DescriptorLayoutBuilder layoutBuilder;
+    layoutBuilder.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    layoutBuilder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    layoutBuilder.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+    const VkDescriptorSetLayout pLayout = layoutBuilder.Build(m_pVkDevice, m_descriptorLayoutCache, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+
+    DescriptorUpdateTemplate updateTemplate;
+    updateTemplate.AddBuffer(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(GLTFMetallic_Roughness::DescriptorData, constants));
+    updateTemplate.AddImage(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(GLTFMetallic_Roughness::DescriptorData, colorImage));
+    updateTemplate.AddImage(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(GLTFMetallic_Roughness::DescriptorData, metalRoughImage));
+    updateTemplate.Build(m_pVkDevice, pLayout);
+
+    std::vector<VkDescriptorSet> sets(materialCount);
+    std::vector<GLTFMetallic_Roughness::DescriptorData> descriptorData(materialCount);
+    std::vector<DescriptorBufferSet> bufferSets;
+
+    auto MeasureWrites = [&](const auto& reset, const auto& writeSets) {
+        float totalMs = 0.f;
+
+        for (uint32_t i = 0; i < runCount; ++i) {
+            reset();
+
+            auto start = std::chrono::steady_clock::now();
+            writeSets();
+            auto end = std::chrono::steady_clock::now();
+
+            totalMs += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+        }
+
+        return totalMs / runCount;
+    };
+
+    auto ClearPools = [&]() {
+        allocator.ClearPools(m_pVkDevice);
+    };
+
+    // what WriteMaterial did before the template: write structs built per material, one update call each
+    const float writerMs = MeasureWrites(ClearPools, [&]() {
+        DescriptorWriter writer;
+
+        for (uint32_t i = 0; i < materialCount; ++i) {
+            const VkImageView pView = GetImage(resources.colorImage).pImageView;
+
+            sets[i] = allocator.Allocate(m_pVkDevice, pLayout);
+
+            writer.Clear();
+            writer.WriteBuffer(0, GetBuffer(constants).pBuffer, constantsSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+            writer.WriteImage(1, pView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            writer.WriteImage(2, pView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            writer.UpdateSet(m_pVkDevice, sets[i]);
+        }
+    });
+
+    const float templateMs = MeasureWrites(ClearPools, [&]() {
+        for (uint32_t i = 0; i < materialCount; ++i) {
+            resources.constantsIndex = i;
+
+            descriptorData[i] = m_metalRoughMaterial.GetDescriptorData(*this, resources);
+            sets[i] = allocator.Allocate(m_pVkDevice, pLayout);
+        }
+
+        updateTemplate.UpdateSets(m_pVkDevice, sets, descriptorData.data(), sizeof(GLTFMetallic_Roughness::DescriptorData));
+    });
+
+    const DescriptorBufferLayout& bufferLayout = m_metalRoughMaterial.descBufferLayout;
+
+    // ignores fragmentation, the ranges are all the same size
+    const bool canMeasureDescriptorBuffer = m_useDescriptorBuffer && 
+        m_descriptorBuffer.GetSize() - m_descriptorBuffer.GetUsedSize() >= bufferLayout.size * materialCount;
+
+    auto FreeBufferSets = [&]() {
+        for (const DescriptorBufferSet& set : bufferSets) {
+            m_descriptorBuffer.Free(set.pAllocation);
+        }
+
+        bufferSets.clear();
+    };
+
+    float bufferMs = -1.f;
+    bool isDescriptorBufferFull = false;
+
+    if (canMeasureDescriptorBuffer) {
+        bufferSets.reserve(materialCount);
+
+        bufferMs = MeasureWrites(FreeBufferSets, [&]() {
+            for (uint32_t i = 0; i < materialCount; ++i) {
+                resources.constantsIndex = i;
+
+                const DescriptorBufferSet set = m_descriptorBuffer.Allocate(bufferLayout);
+
+                // fragmentation the size check above ignores, the sets written so far are freed as usual
+                if (set.pAllocation == VK_NULL_HANDLE) {
+                    isDescriptorBufferFull = true;
+                    break;
+                }
+
+                bufferSets.push_back(set);
+                m_metalRoughMaterial.WriteDescriptorBufferSet(*this, set, resources);
+            }
+        });
+    }
+
+    fmt::print("Material benchmark: {} material sets, average of {} runs\n", materialCount, runCount);
+    fmt::print("{:>18} {:>12}\n", "path", "ms");
+    fmt::print("{:>18} {:>12.3f}\n", "write structs", writerMs);
+    fmt::print("{:>18} {:>12.3f}\n", "update template", templateMs);
+
+    if (canMeasureDescriptorBuffer && !isDescriptorBufferFull) {
+        fmt::print("{:>18} {:>12.3f}\n", "descriptor buffer", bufferMs);
+
+        // pool memory is the driver's, it is estimated with the descriptor sizes the buffer reports
+        const size_t descriptorBytes = m_descriptorBuffer.GetDescriptorSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) +
+            2 * m_descriptorBuffer.GetDescriptorSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+        fmt::print("Descriptor memory: buffer {} bytes per set, {:.1f} KB in total; pools reserve {} descriptors, about {:.1f} KB\n",
+            bufferLayout.size, bufferLayout.size * materialCount / 1024.f, 3 * materialCount, descriptorBytes * materialCount / 1024.f);
+    } else if (m_useDescriptorBuffer) {
+        fmt::print("Descriptor buffer skipped, {} sets don't fit in the free part of the buffer\n", materialCount);
+    } else {
+        fmt::print("Descriptor buffer skipped, run with --descriptor-buffer to compare it\n");
+    }
+
+    // the sets were never bound, nothing on the GPU references them or the buffer
+    FreeBufferSets();
+    updateTemplate.Destroy(m_pVkDevice);
+    allocator.DestroyPools(m_pVkDevice);
+    ReleaseBuffer(constants);
+}
+
+
+bool VulkanEngine::PollEvents() noexcept
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                return false;
+
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_MINIMIZED) {
+                    m_needRender = false;
+                } else if (event.window.event == SDL_WINDOWEVENT_RESTORED) {
+                    m_needRender = true;
+                }
+                break;
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_F5) {
+                    m_isFlyCameraMode = !m_isFlyCameraMode;
+                    SDL_SetRelativeMouseMode(m_isFlyCameraMode ? SDL_TRUE : SDL_FALSE);
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        if (m_isFlyCameraMode) {
+            m_mainCamera.ProcessSDLEvent(event);
+        }
+
+        std::lock_guard lock(m_imguiMutex);
+        ImGui_ImplSDL2_ProcessEvent(&event);
+    }
+
+    return true;
+}
+
+
+void VulkanEngine::RunFrame() noexcept
+{
+    Simulate(m_framePackets.GetBack());
+    m_framePackets.Publish();
+
+    m_framePackets.Acquire();
+    RenderFrame(m_framePackets.GetFront());
+}
+
+
+void VulkanEngine::Simulate(FramePacket& packet) noexcept
+{
+    auto start = std::chrono::system_clock::now();
+
+    UpdateScene(packet);
+    CullDraws(packet);
+
+    packet.isFlyCameraMode = m_isFlyCameraMode;
+
+    {
+        // SDL mouse and cursor calls have to run on the window thread, the render thread's NewFrame picks the result up
+        std::lock_guard lock(m_imguiMutex);
+        ImGui_ImplSDL2_NewFrame();
+    }
+
+    auto end = std::chrono::system_clock::now();
+
+    packet.simulationTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+}
+
+
+void VulkanEngine::RenderFrame(const FramePacket& packet) noexcept
+{
+    const uint64_t frameNumber = m_frameNumber;
+    auto startTime = Timeline::Clock::now();
+
+    m_stats.simulationTime = packet.simulationTime;
+    m_stats.sceneUpdateTime = packet.sceneUpdateTime;
+    m_stats.cullTime = packet.cullTime;
+    m_stats.sortTime = packet.sortTime;
+
+    if (m_needResizeSwapChain) {
+        ResizeSwapChain();
+    }
+
+    {
+        // the simulation thread feeds the SDL events in meanwhile
+        std::lock_guard lock(m_imguiMutex);
+
+        ImGui_ImplVulkan_NewFrame();
+
+        ImGui::NewFrame();
+        RenderDbgUI(packet);
+        ImGui::Render();
+    }
+
+    Render(packet);
+
+    auto endTime = Timeline::Clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
+    m_stats.frameTime = elapsedTime.count() / 1000.f;
+
+    // Render doesn't advance the frame number when the swapchain is out of date or the packet is stale, nothing is presented then
+    if (frameNumber == 0 && m_frameNumber == 1) {
+        m_startupTimeline.AddEvent("first frame", startTime, endTime);
+        m_startupTimeline.Print("Startup timeline");
+
+        fmt::print("Time to first frame: {:.2f} ms\n", m_startupTimeline.GetElapsedMs());
+    }
+}
+
+
+VulkanEngine::~VulkanEngine()
+{
+    Terminate();
+}
+
+
+void VulkanEngine::Render(const FramePacket& packet) noexcept
+{
+    // scenes finished loading are added here, the simulation culls them with its next packet
+    PumpAsyncWork();
+
+    // the removed scene's materials are released once the frames in flight are done, not this one
+    if (packet.drawContextVersion != m_drawContextVersion) {
+        return;
+    }
+
+    UpdateMemoryBudget();
+    m_memoryPools.Update(*this);
+
+    // same release rule as in RemoveScene, frames in flight may still bind a replaced pipeline
+    m_pipelineCompiler.PublishCompleted([this](VkPipeline pipeline) {
+        m_deferredDestroys.PushPipeline(GetReleaseRetireFrame(), pipeline);
+    });
+
+    m_isDepthPrepassReady.store(m_metalRoughMaterial.pDepthPrepassPipeline->pipeline != VK_NULL_HANDLE, std::memory_order_release);
+
+    FrameData& currFrameData = GetCurrentFrameData();
+
+    constexpr uint64_t waitRenderFenceTimeoutNs = 1'000'000'000;
+
+    ENG_VK_CHECK(vkWaitForFences(m_pVkDevice, 1, &currFrameData.pVkRenderFence, true, waitRenderFenceTimeoutNs));
+	
+    currFrameData.deletionQueue.Flush();
+    m_deferredDestroys.Flush(*this, m_frameNumber);
+    currFrameData.descriptorAllocator.ClearPools(m_pVkDevice);
+
+    if (currFrameData.hasTimestamps) {
+        // the fence guarantees the queries of the last submit from this frame slot are available
+        std::array<uint64_t, GEOMETRY_TIMESTAMP_COUNT> timestamps = {};
+        ENG_VK_CHECK(vkGetQueryPoolResults(m_pVkDevice, currFrameData.pVkTimestampQueryPool, 0, GEOMETRY_TIMESTAMP_COUNT, 
+            sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+
+        m_stats.gpuDepthPrepassTime = (timestamps[1] - timestamps[0]) * m_timestampPeriodNs / 1'000'000.f;
+        m_stats.gpuGeometryTime = (timestamps[2] - timestamps[0]) * m_timestampPeriodNs / 1'000'000.f;
+    }
+
+    constexpr uint64_t acquireNextSwapChainImageTimeoutNs = 1'000'000'000;
+
+    uint32_t swapChainImageIndex;
+    VkResult acquireResult = vkAcquireNextImageKHR(m_pVkDevice, m_pVkSwapChain, acquireNextSwapChainImageTimeoutNs,
+        currFrameData.pVkSwapChainSemaphore, VK_NULL_HANDLE, &swapChainImageIndex);
+        
+    if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+        m_needResizeSwapChain = true;
+        return;
+    }
+
+    VkCommandBuffer pCmdBuf = currFrameData.pVkCmdBuffer;
+        
+    ENG_VK_CHECK(vkResetFences(m_pVkDevice, 1, &currFrameData.pVkRenderFence));
+    ENG_VK_CHECK(vkResetCommandBuffer(pCmdBuf, 0));
+
+    m_rndExtent.width  = std::min(m_swapChainExtent.width, m_rndImage.extent.width) * m_dynResScale;
+    m_rndExtent.height = std::min(m_swapChainExtent.height, m_rndImage.extent.height) * m_dynResScale;
 
     const VkCommandBufferBeginInfo cmdBuffBeginInfo = vkinit::CmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
     ENG_VK_CHECK(vkBeginCommandBuffer(pCmdBuf, &cmdBuffBeginInfo));
@@ -427,7 +1274,7 @@ void VulkanEngine::Render() noexcept
     vkutil::TransitImage(pCmdBuf, m_rndImage.pImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
     vkutil::TransitImage(pCmdBuf, m_depthImage.pImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-    RenderGeometry(pCmdBuf);
+    RenderGeometry(pCmdBuf, packet);
 
     vkutil::TransitImage(pCmdBuf, m_rndImage.pImage, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
     
@@ -452,6 +1299,8 @@ void VulkanEngine::Render() noexcept
 
 	ENG_VK_CHECK(vkQueueSubmit2(m_pVkGraphicsQueue, 1, &submitInfo2, currFrameData.pVkRenderFence));
 
+    UpdateTextureStreaming(packet);
+
     VkPresentInfoKHR presentInfo = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
@@ -501,84 +1350,140 @@ void VulkanEngine::RenderBackground(VkCommandBuffer pCmdBuf) noexcept
 }
 
 
-void VulkanEngine::RenderGeometry(VkCommandBuffer pCmdBuf) noexcept
+void VulkanEngine::RenderGeometry(VkCommandBuffer pCmdBuf, const FramePacket& packet) noexcept
 {
     m_stats.drawCallCount = 0;
     m_stats.triangleCount = 0;
     
     auto start = std::chrono::system_clock::now();
 
-    VkRenderingAttachmentInfo colorAttachment = vkinit::RenderingAttachmentInfo(m_rndImage.pImageView, std::nullopt, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-    VkRenderingAttachmentInfo depthAttachment = vkinit::DepthAttachmentInfo(m_depthImage.pImageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	BufferHandle gpuSceneDataBuffer = CreateBuffer(sizeof(SceneData), GetShaderBufferUsage(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT), MemoryCategory::UNIFORMS);
 
-	VkRenderingInfo renderInfo = vkinit::RenderingInfo(m_rndExtent, &colorAttachment, &depthAttachment);
-	vkCmdBeginRendering(pCmdBuf, &renderInfo);
+	// freed once this frame is done with it
+	m_deferredDestroys.PushBuffer(GetCurrentRetireFrame(), gpuSceneDataBuffer);
 
-	BufferHandle gpuSceneDataBuffer = CreateBuffer(sizeof(SceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	SceneData* sceneUniformData = (SceneData*)gpuSceneDataBuffer.pAllocation->GetMappedData();
+	*sceneUniformData = packet.sceneData;
 
-	//add it to the deletion queue of this frame so it gets deleted once its been used
-	GetCurrentFrameData().deletionQueue.PushDeletor([=, this]() {
-		BufferHandle buffer = gpuSceneDataBuffer;
-        DestroyBuffer(buffer);
-	});
+    VkDescriptorSet globalDescriptor = VK_NULL_HANDLE;
+    DescriptorBufferSet globalBufferSet = {};
 
-	SceneData* sceneUniformData = (SceneData*)gpuSceneDataBuffer.pAllocation->GetMappedData();
-	*sceneUniformData = m_sceneData;
+    if (m_useDescriptorBuffer) {
+        globalBufferSet = m_descriptorBuffer.Allocate(m_sceneDataBufferLayout);
+
+        // materials took the whole buffer, drawing nothing beats overwriting their descriptors
+        if (globalBufferSet.pAllocation == VK_NULL_HANDLE) {
+            return;
+        }
 
-	//create a descriptor set that binds that buffer and update it
-	VkDescriptorSet globalDescriptor = GetCurrentFrameData().descriptorAllocator.Allocate(m_pVkDevice, m_pSceneDataDescriptorLayout);
+        m_descriptorBuffer.WriteBuffer(m_sceneDataBufferLayout, globalBufferSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 
+            gpuSceneDataBuffer.deviceAddress, sizeof(SceneData));
 
-	DescriptorWriter writer;
-	writer.WriteBuffer(0, gpuSceneDataBuffer.pBuffer, sizeof(SceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.UpdateSet(m_pVkDevice, globalDescriptor);
+        m_deferredDestroys.PushDescriptorRange(GetCurrentRetireFrame(), globalBufferSet.pAllocation);
+
+        // set offsets of all the passes below index into it
+        m_descriptorBuffer.Bind(pCmdBuf);
+    } else {
+        //create a descriptor set that binds that buffer and update it
+        globalDescriptor = GetCurrentFrameData().descriptorAllocator.Allocate(m_pVkDevice, m_pSceneDataDescriptorLayout);
+
+        const VkDescriptorBufferInfo sceneDataInfo = { gpuSceneDataBuffer.pBuffer, 0, sizeof(SceneData) };
+        m_sceneDataTemplate.UpdateSet(m_pVkDevice, globalDescriptor, &sceneDataInfo);
+    }
 
-    MaterialPipeline* pLastPipeline = nullptr;
+    const MaterialPipeline* pLastPipeline = nullptr;
     MaterialInstance* pLastMaterial = nullptr;
-    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    BufferID lastIndexBuffer = {};
 
-    auto Render = [&](const RenderObject& obj) {
-        if (obj.pMaterial != pLastMaterial) {
-            pLastMaterial = obj.pMaterial;
-            
-            if (obj.pMaterial->pPipeline != pLastPipeline) {
-                pLastPipeline = obj.pMaterial->pPipeline;
-
-                vkCmdBindPipeline(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, obj.pMaterial->pPipeline->pipeline);
-                vkCmdBindDescriptorSets(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, obj.pMaterial->pPipeline->layout, 0, 1, 
-                    &globalDescriptor, 0, nullptr);
-
-                VkViewport viewport = {};
-                viewport.x = 0;
-                viewport.y = 0;
-                viewport.width = m_rndExtent.width;
-                viewport.height = m_rndExtent.height;
-                viewport.minDepth = 0.f;
-                viewport.maxDepth = 1.f;
-
-                vkCmdSetViewport(pCmdBuf, 0, 1, &viewport);
-
-                VkRect2D scissor = {};
-                scissor.offset.x = 0;
-                scissor.offset.y = 0;
-                scissor.extent.width = m_rndExtent.width;
-                scissor.extent.height = m_rndExtent.height;
-
-                vkCmdSetScissor(pCmdBuf, 0, 1, &scissor);
-            }
+    auto BindPipeline = [&](const MaterialPipeline* pPipeline) {
+        pLastPipeline = pPipeline;
+
+        vkCmdBindPipeline(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPipeline->pipeline);
+
+        if (m_useDescriptorBuffer) {
+            m_descriptorBuffer.BindSet(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPipeline->layout, 0, globalBufferSet);
+        } else {
+            vkCmdBindDescriptorSets(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPipeline->layout, 0, 1, 
+                &globalDescriptor, 0, nullptr);
+        }
+    };
+
+    MaterialDrawState lastDrawState = {};
+    bool hasDrawState = false;
+    bool isColorPass = false;
+
+    // every material pipeline keeps viewport, scissor and MATERIAL_DYNAMIC_STATES dynamic, they survive pipeline binds
+    auto BeginPassState = [&](bool hasColorAttachment) {
+        hasDrawState = false;
+        isColorPass = hasColorAttachment;
+
+        VkViewport viewport = {};
+        viewport.x = 0;
+        viewport.y = 0;
+        viewport.width = m_rndExtent.width;
+        viewport.height = m_rndExtent.height;
+        viewport.minDepth = 0.f;
+        viewport.maxDepth = 1.f;
+
+        vkCmdSetViewport(pCmdBuf, 0, 1, &viewport);
+
+        VkRect2D scissor = {};
+        scissor.offset.x = 0;
+        scissor.offset.y = 0;
+        scissor.extent.width = m_rndExtent.width;
+        scissor.extent.height = m_rndExtent.height;
+
+        vkCmdSetScissor(pCmdBuf, 0, 1, &scissor);
+
+        vkCmdSetDepthTestEnable(pCmdBuf, VK_TRUE);
+
+        if (isColorPass && m_isBlendDynamicStateSupported) {
+            // the additive blending of the transparent pass, blend enable picks whether it applies
+            const VkColorBlendEquationEXT blendEquation = {
+                .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+                .dstColorBlendFactor = VK_BLEND_FACTOR_ONE,
+                .colorBlendOp = VK_BLEND_OP_ADD,
+                .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+                .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+                .alphaBlendOp = VK_BLEND_OP_ADD,
+            };
+
+            vkCmdSetColorBlendEquationEXT(pCmdBuf, 0, 1, &blendEquation);
+        }
+    };
+
+    auto SetDrawState = [&](const MaterialDrawState& state) {
+        if (!hasDrawState || state.cullMode != lastDrawState.cullMode) {
+            vkCmdSetCullMode(pCmdBuf, state.cullMode);
+        }
+
+        if (!hasDrawState || state.depthWriteEnable != lastDrawState.depthWriteEnable) {
+            vkCmdSetDepthWriteEnable(pCmdBuf, state.depthWriteEnable);
+        }
+
+        if (!hasDrawState || state.depthCompareOp != lastDrawState.depthCompareOp) {
+            vkCmdSetDepthCompareOp(pCmdBuf, state.depthCompareOp);
+        }
 
-            vkCmdBindDescriptorSets(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, obj.pMaterial->pPipeline->layout, 1, 1, 
-                &obj.pMaterial->descriptorSet, 0, nullptr);
+        if (isColorPass && m_isBlendDynamicStateSupported && (!hasDrawState || state.blendEnable != lastDrawState.blendEnable)) {
+            vkCmdSetColorBlendEnableEXT(pCmdBuf, 0, 1, &state.blendEnable);
         }
 
+        lastDrawState = state;
+        hasDrawState = true;
+    };
+
+    auto Draw = [&](const RenderObject& obj) {
         if (obj.indexBuffer != lastIndexBuffer) {
             lastIndexBuffer = obj.indexBuffer;
-            vkCmdBindIndexBuffer(pCmdBuf, obj.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            vkCmdBindIndexBuffer(pCmdBuf, GetBuffer(obj.indexBuffer).pBuffer, 0, VK_INDEX_TYPE_UINT32);
         }
 
 		GPUDrawPushConstants pushConstants;
-		pushConstants.vertBufferGpuAddress = obj.vertexBufferAddress;
+		pushConstants.vertBufferGpuAddress = GetBuffer(obj.vertexBuffer).deviceAddress;
 		pushConstants.transform = obj.transform;
-		vkCmdPushConstants(pCmdBuf, obj.pMaterial->pPipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+		pushConstants.materialIndex = obj.pMaterial->constantsIndex;
+		vkCmdPushConstants(pCmdBuf, pLastPipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
 
 		vkCmdDrawIndexed(pCmdBuf, obj.indexCount, 1, obj.firstIndex, 0, 0);
 
@@ -586,45 +1491,126 @@ void VulkanEngine::RenderGeometry(VkCommandBuffer pCmdBuf) noexcept
         m_stats.triangleCount += obj.indexCount / 3;   
     };
 
-    std::vector<uint32_t> opaqueDraws;
-    opaqueDraws.reserve(m_mainDrawContext.opaqueSurfaces.size());
+    auto RenderDepth = [&](const RenderObject& obj) {
+        if (pLastPipeline != m_metalRoughMaterial.pDepthPrepassPipeline) {
+            BindPipeline(m_metalRoughMaterial.pDepthPrepassPipeline);
+        }
+
+        SetDrawState(DEPTH_PREPASS_DRAW_STATE);
+
+        Draw(obj);
+    };
+
+    auto Render = [&](const RenderObject& obj) {
+        const MaterialPipeline* pPipeline = GetShadingPipeline(obj, packet.isDepthPrepassReady);
 
-    for (uint32_t i = 0; i < m_mainDrawContext.opaqueSurfaces.size(); i++) {
-        if (IsRendObjVisible(m_mainDrawContext.opaqueSurfaces[i], m_sceneData.viewProjMat)) {
-            opaqueDraws.push_back(i);
+        if (obj.pMaterial->passType == MaterialPass::TRANSPARENT) {
+            SetDrawState(TRANSPARENT_DRAW_STATE);
+        } else if (IsDrawnInDepthPrepass(obj, packet.isDepthPrepassReady)) {
+            SetDrawState(DEPTH_EQUAL_DRAW_STATE);
+        } else {
+            SetDrawState(OPAQUE_DRAW_STATE);
         }
-    }
 
-    std::sort(opaqueDraws.begin(), opaqueDraws.end(), [&](uint32_t iA, uint32_t iB) {
-        const RenderObject& a = m_mainDrawContext.opaqueSurfaces[iA];
-        const RenderObject& b = m_mainDrawContext.opaqueSurfaces[iB];
+        if (pPipeline != pLastPipeline) {
+            BindPipeline(pPipeline);
+            pLastMaterial = nullptr;
+        }
 
-        return a.pMaterial == b.pMaterial ? a.indexBuffer < b.indexBuffer : a.pMaterial < b.pMaterial;
-    });
+        if (obj.pMaterial != pLastMaterial) {
+            // on the pool path materials that differ in constants only share a set, their draws just push another index
+            const bool isSetBound = !m_useDescriptorBuffer && pLastMaterial != nullptr && 
+                pLastMaterial->descriptorSet == obj.pMaterial->descriptorSet;
 
-	for (uint32_t idx : opaqueDraws) {
-		Render(m_mainDrawContext.opaqueSurfaces[idx]);
-	}
+            pLastMaterial = obj.pMaterial;
 
-    for (const RenderObject& obj : m_mainDrawContext.transparentSurfaces) {
-		if (IsRendObjVisible(obj, m_sceneData.viewProjMat)) {
-            Render(obj);
+            if (m_useDescriptorBuffer) {
+                m_descriptorBuffer.BindSet(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPipeline->layout, 1, obj.pMaterial->descriptorBufferSet);
+            } else if (!isSetBound) {
+                vkCmdBindDescriptorSets(pCmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPipeline->layout, 1, 1, 
+                    &obj.pMaterial->descriptorSet, 0, nullptr);
+            }
         }
-	}
 
-	vkCmdEndRendering(pCmdBuf);
+        Draw(obj);
+    };
 
-    auto end = std::chrono::system_clock::now();
-    
-    m_stats.meshRenderTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
-}
+    FrameData& currFrameData = GetCurrentFrameData();
 
+    if (m_isTimestampSupported) {
+        vkCmdResetQueryPool(pCmdBuf, currFrameData.pVkTimestampQueryPool, 0, GEOMETRY_TIMESTAMP_COUNT);
+        vkCmdWriteTimestamp2(pCmdBuf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, currFrameData.pVkTimestampQueryPool, 0);
+    }
 
-void VulkanEngine::RenderDbgUI() noexcept
-{
-    if (ImGui::Begin("Debug info")) {            
-		ComputeEffect& selected = m_backgroundEffects[m_currBackgroundEffect];
-		
+    const bool needDepthPrepass = packet.depthPrepassDrawCount > 0;
+
+    if (needDepthPrepass) {
+        const VkRenderingAttachmentInfo prepassDepthAttachment = vkinit::DepthAttachmentInfo(m_depthImage.pImageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+        const VkRenderingInfo prepassRenderInfo = vkinit::RenderingInfo(m_rndExtent, nullptr, &prepassDepthAttachment);
+        vkCmdBeginRendering(pCmdBuf, &prepassRenderInfo);
+
+        BeginPassState(false);
+
+        for (const RenderObject& obj : packet.draws) {
+            if (IsDrawnInDepthPrepass(obj, packet.isDepthPrepassReady)) {
+                RenderDepth(obj);
+            }
+        }
+
+        vkCmdEndRendering(pCmdBuf);
+
+        // the shading pass tests against the pre-pass depth, its writes have to land before that
+        VkMemoryBarrier2 depthBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+        depthBarrier.srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+        depthBarrier.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        depthBarrier.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+        depthBarrier.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        depInfo.memoryBarrierCount = 1;
+        depInfo.pMemoryBarriers = &depthBarrier;
+
+        vkCmdPipelineBarrier2(pCmdBuf, &depInfo);
+    }
+
+    if (m_isTimestampSupported) {
+        vkCmdWriteTimestamp2(pCmdBuf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, currFrameData.pVkTimestampQueryPool, 1);
+    }
+
+    const VkAttachmentLoadOp depthLoadOp = needDepthPrepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+    VkRenderingAttachmentInfo colorAttachment = vkinit::RenderingAttachmentInfo(m_rndImage.pImageView, std::nullopt, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::DepthAttachmentInfo(m_depthImage.pImageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, depthLoadOp);
+
+	VkRenderingInfo renderInfo = vkinit::RenderingInfo(m_rndExtent, &colorAttachment, &depthAttachment);
+	vkCmdBeginRendering(pCmdBuf, &renderInfo);
+
+    BeginPassState(true);
+
+    // keys put opaque draws first, then transparent ones back to front
+	for (const RenderObject& obj : packet.draws) {
+		Render(obj);
+	}
+
+	vkCmdEndRendering(pCmdBuf);
+
+    if (m_isTimestampSupported) {
+        vkCmdWriteTimestamp2(pCmdBuf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, currFrameData.pVkTimestampQueryPool, 2);
+        currFrameData.hasTimestamps = true;
+    }
+
+    auto end = std::chrono::system_clock::now();
+    
+    m_stats.meshRenderTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+}
+
+
+void VulkanEngine::RenderDbgUI(const FramePacket& packet) noexcept
+{
+    if (ImGui::Begin("Debug info")) {            
+		ComputeEffect& selected = m_backgroundEffects[m_currBackgroundEffect];
+		
 		ImGui::Text("Selected effect: %s", selected.name.data());
 		ImGui::SliderInt("Effect Index", &m_currBackgroundEffect, 0, m_backgroundEffects.size() - 1);
 		
@@ -661,18 +1647,94 @@ void VulkanEngine::RenderDbgUI() noexcept
         ImGui::NewLine();
         ImGui::Text("Is Fly Camera (F5):");
         ImGui::SameLine();
-        ImGui::TextColored(m_isFlyCameraMode ? ImVec4(0.f, 1.f, 0.f, 1.f) : ImVec4(1.f, 0.f, 0.f, 1.f), m_isFlyCameraMode ? "true" : "false");
-        ImGui::SliderFloat("Camera Speed", &m_mainCamera.speed, 0.f, 10.f);
+        ImGui::TextColored(packet.isFlyCameraMode ? ImVec4(0.f, 1.f, 0.f, 1.f) : ImVec4(1.f, 0.f, 0.f, 1.f), packet.isFlyCameraMode ? "true" : "false");
+
+        // the camera belongs to the simulation, it picks the speed up with its next update
+        float cameraSpeed = m_cameraSpeed.load(std::memory_order_relaxed);
+        if (ImGui::SliderFloat("Camera Speed", &cameraSpeed, 0.f, 10.f)) {
+            m_cameraSpeed.store(cameraSpeed, std::memory_order_relaxed);
+        }
+
+        JobSystem& jobSystem = JobSystem::GetInstance();
+        int jobThreadCount = jobSystem.GetActiveThreadCount();
+        if (ImGui::SliderInt("Job Threads", &jobThreadCount, 1, jobSystem.GetThreadCount())) {
+            jobSystem.SetActiveThreadCount(jobThreadCount);
+        }
+
+        for (const std::shared_ptr<SceneLoadState>& pLoad : m_sceneLoads) {
+            ImGui::PushID(pLoad.get());
+
+            ImGui::Text("Loading %s", pLoad->name.c_str());
+            ImGui::ProgressBar(pLoad->GetProgress(), ImVec2(-FLT_MIN, 0.f));
+
+            ImGui::BeginDisabled(pLoad->IsCancelled());
+            if (ImGui::SmallButton("Cancel")) {
+                pLoad->Cancel();
+            }
+            ImGui::EndDisabled();
+
+            ImGui::PopID();
+        }
+
+        // smaller budgets than the scene's full chains make far textures fall back to their tail mips
+        int textureBudgetMB = (int)(m_textureStreamer.GetBudget() / (1024 * 1024));
+        if (ImGui::SliderInt("Texture Budget (MB)", &textureBudgetMB, 16, 4096)) {
+            m_textureStreamer.SetBudget((uint64_t)textureBudgetMB * 1024 * 1024);
+        }
+
+        // compare "GPU geometry" in Stats with the pre-pass on and off to see if it pays off for a scene
+        ImGui::NewLine();
+        ImGui::Text("Depth pre-pass:");
+        for (auto& [name, pScene] : m_loadedScenes) {
+            bool useDepthPrepass = pScene->IsDepthPrepassEnabled();
+            if (ImGui::Checkbox(name.c_str(), &useDepthPrepass)) {
+                std::lock_guard lock(m_drawContextMutex);
+                pScene->SetDepthPrepass(useDepthPrepass);
+            }
+        }
 
         ImGui::End();
 	}
 
     if (ImGui::Begin("Stats", nullptr, ImGuiWindowFlags_NoResize)) {
         ImGui::Text("Frametime %f ms", m_stats.frameTime);
+        ImGui::Text("Simulation time %f ms", m_stats.simulationTime);
         ImGui::Text("Draw time %f ms", m_stats.meshRenderTime);
         ImGui::Text("Update time %f ms", m_stats.sceneUpdateTime);
+        ImGui::Text("Cull time %f ms", m_stats.cullTime);
+        ImGui::Text("Sort time %f ms", m_stats.sortTime);
+        ImGui::Text("GPU depth pre-pass %f ms", m_stats.gpuDepthPrepassTime);
+        ImGui::Text("GPU geometry (total) %f ms", m_stats.gpuGeometryTime);
         ImGui::Text("Triangles %i", m_stats.triangleCount);
         ImGui::Text("Draws %i", m_stats.drawCallCount);
+        ImGui::Text("Pipelines %zu, %llu cache hits", m_pipelinePermutations.GetPipelineCount(), 
+            (unsigned long long)m_pipelinePermutations.GetHitCount());
+
+        const TextureStreamerStats streamerStats = m_textureStreamer.GetStats();
+        ImGui::Text("Streamed textures %u, %u pending", streamerStats.textureCount, streamerStats.pendingCount);
+        ImGui::Text("Texture memory %.1f / %.1f MB", streamerStats.residentBytes / (1024.f * 1024.f), streamerStats.fullChainBytes / (1024.f * 1024.f));
+
+        ImGui::NewLine();
+        ImGui::Text(m_isMemoryBudgetSupported ? "Device memory:" : "Device memory (estimated budget):");
+
+        for (uint32_t heap = 0; heap < m_heapCount; ++heap) {
+            ImGui::Text("Heap %u%s %.1f / %.1f MB", heap, heap == m_deviceHeapIndex ? " (device)" : "",
+                m_heapBudgets[heap].usage / (1024.f * 1024.f), m_heapBudgets[heap].budget / (1024.f * 1024.f));
+        }
+
+        for (size_t category = 0; category < m_memoryCategoryBytes.size(); ++category) {
+            ImGui::Text("%s %.1f MB", GetMemoryCategoryName((MemoryCategory)category), 
+                m_memoryCategoryBytes[category].load(std::memory_order_relaxed) / (1024.f * 1024.f));
+        }
+
+        for (size_t pool = 0; pool < (size_t)MemoryPools::Pool::COUNT; ++pool) {
+            const MemoryPoolStats poolStats = m_memoryPools.GetPoolStats((MemoryPools::Pool)pool);
+            ImGui::Text("%s pool %.1f / %.1f MB", MemoryPools::GetPoolName((MemoryPools::Pool)pool),
+                poolStats.allocationBytes / (1024.f * 1024.f), poolStats.blockBytes / (1024.f * 1024.f));
+        }
+
+        ImGui::Text("Defragmented %.1f MB%s", m_memoryPools.GetMovedBytes() / (1024.f * 1024.f), m_memoryPools.IsDefragmenting() ? ", running" : "");
+
         ImGui::End();
     }
 }
@@ -743,6 +1805,77 @@ bool VulkanEngine::InitVulkan() noexcept
 
     vkb::PhysicalDevice& vkbPhysDevice = vkbPhysDeviceSelectionResult.value();
 
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gplFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+        .graphicsPipelineLibrary = true,
+    };
+
+    // optional, pipelines are compiled as a whole in the background without it
+    m_isGraphicsPipelineLibrarySupported = vkbPhysDevice.is_extension_present(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        vkbPhysDevice.is_extension_present(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        vkbPhysDevice.enable_extension_features_if_present(gplFeatures);
+
+    if (m_isGraphicsPipelineLibrarySupported) {
+        vkbPhysDevice.enable_extension_if_present(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+        vkbPhysDevice.enable_extension_if_present(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+
+        VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT gplProps = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT };
+        
+        VkPhysicalDeviceProperties2 props2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+        props2.pNext = &gplProps;
+
+        vkGetPhysicalDeviceProperties2(vkbPhysDevice.physical_device, &props2);
+
+        // linking without fast-link support can cost as much as a full compile, there is no gain then
+        m_isGraphicsPipelineLibrarySupported = gplProps.graphicsPipelineLibraryFastLinking;
+    }
+
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT,
+        .extendedDynamicState3ColorBlendEnable = true,
+        .extendedDynamicState3ColorBlendEquation = true,
+    };
+
+    // optional, transparent materials keep pipelines of their own without it. Cull mode and depth state are core in 1.3.
+    m_isBlendDynamicStateSupported = vkbPhysDevice.is_extension_present(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME) &&
+        vkbPhysDevice.enable_extension_features_if_present(dynamicState3Features);
+
+    if (m_isBlendDynamicStateSupported) {
+        vkbPhysDevice.enable_extension_if_present(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+    }
+
+    VkPhysicalDeviceFeatures bcFeatures = {};
+    bcFeatures.textureCompressionBC = true;
+
+    // optional, BC textures are replaced with the checkerboard without it
+    m_isTextureCompressionBCSupported = vkbPhysDevice.enable_features_if_present(bcFeatures);
+
+    VkPhysicalDeviceFeatures storageFeatures = {};
+    storageFeatures.shaderStorageImageWriteWithoutFormat = true;
+
+    // optional, mips are blitted one level after another without it
+    const bool isStorageWriteWithoutFormatSupported = vkbPhysDevice.enable_features_if_present(storageFeatures);
+
+    // optional, VMA estimates the budgets from heap sizes and its own allocations without it
+    m_isMemoryBudgetSupported = vkbPhysDevice.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    if (m_useDescriptorBuffer) {
+        VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+            .descriptorBuffer = true,
+        };
+
+        // optional, scene and material sets come from descriptor pools without it
+        m_useDescriptorBuffer = vkbPhysDevice.is_extension_present(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME) &&
+            vkbPhysDevice.enable_extension_features_if_present(descriptorBufferFeatures);
+
+        if (m_useDescriptorBuffer) {
+            vkbPhysDevice.enable_extension_if_present(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+        } else {
+            fmt::print("VK_EXT_descriptor_buffer is not supported, descriptor sets come from pools\n");
+        }
+    }
+
     vkb::DeviceBuilder vkbDeviceBuilder(vkbPhysDevice);
     vkb::Result<vkb::Device> vkbDeviceBuildResult = vkbDeviceBuilder.build();
 
@@ -759,17 +1892,51 @@ bool VulkanEngine::InitVulkan() noexcept
     m_pVkGraphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     m_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+    vkGetPhysicalDeviceProperties(m_pVkPhysDevice, &m_vkPhysDeviceProps);
+
+    m_mipGenerator.Init(m_pVkDevice, m_pVkPhysDevice, isStorageWriteWithoutFormatSupported);
+
+    m_timestampPeriodNs = m_vkPhysDeviceProps.limits.timestampPeriod;
+    m_isTimestampSupported = m_vkPhysDeviceProps.limits.timestampComputeAndGraphics && 
+        vkbDevice.queue_families[m_graphicsQueueFamily].timestampValidBits > 0;
+
     VmaAllocatorCreateInfo vmaCreateInfo = {};
     vmaCreateInfo.physicalDevice = m_pVkPhysDevice;
     vmaCreateInfo.device = m_pVkDevice;
     vmaCreateInfo.instance = m_pVkInstance;
+    vmaCreateInfo.vulkanApiVersion = VK_API_VERSION_1_3;
     vmaCreateInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+
+    if (m_isMemoryBudgetSupported) {
+        vmaCreateInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
+
     vmaCreateAllocator(&vmaCreateInfo, &m_pVMA);
 
+    const VkPhysicalDeviceMemoryProperties* pMemoryProps = nullptr;
+    vmaGetMemoryProperties(m_pVMA, &pMemoryProps);
+
+    m_heapCount = pMemoryProps->memoryHeapCount;
+
+    for (uint32_t heap = 0; heap < m_heapCount; ++heap) {
+        const VkMemoryHeap& memoryHeap = pMemoryProps->memoryHeaps[heap];
+
+        if ((memoryHeap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && memoryHeap.size > pMemoryProps->memoryHeaps[m_deviceHeapIndex].size) {
+            m_deviceHeapIndex = heap;
+        }
+    }
+
     m_mainDeletionQueue.PushDeletor([&]() {
         vmaDestroyAllocator(m_pVMA);
     });
 
+    m_memoryPools.Init(m_pVkDevice, m_pVMA);
+
+    // runs before the allocator is destroyed and after everything allocated later is freed
+    m_mainDeletionQueue.PushDeletor([&]() {
+        m_memoryPools.Terminate();
+    });
+
     return true;
 }
 
@@ -871,6 +2038,14 @@ bool VulkanEngine::InitCommands() noexcept
         const VkCommandBufferAllocateInfo cmdBufferAllocateInfo = vkinit::CmdBufferAllocateInfo(m_framesData[i].pVkCmdPool, 1);
 
         ENG_VK_CHECK(vkAllocateCommandBuffers(m_pVkDevice, &cmdBufferAllocateInfo, &m_framesData[i].pVkCmdBuffer));
+
+        if (m_isTimestampSupported) {
+            VkQueryPoolCreateInfo queryPoolCreateInfo = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+            queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolCreateInfo.queryCount = GEOMETRY_TIMESTAMP_COUNT;
+
+            ENG_VK_CHECK(vkCreateQueryPool(m_pVkDevice, &queryPoolCreateInfo, nullptr, &m_framesData[i].pVkTimestampQueryPool));
+        }
     }
 
     ENG_VK_CHECK(vkCreateCommandPool(m_pVkDevice, &cmdPoolCreateInfo, nullptr, &m_pImmCommandPool));
@@ -917,16 +2092,36 @@ bool VulkanEngine::InitDescriptors() noexcept
 
 	DescriptorLayoutBuilder builder;
 	builder.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-	m_pComputeBackgroundDescriptorLayout = builder.Build(m_pVkDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+	m_pComputeBackgroundDescriptorLayout = builder.Build(m_pVkDevice, m_descriptorLayoutCache, VK_SHADER_STAGE_COMPUTE_BIT);
     m_pComputeBackgroundDescriptors = m_globalDescriptorAllocator.Allocate(m_pVkDevice, m_pComputeBackgroundDescriptorLayout);	
 
+    if (m_useDescriptorBuffer) {
+        const VkBufferUsageFlags usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+        // written by the host like the uniform buffers, the GPU reads the descriptors in place
+        m_descriptorBufferMemory = CreateBuffer(DESCRIPTOR_BUFFER_SIZE, usage, MemoryCategory::UNIFORMS);
+        m_descriptorBuffer.Init(m_pVkDevice, m_pVkPhysDevice, m_descriptorBufferMemory, usage);
+    }
+
+    // sets of descriptor buffer layouts can't be allocated from pools, the layout cache tells them apart by the flag
+    const VkDescriptorSetLayoutCreateFlags sceneLayoutFlags = m_useDescriptorBuffer ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+
     builder.Clear();
     builder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    m_pSceneDataDescriptorLayout = builder.Build(m_pVkDevice, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_pSceneDataDescriptorLayout = builder.Build(m_pVkDevice, m_descriptorLayoutCache, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        sceneLayoutFlags);
+
+    if (m_useDescriptorBuffer) {
+        m_sceneDataBufferLayout = m_descriptorBuffer.GetLayout(m_pSceneDataDescriptorLayout, 1);
+    } else {
+        m_sceneDataTemplate.AddBuffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0);
+        m_sceneDataTemplate.Build(m_pVkDevice, m_pSceneDataDescriptorLayout);
+    }
 
     builder.Clear();
 	builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	m_singleImageDescriptorLayout = builder.Build(m_pVkDevice, VK_SHADER_STAGE_FRAGMENT_BIT);
+	m_singleImageDescriptorLayout = builder.Build(m_pVkDevice, m_descriptorLayoutCache, VK_SHADER_STAGE_FRAGMENT_BIT);
 
 	DescriptorWriter writer;
     writer.WriteImage(0, m_rndImage.pImageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
@@ -941,8 +2136,8 @@ bool VulkanEngine::InitDescriptors() noexcept
 			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
 		};
 
-		m_framesData[i].descriptorAllocator = DescriptorAllocatorGrowable{};
-		m_framesData[i].descriptorAllocator.Init(m_pVkDevice, 1000, frameSizes);
+		// recording jobs allocate from their own thread's pools
+		m_framesData[i].descriptorAllocator.Init(JobSystem::GetInstance().GetThreadCount(), 1000, frameSizes);
 	}
 
 	m_mainDeletionQueue.PushDeletor([&]() {
@@ -951,24 +2146,54 @@ bool VulkanEngine::InitDescriptors() noexcept
         }
 
 		m_globalDescriptorAllocator.DestroyPools(m_pVkDevice);
-        
-        vkDestroyDescriptorSetLayout(m_pVkDevice, m_singleImageDescriptorLayout, nullptr);
-		vkDestroyDescriptorSetLayout(m_pVkDevice, m_pSceneDataDescriptorLayout, nullptr);
-		vkDestroyDescriptorSetLayout(m_pVkDevice, m_pComputeBackgroundDescriptorLayout, nullptr);
+        m_sceneDataTemplate.Destroy(m_pVkDevice);
+        m_descriptorLayoutCache.Destroy(m_pVkDevice);
+
+        if (m_descriptorBuffer.IsInitialized()) {
+            m_descriptorBuffer.Terminate();
+            DestroyBuffer(m_descriptorBufferMemory);
+        }
 	});
 
     return true;
 }
 
 
+void VulkanEngine::InitPipelineCache() noexcept
+{
+    if (m_usePipelineCache) {
+        m_pVkPipelineCache = vkutil::LoadPipelineCache(m_pVkDevice, m_vkPhysDeviceProps, ENG_PIPELINE_CACHE_PATH, &m_isPipelineCacheLoaded);
+    }
+}
+
+
 bool VulkanEngine::InitPipelines() noexcept
 {
+    if (!m_shaderArchive.Open(ENG_SHADER_ARCHIVE_PATH)) {
+        ENG_ASSERT_FAIL("Failed to open shader archive: {}", ENG_SHADER_ARCHIVE_PATH.string());
+        return false;
+    }
+
+    m_pipelineCompiler.Init(m_pVkDevice, m_pVkPipelineCache, m_isGraphicsPipelineLibrarySupported);
+    m_pipelinePermutations.Init(m_pVkDevice, &m_pipelineCompiler);
+
     if (!InitBackgroundPipelines()) {
         return false;
     }
 
+    if (!m_mipGenerator.BuildPipeline(m_shaderArchive, m_pVkPipelineCache)) {
+        return false;
+    }
+
+    m_mainDeletionQueue.PushDeletor([&]() {
+        m_mipGenerator.Terminate();
+    });
+
     m_metalRoughMaterial.BuildPipelines(this);
 
+    m_textureStreamer.Init(m_pVkDevice, m_metalRoughMaterial.descSetLayout, GLTFMetallic_Roughness::DESCRIPTOR_BINDING_COUNT,
+        m_useDescriptorBuffer ? &m_descriptorBuffer : nullptr);
+
     return true;
 }
 
@@ -990,15 +2215,15 @@ bool VulkanEngine::InitBackgroundPipelines() noexcept
 
     ENG_VK_CHECK(vkCreatePipelineLayout(m_pVkDevice, &layoutCreateInfo, VK_NULL_HANDLE, &m_pComputeBackgroundPipelineLayout));
 
-    VkShaderModule pGradientShaderModule = VK_NULL_HANDLE;
-    if (!vkutil::LoadShaderModule(ENG_GRADIENT_CS_PATH, m_pVkDevice, pGradientShaderModule)) {
-        ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_GRADIENT_CS_PATH.string().c_str());
+    VkShaderModule pGradientShaderModule = m_shaderArchive.GetModule(m_pVkDevice, ENG_GRADIENT_CS_NAME);
+    if (pGradientShaderModule == VK_NULL_HANDLE) {
+        ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_GRADIENT_CS_NAME);
         return false;
     }
 
-    VkShaderModule pSkyShaderModule = VK_NULL_HANDLE;
-    if (!vkutil::LoadShaderModule(ENG_SKY_CS_PATH, m_pVkDevice, pSkyShaderModule)) {
-        ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_SKY_CS_PATH.string().c_str());
+    VkShaderModule pSkyShaderModule = m_shaderArchive.GetModule(m_pVkDevice, ENG_SKY_CS_NAME);
+    if (pSkyShaderModule == VK_NULL_HANDLE) {
+        ENG_ASSERT_FAIL("Failed to load shader module: {}", ENG_SKY_CS_NAME);
         return false;
     }
 
@@ -1021,7 +2246,7 @@ bool VulkanEngine::InitBackgroundPipelines() noexcept
     gradient.data.data[0] = glm::vec4(1.f, 0.f, 0.f, 1.f);
     gradient.data.data[1] = glm::vec4(0.f, 0.f, 1.f, 1.f);
 
-    ENG_VK_CHECK(vkCreateComputePipelines(m_pVkDevice, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
+    ENG_VK_CHECK(vkCreateComputePipelines(m_pVkDevice, m_pVkPipelineCache, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
     
     computePipelineCreateInfo.stage.module = pSkyShaderModule;
     
@@ -1030,14 +2255,11 @@ bool VulkanEngine::InitBackgroundPipelines() noexcept
     sky.layout = m_pComputeBackgroundPipelineLayout;
     sky.data.data[0] = glm::vec4(0.1f, 0.2f, 0.4f, 0.97f);
 
-    ENG_VK_CHECK(vkCreateComputePipelines(m_pVkDevice, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
+    ENG_VK_CHECK(vkCreateComputePipelines(m_pVkDevice, m_pVkPipelineCache, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
 
     m_backgroundEffects.emplace_back(gradient);
     m_backgroundEffects.emplace_back(sky);
 
-    vkDestroyShaderModule(m_pVkDevice, pGradientShaderModule, nullptr);
-    vkDestroyShaderModule(m_pVkDevice, pSkyShaderModule, nullptr);
-
 	m_mainDeletionQueue.PushDeletor([&]() {
 		vkDestroyPipelineLayout(m_pVkDevice, m_pComputeBackgroundPipelineLayout, nullptr);
 		
@@ -1053,13 +2275,13 @@ bool VulkanEngine::InitBackgroundPipelines() noexcept
 void VulkanEngine::InitDefaultData() noexcept
 {
     const uint32_t whiteColorU32 = glm::packUnorm4x8(glm::vec4(1.f));
-	m_whiteImage = CreateImage(VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, (const void*)&whiteColorU32);
+	m_whiteImage = RegisterImage(CreateImage(VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, (const void*)&whiteColorU32));
 
 	const uint32_t greyColorU32 = glm::packUnorm4x8(glm::vec4(0.66f, 0.66f, 0.66f, 1.f));
-	m_greyImage = CreateImage(VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, (const void*)&greyColorU32);
+	m_greyImage = RegisterImage(CreateImage(VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, (const void*)&greyColorU32));
 
 	const uint32_t blackColorU32 = glm::packUnorm4x8(glm::vec4(0.f, 0.f, 0.f, 1.f));
-	m_blackImage = CreateImage(VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, (const void*)&blackColorU32);
+	m_blackImage = RegisterImage(CreateImage(VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, (const void*)&blackColorU32));
 
 	std::array<uint32_t, 16 * 16> pixels;
 	for (int x = 0; x < 16; x++) {
@@ -1067,7 +2289,7 @@ void VulkanEngine::InitDefaultData() noexcept
 			pixels[y * 16 + x] = ((x % 2) ^ (y % 2)) ? whiteColorU32 : blackColorU32;
 		}
 	}
-	m_checkerboardImage = CreateImage(VkExtent3D{16, 16, 1}, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, pixels.data());
+	m_checkerboardImage = RegisterImage(CreateImage(VkExtent3D{16, 16, 1}, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, pixels.data()));
 
 	VkSamplerCreateInfo samplerInfo = {};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1081,37 +2303,47 @@ void VulkanEngine::InitDefaultData() noexcept
 	samplerInfo.minFilter = VK_FILTER_LINEAR;
 	vkCreateSampler(m_pVkDevice, &samplerInfo, nullptr, &m_linearSampler);
 
+	m_mainDeletionQueue.PushDeletor([&]() {
+        vkDestroySampler(m_pVkDevice, m_nearestSampler, nullptr);
+        vkDestroySampler(m_pVkDevice, m_linearSampler, nullptr);
+
+        ReleaseImage(m_whiteImage);
+        ReleaseImage(m_blackImage);
+        ReleaseImage(m_greyImage);
+        ReleaseImage(m_checkerboardImage);
+	});
+}
+
+
+void VulkanEngine::InitDefaultMaterial() noexcept
+{
     GLTFMetallic_Roughness::MaterialResources materialResources;
 	materialResources.colorImage = m_whiteImage;
 	materialResources.colorSampler = m_linearSampler;
 	materialResources.metalRoughImage = m_whiteImage;
 	materialResources.metalRoughSampler = m_linearSampler;
 
-	BufferHandle materialConstants = CreateBuffer(sizeof(GLTFMetallic_Roughness::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	const BufferID materialConstants = RegisterBuffer(CreateBuffer(sizeof(GLTFMetallic_Roughness::MaterialConstants), 
+        GetShaderBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT), MemoryCategory::UNIFORMS));
 
-	GLTFMetallic_Roughness::MaterialConstants* pSceneUniformData = (GLTFMetallic_Roughness::MaterialConstants*)materialConstants.pAllocation->GetMappedData();
+	GLTFMetallic_Roughness::MaterialConstants* pSceneUniformData = (GLTFMetallic_Roughness::MaterialConstants*)GetBuffer(materialConstants).allocationInfo.pMappedData;
 	pSceneUniformData->colorFactors = glm::vec4{1,1,1,1};
 	pSceneUniformData->metallicRoughnessFactors = glm::vec4{1,0.5,0,0};
 
 	m_mainDeletionQueue.PushDeletor([=, this]() {
-		BufferHandle buffer = materialConstants;
-        DestroyBuffer(buffer);
+        ReleaseBuffer(materialConstants);
 	});
 
-	materialResources.dataBuffer = materialConstants.pBuffer;
-	materialResources.dataBufferOffset = 0;
+	materialResources.dataBuffer = materialConstants;
+	materialResources.dataBufferSize = sizeof(GLTFMetallic_Roughness::MaterialConstants);
+	materialResources.constantsIndex = 0;
+	materialResources.useAlphaTest = false;
 
-	m_defaultData = m_metalRoughMaterial.WriteMaterial(m_pVkDevice, MaterialPass::OPAQUE, materialResources, m_globalDescriptorAllocator);
+	const std::optional<MaterialInstance> defaultData = m_metalRoughMaterial.WriteMaterial(*this, MaterialPass::OPAQUE, materialResources, m_globalDescriptorAllocator);
+	// nothing else is in the descriptor buffer yet
+	ENG_ASSERT(defaultData.has_value());
 
-	m_mainDeletionQueue.PushDeletor([&]() {
-        vkDestroySampler(m_pVkDevice, m_nearestSampler, nullptr);
-        vkDestroySampler(m_pVkDevice, m_linearSampler, nullptr);
-
-        DestroyImage(m_whiteImage);
-        DestroyImage(m_blackImage);
-        DestroyImage(m_greyImage);
-        DestroyImage(m_checkerboardImage);
-	});
+	m_defaultData = defaultData.value();
 }
 
 
@@ -1158,6 +2390,7 @@ bool VulkanEngine::InitImGui() noexcept
     };
     
     initInfo.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    initInfo.PipelineCache = m_pVkPipelineCache;
     initInfo.PipelineRenderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
     initInfo.PipelineRenderingCreateInfo.colorAttachmentCount = 1;
     initInfo.PipelineRenderingCreateInfo.pColorAttachmentFormats = &m_swapChainImageFormat;
@@ -1196,61 +2429,527 @@ void VulkanEngine::ImmediateSubmit(std::function<void(VkCommandBuffer pCmdBuf)>&
 }
 
 
-void VulkanEngine::UpdateScene()
+void VulkanEngine::UpdateScene(FramePacket& packet) noexcept
 {
-    m_stats.sceneUpdateTime = 0;
-    
     auto start = std::chrono::system_clock::now();
 
+    m_mainCamera.speed = m_cameraSpeed.load(std::memory_order_relaxed);
     m_mainCamera.Update();
 
-    m_mainDrawContext.opaqueSurfaces.clear();
-    m_mainDrawContext.transparentSurfaces.clear();
+    // m_windowExtent belongs to the render thread, it is rewritten on swapchain resizes
+    int32_t windowWidth = 0, windowHeight = 0;
+    SDL_GetWindowSize(m_pWindow, &windowWidth, &windowHeight);
 
-    m_loadedScenes["structure"]->Render(glm::identity<glm::mat4>(), m_mainDrawContext);
+    const float aspect = windowHeight > 0 ? (float)windowWidth / (float)windowHeight : 1.f;
 
     const glm::mat4 viewMat = m_mainCamera.GetViewMatrix();
-    glm::mat4 projMat = glm::perspective(glm::radians(70.f), (float)m_windowExtent.width / (float)m_windowExtent.height, 10000.f, 0.1f);
+    glm::mat4 projMat = glm::perspective(glm::radians(70.f), aspect, 10000.f, 0.1f);
 
     projMat[1][1] *= -1;
 
-	m_sceneData.viewMat = viewMat;
-	m_sceneData.projMat = projMat;
-	m_sceneData.viewProjMat = projMat * viewMat;
+    SceneData& sceneData = packet.sceneData;
+
+	sceneData.viewMat = viewMat;
+	sceneData.projMat = projMat;
+	sceneData.viewProjMat = projMat * viewMat;
+
+	sceneData.ambientColor = glm::vec4(0.1f);
+	sceneData.sunLightColor = glm::vec4(1.f);
+	sceneData.sunLightDirectionAndPower = glm::vec4(0.f, 1.f, 0.5f, 1.f);
 
-	m_sceneData.ambientColor = glm::vec4(0.1f);
-	m_sceneData.sunLightColor = glm::vec4(1.f);
-	m_sceneData.sunLightDirectionAndPower = glm::vec4(0.f, 1.f, 0.5f, 1.f);
+    packet.cameraPosition = m_mainCamera.position;
 
     auto end = std::chrono::system_clock::now();
     
-    m_stats.sceneUpdateTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+    packet.sceneUpdateTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+}
+
+
+void VulkanEngine::CullDraws(FramePacket& packet) noexcept
+{
+    // the published pipeline never goes back to null, draws sorted as ready stay drawable
+    packet.isDepthPrepassReady = m_isDepthPrepassReady.load(std::memory_order_acquire);
+
+    // held through the copy, the render thread only changes the objects between its frames
+    std::lock_guard lock(m_drawContextMutex);
+
+    packet.drawContextVersion = m_drawContextVersion;
+
+    const std::span<const RenderObject> objects = m_mainDrawContext.GetObjects();
+    const glm::vec3 cameraPos = packet.cameraPosition;
+
+    auto cullStart = std::chrono::system_clock::now();
+
+    constexpr size_t cullBatchSize = 128;
+
+    m_drawVisibility.resize(objects.size());
+    m_drawObjectKeys.resize(objects.size());
+
+    JobSystem::GetInstance().ParallelFor(objects.size(), cullBatchSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            m_drawVisibility[i] = IsRendObjVisible(objects[i], packet.sceneData.viewProjMat);
+
+            if (m_drawVisibility[i]) {
+                m_drawObjectKeys[i] = BuildDrawSortKey(objects[i], GetShadingPipeline(objects[i], packet.isDepthPrepassReady), cameraPos);
+            }
+        }
+    });
+
+    m_drawSortKeys.clear();
+    m_drawSortIndices.clear();
+
+    packet.depthPrepassDrawCount = 0;
+
+    for (uint32_t i = 0; i < objects.size(); i++) {
+        if (m_drawVisibility[i]) {
+            m_drawSortKeys.push_back(m_drawObjectKeys[i]);
+            m_drawSortIndices.push_back(i);
+
+            if (IsDrawnInDepthPrepass(objects[i], packet.isDepthPrepassReady)) {
+                ++packet.depthPrepassDrawCount;
+            }
+        }
+    }
+
+    auto sortStart = std::chrono::system_clock::now();
+
+    m_drawSortTmpKeys.resize(m_drawSortKeys.size());
+    m_drawSortTmpIndices.resize(m_drawSortIndices.size());
+
+    RadixSort(m_drawSortKeys, m_drawSortIndices, m_drawSortTmpKeys, m_drawSortTmpIndices);
+
+    packet.draws.clear();
+
+    for (uint32_t idx : m_drawSortIndices) {
+        packet.draws.push_back(objects[idx]);
+    }
+
+    auto sortEnd = std::chrono::system_clock::now();
+
+    packet.cullTime = std::chrono::duration_cast<std::chrono::microseconds>(sortStart - cullStart).count() / 1000.f;
+    packet.sortTime = std::chrono::duration_cast<std::chrono::microseconds>(sortEnd - sortStart).count() / 1000.f;
+}
+
+
+void VulkanEngine::UpdateTextureStreaming(const FramePacket& packet) noexcept
+{
+    if (!m_textureStreamer.HasTextures()) {
+        return;
+    }
+
+    const glm::vec3 cameraPos = packet.cameraPosition;
+
+    // pixels covered by one unit at distance one
+    const float pixelScale = std::abs(packet.sceneData.projMat[1][1]) * 0.5f * m_rndExtent.height;
+
+    // the packet holds the visible draws only
+    for (const RenderObject& obj : packet.draws) {
+        const glm::vec3 center = glm::vec3(obj.transform * glm::vec4(obj.bounds.origin, 1.f));
+        const float scale = std::max({ glm::length(glm::vec3(obj.transform[0])), glm::length(glm::vec3(obj.transform[1])), 
+            glm::length(glm::vec3(obj.transform[2])) });
+        const float radius = obj.bounds.sphereRadius * scale;
+
+        // close surfaces may contain the camera, they want the full chain anyway
+        const float distance = std::max(glm::length(center - cameraPos) - radius, 0.1f);
+
+        m_textureStreamer.AddMaterialDemand(obj.pMaterial, 2.f * radius * pixelScale / distance);
+    }
+
+    m_textureStreamer.Update(*this);
+}
+
+
+void VulkanEngine::AddScene(const std::string& name, std::shared_ptr<LoadedGLTF> pScene) noexcept
+{
+    RemoveScene(name);
+
+    {
+        std::lock_guard lock(m_drawContextMutex);
+        pScene->RegisterDraws(m_mainDrawContext);
+    }
+
+    EnableMeshMoves(*pScene);
+
+    m_loadedScenes[name] = std::move(pScene);
+}
+
+
+void VulkanEngine::EnableMeshMoves(LoadedGLTF& scene) noexcept
+{
+    for (auto& [name, pMesh] : scene.meshes) {
+        // releasing the buffers removes the callbacks, the ids stay valid as long as they are set
+        for (BufferID id : { pMesh->meshBuffers.idxBuff, pMesh->meshBuffers.vertBuff }) {
+            m_memoryPools.SetBufferMoveCallback(GetBuffer(id).pAllocation, [this, id](VkBuffer pNewBuffer) {
+                BufferHandle& buffer = GetBuffer(id);
+                buffer.pBuffer = pNewBuffer;
+
+                if (buffer.deviceAddress != 0) {
+                    VkBufferDeviceAddressInfo deviceAdressInfo = { 
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                        .buffer = pNewBuffer
+                    };
+
+                    buffer.deviceAddress = vkGetBufferDeviceAddress(m_pVkDevice, &deviceAdressInfo);
+                }
+            });
+        }
+    }
+}
+
+
+void VulkanEngine::RemoveScene(const std::string& name) noexcept
+{
+    auto it = m_loadedScenes.find(name);
+    if (it == m_loadedScenes.end()) {
+        return;
+    }
+
+    std::shared_ptr<LoadedGLTF> pScene = std::move(it->second);
+    m_loadedScenes.erase(it);
+
+    {
+        std::lock_guard lock(m_drawContextMutex);
+
+        pScene->UnregisterDraws(m_mainDrawContext);
+        ++m_drawContextVersion;
+    }
+
+    // scene GPU resources may still be referenced by frames in flight, the next frame slot is flushed only
+    // after the last frame that could have recorded this scene has completed
+    GetReleaseDeletionQueue().PushDeletor([pScene]() mutable {
+        pScene.reset();
+    });
+}
+
+
+std::shared_ptr<SceneLoadState> VulkanEngine::StartSceneLoad(const std::string& name, const std::filesystem::path& filepath) noexcept
+{
+    std::shared_ptr<SceneLoadState> pState = std::make_shared<SceneLoadState>();
+    pState->name = name;
+    pState->filepath = filepath;
+
+    m_sceneLoads.emplace_back(pState);
+
+    LoadAndPublishScene(pState);
+
+    return pState;
+}
+
+
+void VulkanEngine::WaitSceneLoads() noexcept
+{
+    while (!m_sceneLoads.empty()) {
+        PumpAsyncWork();
+        std::this_thread::yield();
+    }
+}
+
+
+Task<std::shared_ptr<LoadedGLTF>> VulkanEngine::LoadSceneAsync(std::filesystem::path filepath, std::shared_ptr<SceneLoadState> pState) noexcept
+{
+    if (pState == nullptr) {
+        pState = std::make_shared<SceneLoadState>();
+        pState->filepath = filepath;
+    }
+
+    pState->status.store(SceneLoadStatus::PARSING, std::memory_order_release);
+
+    if (filepath.extension() == ".vkscene") {
+        co_return co_await LoadCookedSceneAsync(std::move(filepath), std::move(pState));
+    }
+
+    co_await ResumeOnBackgroundJob {};
+
+    std::shared_ptr<ParsedGLTF> pParsed = ParseGLTF(filepath, &pState->parseProgress);
+
+    // resources are created and submitted on the main thread, between frames
+    co_await ResumeOnMainThread();
+
+    if (pParsed == nullptr || pState->IsCancelled()) {
+        pState->status.store(pState->IsCancelled() ? SceneLoadStatus::CANCELLED : SceneLoadStatus::FAILED, std::memory_order_release);
+        co_return nullptr;
+    }
+
+    // streamed textures already gave back what they could, a new scene would run the device out of memory
+    if (IsDeviceMemoryLow()) {
+        fmt::println(stderr, "Scene {} is not loaded, device memory is almost exhausted", filepath.string().c_str());
+
+        pState->status.store(SceneLoadStatus::FAILED, std::memory_order_release);
+        co_return nullptr;
+    }
+
+    pState->status.store(SceneLoadStatus::UPLOADING, std::memory_order_release);
+
+    UploadBatch uploadBatch;
+    std::optional<std::shared_ptr<LoadedGLTF>> scene = LoadGLTF(this, *pParsed, uploadBatch);
+
+    const uint64_t submitId = uploadBatch.SubmitAsync(*this);
+
+    // the staging buffer holds a copy of everything the GPU still needs
+    pParsed = nullptr;
+
+    co_await WaitForSubmit(submitId);
+
+    if (!scene.has_value() || pState->IsCancelled()) {
+        // never drawn and the uploads are done, the resources can go right away
+        pState->status.store(pState->IsCancelled() ? SceneLoadStatus::CANCELLED : SceneLoadStatus::FAILED, std::memory_order_release);
+        co_return nullptr;
+    }
+
+    pState->status.store(SceneLoadStatus::DONE, std::memory_order_release);
+
+    co_return std::move(scene.value());
+}
+
+
+Task<std::shared_ptr<LoadedGLTF>> VulkanEngine::LoadCookedSceneAsync(std::filesystem::path filepath, std::shared_ptr<SceneLoadState> pState) noexcept
+{
+    co_await ResumeOnBackgroundJob {};
+
+    MappedFile mappedFile;
+
+    if (mappedFile.Open(filepath)) {
+        // the mapping is lazy, the main thread would otherwise stall on the page faults while it fills the staging buffer
+        constexpr size_t pageSize = 4096;
+        constexpr size_t progressStep = 1024 * pageSize;
+
+        const std::span<const uint8_t> data = mappedFile.GetData();
+        pState->parseProgress.itemCount.store((uint32_t)((data.size() + progressStep - 1) / progressStep), std::memory_order_relaxed);
+
+        uint8_t pageSum = 0;
+
+        for (size_t offset = 0; offset < data.size() && !pState->IsCancelled(); offset += pageSize) {
+            pageSum += *(const volatile uint8_t*)(data.data() + offset);
+
+            if ((offset + pageSize) % progressStep == 0) {
+                pState->parseProgress.doneItemCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        (void)pageSum;
+    } else {
+        fmt::println(stderr, "Failed to open cooked scene: {}", filepath.string().c_str());
+    }
+
+    co_await ResumeOnMainThread();
+
+    if (!mappedFile.IsOpen() || pState->IsCancelled()) {
+        pState->status.store(pState->IsCancelled() ? SceneLoadStatus::CANCELLED : SceneLoadStatus::FAILED, std::memory_order_release);
+        co_return nullptr;
+    }
+
+    if (IsDeviceMemoryLow()) {
+        fmt::println(stderr, "Scene {} is not loaded, device memory is almost exhausted", filepath.string().c_str());
+
+        pState->status.store(SceneLoadStatus::FAILED, std::memory_order_release);
+        co_return nullptr;
+    }
+
+    pState->status.store(SceneLoadStatus::UPLOADING, std::memory_order_release);
+
+    // the cooked data goes through one staging buffer and one immediate submit, between frames
+    std::optional<std::shared_ptr<LoadedGLTF>> scene = LoadCookedScene(this, filepath, std::move(mappedFile));
+
+    if (!scene.has_value()) {
+        pState->status.store(SceneLoadStatus::FAILED, std::memory_order_release);
+        co_return nullptr;
+    }
+
+    pState->status.store(SceneLoadStatus::DONE, std::memory_order_release);
+
+    co_return std::move(scene.value());
+}
+
+
+DetachedTask VulkanEngine::LoadAndPublishScene(std::shared_ptr<SceneLoadState> pState) noexcept
+{
+    const Timeline::Clock::time_point startTime = Timeline::Clock::now();
+
+    std::shared_ptr<LoadedGLTF> pScene = co_await LoadSceneAsync(pState->filepath, pState);
+
+    // resumed by PumpAsyncWork, no frame is being recorded
+    if (pScene != nullptr) {
+        AddScene(pState->name, std::move(pScene));
+
+        const float loadMs = std::chrono::duration_cast<std::chrono::microseconds>(Timeline::Clock::now() - startTime).count() / 1000.f;
+        fmt::print("Scene \"{}\" loaded in {:.2f} ms\n", pState->name, loadMs);
+    }
+
+    std::erase(m_sceneLoads, pState);
+}
+
+
+void VulkanEngine::MainThreadAwaiter::await_suspend(std::coroutine_handle<> handle) const noexcept
+{
+    std::lock_guard lock(pEngine->m_mainThreadResumeMutex);
+    pEngine->m_mainThreadResumeQueue.emplace_back(handle);
+}
+
+
+bool VulkanEngine::AsyncSubmitAwaiter::await_ready() const noexcept
+{
+    return !pEngine->m_asyncSubmits.contains(submitId);
+}
+
+
+void VulkanEngine::AsyncSubmitAwaiter::await_suspend(std::coroutine_handle<> handle) const noexcept
+{
+    pEngine->m_asyncSubmits[submitId].waiters.emplace_back(handle);
+}
+
+
+uint64_t VulkanEngine::SubmitAsync(const std::function<void(VkCommandBuffer pCmdBuf)>& record, std::function<void()>&& onComplete) noexcept
+{
+    ENG_ASSERT(IsMainThread());
+
+    AsyncSubmit submit = {};
+    submit.onComplete = std::move(onComplete);
+
+    const VkCommandPoolCreateInfo cmdPoolCreateInfo = vkinit::CmdPoolCreateInfo(m_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    ENG_VK_CHECK(vkCreateCommandPool(m_pVkDevice, &cmdPoolCreateInfo, nullptr, &submit.pVkCmdPool));
+
+    const VkCommandBufferAllocateInfo cmdBufferAllocateInfo = vkinit::CmdBufferAllocateInfo(submit.pVkCmdPool, 1);
+    ENG_VK_CHECK(vkAllocateCommandBuffers(m_pVkDevice, &cmdBufferAllocateInfo, &submit.pVkCmdBuffer));
+
+    const VkFenceCreateInfo fenceCreateInfo = vkinit::FenceCreateInfo();
+    ENG_VK_CHECK(vkCreateFence(m_pVkDevice, &fenceCreateInfo, nullptr, &submit.pVkFence));
+
+    VkCommandBufferBeginInfo cmdBufBeginInfo = vkinit::CmdBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    ENG_VK_CHECK(vkBeginCommandBuffer(submit.pVkCmdBuffer, &cmdBufBeginInfo));
+    record(submit.pVkCmdBuffer);
+    ENG_VK_CHECK(vkEndCommandBuffer(submit.pVkCmdBuffer));
+
+    VkCommandBufferSubmitInfo cmdBufSubmitInfo = vkinit::CmdBufferSubmitInfo(submit.pVkCmdBuffer);
+    VkSubmitInfo2 submitInfo2 = vkinit::SubmitInfo2(&cmdBufSubmitInfo, nullptr, nullptr);
+
+    ENG_VK_CHECK(vkQueueSubmit2(m_pVkGraphicsQueue, 1, &submitInfo2, submit.pVkFence));
+
+    const uint64_t submitId = m_nextAsyncSubmitId++;
+    m_asyncSubmits.emplace(submitId, std::move(submit));
+
+    return submitId;
+}
+
+
+void VulkanEngine::PumpAsyncWork() noexcept
+{
+    std::vector<std::coroutine_handle<>> readyHandles;
+
+    for (auto it = m_asyncSubmits.begin(); it != m_asyncSubmits.end();) {
+        AsyncSubmit& submit = it->second;
+
+        if (vkGetFenceStatus(m_pVkDevice, submit.pVkFence) != VK_SUCCESS) {
+            ++it;
+            continue;
+        }
+
+        if (submit.onComplete) {
+            submit.onComplete();
+        }
+
+        vkDestroyFence(m_pVkDevice, submit.pVkFence, nullptr);
+        vkDestroyCommandPool(m_pVkDevice, submit.pVkCmdPool, nullptr);
+
+        readyHandles.insert(readyHandles.end(), submit.waiters.begin(), submit.waiters.end());
+
+        it = m_asyncSubmits.erase(it);
+    }
+
+    {
+        std::lock_guard lock(m_mainThreadResumeMutex);
+
+        readyHandles.insert(readyHandles.end(), m_mainThreadResumeQueue.begin(), m_mainThreadResumeQueue.end());
+        m_mainThreadResumeQueue.clear();
+    }
+
+    // coroutines resumed here may submit or queue themselves again, they are picked up by the next pump
+    for (std::coroutine_handle<> handle : readyHandles) {
+        handle.resume();
+    }
 }
 
 
-BufferHandle VulkanEngine::CreateBuffer(size_t size, VkBufferUsageFlags bufUsage, VmaMemoryUsage memUsage) const noexcept
+BufferHandle VulkanEngine::CreateBuffer(size_t size, VkBufferUsageFlags bufUsage, MemoryCategory category) const noexcept
 {
     VkBufferCreateInfo bufCreateInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
     bufCreateInfo.size = size;
     bufCreateInfo.usage = bufUsage;
 
-    VmaAllocationCreateInfo allocCreateInfo = {};
-    allocCreateInfo.usage = memUsage;
-    allocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    VmaAllocationCreateInfo allocCreateInfo = m_memoryPools.GetAllocationCreateInfo(category);
 
     BufferHandle buffer = {};
-    ENG_VK_CHECK(vmaCreateBuffer(m_pVMA, &bufCreateInfo, &allocCreateInfo, &buffer.pBuffer, &buffer.pAllocation, &buffer.allocationInfo));
+    VkResult result = vmaCreateBuffer(m_pVMA, &bufCreateInfo, &allocCreateInfo, &buffer.pBuffer, &buffer.pAllocation, &buffer.allocationInfo);
+
+    // pool blocks have a fixed size, what doesn't fit goes to the default pools
+    if (result != VK_SUCCESS && allocCreateInfo.pool != VK_NULL_HANDLE) {
+        allocCreateInfo.pool = VK_NULL_HANDLE;
+        result = vmaCreateBuffer(m_pVMA, &bufCreateInfo, &allocCreateInfo, &buffer.pBuffer, &buffer.pAllocation, &buffer.allocationInfo);
+    }
+
+    ENG_VK_CHECK(result);
+
+    TrackAllocation(buffer.pAllocation, category, buffer.allocationInfo.size);
+
+    if ((bufUsage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) != 0) {
+        VkBufferDeviceAddressInfo deviceAdressInfo = { 
+            .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+            .buffer = buffer.pBuffer
+        };
+
+        buffer.deviceAddress = vkGetBufferDeviceAddress(m_pVkDevice, &deviceAdressInfo);
+    }
+
+    if (category == MemoryCategory::MESHES) {
+        m_memoryPools.AddMovableBuffer(buffer, size, bufUsage);
+    }
 
     return buffer;
 }
 
 
+void VulkanEngine::TrackAllocation(VmaAllocation pAllocation, MemoryCategory category, uint64_t size) const noexcept
+{
+    // the category travels with the allocation, handles don't have to carry it
+    vmaSetAllocationUserData(m_pVMA, pAllocation, reinterpret_cast<void*>(static_cast<uintptr_t>(category)));
+    m_memoryCategoryBytes[(size_t)category].fetch_add(size, std::memory_order_relaxed);
+}
+
+
+void VulkanEngine::UntrackAllocation(VmaAllocation pAllocation) const noexcept
+{
+    if (pAllocation == VK_NULL_HANDLE) {
+        return;
+    }
+
+    VmaAllocationInfo allocationInfo = {};
+    vmaGetAllocationInfo(m_pVMA, pAllocation, &allocationInfo);
+
+    const size_t category = static_cast<size_t>(reinterpret_cast<uintptr_t>(allocationInfo.pUserData));
+    ENG_ASSERT(category < m_memoryCategoryBytes.size());
+
+    m_memoryCategoryBytes[category].fetch_sub(allocationInfo.size, std::memory_order_relaxed);
+}
+
+
 void VulkanEngine::DestroyBuffer(BufferHandle& buffer) const noexcept
 {
-    vmaDestroyBuffer(m_pVMA, buffer.pBuffer, buffer.pAllocation);
+    UntrackAllocation(buffer.pAllocation);
+
+    // a defragmentation pass moving it destroys the handle and frees the memory when it ends
+    if (!m_memoryPools.ReleaseMovable(buffer.pAllocation)) {
+        vmaDestroyBuffer(m_pVMA, buffer.pBuffer, buffer.pAllocation);
+    }
     
     buffer.pBuffer = VK_NULL_HANDLE;
     buffer.pAllocation = VK_NULL_HANDLE;
+    buffer.deviceAddress = 0;
+}
+
+
+VkBufferUsageFlags VulkanEngine::GetShaderBufferUsage(VkBufferUsageFlags usage) const noexcept
+{
+    return usage | (m_useDescriptorBuffer ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT : 0);
 }
 
 
@@ -1264,16 +2963,18 @@ ImageHandle VulkanEngine::CreateImage(const VkExtent3D& extent, VkFormat format,
         usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
     }
 
+    // mips are written by compute through storage views, blits stay the fallback
+    if (mipmapped && m_mipGenerator.IsFormatSupported(format)) {
+        usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    }
+
     VkImageCreateInfo imageInfo = vkinit::ImageCreateInfo(extent, format, usage);
     if (mipmapped) {
-        imageInfo.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(extent.width, extent.height)))) + 1;
+        imageInfo.mipLevels = GetTextureMipCount(extent.width, extent.height);
     }
 
-    VmaAllocationCreateInfo allocInfo = {};
-	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    ENG_VK_CHECK(vmaCreateImage(m_pVMA, &imageInfo, &allocInfo, &image.pImage, &image.pAllocation, nullptr));
+    const bool isRenderTarget = usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+    AllocateImage(imageInfo, isRenderTarget ? MemoryCategory::RENDER_TARGETS : MemoryCategory::TEXTURES, image);
     
     const VkImageAspectFlags aspectFlag = (format == VK_FORMAT_D32_SFLOAT ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
 
@@ -1283,45 +2984,174 @@ ImageHandle VulkanEngine::CreateImage(const VkExtent3D& extent, VkFormat format,
 	ENG_VK_CHECK(vkCreateImageView(m_pVkDevice, &viewInfo, nullptr, &image.pImageView));
 
     if (pData != nullptr) {
-        const size_t dataSize = extent.width * extent.height * extent.depth * 4;
-        BufferHandle stagingBuffer = CreateBuffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    
-        memcpy(stagingBuffer.allocationInfo.pMappedData, pData, dataSize);
-    
-        ImmediateSubmit([&](VkCommandBuffer cmdBuffer){
-            vkutil::TransitImage(cmdBuffer, image.pImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    
-            VkBufferImageCopy copyRegion = {};
-            copyRegion.bufferOffset = 0;
-            copyRegion.bufferRowLength = 0;
-            copyRegion.bufferImageHeight = 0;
-    
-            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            copyRegion.imageSubresource.mipLevel = 0;
-            copyRegion.imageSubresource.baseArrayLayer = 0;
-            copyRegion.imageSubresource.layerCount = 1;
-            copyRegion.imageExtent = extent;
-    
-            vkCmdCopyBufferToImage(cmdBuffer, stagingBuffer.pBuffer, image.pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-    
-            if (mipmapped) {
-                vkutil::GenerateMipmaps(cmdBuffer, image.pImage, VkExtent2D{image.extent.width, image.extent.height});
-            } else {
-                vkutil::TransitImage(cmdBuffer, image.pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-            }
-        });
-    
-        DestroyBuffer(stagingBuffer);
+        const bool isCompressed = IsBlockCompressedFormat(format);
+        const uint32_t dataMipCount = isCompressed ? imageInfo.mipLevels : 1;
+
+        std::vector<UploadBatch::MipData> mips(dataMipCount);
+        size_t dataSize = 0;
+
+        for (uint32_t mip = 0; mip < dataMipCount; ++mip) {
+            const uint32_t mipWidth = std::max(extent.width >> mip, 1u);
+            const uint32_t mipHeight = std::max(extent.height >> mip, 1u);
+
+            // formats outside texture_format.h are only ever created as 4 byte texels here
+            const uint64_t mipSize = GetTextureMipSize(format, extent.width, extent.height, mip);
+
+            mips[mip].pData = static_cast<const uint8_t*>(pData) + dataSize;
+            mips[mip].size = mipSize > 0 ? mipSize : (size_t)mipWidth * mipHeight * extent.depth * 4;
+
+            dataSize += mips[mip].size;
+        }
+
+        UploadBatch uploadBatch;
+
+        if (mipmapped && !isCompressed) {
+            uploadBatch.AddImageUpload(image, mips[0].pData, mips[0].size, true);
+        } else {
+            uploadBatch.AddImageMipsUpload(image, mips);
+        }
+
+        uploadBatch.Submit(*this);
     }
 
     return image;
 }
 
 
+ImageHandle VulkanEngine::CreateTextureImage(const VkExtent3D& extent, VkFormat format, uint32_t mipCount, const VkComponentMapping& swizzle)
+{
+    ENG_ASSERT(mipCount > 0 && mipCount <= GetTextureMipCount(extent.width, extent.height));
+
+    ImageHandle image = {};
+    image.extent = extent;
+    image.format = format;
+
+    // transfer source lets defragmentation copy it to its new place
+    const VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+    VkImageCreateInfo imageInfo = vkinit::ImageCreateInfo(extent, format, usage);
+    imageInfo.mipLevels = mipCount;
+
+    AllocateImage(imageInfo, MemoryCategory::TEXTURES, image);
+
+    VkImageViewCreateInfo viewInfo = vkinit::ImageViewCreateInfo(image.pImage, format, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = mipCount;
+    viewInfo.components = swizzle;
+
+	ENG_VK_CHECK(vkCreateImageView(m_pVkDevice, &viewInfo, nullptr, &image.pImageView));
+
+    m_memoryPools.AddMovableImage(image, mipCount, usage, swizzle);
+
+    return image;
+}
+
+
+void VulkanEngine::AllocateImage(const VkImageCreateInfo& imageInfo, MemoryCategory category, ImageHandle& image) const noexcept
+{
+    VmaAllocationCreateInfo allocCreateInfo = m_memoryPools.GetAllocationCreateInfo(category);
+
+    VmaAllocationInfo allocationInfo = {};
+    VkResult result = vmaCreateImage(m_pVMA, &imageInfo, &allocCreateInfo, &image.pImage, &image.pAllocation, &allocationInfo);
+
+    if (result != VK_SUCCESS && allocCreateInfo.pool != VK_NULL_HANDLE) {
+        allocCreateInfo.pool = VK_NULL_HANDLE;
+        result = vmaCreateImage(m_pVMA, &imageInfo, &allocCreateInfo, &image.pImage, &image.pAllocation, &allocationInfo);
+    }
+
+    ENG_VK_CHECK(result);
+
+    TrackAllocation(image.pAllocation, category, allocationInfo.size);
+}
+
+
+void VulkanEngine::UpdateMemoryBudget() noexcept
+{
+    // VMA refreshes the budgets from the driver once per frame index
+    vmaSetCurrentFrameIndex(m_pVMA, (uint32_t)m_frameNumber);
+    vmaGetHeapBudgets(m_pVMA, m_heapBudgets.data());
+
+    const VmaBudget& deviceBudget = m_heapBudgets[m_deviceHeapIndex];
+    const TextureStreamerStats streamerStats = m_textureStreamer.GetStats();
+
+    // what pending streamer changes are about to free is already counted out
+    const uint64_t releasingBytes = streamerStats.residentBytes - streamerStats.targetBytes;
+    const uint64_t projectedUsage = deviceBudget.usage - std::min(deviceBudget.usage, releasingBytes);
+    const uint64_t streamingTarget = (uint64_t)(deviceBudget.budget * DEVICE_MEMORY_STREAMING_FRACTION);
+
+    // textures stream in up to the target and shed their least recently used mips above it
+    if (projectedUsage > streamingTarget) {
+        const uint64_t excess = projectedUsage - streamingTarget;
+        m_textureStreamer.SetMemoryLimit(streamerStats.targetBytes - std::min(streamerStats.targetBytes, excess));
+    } else {
+        m_textureStreamer.SetMemoryLimit(streamerStats.targetBytes + (streamingTarget - projectedUsage));
+    }
+}
+
+
+bool VulkanEngine::IsDeviceMemoryLow() const noexcept
+{
+    const VmaBudget& deviceBudget = m_heapBudgets[m_deviceHeapIndex];
+    return deviceBudget.usage > deviceBudget.budget * DEVICE_MEMORY_LOW_FRACTION;
+}
+
+
+void VulkanEngine::PrintMemoryStats() const noexcept
+{
+    constexpr float bytesPerMB = 1024.f * 1024.f;
+
+    fmt::print("Device memory{}:\n", m_isMemoryBudgetSupported ? "" : " (budgets estimated, no VK_EXT_memory_budget)");
+
+    for (uint32_t heap = 0; heap < m_heapCount; ++heap) {
+        fmt::print("  heap {}{}: {:.1f} / {:.1f} MB\n", heap, heap == m_deviceHeapIndex ? " (device)" : "",
+            m_heapBudgets[heap].usage / bytesPerMB, m_heapBudgets[heap].budget / bytesPerMB);
+    }
+
+    for (size_t category = 0; category < m_memoryCategoryBytes.size(); ++category) {
+        fmt::print("  {}: {:.1f} MB\n", GetMemoryCategoryName((MemoryCategory)category),
+            m_memoryCategoryBytes[category].load(std::memory_order_relaxed) / bytesPerMB);
+    }
+
+    for (size_t pool = 0; pool < (size_t)MemoryPools::Pool::COUNT; ++pool) {
+        const MemoryPoolStats poolStats = m_memoryPools.GetPoolStats((MemoryPools::Pool)pool);
+        fmt::print("  {} pool: {:.1f} / {:.1f} MB\n", MemoryPools::GetPoolName((MemoryPools::Pool)pool),
+            poolStats.allocationBytes / bytesPerMB, poolStats.blockBytes / bytesPerMB);
+    }
+
+    fmt::print("  defragmented: {:.1f} MB\n", m_memoryPools.GetMovedBytes() / bytesPerMB);
+
+    if (m_useDescriptorBuffer) {
+        fmt::print("  descriptor buffer: {:.2f} / {:.1f} MB\n", m_descriptorBuffer.GetUsedSize() / bytesPerMB, m_descriptorBuffer.GetSize() / bytesPerMB);
+    }
+}
+
+
+bool VulkanEngine::IsTextureFormatSupported(VkFormat format) const noexcept
+{
+    TextureFormatInfo formatInfo;
+    if (!GetTextureFormatInfo(format, formatInfo)) {
+        return false;
+    }
+
+    if (formatInfo.isCompressed && !m_isTextureCompressionBCSupported) {
+        return false;
+    }
+
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(m_pVkPhysDevice, format, &formatProps);
+
+    const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+    return (formatProps.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+
 void VulkanEngine::DestroyImage(ImageHandle& image)
 {
-    vkDestroyImageView(m_pVkDevice, image.pImageView, nullptr);
-	vmaDestroyImage(m_pVMA, image.pImage, image.pAllocation);
+    UntrackAllocation(image.pAllocation);
+
+    if (!m_memoryPools.ReleaseMovable(image.pAllocation)) {
+        vkDestroyImageView(m_pVkDevice, image.pImageView, nullptr);
+        vmaDestroyImage(m_pVMA, image.pImage, image.pAllocation);
+    }
 
     image.pImage = VK_NULL_HANDLE;
     image.pImageView = VK_NULL_HANDLE;
@@ -1331,48 +3161,122 @@ void VulkanEngine::DestroyImage(ImageHandle& image)
 }
 
 
-MeshGpuBuffers VulkanEngine::UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices)  const noexcept
+ImageID VulkanEngine::RegisterImage(const ImageHandle& image) noexcept
 {
-    
-    MeshGpuBuffers mesh;
-    
-	const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-	mesh.vertBuff = CreateBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
+    return m_images.Insert(SharedResource<ImageHandle> { image, 1 });
+}
 
-	VkBufferDeviceAddressInfo deviceAdressInfo = { 
-        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        .buffer = mesh.vertBuff.pBuffer
-    };
-	mesh.vertBufferGpuAddress = vkGetBufferDeviceAddress(m_pVkDevice, &deviceAdressInfo);
 
-    const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
-	mesh.idxBuff = CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+void VulkanEngine::AcquireImage(ImageID id) noexcept
+{
+    SharedResource<ImageHandle>* pShared = m_images.Get(id);
+    ENG_ASSERT(pShared != nullptr);
+
+    ++pShared->refCount;
+}
+
 
-    BufferHandle stagingBuff = CreateBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+void VulkanEngine::ReleaseImage(ImageID id) noexcept
+{
+    SharedResource<ImageHandle>* pShared = m_images.Get(id);
+    ENG_ASSERT(pShared != nullptr && pShared->refCount > 0);
 
-	void* data = stagingBuff.pAllocation->GetMappedData();
+    if (--pShared->refCount == 0) {
+        DestroyImage(pShared->resource);
+        m_images.Erase(id);
+    }
+}
 
-	memcpy(data, vertices.data(), vertexBufferSize);
-	memcpy((uint8_t*)data + vertexBufferSize, indices.data(), indexBufferSize);
 
-	ImmediateSubmit([&](VkCommandBuffer pCmd) {
-		VkBufferCopy vertexCopy = { 0 };
-		vertexCopy.dstOffset = 0;
-		vertexCopy.srcOffset = 0;
-		vertexCopy.size = vertexBufferSize;
+ImageHandle& VulkanEngine::GetImage(ImageID id) noexcept
+{
+    SharedResource<ImageHandle>* pShared = m_images.Get(id);
+    ENG_ASSERT(pShared != nullptr);
 
-		vkCmdCopyBuffer(pCmd, stagingBuff.pBuffer, mesh.vertBuff.pBuffer, 1, &vertexCopy);
+    return pShared->resource;
+}
 
-		VkBufferCopy indexCopy = { 0 };
-		indexCopy.dstOffset = 0;
-		indexCopy.srcOffset = vertexBufferSize;
-		indexCopy.size = indexBufferSize;
 
-		vkCmdCopyBuffer(pCmd, stagingBuff.pBuffer, mesh.idxBuff.pBuffer, 1, &indexCopy);
-	});
+const ImageHandle& VulkanEngine::GetImage(ImageID id) const noexcept
+{
+    const SharedResource<ImageHandle>* pShared = m_images.Get(id);
+    ENG_ASSERT(pShared != nullptr);
+
+    return pShared->resource;
+}
+
+
+BufferID VulkanEngine::RegisterBuffer(const BufferHandle& buffer) noexcept
+{
+    return m_buffers.Insert(SharedResource<BufferHandle> { buffer, 1 });
+}
+
+
+void VulkanEngine::AcquireBuffer(BufferID id) noexcept
+{
+    SharedResource<BufferHandle>* pShared = m_buffers.Get(id);
+    ENG_ASSERT(pShared != nullptr);
+
+    ++pShared->refCount;
+}
+
+
+void VulkanEngine::ReleaseBuffer(BufferID id) noexcept
+{
+    SharedResource<BufferHandle>* pShared = m_buffers.Get(id);
+    ENG_ASSERT(pShared != nullptr && pShared->refCount > 0);
+
+    if (--pShared->refCount == 0) {
+        DestroyBuffer(pShared->resource);
+        m_buffers.Erase(id);
+    }
+}
+
+
+BufferHandle& VulkanEngine::GetBuffer(BufferID id) noexcept
+{
+    SharedResource<BufferHandle>* pShared = m_buffers.Get(id);
+    ENG_ASSERT(pShared != nullptr);
+
+    return pShared->resource;
+}
+
+
+const BufferHandle& VulkanEngine::GetBuffer(BufferID id) const noexcept
+{
+    const SharedResource<BufferHandle>* pShared = m_buffers.Get(id);
+    ENG_ASSERT(pShared != nullptr);
+
+    return pShared->resource;
+}
+
+
+MeshGpuBuffers VulkanEngine::CreateMeshBuffers(size_t indexCount, size_t vertexCount) noexcept
+{
+    MeshGpuBuffers mesh;
+
+    // zero sized buffers aren't allowed, empty meshes still get valid handles
+	const size_t vertexBufferSize = std::max<size_t>(vertexCount * sizeof(Vertex), 1);
+    // transfer source lets defragmentation copy them to their new place
+	mesh.vertBuff = RegisterBuffer(CreateBuffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemoryCategory::MESHES));
+
+    const size_t indexBufferSize = std::max<size_t>(indexCount * sizeof(uint32_t), 1);
+	mesh.idxBuff = RegisterBuffer(CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryCategory::MESHES));
+
+	return mesh;
+}
+
+
+MeshGpuBuffers VulkanEngine::UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) noexcept
+{
+    MeshGpuBuffers mesh = CreateMeshBuffers(indices.size(), vertices.size());
 
-	DestroyBuffer(stagingBuff);
+    UploadBatch batch;
+    batch.AddBufferUpload(GetBuffer(mesh.vertBuff).pBuffer, vertices.data(), vertices.size_bytes());
+    batch.AddBufferUpload(GetBuffer(mesh.idxBuff).pBuffer, indices.data(), indices.size_bytes());
+    batch.Submit(*this);
 
 	return mesh;
 }
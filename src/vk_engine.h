@@ -1,19 +1,35 @@
 #pragma once
 
 #include "vk_types.h"
+#include "vk_deferred_destroy.h"
 #include "vk_descriptors.h"
 #include "vk_loader.h"
+#include "vk_memory_pools.h"
+#include "vk_mip_generator.h"
+#include "vk_pipeline_compiler.h"
+#include "vk_pipeline_permutations.h"
+#include "vk_shader_archive.h"
+#include "vk_texture_streamer.h"
 
 #include "camera.h"
+#include "task.h"
+#include "timeline.h"
+#include "triple_buffer.h"
 
 #include <array>
+#include <atomic>
+#include <coroutine>
 #include <deque>
 
 #include <functional>
+#include <mutex>
+#include <thread>
 
 #include <cstdint>
 
 
+// Deletors may be pushed from job threads, init work runs on them. Per-frame releases of plain
+// resources go to the DeferredDestroyQueue, this one is for init and rare teardown work.
 class DeletionQueue final
 {
 public:
@@ -21,19 +37,26 @@ public:
 
 	void PushDeletor(std::function<void()>&& deletor) noexcept
     {
+        std::lock_guard lock(m_mutex);
 		m_deletors.emplace_back(std::forward<std::function<void()>>(deletor));
 	}
 
 	void Flush() noexcept
     {
-		for (auto it = m_deletors.rbegin(); it != m_deletors.rend(); ++it) {
+        std::deque<std::function<void()>> deletors;
+
+        {
+            std::lock_guard lock(m_mutex);
+            deletors.swap(m_deletors);
+        }
+
+		for (auto it = deletors.rbegin(); it != deletors.rend(); ++it) {
 			(*it)();
 		}
-
-		m_deletors.clear();
 	}
 
 private:
+    std::mutex m_mutex;
     std::deque<std::function<void()>> m_deletors;
 };
 
@@ -42,20 +65,49 @@ struct RenderObject
 {
     uint32_t indexCount;
     uint32_t firstIndex;
-    VkBuffer indexBuffer;
+    // resolved while recording, defragmentation may move the buffers behind the ids
+    BufferID indexBuffer;
+    BufferID vertexBuffer;
     
     MaterialInstance* pMaterial;
+    uint32_t meshID;
     Bounds bounds;
 
     glm::mat4 transform;
-    VkDeviceAddress vertexBufferAddress;
+
+    // opaque draws lay down depth in the pre-pass and shade with depth EQUAL afterwards
+    bool useDepthPrepass;
 };
 
 
-struct RenderContext
+// Persistent draw records. Objects are registered when a scene is added and patched only
+// when their node changes, ids stay stable while the dense array is compacted on removal.
+class RenderContext final
 {
-	std::vector<RenderObject> opaqueSurfaces;
-	std::vector<RenderObject> transparentSurfaces;
+public:
+    RenderContext() = default;
+
+    RenderObjectID AddObject(const RenderObject& obj) noexcept;
+    void RemoveObject(RenderObjectID id) noexcept;
+
+    void SetObjectTransform(RenderObjectID id, const glm::mat4& transform) noexcept;
+    void SetObjectMaterial(RenderObjectID id, MaterialInstance* pMaterial) noexcept;
+    void SetObjectDepthPrepass(RenderObjectID id, bool useDepthPrepass) noexcept;
+
+    void Clear() noexcept;
+
+    std::span<const RenderObject> GetObjects() const noexcept { return m_objects; }
+    size_t GetObjectCount() const noexcept { return m_objects.size(); }
+
+private:
+    RenderObject& GetObject(RenderObjectID id) noexcept;
+
+private:
+    std::vector<RenderObject> m_objects;
+    std::vector<RenderObjectID> m_objectIDs;
+
+    std::vector<uint32_t> m_objectIndices;
+    std::vector<RenderObjectID> m_freeIDs;
 };
 
 
@@ -66,47 +118,132 @@ struct GLTFMetallic_Roughness
     void BuildPipelines(VulkanEngine* pEngine);
 	void ClearResources(VkDevice device);
 
-	MaterialInstance WriteMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator);
+	// std::nullopt when the descriptor buffer has no room left for the material
+	std::optional<MaterialInstance> WriteMaterial(VulkanEngine& engine, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator);
+
+    // data buffer, color and metal-rough textures
+    static constexpr uint32_t DESCRIPTOR_BINDING_COUNT = 3;
+
+    // Specialization constant ids of mesh.frag, a shading pipeline is built per combination in use
+    enum class MaterialFeature : uint32_t
+    {
+        COLOR_TEXTURE,
+        ALPHA_TEST,
+        COUNT
+    };
 
+	// std430 layout of input_structures.glsl, packed back to back in a scene's storage buffer
 	struct MaterialConstants
     {
 		glm::vec4 colorFactors;
+		// metallic, roughness, alpha cutoff
 		glm::vec4 metallicRoughnessFactors;
-		glm::vec4 PADDING[14];
 	};
 
 	struct MaterialResources
     {
-		ImageHandle colorImage;
+		ImageID colorImage;
 		VkSampler colorSampler;
-		ImageHandle metalRoughImage;
+		ImageID metalRoughImage;
 		VkSampler metalRoughSampler;
-		VkBuffer dataBuffer;
-		uint32_t dataBufferOffset;
+		// binding 0 covers the constants of every material in dataBuffer, draws push the index of theirs
+		BufferID dataBuffer;
+		uint32_t dataBufferSize;
+		uint32_t constantsIndex;
+		// discards fragments below the cutoff in the constants, such materials skip the depth pre-pass
+		bool useAlphaTest;
 	};
 
-    MaterialPipeline opaquePipeline;
-	MaterialPipeline transparentPipeline;
+    // what descTemplate writes a material set from
+    struct DescriptorData
+    {
+        VkDescriptorBufferInfo constants;
+        VkDescriptorImageInfo colorImage;
+        VkDescriptorImageInfo metalRoughImage;
+    };
+
+    DescriptorData GetDescriptorData(const VulkanEngine& engine, const MaterialResources& resources) const noexcept;
+    // Writes the descriptors of resources into set of VulkanEngine::m_descriptorBuffer
+    void WriteDescriptorBufferSet(VulkanEngine& engine, const DescriptorBufferSet& set, const MaterialResources& resources) noexcept;
+
+    // Shading pipeline of builder specialized for features, a mask of MaterialFeature bits
+    MaterialPipeline* GetPermutation(VulkanEngine& engine, const vkutil::PipelineBuilder& builder, uint32_t features) const noexcept;
+
+    // opaque without features, built up front: the permutations draw with it until they are compiled
+    MaterialPipeline* pDefaultPipeline;
+    // writes depth only, opaque materials shade the surviving fragments with depthEqualBuilder permutations
+    MaterialPipeline* pDepthPrepassPipeline;
+
+    vkutil::PipelineBuilder opaqueBuilder;
+    vkutil::PipelineBuilder transparentBuilder;
+    vkutil::PipelineBuilder depthEqualBuilder;
 
 	VkDescriptorSetLayout descSetLayout;
 
-	DescriptorWriter descWriter;
+	DescriptorUpdateTemplate descTemplate;
+    // descSetLayout inside VulkanEngine::m_descriptorBuffer, descTemplate isn't built then
+    DescriptorBufferLayout descBufferLayout;
+
+    uint32_t nextMaterialID = 0;
 };
 
 
 struct MeshNode : public Node
 {
-	void Render(const glm::mat4& topMatrix, RenderContext& ctx) override;
+    void RefreshTransform(const glm::mat4& parentTrs) override;
+
+    void RegisterDraws(RenderContext& ctx) override;
+    void UnregisterDraws(RenderContext& ctx) override;
+
+    void ForEachDraw(const std::function<void(RenderObjectID)>& func) override;
+
+    // The surface belongs to the mesh, so the material changes for every node drawing it. This node's
+    // records are patched right away, the others pick it up when they register their draws again.
+    void SetSurfaceMaterial(size_t surfaceIdx, std::shared_ptr<GLTFMaterial> pMaterial) noexcept;
 
 	std::shared_ptr<MeshAsset> pMesh;
+
+    // one draw record per mesh surface, valid while the node is registered in pDrawCtx
+    std::vector<RenderObjectID> drawIDs;
+    RenderContext* pDrawCtx = nullptr;
+};
+
+
+// What the simulation hands to the render thread for one frame, immutable once published.
+// Draws are copies in draw order, scene changes after the cull don't reach them.
+struct FramePacket
+{
+    SceneData sceneData;
+    glm::vec3 cameraPosition;
+
+    // visible draws sorted by their BuildDrawSortKey keys, opaque ones first
+    std::vector<RenderObject> draws;
+    size_t depthPrepassDrawCount;
+    // readiness of the pre-pass pipeline the draws were sorted with
+    bool isDepthPrepassReady;
+    // VulkanEngine::m_drawContextVersion at the cull
+    uint64_t drawContextVersion;
+
+    bool isFlyCameraMode;
+
+    float simulationTime;
+    float sceneUpdateTime;
+    float cullTime;
+    float sortTime;
 };
 
 
 struct EngineStats
 {
+    // render thread, the simulation runs next to it
     float frameTime;
+    float simulationTime;
     float sceneUpdateTime;
+    float cullTime;
+    float sortTime;
     float meshRenderTime;
+    float gpuDepthPrepassTime;
+    float gpuGeometryTime;
     int triangleCount;
     int drawCallCount;
 };
@@ -125,11 +262,24 @@ private:
 	    VkFence pVkRenderFence;
 
         DeletionQueue deletionQueue;
-        DescriptorAllocatorGrowable descriptorAllocator;
+        DescriptorAllocatorPerThread descriptorAllocator;
+
+        // geometry pass begin, depth pre-pass end, geometry pass end
+        VkQueryPool pVkTimestampQueryPool;
+        bool hasTimestamps = false;
     };
 
+    static constexpr uint32_t GEOMETRY_TIMESTAMP_COUNT = 3;
+
     static constexpr size_t FRAMES_DATA_INST_COUNT = UINTMAX_C(2);
 
+    // scene and material sets with the descriptor buffer backend, a material set takes a few hundred bytes at most
+    static constexpr size_t DESCRIPTOR_BUFFER_SIZE = 8 * 1024 * 1024;
+
+    // fractions of the device heap budget: streamed textures fill memory up to the first, loads stop past the second
+    static constexpr float DEVICE_MEMORY_STREAMING_FRACTION = 0.85f;
+    static constexpr float DEVICE_MEMORY_LOW_FRACTION = 0.95f;
+
     struct ComputePushConstants
     {
         glm::vec4 data[4];
@@ -145,6 +295,37 @@ private:
         ComputePushConstants data;
     };
 
+    // Submission that nobody blocks on, retired by PumpAsyncWork once its fence is signaled
+    struct AsyncSubmit
+    {
+        VkCommandPool pVkCmdPool;
+        VkCommandBuffer pVkCmdBuffer;
+        VkFence pVkFence;
+
+        std::function<void()> onComplete;
+        std::vector<std::coroutine_handle<>> waiters;
+    };
+
+    struct MainThreadAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) const noexcept;
+        void await_resume() const noexcept {}
+
+        VulkanEngine* pEngine;
+    };
+
+    struct AsyncSubmitAwaiter
+    {
+        // the submission may already be retired
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> handle) const noexcept;
+        void await_resume() const noexcept {}
+
+        VulkanEngine* pEngine;
+        uint64_t submitId;
+    };
+
 public:
     static VulkanEngine& GetInstance() noexcept;
 
@@ -152,10 +333,18 @@ public:
     void Init() noexcept;
     void Terminate() noexcept;
     void Run() noexcept;
+    void RunBenchmark() noexcept;
+    // Compares scene load times of the glTF and the cooked scene paths, -1 marks a failed load
+    void RunLoadBenchmark() noexcept;
+    // Times writing the descriptor sets of a large scene's materials with write structs, with the update template
+    // and, with the descriptor buffer backend, into the descriptor buffer
+    void RunMaterialBenchmark() noexcept;
 
     bool IsInitialized() const noexcept { return m_isInitialized; }
 
-    MeshGpuBuffers UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) const noexcept;
+    // Buffers without contents, to be filled through an UploadBatch. Both are registered, see RegisterBuffer.
+    MeshGpuBuffers CreateMeshBuffers(size_t indexCount, size_t vertexCount) noexcept;
+    MeshGpuBuffers UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) noexcept;
 
 public:
     VulkanEngine() = default;
@@ -166,10 +355,20 @@ public:
     VulkanEngine& operator=(const VulkanEngine& other) = delete;
     VulkanEngine& operator=(VulkanEngine&& other) = delete;
 
-    void Render() noexcept;
+    bool PollEvents() noexcept;
+    // Simulates and renders one frame on the calling thread, Run overlaps the two on separate threads
+    void RunFrame() noexcept;
+    void RunRenderThread() noexcept;
+
+    // Simulation side: camera, scene data and the sorted visible draws
+    void Simulate(FramePacket& packet) noexcept;
+    void CullDraws(FramePacket& packet) noexcept;
+
+    void RenderFrame(const FramePacket& packet) noexcept;
+    void Render(const FramePacket& packet) noexcept;
     void RenderBackground(VkCommandBuffer pCmdBuf) noexcept;
-    void RenderGeometry(VkCommandBuffer pCmdBuf) noexcept;
-    void RenderDbgUI() noexcept;
+    void RenderGeometry(VkCommandBuffer pCmdBuf, const FramePacket& packet) noexcept;
+    void RenderDbgUI(const FramePacket& packet) noexcept;
     void RenderImGui(VkCommandBuffer pCmdBuf, VkImageView pTargetImageView) noexcept;
 
     bool InitVulkan() noexcept;
@@ -184,24 +383,101 @@ public:
 
     bool InitDescriptors() noexcept;
 
+    void InitPipelineCache() noexcept;
     bool InitPipelines() noexcept;
     bool InitBackgroundPipelines() noexcept;
 
     void InitDefaultData() noexcept;
+    void InitDefaultMaterial() noexcept;
 
     bool InitImGui() noexcept;
     void ImmediateSubmit(std::function<void(VkCommandBuffer pCmdBuf)>&& function) const noexcept;
 
-    void UpdateScene();
-
-    BufferHandle CreateBuffer(size_t size, VkBufferUsageFlags bufUsage, VmaMemoryUsage memUsage) const noexcept;
+    void UpdateScene(FramePacket& packet) noexcept;
+    // Feeds the screen size of this frame's visible draws to the texture streamer
+    void UpdateTextureStreaming(const FramePacket& packet) noexcept;
+
+    void AddScene(const std::string& name, std::shared_ptr<LoadedGLTF> pScene) noexcept;
+    // Lets defragmentation move the mesh buffers of an uploaded scene, draws look them up by id
+    void EnableMeshMoves(LoadedGLTF& scene) noexcept;
+    void RemoveScene(const std::string& name) noexcept;
+
+    // Loads a glTF or cooked (.vkscene) scene without blocking and adds it under name at a frame boundary once its uploads are done.
+    // Frames keep drawing the scenes that are already loaded in the meantime.
+    std::shared_ptr<SceneLoadState> StartSceneLoad(const std::string& name, const std::filesystem::path& filepath) noexcept;
+    // Runs the frame boundary work until every started load is finished
+    void WaitSceneLoads() noexcept;
+
+    // Parses and decodes on a background job, then creates the resources and submits their uploads on the main thread.
+    // The awaiting coroutine resumes on the main thread once the GPU is done, nullptr if the load failed or was cancelled.
+    Task<std::shared_ptr<LoadedGLTF>> LoadSceneAsync(std::filesystem::path filepath, std::shared_ptr<SceneLoadState> pState = nullptr) noexcept;
+    // Cooked branch of LoadSceneAsync, maps the file and faults its pages in on a background job
+    Task<std::shared_ptr<LoadedGLTF>> LoadCookedSceneAsync(std::filesystem::path filepath, std::shared_ptr<SceneLoadState> pState) noexcept;
+    DetachedTask LoadAndPublishScene(std::shared_ptr<SceneLoadState> pState) noexcept;
+
+    // co_await continues the coroutine on the main thread at the next frame boundary
+    MainThreadAwaiter ResumeOnMainThread() noexcept { return MainThreadAwaiter { this }; }
+
+    // The thread that runs the engine's main thread only work: the one that called Init, the render thread
+    // while Run is in progress. It isn't a job system thread then, so its job system index can't tell.
+    bool IsMainThread() const noexcept { return std::this_thread::get_id() == m_mainThreadID; }
+
+    // Records and submits on the graphics queue without waiting. onComplete runs on the main thread
+    // once the GPU is done with it. Main thread only.
+    uint64_t SubmitAsync(const std::function<void(VkCommandBuffer pCmdBuf)>& record, std::function<void()>&& onComplete) noexcept;
+    AsyncSubmitAwaiter WaitForSubmit(uint64_t submitId) noexcept { return AsyncSubmitAwaiter { this, submitId }; }
+
+    // Retires finished async submissions and resumes the coroutines waiting for them or for the main thread
+    void PumpAsyncWork() noexcept;
+
+    // The category picks the memory type and the pool, see MemoryPools::GetAllocationCreateInfo
+    BufferHandle CreateBuffer(size_t size, VkBufferUsageFlags bufUsage, MemoryCategory category) const noexcept;
     void DestroyBuffer(BufferHandle& buffer) const noexcept;
+    // Usage of uniform and storage buffers bound through descriptors, descriptor buffers reference them by device address
+    VkBufferUsageFlags GetShaderBufferUsage(VkBufferUsageFlags usage) const noexcept;
 
+    // Block compressed pData holds the whole chain when mipmapped, the GPU can't generate mips for those formats.
+    // Images with attachment usage count as render targets, the rest as textures.
     ImageHandle CreateImage(const VkExtent3D& extent, VkFormat format, VkImageUsageFlags usage, const void* pData = nullptr, bool mipmapped = false);
+    // Sampled image with a stored mip chain, filled through UploadBatch::AddImageMipsUpload
+    ImageHandle CreateTextureImage(const VkExtent3D& extent, VkFormat format, uint32_t mipCount, const VkComponentMapping& swizzle = {});
     void DestroyImage(ImageHandle& image);
+    void AllocateImage(const VkImageCreateInfo& imageInfo, MemoryCategory category, ImageHandle& image) const noexcept;
+
+    // Shared images and buffers of scenes and materials. Registering hands the caller the first reference,
+    // the resource is destroyed right away when the last one is released, so releases have to wait for the
+    // frames in flight. Lookups of stale ids assert. Main thread only.
+    ImageID RegisterImage(const ImageHandle& image) noexcept;
+    void AcquireImage(ImageID id) noexcept;
+    void ReleaseImage(ImageID id) noexcept;
+    ImageHandle& GetImage(ImageID id) noexcept;
+    const ImageHandle& GetImage(ImageID id) const noexcept;
+
+    BufferID RegisterBuffer(const BufferHandle& buffer) noexcept;
+    void AcquireBuffer(BufferID id) noexcept;
+    void ReleaseBuffer(BufferID id) noexcept;
+    BufferHandle& GetBuffer(BufferID id) noexcept;
+    const BufferHandle& GetBuffer(BufferID id) const noexcept;
+
+    bool IsTextureFormatSupported(VkFormat format) const noexcept;
+
+    // Refreshes the heap budgets and hands the texture streamer the room left on the device heap
+    void UpdateMemoryBudget() noexcept;
+    // New scenes are refused past this point, what is loaded already keeps working
+    bool IsDeviceMemoryLow() const noexcept;
+    void PrintMemoryStats() const noexcept;
+
+    void TrackAllocation(VmaAllocation pAllocation, MemoryCategory category, uint64_t size) const noexcept;
+    void UntrackAllocation(VmaAllocation pAllocation) const noexcept;
 
     FrameData& GetCurrentFrameData() noexcept { return m_framesData[m_frameNumber % FRAMES_DATA_INST_COUNT]; }
+    // Flushed once every frame in flight that could reference the current state has completed
+    DeletionQueue& GetReleaseDeletionQueue() noexcept { return m_framesData[(m_frameNumber + 1) % FRAMES_DATA_INST_COUNT].deletionQueue; }
 
+    // Retire frames for m_deferredDestroys: what the frame being recorded uses is freed at the current one,
+    // what only the frames in flight may still use at the release one
+    uint64_t GetCurrentRetireFrame() const noexcept { return m_frameNumber + FRAMES_DATA_INST_COUNT; }
+    uint64_t GetReleaseRetireFrame() const noexcept { return m_frameNumber + FRAMES_DATA_INST_COUNT - 1; }
 public:
     struct SDL_Window* m_pWindow = nullptr;
 	VkExtent2D m_windowExtent = { 1000 , 720 };
@@ -224,6 +500,11 @@ public:
     VkQueue m_pVkGraphicsQueue = VK_NULL_HANDLE;
     uint32_t m_graphicsQueueFamily;
 
+    VkPhysicalDeviceProperties m_vkPhysDeviceProps = {};
+
+    float m_timestampPeriodNs = 0.f;
+    bool m_isTimestampSupported = false;
+
     ImageHandle m_rndImage;
     ImageHandle m_depthImage;
     VkExtent2D m_rndExtent;
@@ -231,6 +512,14 @@ public:
     VkFilter m_dynResCopyFilter = VK_FILTER_LINEAR;
 
     DescriptorAllocatorGrowable m_globalDescriptorAllocator;
+    // owns the layouts built through it, they live until the engine terminates
+    DescriptorLayoutCache m_descriptorLayoutCache;
+
+    // Scene and material sets live in m_descriptorBuffer instead of descriptor pools, requested with
+    // --descriptor-buffer and turned off again when VK_EXT_descriptor_buffer is missing
+    bool m_useDescriptorBuffer = false;
+    DescriptorBuffer m_descriptorBuffer;
+    BufferHandle m_descriptorBufferMemory = {};
 
 	VkDescriptorSet m_pComputeBackgroundDescriptors = VK_NULL_HANDLE;
 	VkDescriptorSetLayout m_pComputeBackgroundDescriptorLayout = VK_NULL_HANDLE;
@@ -242,33 +531,110 @@ public:
     VkCommandPool m_pImmCommandPool;
 
     VmaAllocator m_pVMA = VK_NULL_HANDLE;
+    bool m_isMemoryBudgetSupported = false;
+
+    // largest device local heap, textures and meshes end up there
+    uint32_t m_deviceHeapIndex = 0;
+    uint32_t m_heapCount = 0;
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> m_heapBudgets = {};
+
+    // bytes per MemoryCategory, resources are created on job threads as well
+    mutable std::array<std::atomic<uint64_t>, (size_t)MemoryCategory::COUNT> m_memoryCategoryBytes = {};
+    // CreateBuffer and DestroyBuffer register movable allocations, it locks on its own
+    mutable MemoryPools m_memoryPools;
     DeletionQueue m_mainDeletionQueue;
+    DeferredDestroyQueue m_deferredDestroys;
+
+    template <typename T>
+    struct SharedResource
+    {
+        T resource;
+        uint32_t refCount;
+    };
+
+    SlotMap<SharedResource<ImageHandle>, ImageHandle> m_images;
+    SlotMap<SharedResource<BufferHandle>, BufferHandle> m_buffers;
+
+    ShaderArchive m_shaderArchive;
+
+    VkPipelineCache m_pVkPipelineCache = VK_NULL_HANDLE;
+    bool m_usePipelineCache = true;
+    bool m_isPipelineCacheLoaded = false;
+
+    PipelineCompiler m_pipelineCompiler;
+    PipelinePermutationCache m_pipelinePermutations;
+    bool m_isGraphicsPipelineLibrarySupported = false;
+    // VK_EXT_extended_dynamic_state3 blend enable and equation, opaque and transparent materials share pipelines with it
+    bool m_isBlendDynamicStateSupported = false;
+
+    bool m_isTextureCompressionBCSupported = false;
+
+    MipGenerator m_mipGenerator;
+    TextureStreamer m_textureStreamer;
 
     std::vector<ComputeEffect> m_backgroundEffects;
     int32_t m_currBackgroundEffect = 0;
 
-    SceneData m_sceneData;
     VkDescriptorSetLayout m_pSceneDataDescriptorLayout;
+    // writes a VkDescriptorBufferInfo of the frame's scene data buffer
+    DescriptorUpdateTemplate m_sceneDataTemplate;
+    DescriptorBufferLayout m_sceneDataBufferLayout;
 
+    // The render thread adds and removes scenes, the simulation culls against the objects. Both hold the mutex.
     RenderContext m_mainDrawContext;
+    std::mutex m_drawContextMutex;
+    // bumped when a scene is removed, packets culled before reference materials that are about to be released
+    uint64_t m_drawContextVersion = 0;
+    std::atomic<bool> m_isDepthPrepassReady = false;
+
+    // simulation thread scratch
+    std::vector<uint8_t> m_drawVisibility;
+    std::vector<uint64_t> m_drawObjectKeys;
+    std::vector<uint64_t> m_drawSortKeys;
+    std::vector<uint32_t> m_drawSortIndices;
+    std::vector<uint64_t> m_drawSortTmpKeys;
+    std::vector<uint32_t> m_drawSortTmpIndices;
+
+    uint32_t m_nextMeshID = 0;
+
     std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> m_loadedScenes;
+    std::vector<std::shared_ptr<SceneLoadState>> m_sceneLoads;
+
+    std::unordered_map<uint64_t, AsyncSubmit> m_asyncSubmits;
+    uint64_t m_nextAsyncSubmitId = 0;
+
+    std::thread::id m_mainThreadID;
+
+    std::mutex m_mainThreadResumeMutex;
+    std::vector<std::coroutine_handle<>> m_mainThreadResumeQueue;
 
     VkDescriptorSetLayout m_singleImageDescriptorLayout;
 
     MaterialInstance m_defaultData;
     GLTFMetallic_Roughness m_metalRoughMaterial;
 
-    ImageHandle m_whiteImage;
-	ImageHandle m_blackImage;
-	ImageHandle m_greyImage;
-	ImageHandle m_checkerboardImage;
+    ImageID m_whiteImage;
+	ImageID m_blackImage;
+	ImageID m_greyImage;
+	ImageID m_checkerboardImage;
 
 	VkSampler m_nearestSampler;
     VkSampler m_linearSampler;
 
+    // Simulation thread, the render thread's UI sets the speed through m_cameraSpeed
     Camera m_mainCamera;
+    std::atomic<float> m_cameraSpeed = 1.f;
+
+    // The SDL backend of ImGui stays on the window thread, the render thread builds the UI. Both hold it
+    // while they use the ImGui context.
+    std::mutex m_imguiMutex;
+
+    TripleBuffer<FramePacket> m_framePackets;
+
     EngineStats m_stats;
 
+    Timeline m_startupTimeline;
+
 	uint64_t m_frameNumber = 0;
     bool m_isInitialized = false;
     bool m_isFlyCameraMode = false;
@@ -8,5 +8,6 @@ namespace vkutil
     void TransitImage(VkCommandBuffer pCmdBuf, VkImage pImage, VkImageLayout currentLayout, VkImageLayout newLayout) noexcept;
     void CopyImage(VkCommandBuffer pCmdBuf, VkImage pSrcImage, const VkExtent2D& srcExtent, VkImage pDstImage, const VkExtent2D& dstExtent, VkFilter filter = VK_FILTER_LINEAR) noexcept;
 
+    // Blit chain with a barrier per mip, MipGenerator replaces it for formats compute shaders can write
     void GenerateMipmaps(VkCommandBuffer pCmdBuf, VkImage pImage, VkExtent2D extent) noexcept;
 }
@@ -172,12 +172,12 @@ namespace vkinit
     }
 
     
-    VkRenderingAttachmentInfo DepthAttachmentInfo(VkImageView pImageView, VkImageLayout layout) noexcept
+    VkRenderingAttachmentInfo DepthAttachmentInfo(VkImageView pImageView, VkImageLayout layout, VkAttachmentLoadOp loadOp) noexcept
     {
         VkRenderingAttachmentInfo depthAttachment = {.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO};
         depthAttachment.imageView = pImageView;
         depthAttachment.imageLayout = layout;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.loadOp = loadOp;
         depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         depthAttachment.clearValue.depthStencil.depth = 0.f;
 
@@ -191,7 +191,7 @@ namespace vkinit
             .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
             .renderArea = VkRect2D { VkOffset2D { 0, 0 }, extent },
             .layerCount = 1,
-            .colorAttachmentCount = 1,
+            .colorAttachmentCount = pColorAttachment != nullptr ? 1u : 0u,
             .pColorAttachments = pColorAttachment,
             .pDepthAttachment = pDepthAttachment,
         };
@@ -5,45 +5,72 @@
 #include "vk_loader.h"
 #include "vk_engine.h"
 #include "vk_initializers.h"
+#include "vk_images.h"
+#include "vk_upload_batch.h"
 
-#include <glm/gtx/quaternion.hpp>
+#include "job_system.h"
+#include "mapped_file.h"
+#include "scene_file_format.h"
+#include "texture_format.h"
 
-#include <stb_image.h>
 
 
-static VkFilter ExtractFilter(fastgltf::Filter filter)
+static std::optional<ImageHandle> UploadDecodedImage(VulkanEngine* pEngine, DecodedImage& decoded);
+static std::optional<ImageHandle> CreateKtx2Image(VulkanEngine* pEngine, const Ktx2Image& ktx2, UploadBatch& uploadBatch, bool isSRGB);
+static void BuildMaterialKey(const GLTFMetallic_Roughness::MaterialConstants& constants, MaterialPass pass,
+    const GLTFMetallic_Roughness::MaterialResources& resources, DescriptorKey& key) noexcept;
+
+
+void LoadedGLTF::RegisterDraws(RenderContext& ctx)
 {
-    switch (filter) {
-        case fastgltf::Filter::Nearest:
-        case fastgltf::Filter::NearestMipMapNearest:
-        case fastgltf::Filter::NearestMipMapLinear:
-            return VK_FILTER_NEAREST;
-        case fastgltf::Filter::Linear:
-        case fastgltf::Filter::LinearMipMapNearest:
-        case fastgltf::Filter::LinearMipMapLinear:
-        default:
-            return VK_FILTER_LINEAR;
+    ENG_ASSERT(pDrawCtx == nullptr);
+    pDrawCtx = &ctx;
+
+    for (std::shared_ptr<Node>& pNode : topNodes) {
+        pNode->RegisterDraws(ctx);
+    }
+
+    if (useDepthPrepass) {
+        SetDepthPrepass(true);
     }
 }
 
-static VkSamplerMipmapMode ExtractMipmapMode(fastgltf::Filter filter)
+
+void LoadedGLTF::UnregisterDraws(RenderContext& ctx)
 {
-    switch (filter) {
-        case fastgltf::Filter::NearestMipMapNearest:
-        case fastgltf::Filter::LinearMipMapNearest:
-            return VK_SAMPLER_MIPMAP_MODE_NEAREST;
-        case fastgltf::Filter::NearestMipMapLinear:
-        case fastgltf::Filter::LinearMipMapLinear:
-        default:
-            return VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    ENG_ASSERT(pDrawCtx == &ctx);
+
+    for (std::shared_ptr<Node>& pNode : topNodes) {
+        pNode->UnregisterDraws(ctx);
     }
+
+    pDrawCtx = nullptr;
 }
 
 
-void LoadedGLTF::Render(const glm::mat4& topMatrix, RenderContext& ctx)
+void LoadedGLTF::SetTransform(const glm::mat4& topMatrix)
 {
+    // hierarchies below top nodes are disjoint, so they can refresh their draw records concurrently
+    JobSystem::GetInstance().ParallelFor(topNodes.size(), 0, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            topNodes[i]->RefreshTransform(topMatrix);
+        }
+    });
+}
+
+
+void LoadedGLTF::SetDepthPrepass(bool enable)
+{
+    useDepthPrepass = enable;
+
+    if (pDrawCtx == nullptr) {
+        return;
+    }
+
     for (std::shared_ptr<Node>& pNode : topNodes) {
-        pNode->Render(topMatrix, ctx);
+        pNode->ForEachDraw([this, enable](RenderObjectID id) {
+            pDrawCtx->SetObjectDepthPrepass(id, enable);
+        });
     }
 }
 
@@ -52,19 +79,29 @@ void LoadedGLTF::ClearAll()
 {
     VkDevice dv = pCreator->m_pVkDevice;
 
+    if (pDrawCtx != nullptr) {
+        UnregisterDraws(*pDrawCtx);
+    }
+
+    // streamed textures and the descriptor sets the streamer swapped into materials
+    pCreator->m_textureStreamer.ReleaseOwner(*pCreator, this);
+
     descriptorPool.DestroyPools(dv);
-    pCreator->DestroyBuffer(materialDataBuffer);
+
+    // descriptor buffer ranges, the streamer retires the ones it replaced itself
+    for (std::shared_ptr<GLTFMaterial>& pMaterial : uniqueMaterials) {
+        pCreator->m_descriptorBuffer.Free(pMaterial->data.descriptorBufferSet.pAllocation);
+    }
+
+    pCreator->ReleaseBuffer(materialDataBuffer);
 
     for (auto& [k, v] : meshes) {
-		pCreator->DestroyBuffer(v->meshBuffers.idxBuff);
-		pCreator->DestroyBuffer(v->meshBuffers.vertBuff);
+		pCreator->ReleaseBuffer(v->meshBuffers.idxBuff);
+		pCreator->ReleaseBuffer(v->meshBuffers.vertBuff);
     }
 
     for (auto& [k, v] : images) {   
-        if (v.pImage == pCreator->m_checkerboardImage.pImage) {
-            continue;
-        }
-        pCreator->DestroyImage(v);
+        pCreator->ReleaseImage(v);
     }
 
 	for (VkSampler& sampler : samplers) {
@@ -73,53 +110,34 @@ void LoadedGLTF::ClearAll()
 }
 
 
-std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const std::filesystem::path& filepath)
+std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, ParsedGLTF& parsed)
 {
-    fmt::print("Loading GLTF: {}\n", filepath.string().c_str());
+    UploadBatch uploadBatch;
+    std::optional<std::shared_ptr<LoadedGLTF>> scene = LoadGLTF(pEngine, parsed, uploadBatch);
 
-    std::shared_ptr<LoadedGLTF> pScene = std::make_shared<LoadedGLTF>();
-    pScene->pCreator = pEngine;
-    LoadedGLTF& file = *pScene;
+    uploadBatch.Submit(*pEngine);
 
-    fastgltf::Parser parser {};
+    for (DecodedImage& decoded : parsed.images) {
+        FreeDecodedImage(decoded);
+    }
 
-    constexpr fastgltf::Options gltfOptions = fastgltf::Options::DontRequireValidAssetMember 
-        | fastgltf::Options::AllowDouble
-        | fastgltf::Options::LoadExternalBuffers;
+    return scene;
+}
 
-    auto dataExp = fastgltf::GltfDataBuffer::FromPath(filepath);
-    ENG_ASSERT_MSG(dataExp, "GLTF {} error: {}", filepath.string().c_str(), fastgltf::getErrorMessage(dataExp.error()))
 
-    fastgltf::GltfDataBuffer& data = dataExp.get();
+std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, ParsedGLTF& parsed, UploadBatch& uploadBatch)
+{
+    fmt::print("Loading GLTF: {}\n", parsed.filepath.string().c_str());
 
-    fastgltf::Asset gltf;
+    std::shared_ptr<LoadedGLTF> pScene = std::make_shared<LoadedGLTF>();
+    pScene->pCreator = pEngine;
+    LoadedGLTF& file = *pScene;
 
-    auto type = fastgltf::determineGltfFileType(data);
-    if (type == fastgltf::GltfType::glTF) {
-        auto load = parser.loadGltf(data, filepath.parent_path(), gltfOptions);
-        if (load) {
-            gltf = std::move(load.get());
-        } else {
-            fmt::println(stderr, "Failed to load glTF: {}", fastgltf::getErrorMessage(load.error()).data());
-            return std::nullopt;
-        }
-    } else if (type == fastgltf::GltfType::GLB) {
-        auto load = parser.loadGltfBinary(data, filepath.parent_path(), gltfOptions);
-        if (load) {
-            gltf = std::move(load.get());
-        } else {
-            fmt::println(stderr, "Failed to load glTF: {}", fastgltf::getErrorMessage(load.error()).data());
-            return std::nullopt;
-        }
-    } else {
-        fmt::println(stderr, "Failed to determine GLTF container");
-        return std::nullopt;
-    }
+    fastgltf::Asset& gltf = parsed.asset;
 
     // we can stimate the descriptors we will need accurately
     std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
     };
 
@@ -141,39 +159,64 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const
 
         file.samplers.push_back(newSampler);
     }
-    
-    std::vector<ImageHandle> images;
+
+    // images and meshes go to the GPU in a single submission once all of them are created
+    std::vector<ImageID> images;
     images.reserve(gltf.images.size());
 
-    for (fastgltf::Image& image : gltf.images) {  
-        std::optional<ImageHandle> img = LoadImage(pEngine, gltf, image);
+    // base color mips are filtered in linear space
+    const std::vector<uint8_t> imageUsages = GetImageUsages(parsed);
+
+    for (size_t i = 0; i < gltf.images.size(); ++i) {  
+        fastgltf::Image& image = gltf.images[i];
+        const DecodedImage& decoded = parsed.images[i];
+
+        // mesh.frag doesn't sample metal-rough textures, images that are nothing else aren't created
+        if (imageUsages[i] == (uint8_t)ImageUsage::METAL_ROUGH) {
+            images.push_back(pEngine->m_whiteImage);
+            continue;
+        }
+
+        const bool isSRGB = (imageUsages[i] & (uint8_t)ImageUsage::COLOR) != 0;
+
+        std::optional<ImageHandle> img;
+
+		if (decoded.pPixels != nullptr) {
+            img = pEngine->CreateImage(decoded.extent, VK_FORMAT_R8G8B8A8_UNORM,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, nullptr, true);
+
+            uploadBatch.AddImageUpload(img.value(), decoded.pPixels, (size_t)decoded.extent.width * decoded.extent.height * 4, true, isSRGB);
+        } else if (decoded.ktx2.IsValid()) {
+            img = CreateKtx2Image(pEngine, decoded.ktx2, uploadBatch, isSRGB);
+        }
 
 		if (img.has_value()) {
-			images.push_back(img.value());
-			file.images[image.name.c_str()] = img.value();
+            const ImageID imageID = pEngine->RegisterImage(img.value());
+
+			images.push_back(imageID);
+			file.images[image.name.c_str()] = imageID;
 		} else {
 			images.push_back(pEngine->m_checkerboardImage);
 			fmt::print("gltf failed to load texture {}\n", image.name.c_str());
 		}
     }
 
-    file.materialDataBuffer = pEngine->CreateBuffer(sizeof(GLTFMetallic_Roughness::MaterialConstants) * gltf.materials.size(),
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    
-    size_t dataIndex = 0;
+    const uint32_t materialDataSize = sizeof(GLTFMetallic_Roughness::MaterialConstants) * std::max<size_t>(gltf.materials.size(), 1);
+
+    file.materialDataBuffer = pEngine->RegisterBuffer(pEngine->CreateBuffer(materialDataSize,
+        pEngine->GetShaderBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT), MemoryCategory::UNIFORMS));
     
     GLTFMetallic_Roughness::MaterialConstants* pSceneMaterialConstants =
-        (GLTFMetallic_Roughness::MaterialConstants*)file.materialDataBuffer.allocationInfo.pMappedData;
+        (GLTFMetallic_Roughness::MaterialConstants*)pEngine->GetBuffer(file.materialDataBuffer).allocationInfo.pMappedData;
 
     std::vector<std::shared_ptr<GLTFMaterial>> materials;
     materials.reserve(gltf.materials.size());
 
-    for (fastgltf::Material& mat : gltf.materials) {
-        std::shared_ptr<GLTFMaterial> newMat = std::make_shared<GLTFMaterial>();
-        materials.push_back(newMat);
-
-        file.materials[mat.name.c_str()] = newMat;
+    // exporters repeat materials under different names, the ones that draw the same are written once
+    std::unordered_map<DescriptorKey, std::shared_ptr<GLTFMaterial>, DescriptorKeyHash> materialsByKey;
+    DescriptorKey materialKey;
 
+    for (fastgltf::Material& mat : gltf.materials) {
         GLTFMetallic_Roughness::MaterialConstants constants;
         constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
         constants.colorFactors.y = mat.pbrData.baseColorFactor[1];
@@ -182,8 +225,8 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const
 
         constants.metallicRoughnessFactors.x = mat.pbrData.metallicFactor;
         constants.metallicRoughnessFactors.y = mat.pbrData.roughnessFactor;
-        // write material parameters to buffer
-        pSceneMaterialConstants[dataIndex] = constants;
+        constants.metallicRoughnessFactors.z = mat.alphaMode == fastgltf::AlphaMode::Mask ? mat.alphaCutoff : 0.f;
+        constants.metallicRoughnessFactors.w = 0.f;
 
         const MaterialPass passType = mat.alphaMode == fastgltf::AlphaMode::Blend ? MaterialPass::TRANSPARENT : MaterialPass::OPAQUE;
 
@@ -194,117 +237,82 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const
         materialResources.metalRoughImage = pEngine->m_whiteImage;
         materialResources.metalRoughSampler = pEngine->m_linearSampler;
 
-        materialResources.dataBuffer = file.materialDataBuffer.pBuffer;
-        materialResources.dataBufferOffset = dataIndex * sizeof(GLTFMetallic_Roughness::MaterialConstants);
+        materialResources.dataBuffer = file.materialDataBuffer;
+        materialResources.dataBufferSize = materialDataSize;
+        materialResources.useAlphaTest = constants.metallicRoughnessFactors.z > 0.f;
 
         if (mat.pbrData.baseColorTexture.has_value()) {
-            const size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
-            const size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
+            const fastgltf::Texture& texture = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex];
+            const std::optional<size_t> img = GetTextureImageIndex(parsed, texture);
+
+            if (img.has_value()) {
+                materialResources.colorImage = images[img.value()];
+            }
 
-            materialResources.colorImage = images[img];
-            materialResources.colorSampler = file.samplers[sampler];
+            if (texture.samplerIndex.has_value()) {
+                materialResources.colorSampler = file.samplers[texture.samplerIndex.value()];
+            }
         }
-        
-        newMat->data = pEngine->m_metalRoughMaterial.WriteMaterial(pEngine->m_pVkDevice, passType, materialResources, file.descriptorPool);
 
-        ++dataIndex;
-    }
-    
-    std::vector<std::shared_ptr<MeshAsset>> meshes;
-    meshes.reserve(gltf.meshes.size());
+        BuildMaterialKey(constants, passType, materialResources, materialKey);
 
-    std::vector<uint32_t> indices;
-    std::vector<Vertex> vertices;
+        std::shared_ptr<GLTFMaterial>& pMaterial = materialsByKey[materialKey];
 
-    for (const fastgltf::Mesh& mesh : gltf.meshes) {
-        std::shared_ptr<MeshAsset> newmesh = std::make_shared<MeshAsset>();
-        meshes.push_back(newmesh);
+        if (pMaterial == nullptr) {
+            const uint32_t constantsIndex = (uint32_t)file.uniqueMaterials.size();
 
-        file.meshes[mesh.name.c_str()] = newmesh;
-        newmesh->name = mesh.name;
+            pSceneMaterialConstants[constantsIndex] = constants;
+            materialResources.constantsIndex = constantsIndex;
 
-        indices.clear();
-        vertices.clear();
+            const std::optional<MaterialInstance> matData = pEngine->m_metalRoughMaterial.WriteMaterial(*pEngine, passType, materialResources, file.descriptorPool);
 
-        for (const fastgltf::Primitive& p : mesh.primitives) {
-            GeoSurface newSurface;
-            newSurface.startIndex = (uint32_t)indices.size();
-            newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+            if (!matData.has_value()) {
+                fmt::println(stderr, "Descriptor buffer is full, scene {} is not loaded", parsed.filepath.string().c_str());
 
-            size_t initialVtx = vertices.size();
+                // the queued images are released with the scene
+                uploadBatch.Reset();
+                return std::nullopt;
+            }
 
-            {
-                fastgltf::Accessor& indexaccessor = gltf.accessors[p.indicesAccessor.value()];
-                indices.reserve(indices.size() + indexaccessor.count);
+            pMaterial = std::make_shared<GLTFMaterial>();
+            pMaterial->data = matData.value();
 
-                fastgltf::iterateAccessor<std::uint32_t>(gltf, indexaccessor,
-                    [&](std::uint32_t idx) {
-                        indices.push_back(idx + initialVtx);
-                    });
-            }
+            file.uniqueMaterials.push_back(pMaterial);
+        }
 
-            {
-                fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
-                vertices.resize(vertices.size() + posAccessor.count);
-
-                fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor,
-                    [&](glm::vec3 v, size_t index) {
-                        Vertex newvtx;
-                        newvtx.position = v;
-                        newvtx.normal = glm::vec3(1, 0, 0);
-                        newvtx.color = glm::vec4(1.f);
-                        newvtx.uvX = 0;
-                        newvtx.uvY = 0;
-                        vertices[initialVtx + index] = newvtx;
-                    });
-            }
+        materials.push_back(pMaterial);
+        file.materials[mat.name.c_str()] = pMaterial;
+    }
 
-            auto normals = p.findAttribute("NORMAL");
-            if (normals != p.attributes.end()) {
-                fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[normals->accessorIndex],
-                    [&](glm::vec3 v, size_t index) {
-                        vertices[initialVtx + index].normal = v;
-                    });
-            }
+    fmt::print("{} materials, {} after deduplication\n", gltf.materials.size(), file.uniqueMaterials.size());
+    
+    std::vector<std::shared_ptr<MeshAsset>> meshes;
+    meshes.reserve(parsed.meshes.size());
 
-            auto uv = p.findAttribute("TEXCOORD_0");
-            if (uv != p.attributes.end()) {
-                fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[uv->accessorIndex],
-                    [&](glm::vec2 v, size_t index) {
-                        vertices[initialVtx + index].uvX = v.x;
-                        vertices[initialVtx + index].uvY = v.y;
-                    });
-            }
+    for (ParsedMesh& mesh : parsed.meshes) {
+        std::shared_ptr<MeshAsset> newmesh = std::make_shared<MeshAsset>();
+        meshes.push_back(newmesh);
 
-            auto colors = p.findAttribute("COLOR_0");
-            if (colors != p.attributes.end()) {
-                fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[colors->accessorIndex],
-                    [&](glm::vec4 v, size_t index) {
-                        vertices[initialVtx + index].color = v;
-                    });
-            }
+        file.meshes[mesh.name] = newmesh;
+        newmesh->name = mesh.name;
+        newmesh->id = pEngine->m_nextMeshID++;
 
-            if (p.materialIndex.has_value()) {
-                newSurface.material = materials[p.materialIndex.value()];
-            } else {
-                newSurface.material = materials[0];
-            }
+        newmesh->surfaces.reserve(mesh.surfaces.size());
 
-            glm::vec3 minpos = vertices[initialVtx].position;
-            glm::vec3 maxpos = vertices[initialVtx].position;
-            for (size_t i = initialVtx; i < vertices.size(); ++i) {
-                minpos = glm::min(minpos, vertices[i].position);
-                maxpos = glm::max(maxpos, vertices[i].position);
-            }
-            
-            newSurface.bounds.origin = (maxpos + minpos) / 2.f;
-            newSurface.bounds.extents = (maxpos - minpos) / 2.f;
-            newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
+        for (const ParsedSurface& surface : mesh.surfaces) {
+            GeoSurface newSurface;
+            newSurface.startIndex = surface.startIndex;
+            newSurface.count = surface.count;
+            newSurface.bounds = surface.bounds;
+            newSurface.material = materials[surface.materialIndex.value_or(0)];
 
             newmesh->surfaces.push_back(newSurface);
         }
 
-        newmesh->meshBuffers = pEngine->UploadMesh(indices, vertices);
+        newmesh->meshBuffers = pEngine->CreateMeshBuffers(mesh.indices.size(), mesh.vertices.size());
+
+        uploadBatch.AddBufferUpload(pEngine->GetBuffer(newmesh->meshBuffers.vertBuff).pBuffer, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        uploadBatch.AddBufferUpload(pEngine->GetBuffer(newmesh->meshBuffers.idxBuff).pBuffer, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
     }
 
     std::vector<std::shared_ptr<Node>> nodes;
@@ -323,22 +331,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const
         nodes.push_back(newNode);
         file.nodes[node.name.c_str()];
 
-        std::visit(fastgltf::visitor { 
-            [&](const fastgltf::math::fmat4x4& matrix) {
-                memcpy(&newNode->localTrs, matrix.data(), sizeof(matrix));
-            },
-            [&](const fastgltf::TRS& transform) {
-                const glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
-                const glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
-                const glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
-                
-                const glm::mat4 tm = glm::translate(glm::identity<glm::mat4>(), tl);
-                const glm::mat4 rm = glm::toMat4(rot);
-                const glm::mat4 sm = glm::scale(glm::identity<glm::mat4>(), sc);
-                
-                newNode->localTrs = tm * rm * sm;
-            }
-        }, node.transform);
+        newNode->localTrs = GetNodeLocalTransform(node);
     }
 
     for (size_t i = 0; i < gltf.nodes.size(); ++i) {
@@ -362,76 +355,627 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const
 }
 
 
+float SceneLoadState::GetProgress() const noexcept
+{
+    constexpr float parseShare = 0.9f;
+
+    switch (status.load(std::memory_order_acquire)) {
+        case SceneLoadStatus::PARSING:
+        {
+            const uint32_t itemCount = parseProgress.itemCount.load(std::memory_order_relaxed);
+            const uint32_t doneItemCount = parseProgress.doneItemCount.load(std::memory_order_relaxed);
+
+            return itemCount > 0 ? parseShare * doneItemCount / itemCount : 0.f;
+        }
+        case SceneLoadStatus::UPLOADING:
+            return parseShare;
+        default:
+            return 1.f;
+    }
+}
+
+
+std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const std::filesystem::path& filepath)
+{
+    std::shared_ptr<ParsedGLTF> pParsed = ParseGLTF(filepath);
+
+    if (pParsed == nullptr) {
+        return std::nullopt;
+    }
+
+    return LoadGLTF(pEngine, *pParsed);
+}
+
+
+static_assert(sizeof(Vertex) == SCENE_FILE_VERTEX_STRIDE, "Cooked vertices must match the engine vertex layout");
+
+
+template <typename T>
+static bool GetSceneFileTable(std::span<const uint8_t> data, uint64_t offset, uint32_t count, std::span<const T>& outTable)
+{
+    if (offset % alignof(T) != 0 || offset > data.size() || (data.size() - offset) / sizeof(T) < count) {
+        return false;
+    }
+
+    outTable = std::span<const T>(reinterpret_cast<const T*>(data.data() + offset), count);
+    return true;
+}
+
+
+static bool IsSceneFileRangeValid(const SceneFileHeader& header, uint64_t offset, uint64_t size)
+{
+    return offset >= header.dataOffset && offset <= header.fileSize && header.fileSize - offset >= size
+        && offset % SCENE_FILE_BLOB_ALIGNMENT == 0;
+}
+
+
+static std::string GetSceneFileString(std::string_view strings, const SceneFileString& str)
+{
+    return std::string(strings.substr(std::min<size_t>(str.offset, strings.size()), str.length));
+}
+
+
+// Mesh and parent indices are in range or SCENE_FILE_INVALID_INDEX, and parents form a forest. A node in a
+// cycle would never reach the top nodes, its shared_ptr ring would leak.
+static bool AreSceneFileNodesValid(const SceneFileHeader& header, std::span<const SceneFileNode> nodes)
+{
+    for (const SceneFileNode& node : nodes) {
+        const bool areIndicesValid = (node.meshIndex < header.meshCount || node.meshIndex == SCENE_FILE_INVALID_INDEX)
+            && (node.parentIndex < nodes.size() || node.parentIndex == SCENE_FILE_INVALID_INDEX);
+
+        if (!areIndicesValid) {
+            return false;
+        }
+    }
+
+    enum NodeState : uint8_t { UNVISITED, ON_PATH, ROOTED };
+
+    std::vector<uint8_t> states(nodes.size(), UNVISITED);
+    std::vector<uint32_t> path;
+
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        path.clear();
+
+        // walks up until a top node or a node already known to reach one
+        for (uint32_t nodeIdx = i; nodeIdx != SCENE_FILE_INVALID_INDEX && states[nodeIdx] != ROOTED; nodeIdx = nodes[nodeIdx].parentIndex) {
+            if (states[nodeIdx] == ON_PATH) {
+                return false;
+            }
+
+            states[nodeIdx] = ON_PATH;
+            path.push_back(nodeIdx);
+        }
+
+        for (uint32_t nodeIdx : path) {
+            states[nodeIdx] = ROOTED;
+        }
+    }
+
+    return true;
+}
+
+
+std::optional<std::shared_ptr<LoadedGLTF>> LoadCookedScene(VulkanEngine* pEngine, const std::filesystem::path& filepath)
+{
+    fmt::print("Loading cooked scene: {}\n", filepath.string().c_str());
+
+    MappedFile mappedFile;
+
+    if (!mappedFile.Open(filepath)) {
+        fmt::println(stderr, "Failed to open cooked scene: {}", filepath.string().c_str());
+        return std::nullopt;
+    }
+
+    return LoadCookedScene(pEngine, filepath, std::move(mappedFile));
+}
+
+
+std::optional<std::shared_ptr<LoadedGLTF>> LoadCookedScene(VulkanEngine* pEngine, const std::filesystem::path& filepath, MappedFile&& mappedFile)
+{
+    const std::span<const uint8_t> data = mappedFile.GetData();
+
+    if (data.size() < sizeof(SceneFileHeader)) {
+        fmt::println(stderr, "Invalid cooked scene: {}", filepath.string().c_str());
+        return std::nullopt;
+    }
+
+    const SceneFileHeader& header = *reinterpret_cast<const SceneFileHeader*>(data.data());
+
+    if (header.magic != SCENE_FILE_MAGIC || header.version != SCENE_FILE_VERSION) {
+        fmt::println(stderr, "Cooked scene {} has unsupported version {}, recook it", filepath.string().c_str(), header.version);
+        return std::nullopt;
+    }
+
+    std::span<const SceneFileMesh> fileMeshes;
+    std::span<const SceneFileSurface> fileSurfaces;
+    std::span<const SceneFileMaterial> fileMaterials;
+    std::span<const SceneFileSampler> fileSamplers;
+    std::span<const SceneFileTexture> fileTextures;
+    std::span<const SceneFileMip> fileMips;
+    std::span<const SceneFileNode> fileNodes;
+    std::span<const char> fileStrings;
+
+    const bool isLayoutValid = header.fileSize == data.size() && header.dataOffset <= header.fileSize
+        && header.dataOffset % SCENE_FILE_BLOB_ALIGNMENT == 0
+        && GetSceneFileTable(data, header.meshesOffset, header.meshCount, fileMeshes)
+        && GetSceneFileTable(data, header.surfacesOffset, header.surfaceCount, fileSurfaces)
+        && GetSceneFileTable(data, header.materialsOffset, header.materialCount, fileMaterials)
+        && GetSceneFileTable(data, header.samplersOffset, header.samplerCount, fileSamplers)
+        && GetSceneFileTable(data, header.texturesOffset, header.textureCount, fileTextures)
+        && GetSceneFileTable(data, header.mipsOffset, header.mipCount, fileMips)
+        && GetSceneFileTable(data, header.nodesOffset, header.nodeCount, fileNodes)
+        && GetSceneFileTable(data, header.stringsOffset, header.stringsSize, fileStrings);
+
+    if (!isLayoutValid) {
+        fmt::println(stderr, "Invalid cooked scene: {}", filepath.string().c_str());
+        return std::nullopt;
+    }
+
+    const std::string_view strings(fileStrings.data(), fileStrings.size());
+
+    for (const SceneFileMesh& mesh : fileMeshes) {
+        const bool isMeshValid = mesh.surfaceCount <= header.surfaceCount && mesh.firstSurface <= header.surfaceCount - mesh.surfaceCount
+            && IsSceneFileRangeValid(header, mesh.verticesOffset, (uint64_t)mesh.vertexCount * sizeof(Vertex))
+            && IsSceneFileRangeValid(header, mesh.indicesOffset, (uint64_t)mesh.indexCount * sizeof(uint32_t));
+
+        if (!isMeshValid) {
+            fmt::println(stderr, "Invalid mesh in cooked scene: {}", filepath.string().c_str());
+            return std::nullopt;
+        }
+
+        // draws index the mesh buffers with these, the GPU would read past them
+        for (const SceneFileSurface& surface : fileSurfaces.subspan(mesh.firstSurface, mesh.surfaceCount)) {
+            if ((uint64_t)surface.startIndex + surface.indexCount > mesh.indexCount) {
+                fmt::println(stderr, "Invalid surface range in cooked scene: {}", filepath.string().c_str());
+                return std::nullopt;
+            }
+        }
+    }
+
+    for (const SceneFileSurface& surface : fileSurfaces) {
+        if (surface.materialIndex >= header.materialCount) {
+            fmt::println(stderr, "Invalid surface material in cooked scene: {}", filepath.string().c_str());
+            return std::nullopt;
+        }
+    }
+
+    for (const SceneFileMaterial& material : fileMaterials) {
+        if (material.passType > (uint32_t)MaterialPass::OTHER) {
+            fmt::println(stderr, "Invalid material pass in cooked scene: {}", filepath.string().c_str());
+            return std::nullopt;
+        }
+    }
+
+    if (!AreSceneFileNodesValid(header, fileNodes)) {
+        fmt::println(stderr, "Invalid node hierarchy in cooked scene: {}", filepath.string().c_str());
+        return std::nullopt;
+    }
+
+    for (const SceneFileTexture& texture : fileTextures) {
+        if (texture.mipCount == 0) {
+            continue;
+        }
+
+        TextureFormatInfo formatInfo;
+
+        const bool isTextureValid = GetTextureFormatInfo((VkFormat)texture.format, formatInfo)
+            && texture.mipCount <= GetTextureMipCount(texture.width, texture.height)
+            && texture.mipCount <= header.mipCount && texture.firstMip <= header.mipCount - texture.mipCount
+            && std::all_of(std::begin(texture.swizzle), std::end(texture.swizzle), [](uint8_t swizzle) { return swizzle <= VK_COMPONENT_SWIZZLE_A; });
+
+        if (!isTextureValid) {
+            fmt::println(stderr, "Invalid texture in cooked scene: {}", filepath.string().c_str());
+            return std::nullopt;
+        }
+
+        for (uint32_t mip = 0; mip < texture.mipCount; ++mip) {
+            const SceneFileMip& fileMip = fileMips[texture.firstMip + mip];
+
+            // copy offsets must be a multiple of the texel block size, blob alignment covers that
+            const bool isMipValid = IsSceneFileRangeValid(header, fileMip.offset, fileMip.size)
+                && fileMip.size == GetTextureMipSize((VkFormat)texture.format, texture.width, texture.height, mip)
+                && fileMip.offset % formatInfo.blockSize == 0;
+
+            if (!isMipValid) {
+                fmt::println(stderr, "Invalid texture in cooked scene: {}", filepath.string().c_str());
+                return std::nullopt;
+            }
+        }
+    }
+
+    std::shared_ptr<LoadedGLTF> pScene = std::make_shared<LoadedGLTF>();
+    pScene->pCreator = pEngine;
+    LoadedGLTF& file = *pScene;
+
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+    };
+
+    file.descriptorPool.Init(pEngine->m_pVkDevice, fileMaterials.size(), sizes);
+
+    for (const SceneFileSampler& fileSampler : fileSamplers) {
+        VkSamplerCreateInfo sampl = {};
+        sampl.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        sampl.maxLod = VK_LOD_CLAMP_NONE;
+        sampl.minLod = 0;
+        sampl.magFilter = (VkFilter)fileSampler.magFilter;
+        sampl.minFilter = (VkFilter)fileSampler.minFilter;
+        sampl.mipmapMode = (VkSamplerMipmapMode)fileSampler.mipmapMode;
+
+        VkSampler newSampler;
+        vkCreateSampler(pEngine->m_pVkDevice, &sampl, nullptr, &newSampler);
+
+        file.samplers.push_back(newSampler);
+    }
+
+    // the data section is copied as is, blob offsets in the file become staging buffer offsets
+    const uint64_t dataSize = header.fileSize - header.dataOffset;
+
+    BufferHandle stagingBuff = pEngine->CreateBuffer(std::max<uint64_t>(dataSize, 1), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryCategory::STAGING);
+    memcpy(stagingBuff.allocationInfo.pMappedData, data.data() + header.dataOffset, dataSize);
+
+    std::vector<ImageID> images;
+    images.reserve(fileTextures.size());
+
+    // textures without data or in a format the device can't sample get the checkerboard and no copies,
+    // streamed ones only get their tail mips copied
+    std::vector<uint32_t> firstUploadedMips(fileTextures.size(), UINT32_MAX);
+    std::vector<StreamedTextureID> streamedTextureIDs(fileTextures.size(), INVALID_STREAMED_TEXTURE_ID);
+
+    // mesh.frag doesn't sample metal-rough textures, the ones no material uses for color aren't created
+    std::vector<uint8_t> isMetalRoughOnly(fileTextures.size(), 0);
+
+    for (const SceneFileMaterial& fileMaterial : fileMaterials) {
+        if (fileMaterial.metalRoughTextureIndex < fileTextures.size()) {
+            isMetalRoughOnly[fileMaterial.metalRoughTextureIndex] = 1;
+        }
+    }
+
+    for (const SceneFileMaterial& fileMaterial : fileMaterials) {
+        if (fileMaterial.colorTextureIndex < fileTextures.size()) {
+            isMetalRoughOnly[fileMaterial.colorTextureIndex] = 0;
+        }
+    }
+
+    for (size_t i = 0; i < fileTextures.size(); ++i) {
+        const SceneFileTexture& texture = fileTextures[i];
+        const std::string name = GetSceneFileString(strings, texture.name);
+
+        if (isMetalRoughOnly[i]) {
+            images.push_back(pEngine->m_whiteImage);
+            continue;
+        }
+
+        if (texture.mipCount == 0) {
+            images.push_back(pEngine->m_checkerboardImage);
+            fmt::print("cooked scene has no data for texture {}\n", name);
+            continue;
+        }
+
+        if (!pEngine->IsTextureFormatSupported((VkFormat)texture.format)) {
+            images.push_back(pEngine->m_checkerboardImage);
+            fmt::print("texture {} format {} is not supported by the device\n", name, texture.format);
+            continue;
+        }
+
+        const VkExtent3D extent = { texture.width, texture.height, 1 };
+        const VkComponentMapping swizzle = { (VkComponentSwizzle)texture.swizzle[0], (VkComponentSwizzle)texture.swizzle[1],
+            (VkComponentSwizzle)texture.swizzle[2], (VkComponentSwizzle)texture.swizzle[3] };
+
+        const uint32_t tailMip = TextureStreamer::GetTailMip(texture.width, texture.height, texture.mipCount);
+
+        if (tailMip > 0) {
+            StreamedTextureDesc desc = {};
+            desc.extent = extent;
+            desc.format = (VkFormat)texture.format;
+            desc.swizzle = swizzle;
+
+            for (const SceneFileMip& fileMip : fileMips.subspan(texture.firstMip, texture.mipCount)) {
+                desc.mips.emplace_back(UploadBatch::MipData { data.data() + fileMip.offset, fileMip.size });
+            }
+
+            // owned by the streamer, not by file.images
+            ImageID image;
+            streamedTextureIDs[i] = pEngine->m_textureStreamer.RegisterTexture(*pEngine, &file, std::move(desc), image);
+
+            images.push_back(image);
+            firstUploadedMips[i] = tailMip;
+
+            continue;
+        }
+
+        const ImageID image = pEngine->RegisterImage(pEngine->CreateTextureImage(extent, (VkFormat)texture.format, texture.mipCount, swizzle));
+
+        images.push_back(image);
+        file.images[name] = image;
+
+        firstUploadedMips[i] = 0;
+    }
+
+    std::vector<std::shared_ptr<MeshAsset>> meshes;
+    meshes.reserve(fileMeshes.size());
+
+    for (const SceneFileMesh& fileMesh : fileMeshes) {
+        std::shared_ptr<MeshAsset> newmesh = std::make_shared<MeshAsset>();
+        meshes.push_back(newmesh);
+
+        newmesh->name = GetSceneFileString(strings, fileMesh.name);
+        newmesh->id = pEngine->m_nextMeshID++;
+        file.meshes[newmesh->name] = newmesh;
+
+        newmesh->meshBuffers = pEngine->CreateMeshBuffers(fileMesh.indexCount, fileMesh.vertexCount);
+    }
+
+    pEngine->ImmediateSubmit([&](VkCommandBuffer pCmd) {
+        for (size_t i = 0; i < fileMeshes.size(); ++i) {
+            const SceneFileMesh& fileMesh = fileMeshes[i];
+            const MeshGpuBuffers& buffers = meshes[i]->meshBuffers;
+
+            if (fileMesh.vertexCount > 0) {
+                const VkBufferCopy vertexCopy = { fileMesh.verticesOffset - header.dataOffset, 0, fileMesh.vertexCount * sizeof(Vertex) };
+                vkCmdCopyBuffer(pCmd, stagingBuff.pBuffer, pEngine->GetBuffer(buffers.vertBuff).pBuffer, 1, &vertexCopy);
+            }
+
+            if (fileMesh.indexCount > 0) {
+                const VkBufferCopy indexCopy = { fileMesh.indicesOffset - header.dataOffset, 0, fileMesh.indexCount * sizeof(uint32_t) };
+                vkCmdCopyBuffer(pCmd, stagingBuff.pBuffer, pEngine->GetBuffer(buffers.idxBuff).pBuffer, 1, &indexCopy);
+            }
+        }
+
+        std::vector<VkBufferImageCopy> mipCopies;
+
+        for (size_t i = 0; i < fileTextures.size(); ++i) {
+            const SceneFileTexture& texture = fileTextures[i];
+
+            const uint32_t firstMip = firstUploadedMips[i];
+
+            if (firstMip == UINT32_MAX) {
+                continue;
+            }
+
+            mipCopies.clear();
+
+            for (uint32_t mip = firstMip; mip < texture.mipCount; ++mip) {
+                VkBufferImageCopy copyRegion = {};
+                copyRegion.bufferOffset = fileMips[texture.firstMip + mip].offset - header.dataOffset;
+
+                copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                copyRegion.imageSubresource.mipLevel = mip - firstMip;
+                copyRegion.imageSubresource.baseArrayLayer = 0;
+                copyRegion.imageSubresource.layerCount = 1;
+                copyRegion.imageExtent = { std::max(texture.width >> mip, 1u), std::max(texture.height >> mip, 1u), 1 };
+
+                mipCopies.push_back(copyRegion);
+            }
+
+            const VkImage pImage = pEngine->GetImage(images[i]).pImage;
+
+            vkutil::TransitImage(pCmd, pImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            vkCmdCopyBufferToImage(pCmd, stagingBuff.pBuffer, pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)mipCopies.size(), mipCopies.data());
+            vkutil::TransitImage(pCmd, pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+    });
+
+    pEngine->DestroyBuffer(stagingBuff);
+
+    const uint32_t materialDataSize = sizeof(GLTFMetallic_Roughness::MaterialConstants) * std::max<size_t>(fileMaterials.size(), 1);
+
+    file.materialDataBuffer = pEngine->RegisterBuffer(pEngine->CreateBuffer(materialDataSize,
+        pEngine->GetShaderBufferUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT), MemoryCategory::UNIFORMS));
+
+    GLTFMetallic_Roughness::MaterialConstants* pSceneMaterialConstants =
+        (GLTFMetallic_Roughness::MaterialConstants*)pEngine->GetBuffer(file.materialDataBuffer).allocationInfo.pMappedData;
+
+    std::vector<std::shared_ptr<GLTFMaterial>> materials;
+    materials.reserve(fileMaterials.size());
+
+    // the cooker keeps the glTF material list as is, duplicates are merged here like in the glTF path
+    std::unordered_map<DescriptorKey, std::shared_ptr<GLTFMaterial>, DescriptorKeyHash> materialsByKey;
+    DescriptorKey materialKey;
+
+    for (size_t i = 0; i < fileMaterials.size(); ++i) {
+        const SceneFileMaterial& fileMaterial = fileMaterials[i];
+
+        GLTFMetallic_Roughness::MaterialConstants constants = {};
+        memcpy(&constants.colorFactors, fileMaterial.colorFactors, sizeof(fileMaterial.colorFactors));
+        memcpy(&constants.metallicRoughnessFactors, fileMaterial.metallicRoughnessFactors, sizeof(fileMaterial.metallicRoughnessFactors));
+
+        const MaterialPass passType = (MaterialPass)fileMaterial.passType;
+
+        GLTFMetallic_Roughness::MaterialResources materialResources;
+        
+        materialResources.colorImage = pEngine->m_whiteImage;
+        materialResources.colorSampler = pEngine->m_linearSampler;
+        materialResources.metalRoughImage = pEngine->m_whiteImage;
+        materialResources.metalRoughSampler = pEngine->m_linearSampler;
+
+        materialResources.dataBuffer = file.materialDataBuffer;
+        materialResources.dataBufferSize = materialDataSize;
+        // older files leave the cutoff at zero, they never alpha test
+        materialResources.useAlphaTest = constants.metallicRoughnessFactors.z > 0.f;
+
+        if (fileMaterial.colorTextureIndex < images.size()) {
+            materialResources.colorImage = images[fileMaterial.colorTextureIndex];
+        }
+
+        if (fileMaterial.colorSamplerIndex < file.samplers.size()) {
+            materialResources.colorSampler = file.samplers[fileMaterial.colorSamplerIndex];
+        }
+
+        BuildMaterialKey(constants, passType, materialResources, materialKey);
+
+        std::shared_ptr<GLTFMaterial>& pMaterial = materialsByKey[materialKey];
+
+        if (pMaterial == nullptr) {
+            const uint32_t constantsIndex = (uint32_t)file.uniqueMaterials.size();
+
+            pSceneMaterialConstants[constantsIndex] = constants;
+            materialResources.constantsIndex = constantsIndex;
+
+            const std::optional<MaterialInstance> matData = pEngine->m_metalRoughMaterial.WriteMaterial(*pEngine, passType, materialResources, file.descriptorPool);
+
+            if (!matData.has_value()) {
+                fmt::println(stderr, "Descriptor buffer is full, scene {} is not loaded", filepath.string().c_str());
+                return std::nullopt;
+            }
+
+            pMaterial = std::make_shared<GLTFMaterial>();
+            pMaterial->data = matData.value();
+
+            file.uniqueMaterials.push_back(pMaterial);
+
+            // binding 1 is the color texture, the metal-rough one stays the white image
+            if (fileMaterial.colorTextureIndex < images.size() && streamedTextureIDs[fileMaterial.colorTextureIndex] != INVALID_STREAMED_TEXTURE_ID) {
+                const MaterialTextureBinding binding = { 1, streamedTextureIDs[fileMaterial.colorTextureIndex], materialResources.colorSampler };
+                pEngine->m_textureStreamer.RegisterMaterial(&file, &pMaterial->data, std::span(&binding, 1));
+            }
+        }
+
+        materials.push_back(pMaterial);
+        file.materials[GetSceneFileString(strings, fileMaterial.name)] = pMaterial;
+    }
+
+    for (size_t i = 0; i < fileMeshes.size(); ++i) {
+        const SceneFileMesh& fileMesh = fileMeshes[i];
+        std::shared_ptr<MeshAsset>& pMesh = meshes[i];
+
+        pMesh->surfaces.reserve(fileMesh.surfaceCount);
+
+        for (const SceneFileSurface& fileSurface : fileSurfaces.subspan(fileMesh.firstSurface, fileMesh.surfaceCount)) {
+            GeoSurface newSurface;
+            newSurface.startIndex = fileSurface.startIndex;
+            newSurface.count = fileSurface.indexCount;
+            newSurface.material = materials[fileSurface.materialIndex];
+
+            memcpy(&newSurface.bounds.origin, fileSurface.boundsOrigin, sizeof(fileSurface.boundsOrigin));
+            memcpy(&newSurface.bounds.extents, fileSurface.boundsExtents, sizeof(fileSurface.boundsExtents));
+            newSurface.bounds.sphereRadius = fileSurface.boundsSphereRadius;
+
+            pMesh->surfaces.push_back(newSurface);
+        }
+    }
+
+    std::vector<std::shared_ptr<Node>> nodes;
+    nodes.reserve(fileNodes.size());
+
+    for (const SceneFileNode& fileNode : fileNodes) {
+        std::shared_ptr<Node> newNode;
+
+        if (fileNode.meshIndex < meshes.size()) {
+            newNode = std::make_shared<MeshNode>();
+            static_cast<MeshNode*>(newNode.get())->pMesh = meshes[fileNode.meshIndex];
+        } else {
+            newNode = std::make_shared<Node>();
+        }
+
+        memcpy(&newNode->localTrs, fileNode.localTransform, sizeof(fileNode.localTransform));
+
+        nodes.push_back(newNode);
+        file.nodes[GetSceneFileString(strings, fileNode.name)] = newNode;
+    }
+
+    for (size_t i = 0; i < fileNodes.size(); ++i) {
+        const uint32_t parentIdx = fileNodes[i].parentIndex;
+
+        // validated, either a node of the file or SCENE_FILE_INVALID_INDEX
+        if (parentIdx != SCENE_FILE_INVALID_INDEX) {
+            nodes[parentIdx]->children.push_back(nodes[i]);
+            nodes[i]->pParent = nodes[parentIdx];
+        } else {
+            file.topNodes.push_back(nodes[i]);
+        }
+    }
+
+    for (std::shared_ptr<Node>& pNode : file.topNodes) {
+        pNode->RefreshTransform(glm::identity<glm::mat4>());
+    }
+
+    // the mapping stays where it is, the mip pointers handed to the streamer remain valid
+    file.sourceFile = std::move(mappedFile);
+
+    return pScene;
+}
+
+
 std::optional<ImageHandle> LoadImage(VulkanEngine* pEngine, fastgltf::Asset& asset, fastgltf::Image& image)
 {
-    ImageHandle imageHandle = {};
-
-    int width = 0, height = 0, nrChannels = 0;
-
-    std::visit(
-        fastgltf::visitor {
-            [](auto& arg) {},
-            [&](fastgltf::sources::URI& filePath) {
-                ENG_ASSERT(filePath.fileByteOffset == 0); // We don't support offsets with stbi.
-                ENG_ASSERT(filePath.uri.isLocalPath()); // We're only capable of loading local files.
-
-                const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
-                uint8_t* pData = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
-                
-                if (pData) {
-                    VkExtent3D imageSize;
-                    imageSize.width = width;
-                    imageSize.height = height;
-                    imageSize.depth = 1;
-
-                    imageHandle = pEngine->CreateImage(imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, pData, true);
-
-                    stbi_image_free(pData);
-                }
-            },
-            [&](fastgltf::sources::Vector& vector) {
-                uint8_t* pData = stbi_load_from_memory((const stbi_uc*)vector.bytes.data(), static_cast<size_t>(vector.bytes.size()), &width, &height, &nrChannels, 4);
-                
-                if (pData) {
-                    VkExtent3D imageSize;
-                    imageSize.width = width;
-                    imageSize.height = height;
-                    imageSize.depth = 1;
-
-                    imageHandle = pEngine->CreateImage(imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, pData, true);
-
-                    stbi_image_free(pData);
-                }
-            },
-            [&](fastgltf::sources::BufferView& view) {
-                auto& bufferView = asset.bufferViews[view.bufferViewIndex];
-                auto& buffer = asset.buffers[bufferView.bufferIndex];
-
-                std::visit(fastgltf::visitor {
-                    [](auto& arg) {},
-                    [&](fastgltf::sources::Vector& vector) {
-                        uint8_t* pData = stbi_load_from_memory((const stbi_uc*)vector.bytes.data() + bufferView.byteOffset,
-                            static_cast<size_t>(bufferView.byteLength), &width, &height, &nrChannels, 4);
-                        
-                        if (pData) {
-                            VkExtent3D imageSize;
-                            imageSize.width = width;
-                            imageSize.height = height;
-                            imageSize.depth = 1;
-
-                            imageHandle = pEngine->CreateImage(imageSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, pData, true);
-
-                           stbi_image_free(pData);
-                       }
-                   } },
-                buffer.data);
-            },
-        },
-        image.data);
+    DecodedImage decoded = DecodeImage(asset, image);
+    return UploadDecodedImage(pEngine, decoded);
+}
+
+
+static std::optional<ImageHandle> UploadDecodedImage(VulkanEngine* pEngine, DecodedImage& decoded)
+{
+    if (decoded.ktx2.IsValid()) {
+        UploadBatch uploadBatch;
+        std::optional<ImageHandle> imageHandle = CreateKtx2Image(pEngine, decoded.ktx2, uploadBatch, false);
+
+        uploadBatch.Submit(*pEngine);
+        FreeDecodedImage(decoded);
+
+        return imageHandle;
+    }
+
+    if (decoded.pPixels == nullptr) {
+        return std::nullopt;
+    }
+
+    ImageHandle imageHandle = pEngine->CreateImage(decoded.extent, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, decoded.pPixels, true);
+
+    FreeDecodedImage(decoded);
 
     if (imageHandle.pImage != VK_NULL_HANDLE) {
         return imageHandle;
     } else {
         return std::nullopt;
     }
-}
\ No newline at end of file
+}
+
+
+static std::optional<ImageHandle> CreateKtx2Image(VulkanEngine* pEngine, const Ktx2Image& ktx2, UploadBatch& uploadBatch, bool isSRGB)
+{
+    if (!pEngine->IsTextureFormatSupported(ktx2.format)) {
+        fmt::print("KTX2 texture format {} is not supported by the device\n", (uint32_t)ktx2.format);
+        return std::nullopt;
+    }
+
+    if (ktx2.needsMipGeneration) {
+        ImageHandle image = pEngine->CreateImage(ktx2.extent, ktx2.format,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, nullptr, true);
+
+        uploadBatch.AddImageUpload(image, ktx2.data.data(), ktx2.levels[0].size, true, isSRGB);
+
+        return image;
+    }
+
+    // stored levels go up as they are, block compressed ones can't be blitted anyway
+    ImageHandle image = pEngine->CreateTextureImage(ktx2.extent, ktx2.format, (uint32_t)ktx2.levels.size());
+
+    std::vector<UploadBatch::MipData> mips;
+    mips.reserve(ktx2.levels.size());
+
+    for (const Ktx2Level& level : ktx2.levels) {
+        mips.emplace_back(UploadBatch::MipData { ktx2.data.data() + level.offset, level.size });
+    }
+
+    uploadBatch.AddImageMipsUpload(image, mips);
+
+    return image;
+}
+
+
+static void BuildMaterialKey(const GLTFMetallic_Roughness::MaterialConstants& constants, MaterialPass pass,
+    const GLTFMetallic_Roughness::MaterialResources& resources, DescriptorKey& key) noexcept
+{
+    key.clear();
+
+    for (glm::length_t i = 0; i < 4; ++i) {
+        key.push_back(std::bit_cast<uint32_t>(constants.colorFactors[i]));
+        key.push_back(std::bit_cast<uint32_t>(constants.metallicRoughnessFactors[i]));
+    }
+
+    key.push_back((uint64_t)pass);
+    key.push_back(resources.colorImage.value);
+    key.push_back((uint64_t)resources.colorSampler);
+}
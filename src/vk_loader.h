@@ -2,14 +2,12 @@
 
 #include "vk_types.h"
 #include "vk_descriptors.h"
+#include "gltf_import.h"
+#include "mapped_file.h"
 
 #include <unordered_map>
 #include <filesystem>
 
-#include <fastgltf/glm_element_traits.hpp>
-#include <fastgltf/tools.hpp>
-#include <fastgltf/core.hpp>
-
 
 struct GLTFMaterial
 {
@@ -17,14 +15,6 @@ struct GLTFMaterial
 };
 
 
-struct Bounds
-{
-    glm::vec3 origin;
-    float sphereRadius;
-    glm::vec3 extents;
-};
-
-
 struct GeoSurface
 {
     std::shared_ptr<GLTFMaterial> material;
@@ -37,6 +27,7 @@ struct GeoSurface
 struct MeshAsset
 {
     std::string name;
+    uint32_t id;
 
     std::vector<GeoSurface> surfaces;
     MeshGpuBuffers meshBuffers;
@@ -44,13 +35,21 @@ struct MeshAsset
 
 
 class VulkanEngine;
+class UploadBatch;
 
 
 struct LoadedGLTF : public IRenderable
 {
     ~LoadedGLTF() { ClearAll(); }
 
-    void Render(const glm::mat4& topMatrix, RenderContext& ctx) override;
+    void RegisterDraws(RenderContext& ctx) override;
+    void UnregisterDraws(RenderContext& ctx) override;
+
+    void SetTransform(const glm::mat4& topMatrix);
+
+    // Moves the scene's opaque draws to the depth pre-pass, pays off when surfaces overlap a lot on screen
+    void SetDepthPrepass(bool enable);
+    bool IsDepthPrepassEnabled() const { return useDepthPrepass; }
 
 private:
     void ClearAll();
@@ -58,8 +57,12 @@ private:
 public:
     std::unordered_map<std::string, std::shared_ptr<MeshAsset>> meshes;
     std::unordered_map<std::string, std::shared_ptr<Node>> nodes;
-    std::unordered_map<std::string, ImageHandle> images;
+    // owned references, streamed textures belong to the texture streamer and aren't listed
+    std::unordered_map<std::string, ImageID> images;
+    // names of duplicate materials map to the same entry of uniqueMaterials
     std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
+    // indexed like the constants in materialDataBuffer
+    std::vector<std::shared_ptr<GLTFMaterial>> uniqueMaterials;
     
     std::vector<std::shared_ptr<Node>> topNodes;
 
@@ -67,11 +70,59 @@ public:
 
     DescriptorAllocatorGrowable descriptorPool;
 
-    BufferHandle materialDataBuffer;
+    BufferID materialDataBuffer;
+
+    // cooked scenes keep their file mapped, streamed textures upload their higher mips from it
+    MappedFile sourceFile;
 
     VulkanEngine* pCreator;
+    RenderContext* pDrawCtx = nullptr;
+
+private:
+    bool useDepthPrepass = false;
 };
 
 
+enum class SceneLoadStatus : uint8_t
+{
+    PARSING,
+    UPLOADING,
+    DONE,
+    FAILED,
+    CANCELLED
+};
+
+
+// Shared by an asynchronous scene load and whoever started it, see VulkanEngine::LoadSceneAsync
+struct SceneLoadState
+{
+    // 0 to 1, parsing and decoding take most of the load so uploading starts at 0.9
+    float GetProgress() const noexcept;
+
+    // The load stops at its next step, a scene that is already uploaded gets released instead of published
+    void Cancel() noexcept { parseProgress.isCancelled.store(true, std::memory_order_relaxed); }
+    bool IsCancelled() const noexcept { return parseProgress.isCancelled.load(std::memory_order_relaxed); }
+
+    bool IsFinished() const noexcept { return status.load(std::memory_order_acquire) >= SceneLoadStatus::DONE; }
+
+    std::string name;
+    std::filesystem::path filepath;
+
+    ParseProgress parseProgress;
+    std::atomic<SceneLoadStatus> status = SceneLoadStatus::PARSING;
+};
+
+
+// GPU side of the load, creates and uploads the resources of a parsed scene
+std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, ParsedGLTF& parsed);
+// Creates the resources and only records their uploads, parsed has to outlive the batch submission
+std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, ParsedGLTF& parsed, UploadBatch& uploadBatch);
 std::optional<std::shared_ptr<LoadedGLTF>> LoadGLTF(VulkanEngine* pEngine, const std::filesystem::path& filepath);
+
+// Maps a scene cooked by tools/scene_cooker and uploads it as is, the whole data section goes
+// through one staging buffer and one submit
+std::optional<std::shared_ptr<LoadedGLTF>> LoadCookedScene(VulkanEngine* pEngine, const std::filesystem::path& filepath);
+// Same with the file already mapped, so the mapping can be done off the main thread
+std::optional<std::shared_ptr<LoadedGLTF>> LoadCookedScene(VulkanEngine* pEngine, const std::filesystem::path& filepath, MappedFile&& mappedFile);
+
 std::optional<ImageHandle> LoadImage(VulkanEngine* pEngine, fastgltf::Asset& asset, fastgltf::Image& image);
\ No newline at end of file
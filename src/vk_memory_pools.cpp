@@ -0,0 +1,591 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_memory_pools.h"
+#include "vk_engine.h"
+#include "vk_images.h"
+#include "vk_initializers.h"
+
+
+void MemoryPools::Init(VkDevice pDevice, VmaAllocator pAllocator) noexcept
+{
+    ENG_ASSERT(pDevice != VK_NULL_HANDLE && pAllocator != VK_NULL_HANDLE);
+
+    m_pDevice = pDevice;
+    m_pAllocator = pAllocator;
+
+    struct PoolDesc
+    {
+        Pool pool;
+        MemoryCategory category;
+        VkDeviceSize blockSize;
+        // usage of the buffers the memory type is picked for, the texture pool is picked for images
+        VkBufferUsageFlags bufferUsage;
+        bool isLinear;
+    };
+
+    const PoolDesc poolDescs[] = {
+        { Pool::MESHES, MemoryCategory::MESHES, MESH_BLOCK_SIZE,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, false },
+        { Pool::TEXTURES, MemoryCategory::TEXTURES, TEXTURE_BLOCK_SIZE, 0, false },
+        { Pool::STAGING, MemoryCategory::STAGING, STAGING_BLOCK_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true },
+        { Pool::TRANSIENT, MemoryCategory::TRANSIENT, TRANSIENT_BLOCK_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, true },
+    };
+
+    for (const PoolDesc& desc : poolDescs) {
+        // m_pools is still empty, the info carries no pool
+        const VmaAllocationCreateInfo allocInfo = GetAllocationCreateInfo(desc.category);
+
+        uint32_t memoryTypeIndex = 0;
+        VkResult result;
+
+        if (desc.pool == Pool::TEXTURES) {
+            const VkImageCreateInfo imageInfo = vkinit::ImageCreateInfo(VkExtent3D { 256, 256, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+            result = vmaFindMemoryTypeIndexForImageInfo(m_pAllocator, &imageInfo, &allocInfo, &memoryTypeIndex);
+        } else {
+            VkBufferCreateInfo bufInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+            bufInfo.size = 1024;
+            bufInfo.usage = desc.bufferUsage;
+
+            result = vmaFindMemoryTypeIndexForBufferInfo(m_pAllocator, &bufInfo, &allocInfo, &memoryTypeIndex);
+        }
+
+        if (result != VK_SUCCESS) {
+            fmt::println(stderr, "No memory type for the {} pool, its allocations use the default pools", GetPoolName(desc.pool));
+            continue;
+        }
+
+        VmaPoolCreateInfo poolInfo = {};
+        poolInfo.memoryTypeIndex = memoryTypeIndex;
+        poolInfo.blockSize = desc.blockSize;
+
+        // a single block makes the linear algorithm a ring buffer, allocations freed in order reuse it without holes
+        if (desc.isLinear) {
+            poolInfo.flags = VMA_POOL_CREATE_LINEAR_ALGORITHM_BIT;
+            poolInfo.maxBlockCount = 1;
+        }
+
+        VmaPool& pPool = m_pools[(size_t)desc.pool];
+
+        ENG_VK_CHECK(vmaCreatePool(m_pAllocator, &poolInfo, &pPool));
+        vmaSetPoolName(m_pAllocator, pPool, GetPoolName(desc.pool));
+    }
+}
+
+
+void MemoryPools::Terminate() noexcept
+{
+    ENG_ASSERT(!m_isPassRunning);
+
+    if (m_pDefragContext != VK_NULL_HANDLE) {
+        EndDefragmentation();
+    }
+
+    for (VmaPool& pPool : m_pools) {
+        if (pPool != VK_NULL_HANDLE) {
+            vmaDestroyPool(m_pAllocator, pPool);
+            pPool = VK_NULL_HANDLE;
+        }
+    }
+
+    m_movables.clear();
+
+    m_pAllocator = VK_NULL_HANDLE;
+    m_pDevice = VK_NULL_HANDLE;
+}
+
+
+VmaAllocationCreateInfo MemoryPools::GetAllocationCreateInfo(MemoryCategory category) const noexcept
+{
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    switch (category) {
+        case MemoryCategory::MESHES:
+            allocInfo.pool = m_pools[(size_t)Pool::MESHES];
+            break;
+        case MemoryCategory::TEXTURES:
+            allocInfo.pool = m_pools[(size_t)Pool::TEXTURES];
+            break;
+        case MemoryCategory::RENDER_TARGETS:
+            // re-created on resize, they would leave the largest holes in a shared block
+            allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+            break;
+        case MemoryCategory::STAGING:
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            allocInfo.pool = m_pools[(size_t)Pool::STAGING];
+            break;
+        case MemoryCategory::TRANSIENT:
+            allocInfo.pool = m_pools[(size_t)Pool::TRANSIENT];
+            break;
+        case MemoryCategory::UNIFORMS:
+            // device local when the host can write it directly
+            allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            break;
+        default:
+            ENG_ASSERT_FAIL("Unknown memory category");
+            break;
+    }
+
+    return allocInfo;
+}
+
+
+void MemoryPools::AddMovableBuffer(const BufferHandle& buffer, VkDeviceSize size, VkBufferUsageFlags usage) noexcept
+{
+    ENG_ASSERT(buffer.pAllocation != VK_NULL_HANDLE);
+
+    MovableResource resource = {};
+    resource.pBuffer = buffer.pBuffer;
+    resource.bufferSize = size;
+    resource.bufferUsage = usage;
+    resource.isImage = false;
+    resource.passMoveIndex = UINT32_MAX;
+
+    std::scoped_lock lock(m_mutex);
+    m_movables[buffer.pAllocation] = std::move(resource);
+}
+
+
+void MemoryPools::AddMovableImage(const ImageHandle& image, uint32_t mipCount, VkImageUsageFlags usage, const VkComponentMapping& swizzle) noexcept
+{
+    ENG_ASSERT(image.pAllocation != VK_NULL_HANDLE);
+
+    MovableResource resource = {};
+    resource.image = image;
+    resource.mipCount = mipCount;
+    resource.imageUsage = usage;
+    resource.swizzle = swizzle;
+    resource.isImage = true;
+    resource.passMoveIndex = UINT32_MAX;
+
+    std::scoped_lock lock(m_mutex);
+    m_movables[image.pAllocation] = std::move(resource);
+}
+
+
+void MemoryPools::SetBufferMoveCallback(VmaAllocation pAllocation, BufferMoveCallback&& onMoved) noexcept
+{
+    std::scoped_lock lock(m_mutex);
+
+    auto it = m_movables.find(pAllocation);
+    ENG_ASSERT(it != m_movables.end() && !it->second.isImage);
+
+    MovableResource& resource = it->second;
+    resource.onBufferMoved = std::move(onMoved);
+
+    // nobody would pick up the copy, the running pass leaves the allocation where it is
+    if (!resource.onBufferMoved && resource.passMoveIndex != UINT32_MAX && !m_passMoves[resource.passMoveIndex].isApplied) {
+        m_passInfo.pMoves[m_passMoves[resource.passMoveIndex].vmaMoveIndex].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+    }
+}
+
+
+void MemoryPools::SetImageMoveCallback(VmaAllocation pAllocation, ImageMoveCallback&& onMoved) noexcept
+{
+    std::scoped_lock lock(m_mutex);
+
+    auto it = m_movables.find(pAllocation);
+    ENG_ASSERT(it != m_movables.end() && it->second.isImage);
+
+    MovableResource& resource = it->second;
+    resource.onImageMoved = std::move(onMoved);
+
+    if (!resource.onImageMoved && resource.passMoveIndex != UINT32_MAX && !m_passMoves[resource.passMoveIndex].isApplied) {
+        m_passInfo.pMoves[m_passMoves[resource.passMoveIndex].vmaMoveIndex].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+    }
+}
+
+
+bool MemoryPools::ReleaseMovable(VmaAllocation pAllocation) noexcept
+{
+    if (pAllocation == VK_NULL_HANDLE) {
+        return false;
+    }
+
+    std::scoped_lock lock(m_mutex);
+
+    auto it = m_movables.find(pAllocation);
+    if (it == m_movables.end()) {
+        return false;
+    }
+
+    const uint32_t passMoveIndex = it->second.passMoveIndex;
+    m_movables.erase(it);
+
+    if (passMoveIndex == UINT32_MAX) {
+        return false;
+    }
+
+    // VMA may only free an allocation of a pass when the pass ends
+    PassMove& move = m_passMoves[passMoveIndex];
+    move.isReleased = true;
+
+    m_passInfo.pMoves[move.vmaMoveIndex].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_DESTROY;
+
+    return true;
+}
+
+
+void MemoryPools::Update(VulkanEngine& engine) noexcept
+{
+    if (m_isPassRunning) {
+        return;
+    }
+
+    if (m_pDefragContext == VK_NULL_HANDLE) {
+        if (++m_updatesSinceCheck < DEFRAGMENTATION_CHECK_INTERVAL) {
+            return;
+        }
+
+        m_updatesSinceCheck = 0;
+
+        if (!BeginDefragmentation()) {
+            return;
+        }
+    }
+
+    if (vmaBeginDefragmentationPass(m_pAllocator, m_pDefragContext, &m_passInfo) == VK_SUCCESS) {
+        EndDefragmentation();
+        return;
+    }
+
+    {
+        std::scoped_lock lock(m_mutex);
+
+        m_passMoves.clear();
+
+        for (uint32_t i = 0; i < m_passInfo.moveCount; ++i) {
+            VmaDefragmentationMove& vmaMove = m_passInfo.pMoves[i];
+
+            auto it = m_movables.find(vmaMove.srcAllocation);
+            const bool isFollowed = it != m_movables.end() &&
+                (it->second.isImage ? (bool)it->second.onImageMoved : (bool)it->second.onBufferMoved);
+
+            PassMove move = {};
+
+            if (!isFollowed || !PrepareMove(it->second, vmaMove, move)) {
+                vmaMove.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                continue;
+            }
+
+            move.vmaMoveIndex = i;
+            it->second.passMoveIndex = (uint32_t)m_passMoves.size();
+
+            m_passMoves.push_back(move);
+        }
+    }
+
+    // what VMA picked can't move, another pass would pick the same allocations
+    if (m_passMoves.empty()) {
+        vmaEndDefragmentationPass(m_pAllocator, m_pDefragContext, &m_passInfo);
+        EndDefragmentation();
+
+        return;
+    }
+
+    m_isPassRunning = true;
+
+    const uint64_t submitId = engine.SubmitAsync([this](VkCommandBuffer pCmdBuf) { RecordMoves(pCmdBuf); }, nullptr);
+    CompletePass(engine, submitId);
+}
+
+
+MemoryPoolStats MemoryPools::GetPoolStats(Pool pool) const noexcept
+{
+    const VmaPool pPool = m_pools[(size_t)pool];
+
+    if (pPool == VK_NULL_HANDLE) {
+        return MemoryPoolStats {};
+    }
+
+    VmaStatistics stats = {};
+    vmaGetPoolStatistics(m_pAllocator, pPool, &stats);
+
+    return MemoryPoolStats { stats.blockBytes, stats.allocationBytes };
+}
+
+
+const char* MemoryPools::GetPoolName(Pool pool) noexcept
+{
+    switch (pool) {
+        case Pool::MESHES: return "meshes";
+        case Pool::TEXTURES: return "textures";
+        case Pool::STAGING: return "staging";
+        case Pool::TRANSIENT: return "transient";
+        default: return "unknown";
+    }
+}
+
+
+bool MemoryPools::BeginDefragmentation() noexcept
+{
+    ENG_ASSERT(m_pDefragContext == VK_NULL_HANDLE);
+
+    VmaPool pSparsestPool = VK_NULL_HANDLE;
+    uint64_t maxFreeBytes = 0;
+
+    for (Pool pool : { Pool::MESHES, Pool::TEXTURES }) {
+        const VmaPool pPool = m_pools[(size_t)pool];
+
+        if (pPool == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        VmaStatistics stats = {};
+        vmaGetPoolStatistics(m_pAllocator, pPool, &stats);
+
+        const uint64_t freeBytes = stats.blockBytes - stats.allocationBytes;
+
+        // with a single block there is nothing to give back
+        if (stats.blockCount < 2 || freeBytes < stats.blockBytes * DEFRAGMENTATION_MIN_FREE_FRACTION) {
+            continue;
+        }
+
+        if (freeBytes > maxFreeBytes) {
+            maxFreeBytes = freeBytes;
+            pSparsestPool = pPool;
+        }
+    }
+
+    if (pSparsestPool == VK_NULL_HANDLE) {
+        return false;
+    }
+
+    VmaDefragmentationInfo defragInfo = {};
+    defragInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+    defragInfo.pool = pSparsestPool;
+    defragInfo.maxBytesPerPass = DEFRAGMENTATION_MAX_BYTES_PER_PASS;
+    defragInfo.maxAllocationsPerPass = DEFRAGMENTATION_MAX_MOVES_PER_PASS;
+
+    return vmaBeginDefragmentation(m_pAllocator, &defragInfo, &m_pDefragContext) == VK_SUCCESS;
+}
+
+
+void MemoryPools::EndDefragmentation() noexcept
+{
+    VmaDefragmentationStats stats = {};
+    vmaEndDefragmentation(m_pAllocator, m_pDefragContext, &stats);
+
+    m_pDefragContext = VK_NULL_HANDLE;
+    m_movedBytes += stats.bytesMoved;
+}
+
+
+bool MemoryPools::PrepareMove(const MovableResource& resource, const VmaDefragmentationMove& vmaMove, PassMove& move) noexcept
+{
+    move.pAllocation = vmaMove.srcAllocation;
+    move.isImage = resource.isImage;
+
+    // the new resource is bound to the temporary allocation, it becomes srcAllocation's memory when the pass ends
+    if (!resource.isImage) {
+        VkBufferCreateInfo bufInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        bufInfo.size = resource.bufferSize;
+        bufInfo.usage = resource.bufferUsage;
+
+        if (vkCreateBuffer(m_pDevice, &bufInfo, nullptr, &move.pNewBuffer) != VK_SUCCESS) {
+            return false;
+        }
+
+        if (vmaBindBufferMemory(m_pAllocator, vmaMove.dstTmpAllocation, move.pNewBuffer) != VK_SUCCESS) {
+            vkDestroyBuffer(m_pDevice, move.pNewBuffer, nullptr);
+            return false;
+        }
+
+        move.pOldBuffer = resource.pBuffer;
+        move.bufferSize = resource.bufferSize;
+
+        return true;
+    }
+
+    VkImageCreateInfo imageInfo = vkinit::ImageCreateInfo(resource.image.extent, resource.image.format, resource.imageUsage);
+    imageInfo.mipLevels = resource.mipCount;
+
+    ImageHandle newImage = resource.image;
+
+    if (vkCreateImage(m_pDevice, &imageInfo, nullptr, &newImage.pImage) != VK_SUCCESS) {
+        return false;
+    }
+
+    if (vmaBindImageMemory(m_pAllocator, vmaMove.dstTmpAllocation, newImage.pImage) != VK_SUCCESS) {
+        vkDestroyImage(m_pDevice, newImage.pImage, nullptr);
+        return false;
+    }
+
+    VkImageViewCreateInfo viewInfo = vkinit::ImageViewCreateInfo(newImage.pImage, newImage.format, VK_IMAGE_ASPECT_COLOR_BIT);
+    viewInfo.subresourceRange.levelCount = resource.mipCount;
+    viewInfo.components = resource.swizzle;
+
+    if (vkCreateImageView(m_pDevice, &viewInfo, nullptr, &newImage.pImageView) != VK_SUCCESS) {
+        vkDestroyImage(m_pDevice, newImage.pImage, nullptr);
+        return false;
+    }
+
+    move.oldImage = resource.image;
+    move.newImage = newImage;
+    move.mipCount = resource.mipCount;
+
+    return true;
+}
+
+
+void MemoryPools::RecordMoves(VkCommandBuffer pCmdBuf) const noexcept
+{
+    std::vector<VkImageCopy> mipCopies;
+
+    for (const PassMove& move : m_passMoves) {
+        if (!move.isImage) {
+            const VkBufferCopy region = { 0, 0, move.bufferSize };
+            vkCmdCopyBuffer(pCmdBuf, move.pOldBuffer, move.pNewBuffer, 1, &region);
+
+            continue;
+        }
+
+        const VkExtent3D& extent = move.oldImage.extent;
+
+        mipCopies.resize(move.mipCount);
+
+        for (uint32_t mip = 0; mip < move.mipCount; ++mip) {
+            VkImageCopy& copy = mipCopies[mip];
+            copy = {};
+
+            copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+            copy.dstSubresource = copy.srcSubresource;
+            copy.extent = { std::max(extent.width >> mip, 1u), std::max(extent.height >> mip, 1u), 1 };
+        }
+
+        // frames submitted before the holder switches still sample the old image, it goes back to its layout
+        vkutil::TransitImage(pCmdBuf, move.oldImage.pImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        vkutil::TransitImage(pCmdBuf, move.newImage.pImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        vkCmdCopyImage(pCmdBuf, move.oldImage.pImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, move.newImage.pImage,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)mipCopies.size(), mipCopies.data());
+
+        vkutil::TransitImage(pCmdBuf, move.newImage.pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        vkutil::TransitImage(pCmdBuf, move.oldImage.pImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    // buffer copies have no barrier of their own, the frames using the new buffers come in later submissions
+    VkMemoryBarrier2 copyBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    copyBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    copyBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    copyBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    copyBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+    VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    depInfo.memoryBarrierCount = 1;
+    depInfo.pMemoryBarriers = &copyBarrier;
+
+    vkCmdPipelineBarrier2(pCmdBuf, &depInfo);
+}
+
+
+DetachedTask MemoryPools::CompletePass(VulkanEngine& engine, uint64_t submitId) noexcept
+{
+    co_await engine.WaitForSubmit(submitId);
+
+    struct MoveNotification
+    {
+        uint32_t passMoveIndex;
+        // false when the holder kept the old resource
+        std::function<bool()> notify;
+    };
+
+    // holders may call back into the pools, they are notified outside the lock
+    std::vector<MoveNotification> notifications;
+
+    {
+        std::scoped_lock lock(m_mutex);
+
+        for (uint32_t i = 0; i < (uint32_t)m_passMoves.size(); ++i) {
+            PassMove& move = m_passMoves[i];
+
+            if (move.isReleased || m_passInfo.pMoves[move.vmaMoveIndex].operation != VMA_DEFRAGMENTATION_MOVE_OPERATION_COPY) {
+                continue;
+            }
+
+            MovableResource& resource = m_movables.at(move.pAllocation);
+            move.isApplied = true;
+
+            if (move.isImage) {
+                resource.image = move.newImage;
+                notifications.push_back({ i, [onMoved = resource.onImageMoved, newImage = move.newImage]() { return onMoved(newImage); } });
+            } else {
+                resource.pBuffer = move.pNewBuffer;
+                notifications.push_back({ i, [onMoved = resource.onBufferMoved, pNewBuffer = move.pNewBuffer]() { onMoved(pNewBuffer); return true; } });
+            }
+        }
+    }
+
+    for (MoveNotification& notification : notifications) {
+        if (notification.notify()) {
+            continue;
+        }
+
+        std::scoped_lock lock(m_mutex);
+
+        // the copy is dropped at the end of the pass, VMA leaves the allocation in the old resource
+        PassMove& move = m_passMoves[notification.passMoveIndex];
+        m_passInfo.pMoves[move.vmaMoveIndex].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+        move.isApplied = false;
+
+        m_movables.at(move.pAllocation).image = move.oldImage;
+    }
+
+    // frames in flight may still use the old handles, the source memory is only given back after them
+    engine.GetReleaseDeletionQueue().PushDeletor([this]() {
+        EndPass();
+    });
+}
+
+
+void MemoryPools::EndPass() noexcept
+{
+    std::scoped_lock lock(m_mutex);
+
+    for (const PassMove& move : m_passMoves) {
+        const bool isCopied = !move.isReleased && m_passInfo.pMoves[move.vmaMoveIndex].operation == VMA_DEFRAGMENTATION_MOVE_OPERATION_COPY;
+
+        // a copied allocation lives on in the new resource, an ignored one in the old
+        if (move.isReleased || isCopied) {
+            DestroyMoveResource(move, true);
+        }
+
+        if (move.isReleased || !isCopied) {
+            DestroyMoveResource(move, false);
+        }
+
+        if (!move.isReleased) {
+            m_movables.at(move.pAllocation).passMoveIndex = UINT32_MAX;
+        }
+    }
+
+    m_passMoves.clear();
+
+    const VkResult result = vmaEndDefragmentationPass(m_pAllocator, m_pDefragContext, &m_passInfo);
+    m_isPassRunning = false;
+
+    if (result == VK_SUCCESS) {
+        EndDefragmentation();
+    }
+}
+
+
+void MemoryPools::DestroyMoveResource(const PassMove& move, bool isOld) const noexcept
+{
+    // only the handles, the memory belongs to VMA's pass
+    if (!move.isImage) {
+        vkDestroyBuffer(m_pDevice, isOld ? move.pOldBuffer : move.pNewBuffer, nullptr);
+        return;
+    }
+
+    const ImageHandle& image = isOld ? move.oldImage : move.newImage;
+
+    vkDestroyImageView(m_pDevice, image.pImageView, nullptr);
+    vkDestroyImage(m_pDevice, image.pImage, nullptr);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include "task.h"
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+class VulkanEngine;
+
+
+// Called on the main thread once the contents landed in the new resource. The old one stays valid
+// until the frames in flight are done with it, holders only have to switch to the new handle.
+// An image holder that can't switch returns false, the allocation then stays in the old image.
+using BufferMoveCallback = std::function<void(VkBuffer pNewBuffer)>;
+using ImageMoveCallback = std::function<bool(const ImageHandle& newImage)>;
+
+
+struct MemoryPoolStats
+{
+    uint64_t blockBytes;
+    uint64_t allocationBytes;
+};
+
+
+// VMA pools per resource class. Staging and transient scratch live in linear pools used as ring buffers,
+// meshes and textures in block pools that are defragmented incrementally: a pass moves a bounded number of
+// allocations, copies them on the GPU and hands the new handles to the move callbacks of their holders.
+// Allocations without a callback stay where they are.
+class MemoryPools final
+{
+public:
+    enum class Pool : uint8_t
+    {
+        MESHES,
+        TEXTURES,
+        STAGING,
+        TRANSIENT,
+        COUNT
+    };
+
+    static constexpr VkDeviceSize MESH_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize TEXTURE_BLOCK_SIZE = 128ull * 1024 * 1024;
+    static constexpr VkDeviceSize STAGING_BLOCK_SIZE = 64ull * 1024 * 1024;
+    static constexpr VkDeviceSize TRANSIENT_BLOCK_SIZE = 16ull * 1024 * 1024;
+
+    // bounds the copies and the temporary memory of a pass, one pass is in flight at a time
+    static constexpr VkDeviceSize DEFRAGMENTATION_MAX_BYTES_PER_PASS = 16ull * 1024 * 1024;
+    static constexpr uint32_t DEFRAGMENTATION_MAX_MOVES_PER_PASS = 64;
+    // pools are checked every that many updates, defragmentation starts once enough of their blocks is free
+    static constexpr uint32_t DEFRAGMENTATION_CHECK_INTERVAL = 120;
+    static constexpr float DEFRAGMENTATION_MIN_FREE_FRACTION = 0.25f;
+
+public:
+    MemoryPools() = default;
+
+    MemoryPools(const MemoryPools& other) = delete;
+    MemoryPools& operator=(const MemoryPools& other) = delete;
+
+    void Init(VkDevice pDevice, VmaAllocator pAllocator) noexcept;
+    // Every allocation of the pools has to be freed already
+    void Terminate() noexcept;
+
+    // What a category is allocated with, allocations that don't fit a pool block go to the default pools
+    VmaAllocationCreateInfo GetAllocationCreateInfo(MemoryCategory category) const noexcept;
+
+    // Records what a move has to re-create, the allocation stays put until a callback is set
+    void AddMovableBuffer(const BufferHandle& buffer, VkDeviceSize size, VkBufferUsageFlags usage) noexcept;
+    void AddMovableImage(const ImageHandle& image, uint32_t mipCount, VkImageUsageFlags usage, const VkComponentMapping& swizzle) noexcept;
+
+    // Contents have to be uploaded before, an empty callback pins the allocation again
+    void SetBufferMoveCallback(VmaAllocation pAllocation, BufferMoveCallback&& onMoved) noexcept;
+    void SetImageMoveCallback(VmaAllocation pAllocation, ImageMoveCallback&& onMoved) noexcept;
+
+    // Forgets the allocation. True if the running pass moves it, the pass then destroys its handles and frees it.
+    bool ReleaseMovable(VmaAllocation pAllocation) noexcept;
+
+    // Starts a defragmentation when a pool got sparse and runs its passes, engine main thread only
+    void Update(VulkanEngine& engine) noexcept;
+
+    MemoryPoolStats GetPoolStats(Pool pool) const noexcept;
+    static const char* GetPoolName(Pool pool) noexcept;
+    uint64_t GetMovedBytes() const noexcept { return m_movedBytes; }
+    bool IsDefragmenting() const noexcept { return m_pDefragContext != VK_NULL_HANDLE; }
+
+private:
+    struct MovableResource
+    {
+        VkBuffer pBuffer;
+        VkDeviceSize bufferSize;
+        VkBufferUsageFlags bufferUsage;
+        BufferMoveCallback onBufferMoved;
+
+        ImageHandle image;
+        uint32_t mipCount;
+        VkImageUsageFlags imageUsage;
+        VkComponentMapping swizzle;
+        ImageMoveCallback onImageMoved;
+
+        bool isImage;
+        // index in m_passMoves, UINT32_MAX while the allocation isn't moved
+        uint32_t passMoveIndex;
+    };
+
+    struct PassMove
+    {
+        VmaAllocation pAllocation;
+        // index in the pMoves of the VMA pass, its operation decides what happens at the end of the pass
+        uint32_t vmaMoveIndex;
+        bool isImage;
+
+        VkBuffer pOldBuffer;
+        VkBuffer pNewBuffer;
+        VkDeviceSize bufferSize;
+
+        ImageHandle oldImage;
+        ImageHandle newImage;
+        uint32_t mipCount;
+
+        // the holder got the new handle
+        bool isApplied;
+        // the holder destroyed the resource during the pass
+        bool isReleased;
+    };
+
+private:
+    bool BeginDefragmentation() noexcept;
+    void EndDefragmentation() noexcept;
+
+    bool PrepareMove(const MovableResource& resource, const VmaDefragmentationMove& vmaMove, PassMove& move) noexcept;
+    void RecordMoves(VkCommandBuffer pCmdBuf) const noexcept;
+
+    DetachedTask CompletePass(VulkanEngine& engine, uint64_t submitId) noexcept;
+    void EndPass() noexcept;
+
+    void DestroyMoveResource(const PassMove& move, bool isOld) const noexcept;
+
+private:
+    VkDevice m_pDevice = VK_NULL_HANDLE;
+    VmaAllocator m_pAllocator = VK_NULL_HANDLE;
+
+    std::array<VmaPool, (size_t)Pool::COUNT> m_pools = {};
+
+    // resources are created and destroyed on job threads as well
+    mutable std::mutex m_mutex;
+    std::unordered_map<VmaAllocation, MovableResource> m_movables;
+
+    VmaDefragmentationContext m_pDefragContext = VK_NULL_HANDLE;
+    VmaDefragmentationPassMoveInfo m_passInfo = {};
+    std::vector<PassMove> m_passMoves;
+    bool m_isPassRunning = false;
+
+    uint32_t m_updatesSinceCheck = 0;
+    uint64_t m_movedBytes = 0;
+};
@@ -0,0 +1,321 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_mip_generator.h"
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_shader_archive.h"
+
+
+static constexpr std::string_view MIP_GEN_CS_NAME = "mip_gen.comp";
+
+// a workgroup reduces a 64x64 tile to one texel of the 6th mip below the source
+static constexpr uint32_t MIP_GEN_TILE_SIZE = 64;
+static constexpr uint32_t MIP_GEN_TILE_MIP_COUNT = 6;
+
+// the last workgroup reduces at most 64x64 tile texels, larger sources take more than one dispatch
+static constexpr uint32_t MIP_GEN_MAX_SINGLE_DISPATCH_SIZE = MIP_GEN_TILE_SIZE * MIP_GEN_TILE_SIZE;
+
+// counter and padding in front of the tile texels
+static constexpr uint64_t MIP_GEN_SCRATCH_HEADER_SIZE = 16;
+// upper bound of minStorageBufferOffsetAlignment
+static constexpr uint64_t MIP_GEN_SCRATCH_ALIGNMENT = 256;
+
+
+struct MipGenPushConstants
+{
+    int32_t srcSize[2];
+    uint32_t mipCount;
+    uint32_t reduction;
+    uint32_t isSRGB;
+};
+
+
+void MipGenerator::Init(VkDevice pDevice, VkPhysicalDevice pPhysDevice, bool isStorageWriteWithoutFormatSupported) noexcept
+{
+    m_pDevice = pDevice;
+    m_pPhysDevice = pPhysDevice;
+    m_isStorageWriteWithoutFormatSupported = isStorageWriteWithoutFormatSupported;
+}
+
+
+bool MipGenerator::BuildPipeline(ShaderArchive& shaderArchive, VkPipelineCache pPipelineCache) noexcept
+{
+    ENG_ASSERT(m_pDevice != VK_NULL_HANDLE);
+
+    if (!m_isStorageWriteWithoutFormatSupported) {
+        return true;
+    }
+
+    VkShaderModule pShaderModule = shaderArchive.GetModule(m_pDevice, MIP_GEN_CS_NAME);
+    if (pShaderModule == VK_NULL_HANDLE) {
+        ENG_ASSERT_FAIL("Failed to load shader module: {}", MIP_GEN_CS_NAME);
+        return false;
+    }
+
+    DescriptorLayoutBuilder builder;
+    builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_MIPS_PER_DISPATCH);
+    builder.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    m_pDescriptorLayout = builder.Build(m_pDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkPushConstantRange pushConstRange = {};
+    pushConstRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstRange.offset = 0;
+    pushConstRange.size = sizeof(MipGenPushConstants);
+
+    VkPipelineLayoutCreateInfo layoutCreateInfo = {};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.setLayoutCount = 1;
+    layoutCreateInfo.pSetLayouts = &m_pDescriptorLayout;
+    layoutCreateInfo.pushConstantRangeCount = 1;
+    layoutCreateInfo.pPushConstantRanges = &pushConstRange;
+
+    ENG_VK_CHECK(vkCreatePipelineLayout(m_pDevice, &layoutCreateInfo, nullptr, &m_pPipelineLayout));
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = pShaderModule,
+            .pName = "main",
+        },
+        .layout = m_pPipelineLayout,
+    };
+
+    ENG_VK_CHECK(vkCreateComputePipelines(m_pDevice, pPipelineCache, 1, &pipelineCreateInfo, nullptr, &m_pPipeline));
+
+    // mip 0 is read with texelFetch, the filter doesn't matter
+    VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+
+    ENG_VK_CHECK(vkCreateSampler(m_pDevice, &samplerInfo, nullptr, &m_pSampler));
+
+    return true;
+}
+
+
+void MipGenerator::Terminate() noexcept
+{
+    if (m_pDevice == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkDestroySampler(m_pDevice, m_pSampler, nullptr);
+    vkDestroyPipeline(m_pDevice, m_pPipeline, nullptr);
+    vkDestroyPipelineLayout(m_pDevice, m_pPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(m_pDevice, m_pDescriptorLayout, nullptr);
+
+    m_pSampler = VK_NULL_HANDLE;
+    m_pPipeline = VK_NULL_HANDLE;
+    m_pPipelineLayout = VK_NULL_HANDLE;
+    m_pDescriptorLayout = VK_NULL_HANDLE;
+}
+
+
+bool MipGenerator::IsFormatSupported(VkFormat format) const noexcept
+{
+    if (!m_isStorageWriteWithoutFormatSupported) {
+        return false;
+    }
+
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(m_pPhysDevice, format, &formatProps);
+
+    const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+    return (formatProps.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+
+void MipGenerator::Record(const VulkanEngine& engine, VkCommandBuffer pCmdBuf, std::span<const MipGenerationDesc> descs,
+    VkImageLayout srcLayout, VkImageLayout dstLayout, MipGenerationResources& outResources) const noexcept
+{
+    ENG_ASSERT(IsReady());
+
+    // dispatches of one wave are independent, the next wave reads the last mip the previous one wrote
+    std::vector<std::vector<Dispatch>> waves;
+    uint64_t scratchSize = 0;
+
+    for (size_t i = 0; i < descs.size(); ++i) {
+        const MipGenerationDesc& desc = descs[i];
+        ENG_ASSERT(IsFormatSupported(desc.format));
+
+        uint32_t srcMip = 0;
+
+        for (size_t wave = 0; srcMip + 1 < desc.mipCount; ++wave) {
+            Dispatch dispatch = {};
+            dispatch.descIndex = i;
+            dispatch.srcMip = srcMip;
+            dispatch.srcExtent = { std::max(desc.extent.width >> srcMip, 1u), std::max(desc.extent.height >> srcMip, 1u) };
+            dispatch.tileCount = { (dispatch.srcExtent.width + MIP_GEN_TILE_SIZE - 1) / MIP_GEN_TILE_SIZE,
+                (dispatch.srcExtent.height + MIP_GEN_TILE_SIZE - 1) / MIP_GEN_TILE_SIZE };
+
+            const bool isSingleDispatchSize = std::max(dispatch.srcExtent.width, dispatch.srcExtent.height) <= MIP_GEN_MAX_SINGLE_DISPATCH_SIZE;
+            dispatch.mipCount = std::min(desc.mipCount - 1 - srcMip, isSingleDispatchSize ? MAX_MIPS_PER_DISPATCH : MIP_GEN_TILE_MIP_COUNT);
+
+            const uint64_t tileDataSize = dispatch.mipCount > MIP_GEN_TILE_MIP_COUNT ?
+                (uint64_t)dispatch.tileCount.width * dispatch.tileCount.height * sizeof(glm::vec4) : 0;
+
+            dispatch.scratchOffset = scratchSize;
+            dispatch.scratchSize = MIP_GEN_SCRATCH_HEADER_SIZE + tileDataSize;
+            scratchSize = (scratchSize + dispatch.scratchSize + MIP_GEN_SCRATCH_ALIGNMENT - 1) / MIP_GEN_SCRATCH_ALIGNMENT * MIP_GEN_SCRATCH_ALIGNMENT;
+
+            if (waves.size() <= wave) {
+                waves.emplace_back();
+            }
+
+            waves[wave].emplace_back(dispatch);
+            srcMip += dispatch.mipCount;
+        }
+    }
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers(descs.size());
+
+    for (size_t i = 0; i < descs.size(); ++i) {
+        VkImageMemoryBarrier2& barrier = imageBarriers[i];
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.oldLayout = srcLayout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.subresourceRange = vkinit::ImageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier.image = descs[i].pImage;
+    }
+
+    VkMemoryBarrier2 scratchBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    scratchBarrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    scratchBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    scratchBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    scratchBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    VkDependencyInfo depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+    depInfo.pImageMemoryBarriers = imageBarriers.data();
+
+    if (!waves.empty()) {
+        outResources.scratchBuffer = engine.CreateBuffer(scratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            MemoryCategory::TRANSIENT);
+
+        // the counters start at zero
+        vkCmdFillBuffer(pCmdBuf, outResources.scratchBuffer.pBuffer, 0, VK_WHOLE_SIZE, 0);
+
+        depInfo.memoryBarrierCount = 1;
+        depInfo.pMemoryBarriers = &scratchBarrier;
+
+        size_t dispatchCount = 0;
+        for (const std::vector<Dispatch>& wave : waves) {
+            dispatchCount += wave.size();
+        }
+
+        std::array<DescriptorAllocatorGrowable::PoolSizeRatio, 3> poolRatios = {
+            DescriptorAllocatorGrowable::PoolSizeRatio { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.f },
+            DescriptorAllocatorGrowable::PoolSizeRatio { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, (float)MAX_MIPS_PER_DISPATCH },
+            DescriptorAllocatorGrowable::PoolSizeRatio { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.f },
+        };
+
+        outResources.descriptorAllocator.Init(m_pDevice, (uint32_t)dispatchCount, poolRatios);
+    }
+
+    vkCmdPipelineBarrier2(pCmdBuf, &depInfo);
+
+    if (!waves.empty()) {
+        vkCmdBindPipeline(pCmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_pPipeline);
+    }
+
+    DescriptorWriter writer;
+
+    for (size_t waveIdx = 0; waveIdx < waves.size(); ++waveIdx) {
+        if (waveIdx > 0) {
+            VkMemoryBarrier2 waveBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+            waveBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            waveBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+            waveBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            waveBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+
+            VkDependencyInfo waveDepInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+            waveDepInfo.memoryBarrierCount = 1;
+            waveDepInfo.pMemoryBarriers = &waveBarrier;
+
+            vkCmdPipelineBarrier2(pCmdBuf, &waveDepInfo);
+        }
+
+        for (const Dispatch& dispatch : waves[waveIdx]) {
+            const MipGenerationDesc& desc = descs[dispatch.descIndex];
+
+            VkImageViewCreateInfo viewInfo = vkinit::ImageViewCreateInfo(desc.pImage, desc.format, VK_IMAGE_ASPECT_COLOR_BIT);
+            viewInfo.subresourceRange.baseMipLevel = dispatch.srcMip;
+
+            VkImageView pSrcView = VK_NULL_HANDLE;
+            ENG_VK_CHECK(vkCreateImageView(m_pDevice, &viewInfo, nullptr, &pSrcView));
+            outResources.views.emplace_back(pSrcView);
+
+            writer.Clear();
+            writer.WriteImage(0, pSrcView, m_pSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+            VkImageView pMipView = VK_NULL_HANDLE;
+
+            for (uint32_t mip = 0; mip < MAX_MIPS_PER_DISPATCH; ++mip) {
+                // slots past mipCount are never written, they repeat the last view to stay valid
+                if (mip < dispatch.mipCount) {
+                    viewInfo.subresourceRange.baseMipLevel = dispatch.srcMip + 1 + mip;
+
+                    ENG_VK_CHECK(vkCreateImageView(m_pDevice, &viewInfo, nullptr, &pMipView));
+                    outResources.views.emplace_back(pMipView);
+                }
+
+                writer.WriteImage(1, pMipView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, mip);
+            }
+
+            writer.WriteBuffer(2, outResources.scratchBuffer.pBuffer, dispatch.scratchSize, dispatch.scratchOffset, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+            VkDescriptorSet pDescriptorSet = outResources.descriptorAllocator.Allocate(m_pDevice, m_pDescriptorLayout);
+            writer.UpdateSet(m_pDevice, pDescriptorSet);
+
+            vkCmdBindDescriptorSets(pCmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_pPipelineLayout, 0, 1, &pDescriptorSet, 0, nullptr);
+
+            MipGenPushConstants pushConstants = {};
+            pushConstants.srcSize[0] = (int32_t)dispatch.srcExtent.width;
+            pushConstants.srcSize[1] = (int32_t)dispatch.srcExtent.height;
+            pushConstants.mipCount = dispatch.mipCount;
+            pushConstants.reduction = (uint32_t)desc.reduction;
+            pushConstants.isSRGB = desc.isSRGB;
+
+            vkCmdPushConstants(pCmdBuf, m_pPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+            vkCmdDispatch(pCmdBuf, dispatch.tileCount.width, dispatch.tileCount.height, 1);
+        }
+    }
+
+    for (VkImageMemoryBarrier2& barrier : imageBarriers) {
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = dstLayout;
+    }
+
+    depInfo.memoryBarrierCount = 0;
+    depInfo.pMemoryBarriers = nullptr;
+
+    vkCmdPipelineBarrier2(pCmdBuf, &depInfo);
+}
+
+
+void MipGenerator::ReleaseResources(const VulkanEngine& engine, MipGenerationResources& resources) const noexcept
+{
+    for (VkImageView pView : resources.views) {
+        vkDestroyImageView(m_pDevice, pView, nullptr);
+    }
+
+    resources.views.clear();
+
+    if (resources.scratchBuffer.pBuffer != VK_NULL_HANDLE) {
+        resources.descriptorAllocator.DestroyPools(m_pDevice);
+        engine.DestroyBuffer(resources.scratchBuffer);
+    }
+}
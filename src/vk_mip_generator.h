@@ -0,0 +1,95 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+
+#include <span>
+#include <vector>
+
+
+class VulkanEngine;
+class ShaderArchive;
+
+
+enum class MipReduction : uint32_t
+{
+    AVERAGE,
+    // conservative depth pyramids
+    MIN,
+    MAX,
+};
+
+
+struct MipGenerationDesc
+{
+    VkImage pImage;
+    VkFormat format;
+    VkExtent2D extent;
+    // mip 0 included, it has to be filled already
+    uint32_t mipCount;
+
+    MipReduction reduction = MipReduction::AVERAGE;
+    // color is sRGB encoded and averaged in linear space, alpha stays linear
+    bool isSRGB = false;
+};
+
+
+// Views, descriptors and scratch memory of a Record call, released once the GPU is done with the command buffer
+struct MipGenerationResources
+{
+    std::vector<VkImageView> views;
+    DescriptorAllocatorGrowable descriptorAllocator;
+    BufferHandle scratchBuffer = {};
+};
+
+
+// Compute replacement of the blit chain in vkutil::GenerateMipmaps. One dispatch writes up to 12 mips
+// through per-mip storage views, all images of a Record call share the barriers around it.
+class MipGenerator final
+{
+public:
+    static constexpr uint32_t MAX_MIPS_PER_DISPATCH = 12;
+
+public:
+    MipGenerator() = default;
+
+    MipGenerator(const MipGenerator& other) = delete;
+    MipGenerator& operator=(const MipGenerator& other) = delete;
+
+    // Right after device creation, images created from then on know if they need storage usage
+    void Init(VkDevice pDevice, VkPhysicalDevice pPhysDevice, bool isStorageWriteWithoutFormatSupported) noexcept;
+    bool BuildPipeline(ShaderArchive& shaderArchive, VkPipelineCache pPipelineCache) noexcept;
+    void Terminate() noexcept;
+
+    // Images of these formats need VK_IMAGE_USAGE_STORAGE_BIT, the rest falls back to blits
+    bool IsFormatSupported(VkFormat format) const noexcept;
+    bool IsReady() const noexcept { return m_pPipeline != VK_NULL_HANDLE; }
+
+    // The images are in srcLayout as a whole and end up in dstLayout
+    void Record(const VulkanEngine& engine, VkCommandBuffer pCmdBuf, std::span<const MipGenerationDesc> descs,
+        VkImageLayout srcLayout, VkImageLayout dstLayout, MipGenerationResources& outResources) const noexcept;
+
+    void ReleaseResources(const VulkanEngine& engine, MipGenerationResources& resources) const noexcept;
+
+private:
+    struct Dispatch
+    {
+        size_t descIndex;
+        uint32_t srcMip;
+        uint32_t mipCount;
+        VkExtent2D srcExtent;
+        VkExtent2D tileCount;
+        uint64_t scratchOffset;
+        uint64_t scratchSize;
+    };
+
+private:
+    VkDevice m_pDevice = VK_NULL_HANDLE;
+    VkPhysicalDevice m_pPhysDevice = VK_NULL_HANDLE;
+    bool m_isStorageWriteWithoutFormatSupported = false;
+
+    VkDescriptorSetLayout m_pDescriptorLayout = VK_NULL_HANDLE;
+    VkPipelineLayout m_pPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline m_pPipeline = VK_NULL_HANDLE;
+    VkSampler m_pSampler = VK_NULL_HANDLE;
+};
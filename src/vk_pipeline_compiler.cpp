@@ -0,0 +1,205 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_pipeline_compiler.h"
+
+
+void PipelineCompiler::Init(VkDevice pDevice, VkPipelineCache pCache, bool useGraphicsPipelineLibrary) noexcept
+{
+    m_pDevice = pDevice;
+    m_pCache = pCache;
+    m_useGraphicsPipelineLibrary = useGraphicsPipelineLibrary;
+
+    fmt::print("Pipeline compiler: {}\n", useGraphicsPipelineLibrary ? "graphics pipeline libraries with fast linking" : "full pipelines");
+}
+
+
+void PipelineCompiler::Terminate() noexcept
+{
+    if (m_pDevice == VK_NULL_HANDLE) {
+        return;
+    }
+
+    WaitIdle();
+
+    PublishCompleted([this](VkPipeline pipeline) {
+        vkDestroyPipeline(m_pDevice, pipeline, nullptr);
+    });
+
+    if (m_useGraphicsPipelineLibrary) {
+        fmt::print("Pipeline libraries: {} compiled, {} reused\n", m_libraries.size(), m_libraryHitCount);
+    }
+
+    // linked pipelines don't reference their libraries, they can go first
+    for (auto& [hash, library] : m_libraries) {
+        vkDestroyPipeline(m_pDevice, library, nullptr);
+    }
+
+    m_libraries.clear();
+    m_libraryHitCount = 0;
+
+    m_pDevice = VK_NULL_HANDLE;
+    m_pCache = VK_NULL_HANDLE;
+}
+
+
+void PipelineCompiler::CompileAsync(MaterialPipeline* pTarget, const vkutil::PipelineBuilder& builder, VkPipeline fallback) noexcept
+{
+    ENG_ASSERT(m_pDevice != VK_NULL_HANDLE);
+    ENG_ASSERT(pTarget != nullptr);
+
+    pTarget->pipeline = fallback;
+
+    ScheduleJob([this, pTarget, builder]() mutable {
+        if (m_useGraphicsPipelineLibrary) {
+            CompileWithLibraries(pTarget, builder);
+        } else {
+            CompileFull(pTarget, builder);
+        }
+    });
+}
+
+
+void PipelineCompiler::PublishCompleted(const RetireFunc& retire) noexcept
+{
+    std::vector<CompletedPipeline> completed;
+
+    {
+        std::lock_guard lock(m_completedMutex);
+        completed.swap(m_completed);
+    }
+
+    for (const CompletedPipeline& result : completed) {
+        result.pTarget->pipeline = result.pipeline;
+
+        if (result.replaced != VK_NULL_HANDLE) {
+            retire(result.replaced);
+        }
+    }
+}
+
+
+void PipelineCompiler::WaitIdle() noexcept
+{
+    // background jobs only run on the workers, there is nothing to help with here
+    uint32_t pendingCount = m_pendingJobCount.load(std::memory_order_acquire);
+
+    while (pendingCount != 0) {
+        m_pendingJobCount.wait(pendingCount, std::memory_order_acquire);
+        pendingCount = m_pendingJobCount.load(std::memory_order_acquire);
+    }
+}
+
+
+void PipelineCompiler::ScheduleJob(JobSystem::JobFunc&& job) noexcept
+{
+    m_pendingJobCount.fetch_add(1, std::memory_order_relaxed);
+
+    // a compile or link takes milliseconds, a frame waiting on its own jobs must not pick one up
+    JobSystem::GetInstance().ScheduleBackground([this, job = std::move(job)]() mutable {
+        job();
+
+        if (m_pendingJobCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_pendingJobCount.notify_all();
+        }
+    });
+}
+
+
+void PipelineCompiler::CompileFull(MaterialPipeline* pTarget, vkutil::PipelineBuilder& builder) noexcept
+{
+    const VkPipeline pipeline = builder.Build(m_pDevice, m_pCache);
+
+    if (pipeline != VK_NULL_HANDLE) {
+        PushCompleted(CompletedPipeline { pTarget, pipeline, VK_NULL_HANDLE });
+    }
+}
+
+
+void PipelineCompiler::CompileWithLibraries(MaterialPipeline* pTarget, vkutil::PipelineBuilder& builder) noexcept
+{
+    static constexpr std::array<VkGraphicsPipelineLibraryFlagsEXT, 4> parts = {
+        VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+        VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+    };
+
+    std::array<VkPipeline, parts.size()> libraries = {};
+
+    // permutations mostly differ in the fragment shader, the other parts come from the cache
+    JobSystem::GetInstance().ParallelFor(parts.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            libraries[i] = GetLibrary(builder, parts[i]);
+        }
+    });
+
+    const bool areLibrariesBuilt = std::find(libraries.begin(), libraries.end(), VK_NULL_HANDLE) == libraries.end();
+
+    if (!areLibrariesBuilt) {
+        return;
+    }
+
+    const VkPipelineLayout pLayout = builder.m_pipelineLayout;
+    const VkPipelineCreateFlags flags = builder.m_flags;
+
+    const VkPipeline fastLinkedPipeline = vkutil::LinkPipelineLibraries(m_pDevice, libraries, pLayout, flags, false, m_pCache);
+
+    if (fastLinkedPipeline == VK_NULL_HANDLE) {
+        return;
+    }
+
+    PushCompleted(CompletedPipeline { pTarget, fastLinkedPipeline, VK_NULL_HANDLE });
+
+    // scheduled from inside the job, the pending count can't drop to zero in between
+    ScheduleJob([this, pTarget, libraries, pLayout, flags, fastLinkedPipeline]() {
+        const VkPipeline optimizedPipeline = vkutil::LinkPipelineLibraries(m_pDevice, libraries, pLayout, flags, true, m_pCache);
+
+        if (optimizedPipeline != VK_NULL_HANDLE) {
+            PushCompleted(CompletedPipeline { pTarget, optimizedPipeline, fastLinkedPipeline });
+        }
+    });
+}
+
+
+VkPipeline PipelineCompiler::GetLibrary(const vkutil::PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT part) noexcept
+{
+    const uint64_t hash = builder.GetStateHash(part);
+
+    {
+        std::lock_guard lock(m_librariesMutex);
+
+        auto it = m_libraries.find(hash);
+
+        if (it != m_libraries.end()) {
+            ++m_libraryHitCount;
+            return it->second;
+        }
+    }
+
+    // built outside of the lock, jobs that need the same part at once both build it and the first one is kept
+    vkutil::PipelineBuilder partBuilder = builder;
+    const VkPipeline library = partBuilder.BuildLibrary(m_pDevice, part, m_pCache);
+
+    if (library == VK_NULL_HANDLE) {
+        return VK_NULL_HANDLE;
+    }
+
+    std::lock_guard lock(m_librariesMutex);
+
+    auto [it, isInserted] = m_libraries.emplace(hash, library);
+
+    if (!isInserted) {
+        vkDestroyPipeline(m_pDevice, library, nullptr);
+    }
+
+    return it->second;
+}
+
+
+void PipelineCompiler::PushCompleted(const CompletedPipeline& completed) noexcept
+{
+    std::lock_guard lock(m_completedMutex);
+    m_completed.emplace_back(completed);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_pipelines.h"
+
+#include "job_system.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+// Builds graphics pipelines in background jobs. A target keeps drawing with its fallback pipeline until
+// the compiled one is published at a frame boundary, so new pipeline variants never stall a frame.
+// With VK_EXT_graphics_pipeline_library the pipeline parts are compiled as separate libraries and fast-linked
+// first, the link time optimized pipeline replaces the fast-linked one once it is ready. Libraries are kept
+// by the state hash of their part, pipelines that share a part's state compile it once.
+class PipelineCompiler final
+{
+public:
+    using RetireFunc = std::function<void(VkPipeline pipeline)>;
+
+public:
+    PipelineCompiler() = default;
+
+    PipelineCompiler(const PipelineCompiler& other) = delete;
+    PipelineCompiler(PipelineCompiler&& other) = delete;
+    PipelineCompiler& operator=(const PipelineCompiler& other) = delete;
+    PipelineCompiler& operator=(PipelineCompiler&& other) = delete;
+
+    void Init(VkDevice pDevice, VkPipelineCache pCache, bool useGraphicsPipelineLibrary) noexcept;
+    // Waits for the jobs in flight and publishes their results, retired pipelines and the libraries are destroyed right away
+    void Terminate() noexcept;
+
+    // pTarget->pipeline is set to fallback (may be VK_NULL_HANDLE) and stays so until the result is published.
+    // The builder is copied, its shader modules must stay alive until the compiler is idle.
+    void CompileAsync(MaterialPipeline* pTarget, const vkutil::PipelineBuilder& builder, VkPipeline fallback) noexcept;
+
+    // Swaps finished pipelines into their targets. Must be called on the render thread outside of command
+    // recording. retire receives the pipelines replaced by the swap, frames in flight may still use them.
+    void PublishCompleted(const RetireFunc& retire) noexcept;
+
+    void WaitIdle() noexcept;
+    bool IsIdle() const noexcept { return m_pendingJobCount.load(std::memory_order_acquire) == 0; }
+
+    bool IsUsingGraphicsPipelineLibrary() const noexcept { return m_useGraphicsPipelineLibrary; }
+
+private:
+    struct CompletedPipeline
+    {
+        MaterialPipeline* pTarget;
+        VkPipeline pipeline;
+        // fast-linked pipeline superseded by the optimized one
+        VkPipeline replaced;
+    };
+
+private:
+    void CompileFull(MaterialPipeline* pTarget, vkutil::PipelineBuilder& builder) noexcept;
+    void CompileWithLibraries(MaterialPipeline* pTarget, vkutil::PipelineBuilder& builder) noexcept;
+    // The cached library of the part's state, built when missing. VK_NULL_HANDLE if the build failed.
+    VkPipeline GetLibrary(const vkutil::PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT part) noexcept;
+
+    void PushCompleted(const CompletedPipeline& completed) noexcept;
+    // Runs job in the job system's background queue and counts it as pending until it returns
+    void ScheduleJob(JobSystem::JobFunc&& job) noexcept;
+
+private:
+    VkDevice m_pDevice = VK_NULL_HANDLE;
+    VkPipelineCache m_pCache = VK_NULL_HANDLE;
+
+    // background jobs have no counter to wait on, WaitIdle blocks on this one
+    std::atomic<uint32_t> m_pendingJobCount = 0;
+
+    std::mutex m_completedMutex;
+    std::vector<CompletedPipeline> m_completed;
+
+    // keyed by PipelineBuilder::GetStateHash of the part
+    std::mutex m_librariesMutex;
+    std::unordered_map<uint64_t, VkPipeline> m_libraries;
+    uint64_t m_libraryHitCount = 0;
+
+    bool m_useGraphicsPipelineLibrary = false;
+};
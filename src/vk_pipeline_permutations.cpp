@@ -0,0 +1,80 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_pipeline_permutations.h"
+#include "vk_pipeline_compiler.h"
+
+
+void PipelinePermutationCache::Init(VkDevice pDevice, PipelineCompiler* pCompiler) noexcept
+{
+    ENG_ASSERT(pCompiler != nullptr);
+
+    m_pDevice = pDevice;
+    m_pCompiler = pCompiler;
+}
+
+
+void PipelinePermutationCache::Terminate() noexcept
+{
+    if (m_pDevice == VK_NULL_HANDLE) {
+        return;
+    }
+
+    fmt::print("Pipeline permutations: {} pipelines, {} lookups served from the cache\n", m_pipelines.size(), m_hitCount);
+
+    for (auto& [hash, entry] : m_pipelines) {
+        const VkPipeline pipeline = entry.pPipeline->pipeline;
+
+        if (pipeline != VK_NULL_HANDLE && pipeline != entry.fallback) {
+            vkDestroyPipeline(m_pDevice, pipeline, nullptr);
+        }
+    }
+
+    m_pipelines.clear();
+
+    m_pDevice = VK_NULL_HANDLE;
+    m_pCompiler = nullptr;
+}
+
+
+MaterialPipeline* PipelinePermutationCache::GetPipeline(const vkutil::PipelineBuilder& builder, VkPipeline fallback) noexcept
+{
+    const uint64_t hash = builder.GetStateHash();
+
+    auto it = m_pipelines.find(hash);
+
+    if (it != m_pipelines.end()) {
+        ++m_hitCount;
+        return it->second.pPipeline.get();
+    }
+
+    MaterialPipeline* pPipeline = Insert(hash, builder, fallback);
+    m_pCompiler->CompileAsync(pPipeline, builder, fallback);
+
+    return pPipeline;
+}
+
+
+MaterialPipeline* PipelinePermutationCache::AddPipeline(const vkutil::PipelineBuilder& builder, VkPipeline pipeline) noexcept
+{
+    const uint64_t hash = builder.GetStateHash();
+    ENG_ASSERT(!m_pipelines.contains(hash));
+
+    MaterialPipeline* pPipeline = Insert(hash, builder, VK_NULL_HANDLE);
+    pPipeline->pipeline = pipeline;
+
+    return pPipeline;
+}
+
+
+MaterialPipeline* PipelinePermutationCache::Insert(uint64_t hash, const vkutil::PipelineBuilder& builder, VkPipeline fallback) noexcept
+{
+    std::unique_ptr<MaterialPipeline> pPipeline = std::make_unique<MaterialPipeline>();
+    pPipeline->pipeline = VK_NULL_HANDLE;
+    pPipeline->layout = builder.m_pipelineLayout;
+    // draw sort keys group by it
+    pPipeline->id = (uint32_t)m_pipelines.size();
+
+    return m_pipelines.emplace(hash, Entry { std::move(pPipeline), fallback }).first->second.pPipeline.get();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_pipelines.h"
+
+#include <memory>
+#include <unordered_map>
+
+
+class PipelineCompiler;
+
+
+// Pipelines keyed by the state hash of the builder they come from. Identical state returns the pipeline
+// created first, new state is compiled by the PipelineCompiler, so only the permutations in use are paid for.
+// Engine main thread only, see VulkanEngine::IsMainThread.
+class PipelinePermutationCache final
+{
+public:
+    PipelinePermutationCache() = default;
+
+    PipelinePermutationCache(const PipelinePermutationCache& other) = delete;
+    PipelinePermutationCache& operator=(const PipelinePermutationCache& other) = delete;
+
+    void Init(VkDevice pDevice, PipelineCompiler* pCompiler) noexcept;
+    // Destroys every pipeline, the compiler has to be terminated and the device idle
+    void Terminate() noexcept;
+
+    // The pipeline of the builder's state, its pipeline is fallback until the compiled one is published.
+    // fallback stays owned by the caller, also when the compilation fails. Returned pointers stay valid until Terminate.
+    MaterialPipeline* GetPipeline(const vkutil::PipelineBuilder& builder, VkPipeline fallback) noexcept;
+    // Registers a pipeline built by the caller from builder, the cache takes ownership
+    MaterialPipeline* AddPipeline(const vkutil::PipelineBuilder& builder, VkPipeline pipeline) noexcept;
+
+    size_t GetPipelineCount() const noexcept { return m_pipelines.size(); }
+    uint64_t GetHitCount() const noexcept { return m_hitCount; }
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<MaterialPipeline> pPipeline;
+        // belongs to someone else, pPipeline->pipeline keeps it when the compilation fails
+        VkPipeline fallback;
+    };
+
+private:
+    MaterialPipeline* Insert(uint64_t hash, const vkutil::PipelineBuilder& builder, VkPipeline fallback) noexcept;
+
+private:
+    VkDevice m_pDevice = VK_NULL_HANDLE;
+    PipelineCompiler* m_pCompiler = nullptr;
+
+    std::unordered_map<uint64_t, Entry> m_pipelines;
+
+    uint64_t m_hitCount = 0;
+};
@@ -3,17 +3,129 @@
 #include "vk_pipelines.h"
 #include "vk_initializers.h"
 
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
 
 namespace vkutil
 {
+    static constexpr uint32_t PIPELINE_CACHE_FILE_MAGIC = 0x43504556; // "VEPC"
+    static constexpr uint32_t PIPELINE_CACHE_FILE_VERSION = 1;
+
+    static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+
+
+    struct PipelineCacheFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+
+
+    static uint64_t HashBytes(const uint8_t* pData, size_t size, uint64_t hash = FNV_OFFSET_BASIS) noexcept
+    {
+        // FNV-1a
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= pData[i];
+            hash *= 0x100000001b3;
+        }
+
+        return hash;
+    }
+
+
+    // Padding bytes are undefined, only values without them can be hashed as a whole
+    template <typename T>
+    static void HashValue(uint64_t& hash, const T& value) noexcept
+    {
+        static_assert(std::has_unique_object_representations_v<T> || std::is_floating_point_v<T>);
+        hash = HashBytes((const uint8_t*)&value, sizeof(T), hash);
+    }
+
+
+    static PipelineCacheFileHeader MakePipelineCacheFileHeader(const VkPhysicalDeviceProperties& deviceProps, const std::vector<uint8_t>& data) noexcept
+    {
+        PipelineCacheFileHeader header = {};
+        header.magic = PIPELINE_CACHE_FILE_MAGIC;
+        header.version = PIPELINE_CACHE_FILE_VERSION;
+        header.vendorID = deviceProps.vendorID;
+        header.deviceID = deviceProps.deviceID;
+        header.driverVersion = deviceProps.driverVersion;
+        memcpy(header.pipelineCacheUUID, deviceProps.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = data.size();
+        header.dataHash = HashBytes(data.data(), data.size());
+
+        return header;
+    }
+
+
+    // Drivers validate the blob themselves, but not all of them do it reliably, so both our header and the Vulkan one are checked
+    static bool IsPipelineCacheDataValid(const PipelineCacheFileHeader& header, const std::vector<uint8_t>& data, const VkPhysicalDeviceProperties& deviceProps) noexcept
+    {
+        const PipelineCacheFileHeader expected = MakePipelineCacheFileHeader(deviceProps, data);
+
+        if (header.magic != expected.magic || header.version != expected.version) {
+            return false;
+        }
+
+        if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID || header.driverVersion != expected.driverVersion) {
+            return false;
+        }
+
+        if (memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            return false;
+        }
+
+        if (header.dataSize != expected.dataSize || header.dataHash != expected.dataHash) {
+            return false;
+        }
+
+        if (data.size() < sizeof(VkPipelineCacheHeaderVersionOne)) {
+            return false;
+        }
+
+        VkPipelineCacheHeaderVersionOne vkHeader = {};
+        memcpy(&vkHeader, data.data(), sizeof(vkHeader));
+
+        return vkHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE && 
+            vkHeader.vendorID == deviceProps.vendorID && vkHeader.deviceID == deviceProps.deviceID &&
+            memcmp(vkHeader.pipelineCacheUUID, deviceProps.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+
     PipelineBuilder::PipelineBuilder()
     {
         Clear();
     }
 
     
-    VkPipeline PipelineBuilder::Build(VkDevice pDevice) noexcept
+    VkPipeline PipelineBuilder::Build(VkDevice pDevice, VkPipelineCache pCache) noexcept
+    {
+        return CreatePipeline(pDevice, pCache, 0);
+    }
+
+
+    VkPipeline PipelineBuilder::BuildLibrary(VkDevice pDevice, VkGraphicsPipelineLibraryFlagsEXT parts, VkPipelineCache pCache) noexcept
     {
+        ENG_ASSERT(parts != 0);
+        return CreatePipeline(pDevice, pCache, parts);
+    }
+
+
+    VkPipeline PipelineBuilder::CreatePipeline(VkDevice pDevice, VkPipelineCache pCache, VkGraphicsPipelineLibraryFlagsEXT libraryParts) noexcept
+    {
+        // the builder may have been copied since the format was set
+        if (m_renderInfo.colorAttachmentCount > 0) {
+            m_renderInfo.pColorAttachmentFormats = &m_colorAttachmentFormat;
+        }
+
         VkPipelineViewportStateCreateInfo viewportState = {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
             .viewportCount = 1,
@@ -24,7 +136,7 @@ namespace vkutil
             .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
             .logicOpEnable = VK_FALSE,
             .logicOp = VK_LOGIC_OP_COPY,
-            .attachmentCount = 1,
+            .attachmentCount = m_renderInfo.colorAttachmentCount,
             .pAttachments = &m_colorBlendAttachment,
         };
 
@@ -32,11 +144,60 @@ namespace vkutil
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
         };
 
+        // a library may only carry the shader stages of the parts it contains
+        std::vector<VkPipelineShaderStageCreateInfo> stages;
+        stages.reserve(m_shaderStages.size());
+
+        // every stage gets its own entries, offsets are relative to the stage's part of specData
+        std::vector<VkSpecializationInfo> specInfos(m_shaderStages.size());
+        std::vector<VkSpecializationMapEntry> specEntries;
+        std::vector<uint32_t> specData;
+
+        // the stage infos point into them, they must not grow past this
+        specEntries.reserve(m_shaderStages.size() * m_specConstants.size());
+        specData.reserve(m_shaderStages.size() * m_specConstants.size());
+
+        for (const VkPipelineShaderStageCreateInfo& stage : m_shaderStages) {
+            const bool isFragmentStage = stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT;
+            const VkGraphicsPipelineLibraryFlagsEXT stagePart = isFragmentStage ? 
+                VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT : VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+
+            if (libraryParts != 0 && (libraryParts & stagePart) == 0) {
+                continue;
+            }
+
+            VkPipelineShaderStageCreateInfo& stageInfo = stages.emplace_back(stage);
+
+            const size_t firstEntry = specEntries.size();
+            const size_t firstData = specData.size();
+
+            for (const SpecializationConstant& constant : m_specConstants) {
+                if ((constant.stages & stage.stage) == 0) {
+                    continue;
+                }
+
+                const uint32_t offset = (uint32_t)((specData.size() - firstData) * sizeof(uint32_t));
+
+                specEntries.emplace_back(VkSpecializationMapEntry { constant.id, offset, sizeof(uint32_t) });
+                specData.emplace_back(constant.value);
+            }
+
+            if (specEntries.size() > firstEntry) {
+                VkSpecializationInfo& specInfo = specInfos[stages.size() - 1];
+                specInfo.mapEntryCount = (uint32_t)(specEntries.size() - firstEntry);
+                specInfo.pMapEntries = specEntries.data() + firstEntry;
+                specInfo.dataSize = (specData.size() - firstData) * sizeof(uint32_t);
+                specInfo.pData = specData.data() + firstData;
+
+                stageInfo.pSpecializationInfo = &specInfo;
+            }
+        }
+
         VkGraphicsPipelineCreateInfo pipelineInfo = { 
             .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
             .pNext = &m_renderInfo,
-            .stageCount = (uint32_t)m_shaderStages.size(),
-            .pStages = m_shaderStages.data(),
+            .stageCount = (uint32_t)stages.size(),
+            .pStages = stages.data(),
             .pVertexInputState = &vertexInputInfo,
             .pInputAssemblyState = &m_inputAssembly,
             .pViewportState = &viewportState,
@@ -47,16 +208,30 @@ namespace vkutil
             .layout = m_pipelineLayout,
         };
 
-        const VkDynamicState dynStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        pipelineInfo.flags = m_flags;
+
+        VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
 
+        if (libraryParts != 0) {
+            libraryInfo.pNext = &m_renderInfo;
+            libraryInfo.flags = libraryParts;
+
+            pipelineInfo.pNext = &libraryInfo;
+            pipelineInfo.flags |= VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+        }
+
+        std::vector<VkDynamicState> dynStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        dynStates.insert(dynStates.end(), m_dynamicStates.begin(), m_dynamicStates.end());
+
+        // libraries get the full list, the states outside of their parts are ignored
         VkPipelineDynamicStateCreateInfo dynamicInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
-        dynamicInfo.pDynamicStates = dynStates;
-        dynamicInfo.dynamicStateCount = std::size(dynStates);
+        dynamicInfo.pDynamicStates = dynStates.data();
+        dynamicInfo.dynamicStateCount = (uint32_t)dynStates.size();
 
         pipelineInfo.pDynamicState = &dynamicInfo;
 
         VkPipeline newPipeline = VK_NULL_HANDLE;
-        if (vkCreateGraphicsPipelines(pDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+        if (vkCreateGraphicsPipelines(pDevice, pCache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
             ENG_ASSERT_FAIL("failed to create graphics pipeline");
             return VK_NULL_HANDLE;
         }
@@ -76,6 +251,10 @@ namespace vkutil
         m_renderInfo            = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
         m_colorBlendAttachment  = {};
         m_pipelineLayout        = {};
+        m_flags                 = 0;
+
+        m_specConstants.clear();
+        m_dynamicStates.clear();
     }
 
     
@@ -87,6 +266,14 @@ namespace vkutil
         m_shaderStages.emplace_back(vkinit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, pPixelShader));
     }
 
+
+    void PipelineBuilder::SetVertexShader(VkShaderModule pVertexShader) noexcept
+    {
+        m_shaderStages.clear();
+
+        m_shaderStages.emplace_back(vkinit::PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, pVertexShader));
+    }
+
     
     void PipelineBuilder::SetInputTopology(VkPrimitiveTopology topology) noexcept
     {
@@ -208,35 +395,301 @@ namespace vkutil
     }
 
 
-    bool LoadShaderModule(const std::filesystem::path& filepath, VkDevice pDevice, VkShaderModule& pOutModule) noexcept
+    void PipelineBuilder::SetFlags(VkPipelineCreateFlags flags) noexcept
     {
-        std::ifstream file(filepath, std::ios::ate | std::ios::binary);
+        m_flags = flags;
+    }
 
-        if (!file.is_open()) {
-            return false;
+
+    void PipelineBuilder::SetSpecializationConstant(VkShaderStageFlags stages, uint32_t constantID, uint32_t value) noexcept
+    {
+        auto it = std::lower_bound(m_specConstants.begin(), m_specConstants.end(), constantID, 
+            [](const SpecializationConstant& constant, uint32_t id) { return constant.id < id; });
+
+        if (it != m_specConstants.end() && it->id == constantID) {
+            it->stages = stages;
+            it->value = value;
+        } else {
+            m_specConstants.insert(it, SpecializationConstant { stages, constantID, value });
+        }
+    }
+
+
+    void PipelineBuilder::AddDynamicState(VkDynamicState state) noexcept
+    {
+        ENG_ASSERT(state != VK_DYNAMIC_STATE_VIEWPORT && state != VK_DYNAMIC_STATE_SCISSOR);
+
+        auto it = std::lower_bound(m_dynamicStates.begin(), m_dynamicStates.end(), state);
+
+        if (it == m_dynamicStates.end() || *it != state) {
+            m_dynamicStates.insert(it, state);
+        }
+    }
+
+
+    bool PipelineBuilder::IsDynamicState(VkDynamicState state) const noexcept
+    {
+        return std::binary_search(m_dynamicStates.begin(), m_dynamicStates.end(), state);
+    }
+
+
+    uint64_t PipelineBuilder::GetStateHash(VkGraphicsPipelineLibraryFlagsEXT parts) const noexcept
+    {
+        const bool hasVertexInput = (parts & VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT) != 0;
+        const bool hasPreRasterization = (parts & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT) != 0;
+        const bool hasFragmentShader = (parts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT) != 0;
+        const bool hasFragmentOutput = (parts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT) != 0;
+
+        // stages of the shader parts, split as in CreatePipeline
+        VkShaderStageFlags stageMask = 0;
+        stageMask |= hasPreRasterization ? ~VkShaderStageFlags(VK_SHADER_STAGE_FRAGMENT_BIT) : 0;
+        stageMask |= hasFragmentShader ? VK_SHADER_STAGE_FRAGMENT_BIT : 0;
+
+        uint64_t hash = FNV_OFFSET_BASIS;
+
+        HashValue(hash, parts);
+
+        for (const VkPipelineShaderStageCreateInfo& stage : m_shaderStages) {
+            if ((stage.stage & stageMask) == 0) {
+                continue;
+            }
+
+            HashValue(hash, stage.stage);
+            HashValue(hash, stage.module);
+            hash = HashBytes((const uint8_t*)stage.pName, strlen(stage.pName), hash);
+        }
+
+        for (const SpecializationConstant& constant : m_specConstants) {
+            if ((constant.stages & stageMask) == 0) {
+                continue;
+            }
+
+            HashValue(hash, constant.stages & stageMask);
+            HashValue(hash, constant.id);
+            HashValue(hash, constant.value);
+        }
+
+        if (hasVertexInput) {
+            HashValue(hash, m_inputAssembly.topology);
+            HashValue(hash, m_inputAssembly.primitiveRestartEnable);
+        }
+
+        if (hasPreRasterization) {
+            HashValue(hash, m_rasterizer.depthClampEnable);
+            HashValue(hash, m_rasterizer.rasterizerDiscardEnable);
+            HashValue(hash, m_rasterizer.polygonMode);
+            HashValue(hash, m_rasterizer.frontFace);
+            HashValue(hash, m_rasterizer.depthBiasEnable);
+            HashValue(hash, m_rasterizer.depthBiasConstantFactor);
+            HashValue(hash, m_rasterizer.depthBiasClamp);
+            HashValue(hash, m_rasterizer.depthBiasSlopeFactor);
+            HashValue(hash, m_rasterizer.lineWidth);
+
+            if (!IsDynamicState(VK_DYNAMIC_STATE_CULL_MODE)) {
+                HashValue(hash, m_rasterizer.cullMode);
+            }
         }
 
-        const size_t fileSize = (size_t)file.tellg();
+        if (hasFragmentOutput) {
+            HashValue(hash, m_colorBlendAttachment.colorWriteMask);
+
+            if (!IsDynamicState(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT)) {
+                HashValue(hash, m_colorBlendAttachment.blendEnable);
+            }
+
+            if (!IsDynamicState(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT)) {
+                HashValue(hash, m_colorBlendAttachment.srcColorBlendFactor);
+                HashValue(hash, m_colorBlendAttachment.dstColorBlendFactor);
+                HashValue(hash, m_colorBlendAttachment.colorBlendOp);
+                HashValue(hash, m_colorBlendAttachment.srcAlphaBlendFactor);
+                HashValue(hash, m_colorBlendAttachment.dstAlphaBlendFactor);
+                HashValue(hash, m_colorBlendAttachment.alphaBlendOp);
+            }
+        }
+
+        // the fragment shader part reads the sample shading state as well
+        if (hasFragmentShader || hasFragmentOutput) {
+            HashValue(hash, m_multisampling.rasterizationSamples);
+            HashValue(hash, m_multisampling.sampleShadingEnable);
+            HashValue(hash, m_multisampling.minSampleShading);
+            HashValue(hash, m_multisampling.alphaToCoverageEnable);
+            HashValue(hash, m_multisampling.alphaToOneEnable);
+        }
+
+        if (hasFragmentShader) {
+            if (!IsDynamicState(VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE)) {
+                HashValue(hash, m_depthStencil.depthTestEnable);
+            }
+
+            if (!IsDynamicState(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE)) {
+                HashValue(hash, m_depthStencil.depthWriteEnable);
+            }
+
+            if (!IsDynamicState(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP)) {
+                HashValue(hash, m_depthStencil.depthCompareOp);
+            }
+
+            HashValue(hash, m_depthStencil.depthBoundsTestEnable);
+            HashValue(hash, m_depthStencil.stencilTestEnable);
+            HashValue(hash, m_depthStencil.front);
+            HashValue(hash, m_depthStencil.back);
+            HashValue(hash, m_depthStencil.minDepthBounds);
+            HashValue(hash, m_depthStencil.maxDepthBounds);
+        }
+
+        if (hasPreRasterization || hasFragmentShader || hasFragmentOutput) {
+            HashValue(hash, m_renderInfo.viewMask);
+        }
+
+        if (hasFragmentOutput) {
+            HashValue(hash, m_renderInfo.colorAttachmentCount);
+            HashValue(hash, m_renderInfo.colorAttachmentCount > 0 ? m_colorAttachmentFormat : VK_FORMAT_UNDEFINED);
+            HashValue(hash, m_renderInfo.depthAttachmentFormat);
+            HashValue(hash, m_renderInfo.stencilAttachmentFormat);
+        }
+
+        // every part gets the full list, see CreatePipeline
+        for (VkDynamicState state : m_dynamicStates) {
+            HashValue(hash, state);
+        }
 
-        std::vector<uint32_t> buffer((fileSize + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+        if (hasPreRasterization || hasFragmentShader) {
+            HashValue(hash, m_pipelineLayout);
+        }
+
+        HashValue(hash, m_flags);
+
+        return hash;
+    }
 
-        file.seekg(0);
-        file.read((char*)buffer.data(), fileSize);
-        file.close();
 
-        VkShaderModuleCreateInfo createInfo = {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = buffer.size() * sizeof(uint32_t),
-            .pCode = buffer.data(),
+    VkPipeline LinkPipelineLibraries(VkDevice pDevice, std::span<const VkPipeline> libraries, VkPipelineLayout pLayout, 
+        VkPipelineCreateFlags flags, bool optimize, VkPipelineCache pCache) noexcept
+    {
+        VkPipelineLibraryCreateInfoKHR libraryInfo = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+            .libraryCount = (uint32_t)libraries.size(),
+            .pLibraries = libraries.data(),
         };
 
-        VkShaderModule pShaderModule = VK_NULL_HANDLE;
-        if (vkCreateShaderModule(pDevice, &createInfo, nullptr, &pShaderModule) != VK_SUCCESS) {
+        VkGraphicsPipelineCreateInfo pipelineInfo = {
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = &libraryInfo,
+            .flags = flags | (optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : VkPipelineCreateFlags(0)),
+            .layout = pLayout,
+        };
+
+        VkPipeline newPipeline = VK_NULL_HANDLE;
+        if (vkCreateGraphicsPipelines(pDevice, pCache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+            ENG_ASSERT_FAIL("failed to link graphics pipeline libraries");
+            return VK_NULL_HANDLE;
+        }
+
+        return newPipeline;
+    }
+
+
+    VkPipelineCache LoadPipelineCache(VkDevice pDevice, const VkPhysicalDeviceProperties& deviceProps, 
+        const std::filesystem::path& filepath, bool* pOutIsLoaded) noexcept
+    {
+        std::vector<uint8_t> data;
+
+        std::ifstream file(filepath, std::ios::ate | std::ios::binary);
+
+        if (file.is_open()) {
+            const size_t fileSize = (size_t)file.tellg();
+            file.seekg(0);
+
+            PipelineCacheFileHeader header = {};
+            file.read((char*)&header, sizeof(header));
+
+            if (file && header.magic == PIPELINE_CACHE_FILE_MAGIC && header.dataSize == fileSize - sizeof(header)) {
+                data.resize(header.dataSize);
+                file.read((char*)data.data(), data.size());
+
+                if (!file || !IsPipelineCacheDataValid(header, data, deviceProps)) {
+                    fmt::print("Pipeline cache {} is stale or corrupted, starting with an empty one\n", filepath.string());
+                    data.clear();
+                }
+            }
+
+            file.close();
+        }
+
+        VkPipelineCacheCreateInfo createInfo = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+            .initialDataSize = data.size(),
+            .pInitialData = data.empty() ? nullptr : data.data(),
+        };
+
+        VkPipelineCache pCache = VK_NULL_HANDLE;
+        if (vkCreatePipelineCache(pDevice, &createInfo, nullptr, &pCache) != VK_SUCCESS) {
+            // the driver may still reject the blob, an empty cache is always fine
+            createInfo.initialDataSize = 0;
+            createInfo.pInitialData = nullptr;
+            data.clear();
+
+            ENG_VK_CHECK(vkCreatePipelineCache(pDevice, &createInfo, nullptr, &pCache));
+        }
+
+        if (pOutIsLoaded) {
+            *pOutIsLoaded = !data.empty();
+        }
+
+        return pCache;
+    }
+
+
+    bool SavePipelineCache(VkDevice pDevice, VkPipelineCache pCache, const VkPhysicalDeviceProperties& deviceProps, 
+        const std::filesystem::path& filepath) noexcept
+    {
+        size_t dataSize = 0;
+        if (vkGetPipelineCacheData(pDevice, pCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
             return false;
         }
 
-        pOutModule = pShaderModule;
+        std::vector<uint8_t> data(dataSize);
+        if (vkGetPipelineCacheData(pDevice, pCache, &dataSize, data.data()) != VK_SUCCESS) {
+            return false;
+        }
+
+        data.resize(dataSize);
+
+        const PipelineCacheFileHeader header = MakePipelineCacheFileHeader(deviceProps, data);
+
+        std::error_code error;
+
+        if (filepath.has_parent_path()) {
+            std::filesystem::create_directories(filepath.parent_path(), error);
+        }
+
+        std::filesystem::path tmpFilepath = filepath;
+        tmpFilepath += ".tmp";
+
+        {
+            std::ofstream file(tmpFilepath, std::ios::binary | std::ios::trunc);
+
+            if (!file.is_open()) {
+                return false;
+            }
+
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)data.data(), data.size());
+
+            if (!file) {
+                file.close();
+                std::filesystem::remove(tmpFilepath, error);
+                return false;
+            }
+        }
+
+        std::filesystem::rename(tmpFilepath, filepath, error);
         
+        if (error) {
+            std::filesystem::remove(tmpFilepath, error);
+            return false;
+        }
+
         return true;
     }
 }
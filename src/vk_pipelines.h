@@ -3,6 +3,7 @@
 #include "vk_types.h"
 
 #include <filesystem>
+#include <span>
 #include <vector>
 
 
@@ -10,12 +11,19 @@ namespace vkutil
 {
     class PipelineBuilder final
     {
+    public:
+        static constexpr VkGraphicsPipelineLibraryFlagsEXT ALL_LIBRARY_PARTS = 
+            VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT | VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT |
+            VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT | VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+
     public:
         PipelineBuilder();
         
         void Clear() noexcept;
 
         void SetShaders(VkShaderModule pVertexShader, VkShaderModule pPixelShader) noexcept;
+        // Vertex stage only, for depth-only passes without color attachments
+        void SetVertexShader(VkShaderModule pVertexShader) noexcept;
         void SetInputTopology(VkPrimitiveTopology topology) noexcept;
         void SetPolygonMode(VkPolygonMode mode) noexcept;
         void SetCullMode(VkCullModeFlags cullMode, VkFrontFace frontFace) noexcept;
@@ -31,8 +39,33 @@ namespace vkutil
         void DisableDepthTest() noexcept;
 
         void SetLayout(VkPipelineLayout pLayout) noexcept;
+        // Extra create flags, libraries built from the builder get them as well
+        void SetFlags(VkPipelineCreateFlags flags) noexcept;
+        // 32-bit constant for the given stages, setting an id again replaces its value
+        void SetSpecializationConstant(VkShaderStageFlags stages, uint32_t constantID, uint32_t value) noexcept;
+        // Viewport and scissor are always dynamic. The static values of dynamic state stay out of the state hash,
+        // builders that differ only in them share a pipeline.
+        void AddDynamicState(VkDynamicState state) noexcept;
+        bool IsDynamicState(VkDynamicState state) const noexcept;
+
+        // Hash of everything the given VK_EXT_graphics_pipeline_library parts are built from, all of them for
+        // the whole pipeline. Equal state gives equal hashes across builder copies.
+        uint64_t GetStateHash(VkGraphicsPipelineLibraryFlagsEXT parts = ALL_LIBRARY_PARTS) const noexcept;
+
+        VkPipeline Build(VkDevice pDevice, VkPipelineCache pCache = VK_NULL_HANDLE) noexcept;
+        // Builds only the given VK_EXT_graphics_pipeline_library parts, the result can be linked with LinkPipelineLibraries
+        VkPipeline BuildLibrary(VkDevice pDevice, VkGraphicsPipelineLibraryFlagsEXT parts, VkPipelineCache pCache = VK_NULL_HANDLE) noexcept;
 
-        VkPipeline Build(VkDevice pDevice) noexcept;
+    private:
+        struct SpecializationConstant
+        {
+            VkShaderStageFlags stages;
+            uint32_t id;
+            uint32_t value;
+        };
+
+    private:
+        VkPipeline CreatePipeline(VkDevice pDevice, VkPipelineCache pCache, VkGraphicsPipelineLibraryFlagsEXT libraryParts) noexcept;
 
     public:
         std::vector<VkPipelineShaderStageCreateInfo> m_shaderStages;
@@ -45,7 +78,29 @@ namespace vkutil
         VkPipelineDepthStencilStateCreateInfo m_depthStencil;
         VkPipelineRenderingCreateInfo m_renderInfo;
         VkFormat m_colorAttachmentFormat;
+        VkPipelineCreateFlags m_flags;
+
+    private:
+        // sorted by id
+        std::vector<SpecializationConstant> m_specConstants;
+        // sorted, without viewport and scissor
+        std::vector<VkDynamicState> m_dynamicStates;
     };
 
-    bool LoadShaderModule(const std::filesystem::path& filepath, VkDevice pDevice, VkShaderModule& pOutModule) noexcept;
+    // Links pipeline libraries into an executable pipeline. Without optimize the link is fast enough to do
+    // on demand, optimize runs link time optimization and takes about as long as a full build.
+    // flags has to match the extra flags the libraries were built with.
+    VkPipeline LinkPipelineLibraries(VkDevice pDevice, std::span<const VkPipeline> libraries, VkPipelineLayout pLayout, 
+        VkPipelineCreateFlags flags, bool optimize, VkPipelineCache pCache = VK_NULL_HANDLE) noexcept;
+
+    // Creates a pipeline cache seeded from filepath. The file is ignored when it was written by another
+    // device, driver or engine version or is corrupted, the cache starts empty then. 
+    // pOutIsLoaded reports whether the file contents were used.
+    VkPipelineCache LoadPipelineCache(VkDevice pDevice, const VkPhysicalDeviceProperties& deviceProps, 
+        const std::filesystem::path& filepath, bool* pOutIsLoaded = nullptr) noexcept;
+
+    // Writes the cache contents to filepath. The data goes to a temporary file first which then replaces
+    // the old one, so an interrupted write never leaves a truncated cache behind.
+    bool SavePipelineCache(VkDevice pDevice, VkPipelineCache pCache, const VkPhysicalDeviceProperties& deviceProps, 
+        const std::filesystem::path& filepath) noexcept;
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_shader_archive.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+bool ShaderArchive::Open(const std::filesystem::path& filepath) noexcept
+{
+    if (!m_file.Open(filepath)) {
+        return false;
+    }
+
+    const std::span<const uint8_t> data = m_file.GetData();
+
+    ShaderArchiveHeader header = {};
+    if (data.size() >= sizeof(header)) {
+        memcpy(&header, data.data(), sizeof(header));
+    }
+
+    const size_t tocEnd = sizeof(header) + size_t(header.entryCount) * sizeof(ShaderArchiveEntry);
+
+    if (header.magic != SHADER_ARCHIVE_MAGIC || header.version != SHADER_ARCHIVE_VERSION || tocEnd > data.size()) {
+        fmt::print("Invalid shader archive: {}\n", filepath.string());
+        m_file.Close();
+        return false;
+    }
+
+    // mappings are page aligned, so the table right after the 16 byte header is aligned for direct access
+    m_entries = std::span<const ShaderArchiveEntry>(reinterpret_cast<const ShaderArchiveEntry*>(data.data() + sizeof(header)), header.entryCount);
+
+    for (const ShaderArchiveEntry& entry : m_entries) {
+        const bool isInBounds = entry.offset >= tocEnd && entry.offset <= data.size() && entry.size <= data.size() - entry.offset;
+        const bool isAligned = entry.offset % SHADER_ARCHIVE_BLOB_ALIGNMENT == 0 && entry.size % sizeof(uint32_t) == 0;
+
+        if (!isInBounds || !isAligned) {
+            fmt::print("Corrupted shader archive: {}\n", filepath.string());
+            m_entries = {};
+            m_file.Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void ShaderArchive::Close(VkDevice pDevice) noexcept
+{
+    std::lock_guard lock(m_modulesMutex);
+
+    for (auto& [nameHash, pModule] : m_modules) {
+        vkDestroyShaderModule(pDevice, pModule, nullptr);
+    }
+
+    m_modules.clear();
+    m_entries = {};
+    m_file.Close();
+}
+
+
+std::span<const uint32_t> ShaderArchive::FindCode(std::string_view name) const noexcept
+{
+    const uint64_t nameHash = HashShaderName(name);
+
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), nameHash, [](const ShaderArchiveEntry& entry, uint64_t hash) {
+        return entry.nameHash < hash;
+    });
+
+    if (it == m_entries.end() || it->nameHash != nameHash) {
+        return {};
+    }
+
+    const uint32_t* pCode = reinterpret_cast<const uint32_t*>(m_file.GetData().data() + it->offset);
+    return std::span<const uint32_t>(pCode, it->size / sizeof(uint32_t));
+}
+
+
+VkShaderModule ShaderArchive::GetModule(VkDevice pDevice, std::string_view name) noexcept
+{
+    const uint64_t nameHash = HashShaderName(name);
+
+    std::lock_guard lock(m_modulesMutex);
+
+    auto it = m_modules.find(nameHash);
+    if (it != m_modules.end()) {
+        return it->second;
+    }
+
+    const std::span<const uint32_t> code = FindCode(name);
+    if (code.empty()) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkShaderModuleCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = code.size_bytes(),
+        .pCode = code.data(),
+    };
+
+    VkShaderModule pShaderModule = VK_NULL_HANDLE;
+    if (vkCreateShaderModule(pDevice, &createInfo, nullptr, &pShaderModule) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    m_modules.emplace(nameHash, pShaderModule);
+
+    return pShaderModule;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include "mapped_file.h"
+#include "shader_archive_format.h"
+
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+
+
+// Packed SPIR-V archive produced by tools/shader_packer. The file is mapped once and modules are
+// created straight from the mapping, each of them only once.
+class ShaderArchive final
+{
+public:
+    ShaderArchive() = default;
+
+    ShaderArchive(const ShaderArchive& other) = delete;
+    ShaderArchive& operator=(const ShaderArchive& other) = delete;
+
+    bool Open(const std::filesystem::path& filepath) noexcept;
+    // Destroys all cached modules, pipelines built from them stay valid
+    void Close(VkDevice pDevice) noexcept;
+
+    // Empty span if the archive has no shader with this name
+    std::span<const uint32_t> FindCode(std::string_view name) const noexcept;
+
+    // Thread safe. The module is owned by the archive and lives until Close.
+    VkShaderModule GetModule(VkDevice pDevice, std::string_view name) noexcept;
+
+    bool IsOpen() const noexcept { return m_file.IsOpen(); }
+
+private:
+    MappedFile m_file;
+    std::span<const ShaderArchiveEntry> m_entries;
+
+    std::mutex m_modulesMutex;
+    std::unordered_map<uint64_t, VkShaderModule> m_modules;
+};
@@ -0,0 +1,563 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_texture_streamer.h"
+#include "vk_engine.h"
+
+
+static VkExtent3D GetMipExtent(const VkExtent3D& extent, uint32_t mip)
+{
+    return VkExtent3D { std::max(extent.width >> mip, 1u), std::max(extent.height >> mip, 1u), 1 };
+}
+
+
+void TextureStreamer::Init(VkDevice pDevice, VkDescriptorSetLayout pMaterialLayout, uint32_t materialBindingCount, DescriptorBuffer* pDescriptorBuffer) noexcept
+{
+    ENG_ASSERT(pDevice != VK_NULL_HANDLE && pMaterialLayout != VK_NULL_HANDLE);
+
+    m_pDevice = pDevice;
+    m_pMaterialLayout = pMaterialLayout;
+    m_materialBindingCount = materialBindingCount;
+
+    if (pDescriptorBuffer != nullptr) {
+        m_pDescriptorBuffer = pDescriptorBuffer;
+        m_materialBufferLayout = pDescriptorBuffer->GetLayout(pMaterialLayout, materialBindingCount);
+        return;
+    }
+
+    // material sets hold the scene's constants buffer and two textures
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 }
+    };
+
+    m_descriptorAllocator.Init(m_pDevice, 64, sizes);
+}
+
+
+void TextureStreamer::Terminate() noexcept
+{
+    if (m_pDevice == VK_NULL_HANDLE) {
+        return;
+    }
+
+    ENG_ASSERT(m_materialIndices.empty() && m_pendingCount == 0);
+
+    m_descriptorAllocator.DestroyPools(m_pDevice);
+    m_freeSets.clear();
+    m_retiredSets.clear();
+
+    m_textures.clear();
+    m_freeTextureIndices.clear();
+    m_materials.clear();
+    m_freeMaterialIndices.clear();
+
+    m_pDescriptorBuffer = nullptr;
+    m_pDevice = VK_NULL_HANDLE;
+}
+
+
+uint32_t TextureStreamer::GetTailMip(uint32_t width, uint32_t height, uint32_t mipCount) noexcept
+{
+    uint32_t mip = 0;
+
+    while (mip + 1 < mipCount && std::max(width >> mip, height >> mip) > TAIL_MIP_SIZE) {
+        ++mip;
+    }
+
+    return mip;
+}
+
+
+StreamedTextureID TextureStreamer::RegisterTexture(VulkanEngine& engine, const void* pOwner, StreamedTextureDesc&& desc, ImageID& outImage) noexcept
+{
+    ENG_ASSERT(!desc.mips.empty());
+
+    uint32_t index;
+
+    if (!m_freeTextureIndices.empty()) {
+        index = m_freeTextureIndices.back();
+        m_freeTextureIndices.pop_back();
+    } else {
+        index = (uint32_t)m_textures.size();
+        m_textures.emplace_back();
+    }
+
+    StreamedTexture& texture = m_textures[index];
+    texture.extent = desc.extent;
+    texture.format = desc.format;
+    texture.swizzle = desc.swizzle;
+    texture.mips = std::move(desc.mips);
+    texture.pOwner = pOwner;
+    texture.materials.clear();
+
+    texture.tailMip = GetTailMip(texture.extent.width, texture.extent.height, (uint32_t)texture.mips.size());
+    texture.residentMip = texture.tailMip;
+    texture.targetMip = texture.tailMip;
+    texture.demandMip = UINT32_MAX;
+    texture.wantedMip = texture.tailMip;
+
+    texture.lastUsedUpdate = 0;
+    texture.isPending = false;
+    texture.isAlive = true;
+
+    texture.image = engine.RegisterImage(engine.CreateTextureImage(GetMipExtent(texture.extent, texture.tailMip), texture.format,
+        (uint32_t)texture.mips.size() - texture.tailMip, texture.swizzle));
+
+    const uint64_t size = GetChainSize(texture, texture.tailMip);
+    m_residentBytes += size;
+    m_targetBytes += size;
+
+    // the caller uploads the tail before the next frame, defragmentation can't run earlier
+    FollowImageMoves(engine, index);
+
+    outImage = texture.image;
+
+    return index;
+}
+
+
+void TextureStreamer::RegisterMaterial(const void* pOwner, MaterialInstance* pMaterial, std::span<const MaterialTextureBinding> bindings) noexcept
+{
+    ENG_ASSERT(pMaterial != nullptr && !bindings.empty());
+    ENG_ASSERT(!m_materialIndices.contains(pMaterial));
+
+    uint32_t index;
+
+    if (!m_freeMaterialIndices.empty()) {
+        index = m_freeMaterialIndices.back();
+        m_freeMaterialIndices.pop_back();
+    } else {
+        index = (uint32_t)m_materials.size();
+        m_materials.emplace_back();
+    }
+
+    StreamedMaterial& material = m_materials[index];
+    material.pMaterial = pMaterial;
+    material.pOwner = pOwner;
+    material.bindings.assign(bindings.begin(), bindings.end());
+    material.isSetOwned = false;
+
+    m_materialIndices[pMaterial] = index;
+
+    for (const MaterialTextureBinding& binding : bindings) {
+        ENG_ASSERT(binding.texture < m_textures.size() && m_textures[binding.texture].isAlive);
+        m_textures[binding.texture].materials.push_back(index);
+    }
+}
+
+
+void TextureStreamer::ReleaseOwner(VulkanEngine& engine, const void* pOwner) noexcept
+{
+    for (size_t i = 0; i < m_textures.size(); ++i) {
+        StreamedTexture& texture = m_textures[i];
+
+        if (!texture.isAlive || texture.pOwner != pOwner) {
+            continue;
+        }
+
+        // a pending image is destroyed once its upload completes, its size is released then
+        m_residentBytes -= GetChainSize(texture, texture.residentMip);
+        m_targetBytes -= GetChainSize(texture, texture.targetMip);
+
+        engine.ReleaseImage(texture.image);
+        texture.image = {};
+
+        texture.mips.clear();
+        texture.materials.clear();
+        texture.isAlive = false;
+        ++texture.generation;
+
+        m_freeTextureIndices.push_back((uint32_t)i);
+    }
+
+    for (size_t i = 0; i < m_materials.size(); ++i) {
+        StreamedMaterial& material = m_materials[i];
+
+        if (material.pMaterial == nullptr || material.pOwner != pOwner) {
+            continue;
+        }
+
+        if (material.isSetOwned) {
+            m_freeSets.push_back(material.pMaterial->descriptorSet);
+        }
+
+        m_materialIndices.erase(material.pMaterial);
+
+        material.pMaterial = nullptr;
+        material.bindings.clear();
+
+        m_freeMaterialIndices.push_back((uint32_t)i);
+    }
+}
+
+
+void TextureStreamer::AddMaterialDemand(const MaterialInstance* pMaterial, float screenSize) noexcept
+{
+    auto it = m_materialIndices.find(pMaterial);
+    if (it == m_materialIndices.end()) {
+        return;
+    }
+
+    for (const MaterialTextureBinding& binding : m_materials[it->second].bindings) {
+        StreamedTexture& texture = m_textures[binding.texture];
+
+        // the surface is assumed to map the texture once, a mip is enough while its texels don't outnumber the pixels
+        const float textureSize = (float)std::max(texture.extent.width, texture.extent.height);
+        const uint32_t mip = screenSize >= textureSize ? 0 : (uint32_t)std::log2(textureSize / std::max(screenSize, 1.f));
+
+        texture.demandMip = std::min(texture.demandMip, mip);
+    }
+}
+
+
+void TextureStreamer::Update(VulkanEngine& engine) noexcept
+{
+    const uint64_t updateIndex = m_updateIndex++;
+    const uint64_t budget = std::min(m_budget, m_memoryLimit);
+
+    std::vector<uint32_t> upgrades;
+    std::vector<uint32_t> evictions;
+
+    for (uint32_t i = 0; i < m_textures.size(); ++i) {
+        StreamedTexture& texture = m_textures[i];
+
+        if (!texture.isAlive) {
+            continue;
+        }
+
+        const bool isUsed = texture.demandMip != UINT32_MAX;
+
+        // textures out of sight keep their mips until the budget needs them
+        if (isUsed) {
+            texture.lastUsedUpdate = updateIndex;
+            texture.wantedMip = std::min(texture.demandMip, texture.tailMip);
+            texture.demandMip = UINT32_MAX;
+        }
+
+        if (texture.isPending) {
+            continue;
+        }
+
+        if (isUsed && texture.wantedMip < texture.residentMip) {
+            upgrades.push_back(i);
+        }
+
+        const uint32_t evictMip = isUsed ? texture.wantedMip : texture.tailMip;
+
+        if (evictMip > texture.residentMip) {
+            evictions.push_back(i);
+        }
+    }
+
+    if (upgrades.empty() && m_targetBytes <= budget) {
+        return;
+    }
+
+    // largest detail deficit first, evictions start at the least recently used texture
+    std::sort(upgrades.begin(), upgrades.end(), [this](uint32_t left, uint32_t right) {
+        return m_textures[left].residentMip - m_textures[left].wantedMip > m_textures[right].residentMip - m_textures[right].wantedMip;
+    });
+
+    std::sort(evictions.begin(), evictions.end(), [this](uint32_t left, uint32_t right) {
+        return m_textures[left].lastUsedUpdate < m_textures[right].lastUsedUpdate;
+    });
+
+    UploadBatch batch;
+    std::vector<ResidencyChange> changes;
+
+    size_t nextEviction = 0;
+
+    auto Evict = [&]() {
+        const uint32_t evictIndex = evictions[nextEviction++];
+        const StreamedTexture& evicted = m_textures[evictIndex];
+
+        RequestResidency(engine, evictIndex, evicted.lastUsedUpdate == updateIndex ? evicted.wantedMip : evicted.tailMip, batch, changes);
+    };
+
+    // a lowered budget or memory limit is met before anything grows
+    while (m_targetBytes > budget && nextEviction < evictions.size()) {
+        Evict();
+    }
+
+    for (uint32_t textureIndex : upgrades) {
+        if (batch.GetStagingSize() >= MAX_UPLOAD_BYTES_PER_UPDATE) {
+            break;
+        }
+
+        const StreamedTexture& texture = m_textures[textureIndex];
+        const uint64_t residentSize = GetChainSize(texture, texture.residentMip);
+
+        // a partial upgrade is taken when the full one doesn't fit even with every candidate evicted
+        for (uint32_t mip = texture.wantedMip; mip < texture.residentMip; ++mip) {
+            const uint64_t growth = GetChainSize(texture, mip) - residentSize;
+
+            while (m_targetBytes + growth > budget && nextEviction < evictions.size()) {
+                Evict();
+            }
+
+            if (m_targetBytes + growth <= budget) {
+                RequestResidency(engine, textureIndex, mip, batch, changes);
+                break;
+            }
+        }
+    }
+
+    if (changes.empty()) {
+        return;
+    }
+
+    const uint64_t submitId = batch.SubmitAsync(engine);
+    CompleteResidencyChanges(engine, submitId, std::move(changes));
+}
+
+
+TextureStreamerStats TextureStreamer::GetStats() const noexcept
+{
+    TextureStreamerStats stats = {};
+    stats.residentBytes = m_residentBytes;
+    stats.targetBytes = m_targetBytes;
+    stats.pendingCount = m_pendingCount;
+
+    for (const StreamedTexture& texture : m_textures) {
+        if (texture.isAlive) {
+            stats.fullChainBytes += GetChainSize(texture, 0);
+            ++stats.textureCount;
+        }
+    }
+
+    return stats;
+}
+
+
+uint64_t TextureStreamer::GetChainSize(const StreamedTexture& texture, uint32_t firstMip) const noexcept
+{
+    uint64_t size = 0;
+
+    for (size_t mip = firstMip; mip < texture.mips.size(); ++mip) {
+        size += texture.mips[mip].size;
+    }
+
+    return size;
+}
+
+
+void TextureStreamer::RequestResidency(VulkanEngine& engine, uint32_t textureIndex, uint32_t residentMip, UploadBatch& batch,
+    std::vector<ResidencyChange>& changes) noexcept
+{
+    StreamedTexture& texture = m_textures[textureIndex];
+    ENG_ASSERT(!texture.isPending && residentMip != texture.residentMip);
+
+    ResidencyChange& change = changes.emplace_back();
+    change.textureIndex = textureIndex;
+    change.generation = texture.generation;
+    change.residentMip = residentMip;
+    change.size = GetChainSize(texture, residentMip);
+    change.image = engine.CreateTextureImage(GetMipExtent(texture.extent, residentMip), texture.format,
+        (uint32_t)texture.mips.size() - residentMip, texture.swizzle);
+
+    // evictions upload their remaining mips as well, the stored chain is closer than the old image
+    batch.AddImageMipsUpload(change.image, std::span<const UploadBatch::MipData>(texture.mips).subspan(residentMip));
+
+    m_residentBytes += change.size;
+    m_targetBytes += change.size;
+    m_targetBytes -= GetChainSize(texture, texture.targetMip);
+
+    texture.targetMip = residentMip;
+    texture.isPending = true;
+
+    ++m_pendingCount;
+}
+
+
+DetachedTask TextureStreamer::CompleteResidencyChanges(VulkanEngine& engine, uint64_t submitId, std::vector<ResidencyChange> changes) noexcept
+{
+    co_await engine.WaitForSubmit(submitId);
+
+    std::vector<DescriptorBufferSet> newRanges;
+
+    // resumed by PumpAsyncWork, no frame is being recorded
+    for (ResidencyChange& change : changes) {
+        StreamedTexture& texture = m_textures[change.textureIndex];
+
+        --m_pendingCount;
+
+        // the owner is gone, nothing references the new image
+        if (!texture.isAlive || texture.generation != change.generation) {
+            m_residentBytes -= change.size;
+            engine.DestroyImage(change.image);
+
+            continue;
+        }
+
+        // the descriptor buffer is full, the texture keeps its mips and a later update asks again
+        if (!AllocateMaterialRanges(texture, newRanges)) {
+            m_residentBytes -= change.size;
+            m_targetBytes -= change.size;
+            m_targetBytes += GetChainSize(texture, texture.residentMip);
+
+            texture.targetMip = texture.residentMip;
+            texture.isPending = false;
+
+            engine.DestroyImage(change.image);
+
+            continue;
+        }
+
+        m_residentBytes -= GetChainSize(texture, texture.residentMip);
+
+        ImageHandle& image = engine.GetImage(texture.image);
+
+        // the old image is on its way out, a defragmentation pass must not hand it back
+        engine.m_memoryPools.SetImageMoveCallback(image.pAllocation, nullptr);
+
+        // frames in flight may still sample the old image, the id names the new one from here on
+        engine.m_deferredDestroys.PushImage(engine.GetReleaseRetireFrame(), image);
+
+        image = change.image;
+        texture.residentMip = change.residentMip;
+        texture.isPending = false;
+
+        FollowImageMoves(engine, change.textureIndex);
+        RewriteMaterials(engine, texture, newRanges);
+    }
+}
+
+
+void TextureStreamer::FollowImageMoves(VulkanEngine& engine, uint32_t textureIndex) noexcept
+{
+    // same as a residency change, the materials get a set with the new view
+    engine.m_memoryPools.SetImageMoveCallback(engine.GetImage(m_textures[textureIndex].image).pAllocation, [this, &engine, textureIndex](const ImageHandle& newImage) {
+        StreamedTexture& texture = m_textures[textureIndex];
+        std::vector<DescriptorBufferSet> newRanges;
+
+        // the materials couldn't follow, the image stays where it is
+        if (!AllocateMaterialRanges(texture, newRanges)) {
+            return false;
+        }
+
+        engine.GetImage(texture.image) = newImage;
+        RewriteMaterials(engine, texture, newRanges);
+
+        return true;
+    });
+}
+
+
+bool TextureStreamer::AllocateMaterialRanges(const StreamedTexture& texture, std::vector<DescriptorBufferSet>& outRanges) noexcept
+{
+    outRanges.clear();
+
+    if (m_pDescriptorBuffer == nullptr) {
+        return true;
+    }
+
+    for (size_t i = 0; i < texture.materials.size(); ++i) {
+        const DescriptorBufferSet range = m_pDescriptorBuffer->Allocate(m_materialBufferLayout);
+
+        if (range.pAllocation == VK_NULL_HANDLE) {
+            for (const DescriptorBufferSet& allocated : outRanges) {
+                m_pDescriptorBuffer->Free(allocated.pAllocation);
+            }
+
+            outRanges.clear();
+            return false;
+        }
+
+        outRanges.push_back(range);
+    }
+
+    return true;
+}
+
+
+void TextureStreamer::RewriteMaterials(VulkanEngine& engine, const StreamedTexture& texture, std::span<const DescriptorBufferSet> newRanges) noexcept
+{
+    for (size_t i = 0; i < texture.materials.size(); ++i) {
+        StreamedMaterial& material = m_materials[texture.materials[i]];
+
+        if (m_pDescriptorBuffer != nullptr) {
+            RewriteMaterialRange(engine, material, newRanges[i]);
+        } else {
+            RewriteMaterial(engine, material);
+        }
+    }
+}
+
+
+void TextureStreamer::RewriteMaterial(VulkanEngine& engine, StreamedMaterial& material) noexcept
+{
+    VkDescriptorSet pNewSet;
+
+    size_t retiredCount = 0;
+
+    while (retiredCount < m_retiredSets.size() && engine.m_deferredDestroys.IsRetired(m_retiredSets[retiredCount].retireFrame)) {
+        m_freeSets.push_back(m_retiredSets[retiredCount].pSet);
+        ++retiredCount;
+    }
+
+    m_retiredSets.erase(m_retiredSets.begin(), m_retiredSets.begin() + retiredCount);
+
+    if (!m_freeSets.empty()) {
+        pNewSet = m_freeSets.back();
+        m_freeSets.pop_back();
+    } else {
+        pNewSet = m_descriptorAllocator.Allocate(m_pDevice, m_pMaterialLayout);
+    }
+
+    const VkDescriptorSet pOldSet = material.pMaterial->descriptorSet;
+
+    std::vector<VkCopyDescriptorSet> copies(m_materialBindingCount);
+
+    for (uint32_t binding = 0; binding < m_materialBindingCount; ++binding) {
+        VkCopyDescriptorSet& copy = copies[binding];
+        copy.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+        copy.srcSet = pOldSet;
+        copy.srcBinding = binding;
+        copy.dstSet = pNewSet;
+        copy.dstBinding = binding;
+        copy.descriptorCount = 1;
+    }
+
+    // writes are applied before copies within one call, the streamed textures go in a second one
+    vkUpdateDescriptorSets(m_pDevice, 0, nullptr, (uint32_t)copies.size(), copies.data());
+
+    m_descWriter.Clear();
+
+    for (const MaterialTextureBinding& binding : material.bindings) {
+        m_descWriter.WriteImage(binding.binding, engine.GetImage(m_textures[binding.texture].image).pImageView, binding.sampler,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    }
+
+    m_descWriter.UpdateSet(m_pDevice, pNewSet);
+
+    material.pMaterial->descriptorSet = pNewSet;
+
+    if (material.isSetOwned) {
+        // frames in flight may still bind the old set
+        m_retiredSets.push_back(RetiredSet { engine.GetReleaseRetireFrame(), pOldSet });
+    }
+
+    material.isSetOwned = true;
+}
+
+
+void TextureStreamer::RewriteMaterialRange(VulkanEngine& engine, StreamedMaterial& material, const DescriptorBufferSet& newSet) noexcept
+{
+    const DescriptorBufferSet oldSet = material.pMaterial->descriptorBufferSet;
+
+    m_pDescriptorBuffer->CopySet(m_materialBufferLayout, oldSet, newSet);
+
+    for (const MaterialTextureBinding& binding : material.bindings) {
+        const VkDescriptorImageInfo imageInfo = { binding.sampler, engine.GetImage(m_textures[binding.texture].image).pImageView, 
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+        m_pDescriptorBuffer->WriteImage(m_materialBufferLayout, newSet, binding.binding, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfo);
+    }
+
+    material.pMaterial->descriptorBufferSet = newSet;
+
+    // frames in flight may still read the old range, the owner frees the material's current one
+    engine.m_deferredDestroys.PushDescriptorRange(engine.GetReleaseRetireFrame(), oldSet.pAllocation);
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+#include "vk_upload_batch.h"
+
+#include "task.h"
+
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+
+class VulkanEngine;
+
+
+using StreamedTextureID = uint32_t;
+inline constexpr StreamedTextureID INVALID_STREAMED_TEXTURE_ID = UINT32_MAX;
+
+
+struct StreamedTextureDesc
+{
+    VkExtent3D extent;
+    VkFormat format;
+    VkComponentMapping swizzle;
+
+    // the whole stored chain, it has to stay readable until the texture is released
+    std::vector<UploadBatch::MipData> mips;
+};
+
+
+struct MaterialTextureBinding
+{
+    uint32_t binding;
+    StreamedTextureID texture;
+    VkSampler sampler;
+};
+
+
+struct TextureStreamerStats
+{
+    uint64_t residentBytes;
+    // residentBytes once the pending changes land
+    uint64_t targetBytes;
+    uint64_t fullChainBytes;
+    uint32_t textureCount;
+    uint32_t pendingCount;
+};
+
+
+// Keeps the mip tails of streamed textures resident and the higher mips only while surfaces on screen need them.
+// A residency change re-creates the image with the new mip count, uploads it from the stored chain and swaps it in
+// once the GPU is done, materials get a fresh descriptor set as the bound ones may be used by frames in flight.
+// Least recently seen textures drop back to their tail when the budget is exceeded. Engine main thread only.
+class TextureStreamer final
+{
+public:
+    // tail mips are the ones no larger than this, they are uploaded at load and never evicted
+    static constexpr uint32_t TAIL_MIP_SIZE = 64;
+    static constexpr uint64_t DEFAULT_BUDGET = 512ull * 1024 * 1024;
+    // bounds the staging memory of an update and the budget overshoot while old and new images coexist
+    static constexpr uint64_t MAX_UPLOAD_BYTES_PER_UPDATE = 32ull * 1024 * 1024;
+
+public:
+    TextureStreamer() = default;
+
+    TextureStreamer(const TextureStreamer& other) = delete;
+    TextureStreamer& operator=(const TextureStreamer& other) = delete;
+
+    // Material sets have one descriptor in each of the bindings 0..materialBindingCount - 1. With pDescriptorBuffer
+    // materials live in its ranges instead of descriptor sets.
+    void Init(VkDevice pDevice, VkDescriptorSetLayout pMaterialLayout, uint32_t materialBindingCount, DescriptorBuffer* pDescriptorBuffer = nullptr) noexcept;
+    void Terminate() noexcept;
+
+    // First mip kept resident, textures with tail mip 0 are not worth streaming
+    static uint32_t GetTailMip(uint32_t width, uint32_t height, uint32_t mipCount) noexcept;
+
+    // Creates the image with the mips from the tail on, the caller uploads them. outImage keeps naming the texture's
+    // current image across residency changes and stays owned by the streamer, materials have to be registered to follow it.
+    StreamedTextureID RegisterTexture(VulkanEngine& engine, const void* pOwner, StreamedTextureDesc&& desc, ImageID& outImage) noexcept;
+    // pMaterial has to stay alive until its owner is released, its descriptor set is replaced on residency changes
+    void RegisterMaterial(const void* pOwner, MaterialInstance* pMaterial, std::span<const MaterialTextureBinding> bindings) noexcept;
+    // Destroys the images and sets of everything pOwner registered, the GPU must be done with them
+    void ReleaseOwner(VulkanEngine& engine, const void* pOwner) noexcept;
+
+    // screenSize is the on-screen diameter in pixels of a visible surface drawn with pMaterial
+    void AddMaterialDemand(const MaterialInstance* pMaterial, float screenSize) noexcept;
+    // Turns the demand gathered since the last update into uploads and evictions
+    void Update(VulkanEngine& engine) noexcept;
+
+    void SetBudget(uint64_t budget) noexcept { m_budget = budget; }
+    uint64_t GetBudget() const noexcept { return m_budget; }
+    // Lowers the budget while device memory is under pressure, textures shrink until they fit both
+    void SetMemoryLimit(uint64_t limit) noexcept { m_memoryLimit = limit; }
+
+    bool HasTextures() const noexcept { return !m_materialIndices.empty(); }
+    TextureStreamerStats GetStats() const noexcept;
+
+private:
+    struct StreamedTexture
+    {
+        ImageID image;
+        VkExtent3D extent;
+        VkFormat format;
+        VkComponentMapping swizzle;
+        std::vector<UploadBatch::MipData> mips;
+
+        const void* pOwner;
+        std::vector<uint32_t> materials;
+
+        uint32_t tailMip;
+        uint32_t residentMip;
+        // residentMip once the pending change lands
+        uint32_t targetMip;
+        uint32_t demandMip;
+        uint32_t wantedMip;
+
+        uint64_t lastUsedUpdate;
+        uint32_t generation;
+        bool isPending;
+        bool isAlive;
+    };
+
+    struct StreamedMaterial
+    {
+        MaterialInstance* pMaterial;
+        const void* pOwner;
+        std::vector<MaterialTextureBinding> bindings;
+        // sets allocated here go back to the free list, the initial one belongs to the owner's pool
+        bool isSetOwned;
+    };
+
+    struct ResidencyChange
+    {
+        uint32_t textureIndex;
+        uint32_t generation;
+        uint32_t residentMip;
+        uint64_t size;
+        ImageHandle image;
+    };
+
+private:
+    uint64_t GetChainSize(const StreamedTexture& texture, uint32_t firstMip) const noexcept;
+
+    void RequestResidency(VulkanEngine& engine, uint32_t textureIndex, uint32_t residentMip, UploadBatch& batch,
+        std::vector<ResidencyChange>& changes) noexcept;
+    DetachedTask CompleteResidencyChanges(VulkanEngine& engine, uint64_t submitId, std::vector<ResidencyChange> changes) noexcept;
+    // Keeps the texture's image and its materials up to date when defragmentation moves it
+    void FollowImageMoves(VulkanEngine& engine, uint32_t textureIndex) noexcept;
+
+    // A range per material of the texture, all or none. Taken before the image is swapped, a full
+    // descriptor buffer must not leave the materials with the old view.
+    bool AllocateMaterialRanges(const StreamedTexture& texture, std::vector<DescriptorBufferSet>& outRanges) noexcept;
+    // newRanges comes from AllocateMaterialRanges, it is empty without a descriptor buffer
+    void RewriteMaterials(VulkanEngine& engine, const StreamedTexture& texture, std::span<const DescriptorBufferSet> newRanges) noexcept;
+    void RewriteMaterial(VulkanEngine& engine, StreamedMaterial& material) noexcept;
+    void RewriteMaterialRange(VulkanEngine& engine, StreamedMaterial& material, const DescriptorBufferSet& newSet) noexcept;
+
+private:
+    VkDevice m_pDevice = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_pMaterialLayout = VK_NULL_HANDLE;
+    uint32_t m_materialBindingCount = 0;
+
+    struct RetiredSet
+    {
+        uint64_t retireFrame;
+        VkDescriptorSet pSet;
+    };
+
+    DescriptorAllocatorGrowable m_descriptorAllocator;
+    std::vector<VkDescriptorSet> m_freeSets;
+    // replaced sets in retire order, they become free once the engine's deferred destroys passed them
+    std::vector<RetiredSet> m_retiredSets;
+    DescriptorWriter m_descWriter;
+
+    // material ranges aren't shared, a replaced one is retired through the engine's deferred destroys
+    DescriptorBuffer* m_pDescriptorBuffer = nullptr;
+    DescriptorBufferLayout m_materialBufferLayout;
+
+    std::vector<StreamedTexture> m_textures;
+    std::vector<uint32_t> m_freeTextureIndices;
+
+    std::vector<StreamedMaterial> m_materials;
+    std::vector<uint32_t> m_freeMaterialIndices;
+    std::unordered_map<const MaterialInstance*, uint32_t> m_materialIndices;
+
+    uint64_t m_budget = DEFAULT_BUDGET;
+    uint64_t m_memoryLimit = UINT64_MAX;
+    // allocated images, old and new ones of pending changes included
+    uint64_t m_residentBytes = 0;
+    // what stays allocated once the pending changes land, the budget is checked against it
+    uint64_t m_targetBytes = 0;
+    uint32_t m_pendingCount = 0;
+
+    uint64_t m_updateIndex = 1;
+};
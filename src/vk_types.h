@@ -8,6 +8,21 @@
 #include <glm/glm.hpp>
 
 #include "core.h"
+#include "slot_map.h"
+
+
+// What an allocation holds, device memory use is reported per category
+enum class MemoryCategory : uint8_t
+{
+    MESHES,
+    TEXTURES,
+    RENDER_TARGETS,
+    STAGING,
+    // GPU only scratch of a single submission
+    TRANSIENT,
+    UNIFORMS,
+    COUNT
+};
 
 
 struct ImageHandle
@@ -25,6 +40,21 @@ struct BufferHandle
     VkBuffer pBuffer;
     VmaAllocation pAllocation;
     VmaAllocationInfo allocationInfo;
+    // zero unless created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    VkDeviceAddress deviceAddress;
+};
+
+
+// Handles of the shared images and buffers registered in the engine, see VulkanEngine::RegisterImage
+using ImageID = SlotHandle<ImageHandle>;
+using BufferID = SlotHandle<BufferHandle>;
+
+
+// Set written into a descriptor buffer, see DescriptorBuffer
+struct DescriptorBufferSet
+{
+    VkDeviceSize offset;
+    VmaVirtualAllocation pAllocation;
 };
 
 
@@ -38,12 +68,18 @@ struct Vertex
 };
 
 
-struct MeshGpuBuffers
+struct Bounds
 {
-    BufferHandle idxBuff;
-    BufferHandle vertBuff;
+    glm::vec3 origin;
+    float sphereRadius;
+    glm::vec3 extents;
+};
 
-    VkDeviceAddress vertBufferGpuAddress;
+
+struct MeshGpuBuffers
+{
+    BufferID idxBuff;
+    BufferID vertBuff;
 };
 
 
@@ -51,6 +87,8 @@ struct GPUDrawPushConstants
 {
     glm::mat4 transform;
     VkDeviceAddress vertBufferGpuAddress;
+    // slot of the draw's material in the constants buffer bound to its set
+    uint32_t materialIndex;
 };
 
 
@@ -66,6 +104,7 @@ struct MaterialPipeline
 {
 	VkPipeline pipeline;
 	VkPipelineLayout layout;
+    uint32_t id;
 };
 
 
@@ -83,22 +122,35 @@ struct SceneData
 struct MaterialInstance
 {
     MaterialPipeline* pPipeline;
+    // shades after the depth pre-pass, nullptr for materials that can't be drawn in it
+    MaterialPipeline* pDepthEqualPipeline;
+    // descriptorSet on the pool path, descriptorBufferSet with the descriptor buffer backend
     VkDescriptorSet descriptorSet;
+    DescriptorBufferSet descriptorBufferSet;
     MaterialPass passType;
+    uint32_t id;
+    // see GLTFMetallic_Roughness::MaterialResources::constantsIndex
+    uint32_t constantsIndex;
 };
 
 
-struct RenderContext;
+class RenderContext;
+
+using RenderObjectID = uint32_t;
+inline constexpr RenderObjectID INVALID_RENDER_OBJECT_ID = UINT32_MAX;
 
 
 class IRenderable {
 
-    virtual void Render(const glm::mat4& topMatrix, RenderContext& ctx) = 0;
+    virtual void RegisterDraws(RenderContext& ctx) = 0;
+    virtual void UnregisterDraws(RenderContext& ctx) = 0;
 };
 
 struct Node : public IRenderable
 {
-    void RefreshTransform(const glm::mat4& parentTrs)
+    virtual ~Node() = default;
+
+    virtual void RefreshTransform(const glm::mat4& parentTrs)
     {
         worldTrs = parentTrs * localTrs;
         
@@ -107,10 +159,25 @@ struct Node : public IRenderable
         }
     }
 
-    virtual void Render(const glm::mat4& topMatrix, RenderContext& ctx) override
+    virtual void RegisterDraws(RenderContext& ctx) override
+    {
+        for (std::shared_ptr<Node>& pChild : children) {
+            pChild->RegisterDraws(ctx);
+        }
+    }
+
+    virtual void UnregisterDraws(RenderContext& ctx) override
+    {
+        for (std::shared_ptr<Node>& pChild : children) {
+            pChild->UnregisterDraws(ctx);
+        }
+    }
+
+    // Visits the draw records registered by this node and its children
+    virtual void ForEachDraw(const std::function<void(RenderObjectID)>& func)
     {
         for (std::shared_ptr<Node>& pChild : children) {
-            pChild->Render(topMatrix, ctx);
+            pChild->ForEachDraw(func);
         }
     }
 
@@ -0,0 +1,191 @@
+#include "pch.h"
+
+#include "core.h"
+
+#include "vk_upload_batch.h"
+#include "vk_engine.h"
+#include "vk_images.h"
+
+#include "job_system.h"
+#include "texture_format.h"
+
+
+// covers the texel and block sizes of every format the engine uploads
+static constexpr uint64_t UPLOAD_STAGING_ALIGNMENT = 16;
+
+
+void UploadBatch::AddBufferUpload(VkBuffer pDstBuffer, const void* pData, size_t size) noexcept
+{
+    ENG_ASSERT(pDstBuffer != VK_NULL_HANDLE);
+
+    if (size == 0) {
+        return;
+    }
+
+    m_bufferUploads.emplace_back(BufferUpload { pDstBuffer, pData, size, AllocateStaging(size) });
+}
+
+
+void UploadBatch::AddImageUpload(const ImageHandle& dstImage, const void* pData, size_t size, bool generateMips, bool isSRGB) noexcept
+{
+    ENG_ASSERT(dstImage.pImage != VK_NULL_HANDLE);
+    ENG_ASSERT(pData != nullptr && size > 0);
+
+    m_imageUploads.emplace_back(ImageUpload { dstImage.pImage, dstImage.format, dstImage.extent, (uint32_t)m_imageMipUploads.size(), 1, generateMips, isSRGB });
+    m_imageMipUploads.emplace_back(ImageMipUpload { pData, size, AllocateStaging(size) });
+}
+
+
+void UploadBatch::AddImageMipsUpload(const ImageHandle& dstImage, std::span<const MipData> mips) noexcept
+{
+    ENG_ASSERT(dstImage.pImage != VK_NULL_HANDLE);
+    ENG_ASSERT(!mips.empty());
+
+    m_imageUploads.emplace_back(ImageUpload { dstImage.pImage, dstImage.format, dstImage.extent, (uint32_t)m_imageMipUploads.size(), (uint32_t)mips.size(), false, false });
+
+    for (const MipData& mip : mips) {
+        ENG_ASSERT(mip.pData != nullptr && mip.size > 0);
+        m_imageMipUploads.emplace_back(ImageMipUpload { mip.pData, mip.size, AllocateStaging(mip.size) });
+    }
+}
+
+
+void UploadBatch::Submit(const VulkanEngine& engine) noexcept
+{
+    if (IsEmpty()) {
+        return;
+    }
+
+    BufferHandle stagingBuff = FillStaging(engine);
+    MipGenerationResources mipResources;
+
+    engine.ImmediateSubmit([&](VkCommandBuffer pCmdBuf) {
+        RecordCopies(engine, pCmdBuf, stagingBuff.pBuffer, mipResources);
+    });
+
+    engine.DestroyBuffer(stagingBuff);
+    engine.m_mipGenerator.ReleaseResources(engine, mipResources);
+
+    Reset();
+}
+
+
+uint64_t UploadBatch::SubmitAsync(VulkanEngine& engine) noexcept
+{
+    BufferHandle stagingBuff = IsEmpty() ? BufferHandle {} : FillStaging(engine);
+
+    // filled while recording, which happens after the completion callback is handed over
+    std::shared_ptr<MipGenerationResources> pMipResources = std::make_shared<MipGenerationResources>();
+
+    const uint64_t submitId = engine.SubmitAsync([&](VkCommandBuffer pCmdBuf) {
+        if (stagingBuff.pBuffer != VK_NULL_HANDLE) {
+            RecordCopies(engine, pCmdBuf, stagingBuff.pBuffer, *pMipResources);
+        }
+    }, [&engine, pMipResources, stagingBuff]() mutable {
+        if (stagingBuff.pBuffer != VK_NULL_HANDLE) {
+            engine.DestroyBuffer(stagingBuff);
+        }
+
+        engine.m_mipGenerator.ReleaseResources(engine, *pMipResources);
+    });
+
+    Reset();
+
+    return submitId;
+}
+
+
+BufferHandle UploadBatch::FillStaging(const VulkanEngine& engine) const noexcept
+{
+    BufferHandle stagingBuff = engine.CreateBuffer(m_stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryCategory::STAGING);
+    uint8_t* pStagingData = static_cast<uint8_t*>(stagingBuff.allocationInfo.pMappedData);
+
+    JobSystem& jobSystem = JobSystem::GetInstance();
+
+    jobSystem.ParallelFor(m_bufferUploads.size(), 0, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            memcpy(pStagingData + m_bufferUploads[i].stagingOffset, m_bufferUploads[i].pData, m_bufferUploads[i].size);
+        }
+    });
+
+    jobSystem.ParallelFor(m_imageMipUploads.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            memcpy(pStagingData + m_imageMipUploads[i].stagingOffset, m_imageMipUploads[i].pData, m_imageMipUploads[i].size);
+        }
+    });
+
+    return stagingBuff;
+}
+
+
+void UploadBatch::RecordCopies(const VulkanEngine& engine, VkCommandBuffer pCmdBuf, VkBuffer pStagingBuffer, MipGenerationResources& outMipResources) const noexcept
+{
+    const MipGenerator& mipGenerator = engine.m_mipGenerator;
+    for (const BufferUpload& upload : m_bufferUploads) {
+        const VkBufferCopy copy = { upload.stagingOffset, 0, upload.size };
+        vkCmdCopyBuffer(pCmdBuf, pStagingBuffer, upload.pDstBuffer, 1, &copy);
+    }
+
+    std::vector<VkBufferImageCopy> copyRegions;
+    std::vector<MipGenerationDesc> mipGenerations;
+
+    for (const ImageUpload& upload : m_imageUploads) {
+        vkutil::TransitImage(pCmdBuf, upload.pDstImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        copyRegions.clear();
+
+        for (uint32_t mip = 0; mip < upload.mipCount; ++mip) {
+            VkBufferImageCopy copyRegion = {};
+            copyRegion.bufferOffset = m_imageMipUploads[upload.firstMip + mip].stagingOffset;
+
+            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegion.imageSubresource.mipLevel = mip;
+            copyRegion.imageSubresource.baseArrayLayer = 0;
+            copyRegion.imageSubresource.layerCount = 1;
+            // compressed mips smaller than a block still copy their real size, they reach the image edge
+            copyRegion.imageExtent = { std::max(upload.extent.width >> mip, 1u), std::max(upload.extent.height >> mip, 1u), 1 };
+
+            copyRegions.push_back(copyRegion);
+        }
+
+        vkCmdCopyBufferToImage(pCmdBuf, pStagingBuffer, upload.pDstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            (uint32_t)copyRegions.size(), copyRegions.data());
+
+        if (!upload.generateMips) {
+            vkutil::TransitImage(pCmdBuf, upload.pDstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        } else if (mipGenerator.IsReady() && mipGenerator.IsFormatSupported(upload.format)) {
+            MipGenerationDesc& desc = mipGenerations.emplace_back();
+            desc.pImage = upload.pDstImage;
+            desc.format = upload.format;
+            desc.extent = VkExtent2D { upload.extent.width, upload.extent.height };
+            desc.mipCount = GetTextureMipCount(upload.extent.width, upload.extent.height);
+            desc.isSRGB = upload.isSRGB;
+        } else {
+            vkutil::GenerateMipmaps(pCmdBuf, upload.pDstImage, VkExtent2D { upload.extent.width, upload.extent.height });
+        }
+    }
+
+    // one set of barriers for every image of the batch
+    if (!mipGenerations.empty()) {
+        mipGenerator.Record(engine, pCmdBuf, mipGenerations, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            outMipResources);
+    }
+}
+
+
+void UploadBatch::Reset() noexcept
+{
+    m_bufferUploads.clear();
+    m_imageUploads.clear();
+    m_imageMipUploads.clear();
+    m_stagingSize = 0;
+}
+
+
+uint64_t UploadBatch::AllocateStaging(size_t size) noexcept
+{
+    const uint64_t offset = (m_stagingSize + UPLOAD_STAGING_ALIGNMENT - 1) / UPLOAD_STAGING_ALIGNMENT * UPLOAD_STAGING_ALIGNMENT;
+    m_stagingSize = offset + size;
+
+    return offset;
+}
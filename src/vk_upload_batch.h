@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mip_generator.h"
+
+#include <span>
+#include <vector>
+
+
+class VulkanEngine;
+
+
+// Gathers buffer and image uploads into one staging buffer and one submission. Sources are only
+// read in Submit, they have to stay alive until then.
+class UploadBatch final
+{
+public:
+    struct MipData
+    {
+        const void* pData;
+        size_t size;
+    };
+
+public:
+    UploadBatch() = default;
+
+    UploadBatch(const UploadBatch& other) = delete;
+    UploadBatch& operator=(const UploadBatch& other) = delete;
+
+    void AddBufferUpload(VkBuffer pDstBuffer, const void* pData, size_t size) noexcept;
+    // Fills mip 0 of an image created with transfer src/dst usage, with generateMips the rest of the chain is built on the GPU.
+    // isSRGB filters the color of those mips in linear space.
+    void AddImageUpload(const ImageHandle& dstImage, const void* pData, size_t size, bool generateMips, bool isSRGB = false) noexcept;
+    // Fills the first mips.size() mips as they are, block compressed data included
+    void AddImageMipsUpload(const ImageHandle& dstImage, std::span<const MipData> mips) noexcept;
+
+    // Copies the sources into staging memory on the job threads and waits for the transfer to finish
+    void Submit(const VulkanEngine& engine) noexcept;
+    // Same copy, but returns right after the submission, co_await engine.WaitForSubmit(id) to know when the
+    // transfer is done. The sources can be released as soon as it returns. Engine main thread only, see VulkanEngine::SubmitAsync.
+    uint64_t SubmitAsync(VulkanEngine& engine) noexcept;
+
+    // Drops the queued uploads, for a load that releases their destinations before the batch is submitted
+    void Reset() noexcept;
+
+    bool IsEmpty() const noexcept { return m_bufferUploads.empty() && m_imageUploads.empty(); }
+    uint64_t GetStagingSize() const noexcept { return m_stagingSize; }
+
+private:
+    struct BufferUpload
+    {
+        VkBuffer pDstBuffer;
+        const void* pData;
+        size_t size;
+        uint64_t stagingOffset;
+    };
+
+    struct ImageUpload
+    {
+        VkImage pDstImage;
+        VkFormat format;
+        VkExtent3D extent;
+        uint32_t firstMip;
+        uint32_t mipCount;
+        bool generateMips;
+        bool isSRGB;
+    };
+
+    struct ImageMipUpload
+    {
+        const void* pData;
+        size_t size;
+        uint64_t stagingOffset;
+    };
+
+private:
+    uint64_t AllocateStaging(size_t size) noexcept;
+
+    BufferHandle FillStaging(const VulkanEngine& engine) const noexcept;
+    // Mip generation resources have to outlive the submission
+    void RecordCopies(const VulkanEngine& engine, VkCommandBuffer pCmdBuf, VkBuffer pStagingBuffer, MipGenerationResources& outMipResources) const noexcept;
+
+private:
+    std::vector<BufferUpload> m_bufferUploads;
+    std::vector<ImageUpload> m_imageUploads;
+    std::vector<ImageMipUpload> m_imageMipUploads;
+
+    uint64_t m_stagingSize = 0;
+};
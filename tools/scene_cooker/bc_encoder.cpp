@@ -0,0 +1,365 @@
+#include "pch.h"
+
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+
+static constexpr uint32_t BC_BLOCK_TEXEL_COUNT = 16;
+
+// BC7 interpolation weights for 4 bit indices, out of 64
+static constexpr uint32_t BC7_WEIGHTS_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+
+// 4x4 texels of the image starting at (blockX * 4, blockY * 4), edges clamped
+static void LoadBlock(const uint8_t* pPixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, uint8_t outBlock[16][4])
+{
+    for (uint32_t y = 0; y < 4; ++y) {
+        const uint32_t srcY = std::min(blockY * 4 + y, height - 1);
+
+        for (uint32_t x = 0; x < 4; ++x) {
+            const uint32_t srcX = std::min(blockX * 4 + x, width - 1);
+            memcpy(outBlock[y * 4 + x], pPixels + ((size_t)srcY * width + srcX) * 4, 4);
+        }
+    }
+}
+
+
+class BitWriter final
+{
+public:
+    explicit BitWriter(uint8_t* pDst) : m_pDst(pDst) {}
+
+    // LSB first, the way BC7 blocks are laid out
+    void Write(uint32_t value, uint32_t bitCount)
+    {
+        for (uint32_t i = 0; i < bitCount; ++i, ++m_bitOffset) {
+            if ((value >> i) & 1) {
+                m_pDst[m_bitOffset / 8] |= (uint8_t)(1u << (m_bitOffset % 8));
+            }
+        }
+    }
+
+private:
+    uint8_t* m_pDst;
+    uint32_t m_bitOffset = 0;
+};
+
+
+struct BC7Mode6Endpoints
+{
+    // 7 bit values per endpoint and channel plus one p-bit per endpoint
+    uint8_t quantized[2][4];
+    uint8_t pBits[2];
+};
+
+
+static void QuantizeBC7Mode6Endpoint(const float endpoint[4], uint8_t outQuantized[4], uint8_t& outPBit)
+{
+    float bestError = FLT_MAX;
+
+    for (uint8_t pBit = 0; pBit < 2; ++pBit) {
+        uint8_t quantized[4];
+        float error = 0.f;
+
+        for (uint32_t c = 0; c < 4; ++c) {
+            const float value = std::clamp(std::round((endpoint[c] - pBit) / 2.f), 0.f, 127.f);
+            quantized[c] = (uint8_t)value;
+
+            const float diff = (float)((quantized[c] << 1) | pBit) - endpoint[c];
+            error += diff * diff;
+        }
+
+        if (error < bestError) {
+            bestError = error;
+            memcpy(outQuantized, quantized, 4);
+            outPBit = pBit;
+        }
+    }
+}
+
+
+static void GetBC7Mode6Palette(const BC7Mode6Endpoints& endpoints, uint8_t outPalette[16][4])
+{
+    for (uint32_t c = 0; c < 4; ++c) {
+        const uint32_t e0 = (endpoints.quantized[0][c] << 1) | endpoints.pBits[0];
+        const uint32_t e1 = (endpoints.quantized[1][c] << 1) | endpoints.pBits[1];
+
+        for (uint32_t i = 0; i < 16; ++i) {
+            outPalette[i][c] = (uint8_t)(((64 - BC7_WEIGHTS_4[i]) * e0 + BC7_WEIGHTS_4[i] * e1 + 32) >> 6);
+        }
+    }
+}
+
+
+// Picks the closest palette entry for every texel, returns the total squared error
+static uint32_t AssignBC7Mode6Indices(const uint8_t block[16][4], const BC7Mode6Endpoints& endpoints, uint8_t outIndices[16])
+{
+    uint8_t palette[16][4];
+    GetBC7Mode6Palette(endpoints, palette);
+
+    uint32_t totalError = 0;
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        uint32_t bestError = UINT32_MAX;
+
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t error = 0;
+
+            for (uint32_t c = 0; c < 4; ++c) {
+                const int32_t diff = (int32_t)block[t][c] - palette[i][c];
+                error += diff * diff;
+            }
+
+            if (error < bestError) {
+                bestError = error;
+                outIndices[t] = (uint8_t)i;
+            }
+        }
+
+        totalError += bestError;
+    }
+
+    return totalError;
+}
+
+
+// Endpoints along the principal axis of the block colors, the extremes of the projection
+static void FindBC7Mode6AxisEndpoints(const uint8_t block[16][4], float outEndpoints[2][4])
+{
+    float mean[4] = {};
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            mean[c] += block[t][c] / 16.f;
+        }
+    }
+
+    float covariance[4][4] = {};
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        for (uint32_t i = 0; i < 4; ++i) {
+            for (uint32_t j = 0; j < 4; ++j) {
+                covariance[i][j] += (block[t][i] - mean[i]) * (block[t][j] - mean[j]);
+            }
+        }
+    }
+
+    // power iteration, a handful of steps is enough to separate the dominant axis
+    float axis[4] = { 1.f, 1.f, 1.f, 1.f };
+
+    for (uint32_t iter = 0; iter < 8; ++iter) {
+        float next[4] = {};
+
+        for (uint32_t i = 0; i < 4; ++i) {
+            for (uint32_t j = 0; j < 4; ++j) {
+                next[i] += covariance[i][j] * axis[j];
+            }
+        }
+
+        const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+        if (length < 1e-6f) {
+            break;
+        }
+
+        for (uint32_t c = 0; c < 4; ++c) {
+            axis[c] = next[c] / length;
+        }
+    }
+
+    float minProj = FLT_MAX;
+    float maxProj = -FLT_MAX;
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        float proj = 0.f;
+
+        for (uint32_t c = 0; c < 4; ++c) {
+            proj += (block[t][c] - mean[c]) * axis[c];
+        }
+
+        minProj = std::min(minProj, proj);
+        maxProj = std::max(maxProj, proj);
+    }
+
+    for (uint32_t c = 0; c < 4; ++c) {
+        outEndpoints[0][c] = std::clamp(mean[c] + axis[c] * minProj, 0.f, 255.f);
+        outEndpoints[1][c] = std::clamp(mean[c] + axis[c] * maxProj, 0.f, 255.f);
+    }
+}
+
+
+// Least squares endpoints for fixed indices
+static bool RefineBC7Mode6Endpoints(const uint8_t block[16][4], const uint8_t indices[16], float outEndpoints[2][4])
+{
+    float a = 0.f, b = 0.f, c = 0.f;
+    float d0[4] = {};
+    float d1[4] = {};
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        const float w = BC7_WEIGHTS_4[indices[t]] / 64.f;
+
+        a += (1.f - w) * (1.f - w);
+        b += (1.f - w) * w;
+        c += w * w;
+
+        for (uint32_t ch = 0; ch < 4; ++ch) {
+            d0[ch] += (1.f - w) * block[t][ch];
+            d1[ch] += w * block[t][ch];
+        }
+    }
+
+    const float det = a * c - b * b;
+    if (std::abs(det) < 1e-6f) {
+        return false;
+    }
+
+    for (uint32_t ch = 0; ch < 4; ++ch) {
+        outEndpoints[0][ch] = std::clamp((c * d0[ch] - b * d1[ch]) / det, 0.f, 255.f);
+        outEndpoints[1][ch] = std::clamp((a * d1[ch] - b * d0[ch]) / det, 0.f, 255.f);
+    }
+
+    return true;
+}
+
+
+static void EncodeBC7Mode6Block(const uint8_t block[16][4], uint8_t* pDst)
+{
+    float endpoints[2][4];
+    FindBC7Mode6AxisEndpoints(block, endpoints);
+
+    BC7Mode6Endpoints best = {};
+    uint8_t bestIndices[16] = {};
+    uint32_t bestError = UINT32_MAX;
+
+    for (uint32_t iter = 0; iter < 3; ++iter) {
+        BC7Mode6Endpoints candidate = {};
+        QuantizeBC7Mode6Endpoint(endpoints[0], candidate.quantized[0], candidate.pBits[0]);
+        QuantizeBC7Mode6Endpoint(endpoints[1], candidate.quantized[1], candidate.pBits[1]);
+
+        uint8_t indices[16];
+        const uint32_t error = AssignBC7Mode6Indices(block, candidate, indices);
+
+        if (error < bestError) {
+            bestError = error;
+            best = candidate;
+            memcpy(bestIndices, indices, sizeof(indices));
+        }
+
+        if (bestError == 0 || !RefineBC7Mode6Endpoints(block, bestIndices, endpoints)) {
+            break;
+        }
+    }
+
+    // the anchor index has an implicit zero top bit, swapping the endpoints mirrors the indices
+    if (bestIndices[0] >= 8) {
+        std::swap(best.quantized[0], best.quantized[1]);
+        std::swap(best.pBits[0], best.pBits[1]);
+
+        for (uint8_t& index : bestIndices) {
+            index = 15 - index;
+        }
+    }
+
+    memset(pDst, 0, 16);
+    BitWriter writer(pDst);
+
+    // mode 6 is a 1 after six zero bits
+    writer.Write(1u << 6, 7);
+
+    for (uint32_t c = 0; c < 4; ++c) {
+        writer.Write(best.quantized[0][c], 7);
+        writer.Write(best.quantized[1][c], 7);
+    }
+
+    writer.Write(best.pBits[0], 1);
+    writer.Write(best.pBits[1], 1);
+
+    writer.Write(bestIndices[0], 3);
+    for (uint32_t t = 1; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        writer.Write(bestIndices[t], 4);
+    }
+}
+
+
+// BC4 block from one channel: max and min as endpoints, so the 8 value palette is used
+static void EncodeBC4Block(const uint8_t block[16][4], uint32_t channel, uint8_t* pDst)
+{
+    uint8_t minValue = 255;
+    uint8_t maxValue = 0;
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        minValue = std::min(minValue, block[t][channel]);
+        maxValue = std::max(maxValue, block[t][channel]);
+    }
+
+    pDst[0] = maxValue;
+    pDst[1] = minValue;
+
+    uint8_t palette[8] = { maxValue, minValue };
+    for (uint32_t i = 2; i < 8; ++i) {
+        palette[i] = (uint8_t)(((8 - i) * maxValue + (i - 1) * minValue + 3) / 7);
+    }
+
+    uint64_t indexBits = 0;
+
+    for (uint32_t t = 0; t < BC_BLOCK_TEXEL_COUNT; ++t) {
+        uint32_t bestIndex = 0;
+        int32_t bestError = INT32_MAX;
+
+        for (uint32_t i = 0; i < 8; ++i) {
+            const int32_t error = std::abs((int32_t)block[t][channel] - palette[i]);
+
+            if (error < bestError) {
+                bestError = error;
+                bestIndex = i;
+            }
+        }
+
+        indexBits |= (uint64_t)bestIndex << (t * 3);
+    }
+
+    for (uint32_t i = 0; i < 6; ++i) {
+        pDst[2 + i] = (uint8_t)(indexBits >> (i * 8));
+    }
+}
+
+
+template <size_t BLOCK_SIZE, typename EncodeFunc>
+static std::vector<uint8_t> EncodeBlocks(const uint8_t* pPixels, uint32_t width, uint32_t height, EncodeFunc&& encode)
+{
+    const uint32_t blockCountX = (width + 3) / 4;
+    const uint32_t blockCountY = (height + 3) / 4;
+
+    std::vector<uint8_t> result((size_t)blockCountX * blockCountY * BLOCK_SIZE);
+
+    for (uint32_t blockY = 0; blockY < blockCountY; ++blockY) {
+        for (uint32_t blockX = 0; blockX < blockCountX; ++blockX) {
+            uint8_t block[16][4];
+            LoadBlock(pPixels, width, height, blockX, blockY, block);
+
+            encode(block, result.data() + ((size_t)blockY * blockCountX + blockX) * BLOCK_SIZE);
+        }
+    }
+
+    return result;
+}
+
+
+std::vector<uint8_t> EncodeBC7(const uint8_t* pPixels, uint32_t width, uint32_t height)
+{
+    return EncodeBlocks<16>(pPixels, width, height, [](const uint8_t block[16][4], uint8_t* pDst) {
+        EncodeBC7Mode6Block(block, pDst);
+    });
+}
+
+
+std::vector<uint8_t> EncodeBC5(const uint8_t* pPixels, uint32_t width, uint32_t height, uint32_t channelX, uint32_t channelY)
+{
+    return EncodeBlocks<16>(pPixels, width, height, [channelX, channelY](const uint8_t block[16][4], uint8_t* pDst) {
+        EncodeBC4Block(block, channelX, pDst);
+        EncodeBC4Block(block, channelY, pDst + 8);
+    });
+}
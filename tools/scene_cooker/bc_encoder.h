@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+// CPU block compression for the scene cooker. Inputs are RGBA8 images of any size, partial blocks at the
+// right and bottom edges repeat the last column and row.
+
+// BC7 with mode 6 only: one subset, RGBA endpoints with 7 bits and a shared p-bit, 4 bit indices.
+// Handles alpha and smooth gradients well, hard multi-color blocks lose some quality against a full mode search.
+std::vector<uint8_t> EncodeBC7(const uint8_t* pPixels, uint32_t width, uint32_t height);
+
+// BC5 from two channels of the input, channelX goes to red and channelY to green
+std::vector<uint8_t> EncodeBC5(const uint8_t* pPixels, uint32_t width, uint32_t height, uint32_t channelX, uint32_t channelY);
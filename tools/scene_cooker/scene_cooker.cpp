@@ -0,0 +1,519 @@
+// Cooks a glTF scene into the engine-native binary scene format, see src/scene_file_format.h
+// Usage: scene_cooker [--no-compress] <input .gltf/.glb> <output .vkscene>
+// Textures are block compressed to BC7 unless --no-compress keeps them RGBA8. Metallic-roughness textures aren't cooked.
+
+#include "pch.h"
+
+#include "core.h"
+
+#include "gltf_import.h"
+#include "job_system.h"
+#include "scene_file_format.h"
+#include "texture_format.h"
+
+#include "bc_encoder.h"
+
+#include <cmath>
+#include <cstdio>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+
+static_assert(sizeof(Vertex) == SCENE_FILE_VERTEX_STRIDE, "Cooked vertices must match the engine vertex layout");
+
+
+struct CookedScene
+{
+    std::vector<SceneFileMesh> meshes;
+    std::vector<SceneFileSurface> surfaces;
+    std::vector<SceneFileMaterial> materials;
+    std::vector<SceneFileSampler> samplers;
+    std::vector<SceneFileTexture> textures;
+    std::vector<SceneFileMip> mips;
+    std::vector<SceneFileNode> nodes;
+
+    std::string strings;
+
+    // blob offsets are relative to the start of data until the file layout is known
+    std::vector<uint8_t> data;
+};
+
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+static SceneFileString AddString(CookedScene& scene, std::string_view str)
+{
+    const SceneFileString result = { (uint32_t)scene.strings.size(), (uint32_t)str.size() };
+    scene.strings.append(str);
+
+    return result;
+}
+
+
+static uint64_t AddBlob(CookedScene& scene, const void* pData, size_t size)
+{
+    const uint64_t offset = AlignUp(scene.data.size(), SCENE_FILE_BLOB_ALIGNMENT);
+
+    scene.data.resize(offset + size);
+    memcpy(scene.data.data() + offset, pData, size);
+
+    return offset;
+}
+
+
+static float SRGBToLinear(float value)
+{
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+
+static float LinearToSRGB(float value)
+{
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+}
+
+
+// RGBA8 box filtered chain down to 1x1, the last row or column is reused for odd sizes.
+// isSRGB averages color in linear space like the engine's mip generation does, alpha is linear either way.
+static std::vector<std::vector<uint8_t>> BuildMipChain(const uint8_t* pPixels, uint32_t width, uint32_t height, bool isSRGB)
+{
+    std::array<float, 256> toLinear;
+    for (uint32_t i = 0; i < 256; ++i) {
+        toLinear[i] = isSRGB ? SRGBToLinear(i / 255.f) : i / 255.f;
+    }
+
+    std::vector<std::vector<uint8_t>> chain(GetTextureMipCount(width, height));
+    chain[0].assign(pPixels, pPixels + (size_t)width * height * 4);
+
+    for (size_t mip = 1; mip < chain.size(); ++mip) {
+        const std::vector<uint8_t>& src = chain[mip - 1];
+
+        const uint32_t mipWidth = std::max(width / 2, 1u);
+        const uint32_t mipHeight = std::max(height / 2, 1u);
+
+        std::vector<uint8_t>& dst = chain[mip];
+        dst.resize((size_t)mipWidth * mipHeight * 4);
+
+        for (uint32_t y = 0; y < mipHeight; ++y) {
+            const uint32_t y0 = std::min(y * 2, height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+            for (uint32_t x = 0; x < mipWidth; ++x) {
+                const uint32_t x0 = std::min(x * 2, width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+
+                for (uint32_t c = 0; c < 4; ++c) {
+                    const uint8_t s00 = src[((size_t)y0 * width + x0) * 4 + c];
+                    const uint8_t s01 = src[((size_t)y0 * width + x1) * 4 + c];
+                    const uint8_t s10 = src[((size_t)y1 * width + x0) * 4 + c];
+                    const uint8_t s11 = src[((size_t)y1 * width + x1) * 4 + c];
+
+                    uint8_t& result = dst[((size_t)y * mipWidth + x) * 4 + c];
+
+                    if (isSRGB && c < 3) {
+                        const float average = (toLinear[s00] + toLinear[s01] + toLinear[s10] + toLinear[s11]) * 0.25f;
+                        result = (uint8_t)std::lround(std::clamp(LinearToSRGB(average), 0.f, 1.f) * 255.f);
+                    } else {
+                        result = (uint8_t)((s00 + s01 + s10 + s11 + 2) / 4);
+                    }
+                }
+            }
+        }
+
+        width = mipWidth;
+        height = mipHeight;
+    }
+
+    return chain;
+}
+
+
+struct TextureCookJob
+{
+    VkFormat format;
+    // VkComponentSwizzle values restoring the channel layout the shaders expect
+    uint8_t swizzle[4];
+
+    std::vector<std::vector<uint8_t>> mips;
+};
+
+
+static void CookTextures(const ParsedGLTF& parsed, CookedScene& scene, bool compress)
+{
+    const fastgltf::Asset& gltf = parsed.asset;
+
+    const std::vector<uint8_t> usages = GetImageUsages(parsed);
+
+    std::vector<TextureCookJob> jobs(parsed.images.size());
+
+    JobSystem::GetInstance().ParallelFor(parsed.images.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const DecodedImage& image = parsed.images[i];
+            TextureCookJob& job = jobs[i];
+
+            // mesh.frag doesn't sample metal-rough textures, the loader skips images that are nothing else
+            if (usages[i] == (uint8_t)ImageUsage::METAL_ROUGH) {
+                continue;
+            }
+
+            const bool isSRGB = (usages[i] & (uint8_t)ImageUsage::COLOR) != 0;
+
+            const Ktx2Image& ktx2 = image.ktx2;
+
+            if (ktx2.IsValid() && !ktx2.needsMipGeneration) {
+                // already in a GPU format, stored as is
+                job.format = ktx2.format;
+
+                for (const Ktx2Level& level : ktx2.levels) {
+                    job.mips.emplace_back(ktx2.data.data() + level.offset, ktx2.data.data() + level.offset + level.size);
+                }
+            } else if (ktx2.IsValid()) {
+                // needsMipGeneration is only set for RGBA8, its single level is treated like a decoded image
+                job.format = VK_FORMAT_R8G8B8A8_UNORM;
+                job.mips = BuildMipChain(ktx2.data.data() + ktx2.levels[0].offset, image.extent.width, image.extent.height, isSRGB);
+            } else if (image.pPixels != nullptr) {
+                job.format = VK_FORMAT_R8G8B8A8_UNORM;
+                job.mips = BuildMipChain(image.pPixels, image.extent.width, image.extent.height, isSRGB);
+            }
+
+            if (!compress || job.format != VK_FORMAT_R8G8B8A8_UNORM) {
+                continue;
+            }
+
+            job.format = VK_FORMAT_BC7_UNORM_BLOCK;
+        }
+    });
+
+    // block encoding dominates the cook time, every mip of every texture is a separate item
+    struct MipRef
+    {
+        size_t jobIndex;
+        uint32_t mip;
+    };
+
+    std::vector<MipRef> encodedMips;
+    uint64_t rawTextureSize = 0;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const bool isEncoded = jobs[i].format == VK_FORMAT_BC7_UNORM_BLOCK;
+
+        for (uint32_t mip = 0; mip < (uint32_t)jobs[i].mips.size(); ++mip) {
+            if (isEncoded) {
+                encodedMips.emplace_back(MipRef { i, mip });
+            }
+
+            const uint32_t mipWidth = std::max(parsed.images[i].extent.width >> mip, 1u);
+            const uint32_t mipHeight = std::max(parsed.images[i].extent.height >> mip, 1u);
+            rawTextureSize += (uint64_t)mipWidth * mipHeight * 4;
+        }
+    }
+
+    // ktx2 payloads already went to their final format before, only RGBA8 chains are encoded here
+    JobSystem::GetInstance().ParallelFor(encodedMips.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            TextureCookJob& job = jobs[encodedMips[i].jobIndex];
+            const uint32_t mip = encodedMips[i].mip;
+
+            const VkExtent3D& extent = parsed.images[encodedMips[i].jobIndex].extent;
+            const uint32_t mipWidth = std::max(extent.width >> mip, 1u);
+            const uint32_t mipHeight = std::max(extent.height >> mip, 1u);
+
+            std::vector<uint8_t>& pixels = job.mips[mip];
+
+            pixels = EncodeBC7(pixels.data(), mipWidth, mipHeight);
+        }
+    });
+
+    uint64_t cookedTextureSize = 0;
+
+    for (size_t i = 0; i < parsed.images.size(); ++i) {
+        const DecodedImage& image = parsed.images[i];
+        const TextureCookJob& job = jobs[i];
+
+        SceneFileTexture texture = {};
+        texture.name = AddString(scene, gltf.images[i].name);
+        texture.width = image.extent.width;
+        texture.height = image.extent.height;
+        texture.format = job.mips.empty() ? VK_FORMAT_R8G8B8A8_UNORM : job.format;
+        texture.firstMip = (uint32_t)scene.mips.size();
+        texture.mipCount = (uint32_t)job.mips.size();
+        memcpy(texture.swizzle, job.swizzle, sizeof(texture.swizzle));
+
+        if (!image.IsValid()) {
+            fprintf(stderr, "scene_cooker: failed to decode image %s\n", gltf.images[i].name.c_str());
+        }
+
+        for (const std::vector<uint8_t>& mip : job.mips) {
+            scene.mips.emplace_back(SceneFileMip { AddBlob(scene, mip.data(), mip.size()), mip.size() });
+            cookedTextureSize += mip.size();
+        }
+
+        scene.textures.emplace_back(texture);
+    }
+
+    printf("scene_cooker: textures %.2f MB as RGBA8, %.2f MB cooked\n", rawTextureSize / (1024.f * 1024.f), cookedTextureSize / (1024.f * 1024.f));
+
+    for (const fastgltf::Sampler& gltfSampler : gltf.samplers) {
+        SceneFileSampler sampler = {};
+        sampler.magFilter = ExtractFilter(gltfSampler.magFilter.value_or(fastgltf::Filter::Nearest));
+        sampler.minFilter = ExtractFilter(gltfSampler.minFilter.value_or(fastgltf::Filter::Nearest));
+        sampler.mipmapMode = ExtractMipmapMode(gltfSampler.minFilter.value_or(fastgltf::Filter::Nearest));
+
+        scene.samplers.emplace_back(sampler);
+    }
+}
+
+
+static void GetTextureIndices(const ParsedGLTF& parsed, const fastgltf::Optional<fastgltf::TextureInfo>& textureInfo,
+    uint32_t& outTextureIndex, uint32_t& outSamplerIndex)
+{
+    outTextureIndex = SCENE_FILE_INVALID_INDEX;
+    outSamplerIndex = SCENE_FILE_INVALID_INDEX;
+
+    if (!textureInfo.has_value()) {
+        return;
+    }
+
+    const fastgltf::Texture& texture = parsed.asset.textures[textureInfo.value().textureIndex];
+
+    const std::optional<size_t> imageIndex = GetTextureImageIndex(parsed, texture);
+
+    if (imageIndex.has_value()) {
+        outTextureIndex = (uint32_t)imageIndex.value();
+    }
+
+    if (texture.samplerIndex.has_value()) {
+        outSamplerIndex = (uint32_t)texture.samplerIndex.value();
+    }
+}
+
+
+static void CookMaterials(const ParsedGLTF& parsed, CookedScene& scene)
+{
+    const fastgltf::Asset& gltf = parsed.asset;
+
+    for (const fastgltf::Material& gltfMaterial : gltf.materials) {
+        SceneFileMaterial material = {};
+        material.name = AddString(scene, gltfMaterial.name);
+
+        for (size_t i = 0; i < 4; ++i) {
+            material.colorFactors[i] = gltfMaterial.pbrData.baseColorFactor[i];
+        }
+
+        material.metallicRoughnessFactors[0] = gltfMaterial.pbrData.metallicFactor;
+        material.metallicRoughnessFactors[1] = gltfMaterial.pbrData.roughnessFactor;
+        // a zero cutoff turns the alpha test off
+        material.metallicRoughnessFactors[2] = gltfMaterial.alphaMode == fastgltf::AlphaMode::Mask ? gltfMaterial.alphaCutoff : 0.f;
+
+        material.passType = (uint32_t)(gltfMaterial.alphaMode == fastgltf::AlphaMode::Blend ? MaterialPass::TRANSPARENT : MaterialPass::OPAQUE);
+
+        GetTextureIndices(parsed, gltfMaterial.pbrData.baseColorTexture, material.colorTextureIndex, material.colorSamplerIndex);
+        GetTextureIndices(parsed, gltfMaterial.pbrData.metallicRoughnessTexture, material.metalRoughTextureIndex, material.metalRoughSamplerIndex);
+
+        scene.materials.emplace_back(material);
+    }
+}
+
+
+static void CookMeshes(const ParsedGLTF& parsed, CookedScene& scene)
+{
+    for (const ParsedMesh& parsedMesh : parsed.meshes) {
+        SceneFileMesh mesh = {};
+        mesh.name = AddString(scene, parsedMesh.name);
+        mesh.firstSurface = (uint32_t)scene.surfaces.size();
+        mesh.surfaceCount = (uint32_t)parsedMesh.surfaces.size();
+        mesh.vertexCount = (uint32_t)parsedMesh.vertices.size();
+        mesh.indexCount = (uint32_t)parsedMesh.indices.size();
+        mesh.verticesOffset = AddBlob(scene, parsedMesh.vertices.data(), parsedMesh.vertices.size() * sizeof(Vertex));
+        mesh.indicesOffset = AddBlob(scene, parsedMesh.indices.data(), parsedMesh.indices.size() * sizeof(uint32_t));
+
+        for (const ParsedSurface& parsedSurface : parsedMesh.surfaces) {
+            SceneFileSurface surface = {};
+            surface.startIndex = parsedSurface.startIndex;
+            surface.indexCount = parsedSurface.count;
+            // the glTF path falls back to the first material as well
+            surface.materialIndex = (uint32_t)parsedSurface.materialIndex.value_or(0);
+
+            memcpy(surface.boundsOrigin, &parsedSurface.bounds.origin, sizeof(surface.boundsOrigin));
+            memcpy(surface.boundsExtents, &parsedSurface.bounds.extents, sizeof(surface.boundsExtents));
+            surface.boundsSphereRadius = parsedSurface.bounds.sphereRadius;
+
+            scene.surfaces.emplace_back(surface);
+        }
+
+        scene.meshes.emplace_back(mesh);
+    }
+}
+
+
+static void CookNodes(const ParsedGLTF& parsed, CookedScene& scene)
+{
+    const fastgltf::Asset& gltf = parsed.asset;
+
+    scene.nodes.resize(gltf.nodes.size());
+
+    for (size_t i = 0; i < gltf.nodes.size(); ++i) {
+        const fastgltf::Node& gltfNode = gltf.nodes[i];
+        SceneFileNode& node = scene.nodes[i];
+
+        node.name = AddString(scene, gltfNode.name);
+        node.meshIndex = gltfNode.meshIndex.has_value() ? (uint32_t)gltfNode.meshIndex.value() : SCENE_FILE_INVALID_INDEX;
+        node.parentIndex = SCENE_FILE_INVALID_INDEX;
+
+        const glm::mat4 localTrs = GetNodeLocalTransform(gltfNode);
+        memcpy(node.localTransform, &localTrs, sizeof(node.localTransform));
+    }
+
+    for (size_t i = 0; i < gltf.nodes.size(); ++i) {
+        for (size_t childIdx : gltf.nodes[i].children) {
+            scene.nodes[childIdx].parentIndex = (uint32_t)i;
+        }
+    }
+}
+
+
+template <typename T>
+static void WriteTable(std::ofstream& file, const std::vector<T>& table)
+{
+    file.write((const char*)table.data(), table.size() * sizeof(T));
+}
+
+
+static bool WriteSceneFile(const std::filesystem::path& filepath, CookedScene& scene)
+{
+    SceneFileHeader header = {};
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+
+    header.meshCount = (uint32_t)scene.meshes.size();
+    header.surfaceCount = (uint32_t)scene.surfaces.size();
+    header.materialCount = (uint32_t)scene.materials.size();
+    header.samplerCount = (uint32_t)scene.samplers.size();
+    header.textureCount = (uint32_t)scene.textures.size();
+    header.mipCount = (uint32_t)scene.mips.size();
+    header.nodeCount = (uint32_t)scene.nodes.size();
+    header.stringsSize = (uint32_t)scene.strings.size();
+
+    uint64_t offset = sizeof(SceneFileHeader);
+
+    auto PlaceTable = [&offset](uint64_t& outOffset, uint64_t size) {
+        outOffset = offset;
+        offset += size;
+    };
+
+    PlaceTable(header.meshesOffset, scene.meshes.size() * sizeof(SceneFileMesh));
+    PlaceTable(header.surfacesOffset, scene.surfaces.size() * sizeof(SceneFileSurface));
+    PlaceTable(header.materialsOffset, scene.materials.size() * sizeof(SceneFileMaterial));
+    PlaceTable(header.samplersOffset, scene.samplers.size() * sizeof(SceneFileSampler));
+    PlaceTable(header.texturesOffset, scene.textures.size() * sizeof(SceneFileTexture));
+    PlaceTable(header.mipsOffset, scene.mips.size() * sizeof(SceneFileMip));
+    PlaceTable(header.nodesOffset, scene.nodes.size() * sizeof(SceneFileNode));
+    PlaceTable(header.stringsOffset, scene.strings.size());
+
+    header.dataOffset = AlignUp(offset, SCENE_FILE_BLOB_ALIGNMENT);
+    header.fileSize = header.dataOffset + scene.data.size();
+
+    for (SceneFileMesh& mesh : scene.meshes) {
+        mesh.verticesOffset += header.dataOffset;
+        mesh.indicesOffset += header.dataOffset;
+    }
+
+    for (SceneFileMip& mip : scene.mips) {
+        mip.offset += header.dataOffset;
+    }
+
+    std::filesystem::path tmpPath = filepath;
+    tmpPath += ".tmp";
+
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open()) {
+            fprintf(stderr, "scene_cooker: failed to open %s\n", tmpPath.string().c_str());
+            return false;
+        }
+
+        file.write((const char*)&header, sizeof(header));
+
+        WriteTable(file, scene.meshes);
+        WriteTable(file, scene.surfaces);
+        WriteTable(file, scene.materials);
+        WriteTable(file, scene.samplers);
+        WriteTable(file, scene.textures);
+        WriteTable(file, scene.mips);
+        WriteTable(file, scene.nodes);
+
+        file.write(scene.strings.data(), scene.strings.size());
+
+        const std::vector<char> padding((size_t)(header.dataOffset - offset), 0);
+        file.write(padding.data(), padding.size());
+
+        file.write((const char*)scene.data.data(), scene.data.size());
+
+        if (!file) {
+            fprintf(stderr, "scene_cooker: failed to write %s\n", tmpPath.string().c_str());
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, filepath, error);
+
+    if (error) {
+        fprintf(stderr, "scene_cooker: failed to replace %s: %s\n", filepath.string().c_str(), error.message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    const bool compressTextures = !(argc == 4 && strcmp(argv[1], "--no-compress") == 0);
+
+    if (argc != (compressTextures ? 3 : 4)) {
+        fprintf(stderr, "Usage: scene_cooker [--no-compress] <input .gltf/.glb> <output .vkscene>\n");
+        return 1;
+    }
+
+    const std::filesystem::path inputPath = argv[argc - 2];
+    const std::filesystem::path outputPath = argv[argc - 1];
+
+    JobSystem::GetInstance().Init();
+
+    std::shared_ptr<ParsedGLTF> pParsed = ParseGLTF(inputPath);
+
+    if (pParsed == nullptr) {
+        fprintf(stderr, "scene_cooker: failed to parse %s\n", inputPath.string().c_str());
+        JobSystem::GetInstance().Terminate();
+        return 1;
+    }
+
+    CookedScene scene;
+
+    CookTextures(*pParsed, scene, compressTextures);
+    CookMaterials(*pParsed, scene);
+    CookMeshes(*pParsed, scene);
+    CookNodes(*pParsed, scene);
+
+    JobSystem::GetInstance().Terminate();
+
+    if (!std::filesystem::exists(outputPath.parent_path())) {
+        std::filesystem::create_directories(outputPath.parent_path());
+    }
+
+    if (!WriteSceneFile(outputPath, scene)) {
+        return 1;
+    }
+
+    printf("scene_cooker: %zu meshes, %zu textures, %zu nodes cooked into %s (%.2f MB)\n", scene.meshes.size(), scene.textures.size(),
+        scene.nodes.size(), outputPath.string().c_str(), std::filesystem::file_size(outputPath) / (1024.f * 1024.f));
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Packs compiled SPIR-V files into a single shader archive, see src/shader_archive_format.h
+// Usage: shader_packer <output archive> <input .spv>...
+
+#include "shader_archive_format.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+struct PackedShader
+{
+    std::string name;
+    std::vector<char> code;
+    ShaderArchiveEntry entry;
+};
+
+
+static bool ReadFile(const std::filesystem::path& filepath, std::vector<char>& outData)
+{
+    std::ifstream file(filepath, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    outData.resize((size_t)file.tellg());
+
+    file.seekg(0);
+    file.read(outData.data(), outData.size());
+
+    return (bool)file;
+}
+
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: shader_packer <output archive> <input .spv>...\n");
+        return 1;
+    }
+
+    const std::filesystem::path outputPath = argv[1];
+
+    std::vector<PackedShader> shaders;
+    shaders.reserve(argc - 2);
+
+    for (int i = 2; i < argc; ++i) {
+        const std::filesystem::path inputPath = argv[i];
+
+        PackedShader shader = {};
+        // "mesh.vert.spv" is looked up as "mesh.vert"
+        shader.name = inputPath.stem().string();
+
+        if (!ReadFile(inputPath, shader.code)) {
+            fprintf(stderr, "shader_packer: failed to read %s\n", inputPath.string().c_str());
+            return 1;
+        }
+
+        if (shader.code.empty() || shader.code.size() % sizeof(uint32_t) != 0) {
+            fprintf(stderr, "shader_packer: %s is not a valid SPIR-V binary\n", inputPath.string().c_str());
+            return 1;
+        }
+
+        shader.entry.nameHash = HashShaderName(shader.name);
+        shader.entry.size = shader.code.size();
+
+        shaders.emplace_back(std::move(shader));
+    }
+
+    std::sort(shaders.begin(), shaders.end(), [](const PackedShader& lhs, const PackedShader& rhs) {
+        return lhs.entry.nameHash < rhs.entry.nameHash;
+    });
+
+    for (size_t i = 1; i < shaders.size(); ++i) {
+        if (shaders[i].entry.nameHash == shaders[i - 1].entry.nameHash) {
+            fprintf(stderr, "shader_packer: name hash collision between %s and %s\n", shaders[i - 1].name.c_str(), shaders[i].name.c_str());
+            return 1;
+        }
+    }
+
+    uint64_t offset = sizeof(ShaderArchiveHeader) + shaders.size() * sizeof(ShaderArchiveEntry);
+
+    for (PackedShader& shader : shaders) {
+        offset = AlignUp(offset, SHADER_ARCHIVE_BLOB_ALIGNMENT);
+        shader.entry.offset = offset;
+        offset += shader.entry.size;
+    }
+
+    ShaderArchiveHeader header = {};
+    header.magic = SHADER_ARCHIVE_MAGIC;
+    header.version = SHADER_ARCHIVE_VERSION;
+    header.entryCount = (uint32_t)shaders.size();
+
+    std::filesystem::path tmpPath = outputPath;
+    tmpPath += ".tmp";
+
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open()) {
+            fprintf(stderr, "shader_packer: failed to open %s\n", tmpPath.string().c_str());
+            return 1;
+        }
+
+        file.write((const char*)&header, sizeof(header));
+
+        for (const PackedShader& shader : shaders) {
+            file.write((const char*)&shader.entry, sizeof(shader.entry));
+        }
+
+        for (const PackedShader& shader : shaders) {
+            const std::vector<char> padding((size_t)(shader.entry.offset - (uint64_t)file.tellp()), 0);
+            file.write(padding.data(), padding.size());
+            file.write(shader.code.data(), shader.code.size());
+        }
+
+        if (!file) {
+            fprintf(stderr, "shader_packer: failed to write %s\n", tmpPath.string().c_str());
+            return 1;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, outputPath, error);
+
+    if (error) {
+        fprintf(stderr, "shader_packer: failed to replace %s: %s\n", outputPath.string().c_str(), error.message().c_str());
+        return 1;
+    }
+
+    printf("shader_packer: %zu shaders packed into %s\n", shaders.size(), outputPath.string().c_str());
+
+    return 0;
+}